@@ -28,15 +28,24 @@ PyAPI_FUNC(_LlvmFunction *) _LlvmFunction_New(
    re-translated even if the underlying IR function changes. */
 typedef PyObject *(*PyEvalFrameFunction)(struct _frame *);
 PyAPI_FUNC(PyEvalFrameFunction) _LlvmFunction_Jit(
-    _LlvmFunction *llvm_function);
+    struct PyGlobalLlvmData *global_data, _LlvmFunction *llvm_function);
 
-// Forwards to global_data->Optimize(llvm_function->lf_function, level);
+// Forwards to global_data->Optimize(llvm_function->lf_function, level),
+// except that functions bigger than Py_MAX_IR_SIZE_FOR_FULL_OPT are only
+// optimized to Py_QUICK_JIT_OPT_LEVEL.
 PyAPI_FUNC(int) _LlvmFunction_Optimize(struct PyGlobalLlvmData *global_data,
                                        _LlvmFunction *llvm_function,
                                        int level);
 
 PyAPI_FUNC(void) _LlvmFunction_Dealloc(_LlvmFunction *functionobj);
 
+/* Hands old's llvm::Function, and with it any machine code generated from
+   it, over to replacement, then frees the old wrapper.  The function is
+   destroyed when replacement is deallocated.  Used when recompiling code
+   whose old machine code may still be running. */
+PyAPI_FUNC(void) _LlvmFunction_Retire(_LlvmFunction *replacement,
+                                      _LlvmFunction *old);
+
 
 /*
 _llvmfunction exposes an llvm::Function instance to Python code.  Only the
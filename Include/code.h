@@ -63,24 +63,56 @@ typedef struct PyCodeObject {
        invalid, requires recompilation) and non-fatal failures (unexpected
        branch taken, machine code is still valid). If fatal guards are failing
        repeatedly in the same code object, we shouldn't waste time repeatedly
-       recompiling this code. */
+       recompiling this code: each failure makes the code wait longer before
+       it is recompiled (see _PyCode_HOTNESS), and after
+       PY_MAX_FATALBAILCOUNT of them we give up on it. */
     int co_fatalbailcount;
     /* Measure of how hot this code object is. This is used to decide
        which code objects are worth sending through LLVM. */
     long co_hotness;
     /* Keep track of which dicts this code object is watching. */
     PyObject **co_watching;
+    /* Parallel to co_watching: for each watched dict, a dict whose keys are
+       the only keys the machine code depends on, or NULL if it depends on the
+       whole dict.  NULL if we've never narrowed anything. */
+    PyObject **co_watched_keys;
+    /* True while this code object is sitting in the background compile
+       queue (see JIT/CompileQueue.h).  Frames keep running in the
+       interpreter until the compiler thread publishes
+       co_native_function. */
+    char co_compile_pending;
+    /* True once co_llvm_function's assumptions have been invalidated.  The
+       IR has to be regenerated before this code can run as machine code
+       again. */
+    char co_needs_recompile;
+    /* True if can_elide_frame() found that this code's machine code
+       can run in a virtual frame.  Set when the IR is generated. */
+    char co_elide_frame;
 #endif
 } PyCodeObject;
 
-/* If co_fatalbailcount >= PY_MAX_FATAL_BAIL_COUNT, force this code to use the
+/* If co_fatalbailcount >= PY_MAX_FATALBAILCOUNT, force this code to use the
    eval loop forever after. See the comment on the co_fatalbailcount field
    for more details. */
-#define PY_MAX_FATALBAILCOUNT 1
+#define PY_MAX_FATALBAILCOUNT 5
 
-/* The threshold for co_hotness before the code object is considered "hot". */
+/* The threshold for co_hotness before the code object is considered "hot".
+   Under -j whenhot, hot code is compiled with the full optimization pipeline
+   (Py_DEFAULT_JIT_OPT_LEVEL). */
 #define PY_HOTNESS_THRESHOLD 100000
 
+/* Code whose co_hotness passes this lower threshold is "warm": it is compiled
+   right away with the cheap Py_QUICK_JIT_OPT_LEVEL pipeline.  Machine code
+   from that tier keeps counting loop backedges in co_hotness, and once the
+   code passes PY_HOTNESS_THRESHOLD it is recompiled with the full pipeline
+   and the feedback gathered so far. */
+#define PY_QUICK_HOTNESS_THRESHOLD 10000
+
+/* The hotness that is compared against the thresholds above.  Failing a
+   fatal guard resets co_hotness, so invalidated code has to warm up again
+   before it is recompiled, and each failure doubles how long that takes. */
+#define _PyCode_HOTNESS(co) ((co)->co_hotness >> (co)->co_fatalbailcount)
+
 /* Masks for co_flags above.  If you update these, consider updating the
  * fast_function fast path in eval.cc.  */
 #define CO_OPTIMIZED    (1 << 0)
@@ -174,6 +206,16 @@ PyAPI_FUNC(PyObject*) PyCode_Optimize(PyObject *code, PyObject* consts,
    http://code.google.com/p/unladen-swallow/issues/detail?id=41. */
 PyAPI_FUNC(int) _PyCode_ToOptimizedLlvmIr(PyCodeObject *code, int opt_level);
 
+/* Throw away code's LLVM IR and regenerate it, picking up any feedback
+   gathered since it was last compiled, then optimize it to opt_level.  This
+   is how code moves up from the quick tier, and how code whose machine code
+   was invalidated gets new machine code.  The previous IR function, along
+   with any machine code generated from it, stays alive as long as code does,
+   since frames may still be running that machine code; co_native_function
+   is left for the caller to update.  Returns as _PyCode_ToOptimizedLlvmIr();
+   on failure, the old IR is left in place. */
+PyAPI_FUNC(int) _PyCode_RecompileLlvmIr(PyCodeObject *code, int opt_level);
+
 /* Register a code object to receive updates if its globals or builtins change.
    If the globals or builtins change, co_use_jit will be set to 0; this causes
    the machine code to bail back to the interpreter to continue execution.
@@ -186,6 +228,16 @@ PyAPI_FUNC(int) _PyCode_ToOptimizedLlvmIr(PyCodeObject *code, int opt_level);
 PyAPI_FUNC(int) _PyCode_WatchDict(PyCodeObject *code, ReasonWatched reason,
                                   PyObject *dict);
 
+/* Narrow code's dependency on the dict it watches for `reason` to the keys of
+   `keys`, a dict, so that changes to any other key leave the machine code
+   alone.  Passing NULL makes code depend on the whole dict again, which is
+   also the state _PyCode_WatchDict() leaves a newly-watched dict in, and so
+   does passing any key that isn't an exact str.  Steals
+   a reference to keys, even on failure.  Returns 0 on success, -1 on
+   failure. */
+PyAPI_FUNC(int) _PyCode_SetWatchedKeys(PyCodeObject *code,
+                                       ReasonWatched reason, PyObject *keys);
+
 /* Stop watching a dict for changes. Returns 0 on success, -1 on failure. */
 PyAPI_FUNC(int) _PyCode_IgnoreDict(PyCodeObject *code, ReasonWatched reason);
 
@@ -199,7 +251,9 @@ PyAPI_FUNC(void) _PyCode_IgnoreWatchedDicts(PyCodeObject *code);
    Individual fatal guard failures may need to do extra work on their own to
    clean up any special references/data they may have created, but calling this
    function will ensure that `code`'s machine code equivalent will not be
-   called again. */
+   called again.  The code goes back to gathering feedback in the interpreter
+   and is recompiled once it is hot again, unless it has been invalidated
+   PY_MAX_FATALBAILCOUNT times. */
 PyAPI_FUNC(void) _PyCode_InvalidateMachineCode(PyCodeObject *code);
 #endif
 
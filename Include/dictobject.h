@@ -99,10 +99,20 @@ struct _dictobject {
 	 * _PyDict_DropWatcher() to modify this.
 	 */
 	struct PySmallPtrSet *ma_watchers;
+	/* Code objects that only depend on some of this dict's keys, indexed
+	 * by key, so that changing any other key costs one lookup.  These are
+	 * not in ma_watchers, but ma_watchers is non-NULL whenever this is.
+	 * NULL if nobody has registered a key.  Use _PyDict_AddKeyWatcher()
+	 * and _PyDict_DropKeyWatcher() to modify this.
+	 */
+	struct PySmallPtrSetMap *ma_key_watchers;
 #endif
 };
 
 PyAPI_DATA(PyTypeObject) PyDict_Type;
+PyAPI_DATA(PyTypeObject) PyDictIterKey_Type;
+PyAPI_DATA(PyTypeObject) PyDictIterValue_Type;
+PyAPI_DATA(PyTypeObject) PyDictIterItem_Type;
 
 #define PyDict_Check(op) \
                  PyType_FastSubclass(Py_TYPE(op), Py_TPFLAGS_DICT_SUBCLASS)
@@ -162,6 +172,16 @@ PyAPI_FUNC(int) _PyDict_AddWatcher(PyObject *dp, PyCodeObject *code);
    error. */
 PyAPI_FUNC(void) _PyDict_DropWatcher(PyObject *dp, PyCodeObject *code);
 
+/* Like _PyDict_AddWatcher(), but code only depends on the value for key, which
+   must be an exact str.  Changes to other keys leave code alone. */
+PyAPI_FUNC(int) _PyDict_AddKeyWatcher(PyObject *dp, PyCodeObject *code,
+                                      PyObject *key);
+
+/* Undoes _PyDict_AddKeyWatcher(dp, code, key).  Like _PyDict_DropWatcher(),
+   this may be called multiple times. */
+PyAPI_FUNC(void) _PyDict_DropKeyWatcher(PyObject *dp, PyCodeObject *code,
+                                        PyObject *key);
+
 /* Internal helper methods used for testing the dict-watching system. */
 PyAPI_FUNC(Py_ssize_t) _PyDict_NumWatchers(PyDictObject *dp);
 PyAPI_FUNC(int) _PyDict_IsWatchedBy(PyDictObject *dp, PyCodeObject *code);
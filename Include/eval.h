@@ -217,6 +217,16 @@ PyAPI_FUNC(void) _PyEval_RaiseForUnboundFreeVar(struct _frame *, int);
 
 PyAPI_FUNC(PyObject *) _PyEval_CallFunction(PyObject **, int, int);
 PyAPI_FUNC(PyObject *) _PyEval_CallFunctionVarKw(PyObject **, int, int, int);
+#ifdef WITH_LLVM
+/* Like _PyEval_CallFunction() with no keyword arguments, for callsites that
+   call Python functions.  If the function already has machine code, this
+   calls it directly instead of going through PyEval_EvalFrame(). */
+PyAPI_FUNC(PyObject *) _PyEval_CallPyFunction(PyObject **, int);
+
+/* Resumes a suspended generator frame directly in its machine code if it can.
+   Returns 0 if the frame has to go through PyEval_EvalFrame() instead. */
+PyAPI_FUNC(int) _PyEval_ResumeGenerator(struct _frame *, PyObject **);
+#endif
 
 PyAPI_FUNC(PyObject *) _PyEval_ApplySlice(PyObject *, PyObject *, PyObject *);
 PyAPI_FUNC(int) _PyEval_AssignSlice(PyObject *, PyObject *,
@@ -72,6 +72,8 @@ typedef struct _frame {
        why. */
     unsigned char f_bailed_from_llvm;
     unsigned char f_guard_type;
+    /* True for a frame built by _PyFrame_InitVirtual(); see below. */
+    unsigned char f_virtual;
 #endif
 
     PyTryBlock f_blockstack[CO_MAXBLOCKS]; /* for try and loop blocks */
@@ -98,6 +100,7 @@ enum _PyFrameGuardType {
     _PYGUARD_STORE_SUBSCR,
     _PYGUARD_LOAD_METHOD,
     _PYGUARD_CALL_METHOD,
+    _PYGUARD_SLICE,
 };
 
 /* Standard object interface */
@@ -133,6 +136,41 @@ PyAPI_FUNC(int) PyFrame_ClearFreeList(void);
 /* Return the line of code the frame is currently executing. */
 PyAPI_FUNC(int) PyFrame_GetLineNumber(PyFrameObject *);
 
+#ifdef WITH_LLVM
+/* Virtual frames.  _PyEval_CallPyFunction() runs the machine code of leaf
+   functions (see can_elide_frame() in JIT/llvm_compile.cc) in a frame that
+   lives on the C stack.  A virtual frame is never linked into
+   tstate->frame, which is why only code that can't run Python code -- no
+   calls, properties or overloaded operators -- is a leaf.  Anything that
+   needs to hold on to the frame -- a traceback, a tracer, the interpreter
+   after a bail -- gets a heap copy from _PyFrame_Materialize() instead. */
+
+/* Virtual frames have room for this many locals and value stack entries. */
+#define PY_VIRTUAL_FRAME_SLOTS 32
+
+typedef struct {
+    PyFrameObject vf_frame;
+    PyObject *vf_slots[PY_VIRTUAL_FRAME_SLOTS - 1];
+} PyVirtualFrame;
+
+/* Builds a virtual frame for code in vf, borrowing tstate->frame's builtins.
+   Returns NULL, without setting an exception, if code's locals and stack
+   don't fit or if code has different globals from tstate->frame; the caller
+   should use PyFrame_New() instead.  The locals start out NULL. */
+PyAPI_FUNC(PyFrameObject *) _PyFrame_InitVirtual(PyVirtualFrame *vf,
+                                                 PyThreadState *tstate,
+                                                 PyCodeObject *code,
+                                                 PyObject *globals);
+
+/* Returns a new heap frame holding new references to everything in the
+   virtual frame f: its locals, any value stack saved in f_stacktop, its
+   block stack and its position. */
+PyAPI_FUNC(PyFrameObject *) _PyFrame_Materialize(PyFrameObject *f);
+
+/* Releases what the virtual frame f owns, as frame_dealloc() would. */
+PyAPI_FUNC(void) _PyFrame_ClearVirtual(PyFrameObject *f);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
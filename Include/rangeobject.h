@@ -22,6 +22,18 @@ PyAPI_DATA(PyTypeObject) PyRange_Type;
 
 #define PyRange_Check(op) (Py_TYPE(op) == &PyRange_Type)
 
+PyAPI_DATA(PyTypeObject) PyRangeIter_Type;
+
+/* The iterator returned by iter(xrange(...)).  Exposed so that the JIT can
+   advance it inline; see JIT/llvm_inline_functions.c. */
+typedef struct {
+	PyObject_HEAD
+	long	index;
+	long	start;
+	long	step;
+	long	len;
+} _PyRangeIterObject;
+
 #ifdef __cplusplus
 }
 #endif
@@ -34,6 +34,15 @@ typedef struct PyTupleObject {
 } PyTupleObject;
 
 PyAPI_DATA(PyTypeObject) PyTuple_Type;
+PyAPI_DATA(PyTypeObject) PyTupleIter_Type;
+
+/* The iterator returned by iter(tuple).  Exposed so that the JIT can
+   advance it inline; see JIT/llvm_inline_functions.c. */
+typedef struct {
+    PyObject_HEAD
+    long it_index;
+    PyTupleObject *it_seq; /* Set to NULL when iterator is exhausted */
+} _PyTupleIterObject;
 
 #define PyTuple_Check(op) \
                  PyType_FastSubclass(Py_TYPE(op), Py_TPFLAGS_TUPLE_SUBCLASS)
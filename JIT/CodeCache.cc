@@ -0,0 +1,210 @@
+#include "JIT/CodeCache.h"
+
+#include "Python.h"
+#include "code.h"
+#include "JIT/CodeCache_fwd.h"
+#include "JIT/global_llvm_data.h"
+
+#include <stdio.h>
+
+// Bump this if the file format or the meaning of an entry changes.
+#define CODE_CACHE_FORMAT_VERSION 1
+
+// FNV-1a.  Collisions only cost us a misplaced head start, so this doesn't
+// need to be cryptographically strong.
+static uint64_t
+hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uint64_t
+hash_int(uint64_t hash, long value)
+{
+    return hash_bytes(hash, &value, sizeof(value));
+}
+
+static const uint64_t kHashSeed = 14695981039346656037ULL;
+
+static uint64_t
+compute_build_id()
+{
+    // Py_GetVersion() includes the build number, date and compiler.
+    const char *version = Py_GetVersion();
+    uint64_t hash = hash_bytes(kHashSeed, version, strlen(version));
+    return hash_int(hash, CODE_CACHE_FORMAT_VERSION);
+}
+
+// Identifies code across processes.  Code in the same file with the same
+// name, position and bytecode is treated as the same code.
+static uint64_t
+code_digest(PyCodeObject *code)
+{
+    uint64_t hash = kHashSeed;
+    hash = hash_bytes(hash, PyString_AS_STRING(code->co_name),
+                      PyString_GET_SIZE(code->co_name));
+    hash = hash_int(hash, code->co_firstlineno);
+    hash = hash_int(hash, code->co_argcount);
+    hash = hash_int(hash, code->co_nlocals);
+    hash = hash_int(hash, code->co_flags);
+    return hash_bytes(hash, PyString_AS_STRING(code->co_code),
+                      PyString_GET_SIZE(code->co_code));
+}
+
+PyJitCodeCache::PyJitCodeCache()
+    : build_id_(compute_build_id()),
+      enabled_(false)
+{
+}
+
+PyJitCodeCache::File *
+PyJitCodeCache::GetFile(PyCodeObject *code)
+{
+    if (!PyString_Check(code->co_filename) ||
+        !PyString_Check(code->co_name) ||
+        !PyString_Check(code->co_code))
+        return NULL;
+    const char *filename = PyString_AS_STRING(code->co_filename);
+    // Skip "<string>", "<stdin>" and friends.
+    if (filename[0] == '\0' || filename[0] == '<')
+        return NULL;
+
+    // foo.py -> foo.pyj, next to foo.pyc.
+    std::string path(filename, PyString_GET_SIZE(code->co_filename));
+    path += 'j';
+    File &file = this->files_[path];
+    if (!file.loaded) {
+        file.loaded = true;
+        this->ReadFile(path, file);
+    }
+    return &file;
+}
+
+void
+PyJitCodeCache::ReadFile(const std::string &path, File &file)
+{
+    FILE *fp = fopen(path.c_str(), "r");
+    if (fp == NULL)
+        return;
+    unsigned long long build_id;
+    if (fscanf(fp, "unladen-jit-cache %llx\n", &build_id) == 1 &&
+        build_id == this->build_id_) {
+        unsigned long long digest;
+        int opt_level;
+        while (fscanf(fp, "%llx %d\n", &digest, &opt_level) == 2) {
+            if (opt_level < Py_MIN_LLVM_OPT_LEVEL ||
+                opt_level > Py_MAX_LLVM_OPT_LEVEL)
+                break;
+            file.entries[digest] = opt_level;
+        }
+    }
+    fclose(fp);
+}
+
+void
+PyJitCodeCache::WriteFile(const std::string &path, const File &file)
+{
+    // Write to a temporary file and rename it into place so that other
+    // processes never see a partial cache.  The temporary name includes our
+    // pid, so two processes flushing the same module don't write into each
+    // other's file; the last rename wins.
+    char suffix[32];
+    PyOS_snprintf(suffix, sizeof(suffix), ".%ld.tmp", (long)getpid());
+    std::string tmp_path = path + suffix;
+    FILE *fp = fopen(tmp_path.c_str(), "w");
+    if (fp == NULL)
+        return;
+    fprintf(fp, "unladen-jit-cache %llx\n",
+            (unsigned long long)this->build_id_);
+    for (Entries::const_iterator it = file.entries.begin(),
+             end = file.entries.end(); it != end; ++it) {
+        fprintf(fp, "%016llx %d\n", (unsigned long long)it->first,
+                it->second);
+    }
+    if (fclose(fp) != 0 || rename(tmp_path.c_str(), path.c_str()) != 0)
+        remove(tmp_path.c_str());
+}
+
+void
+PyJitCodeCache::Apply(PyCodeObject *code)
+{
+    File *file = this->GetFile(code);
+    if (file != NULL) {
+        Entries::const_iterator it = file->entries.find(code_digest(code));
+        if (it != file->entries.end()) {
+            long threshold = it->second >= Py_DEFAULT_JIT_OPT_LEVEL ?
+                PY_HOTNESS_THRESHOLD : PY_QUICK_HOTNESS_THRESHOLD;
+            long head_start = threshold - PY_CODE_CACHE_WARMUP;
+            if (code->co_hotness < head_start)
+                code->co_hotness = head_start;
+        }
+    }
+
+    // Nested functions, classes and lambdas live in co_consts.
+    PyObject *consts = code->co_consts;
+    if (consts == NULL || !PyTuple_Check(consts))
+        return;
+    for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(consts); ++i) {
+        PyObject *item = PyTuple_GET_ITEM(consts, i);
+        if (PyCode_Check(item))
+            this->Apply((PyCodeObject *)item);
+    }
+}
+
+void
+PyJitCodeCache::Record(PyCodeObject *code, int opt_level)
+{
+    File *file = this->GetFile(code);
+    if (file == NULL)
+        return;
+    uint64_t digest = code_digest(code);
+    Entries::iterator it = file->entries.find(digest);
+    if (it != file->entries.end() && it->second >= opt_level)
+        return;
+    file->entries[digest] = opt_level;
+    file->dirty = true;
+}
+
+void
+PyJitCodeCache::Flush()
+{
+    for (llvm::StringMap<File>::iterator it = this->files_.begin(),
+             end = this->files_.end(); it != end; ++it) {
+        File &file = it->getValue();
+        if (!file.dirty)
+            continue;
+        this->WriteFile(it->getKey().str(), file);
+        file.dirty = false;
+    }
+}
+
+void
+PyJitCodeCache_SetEnabled(PyGlobalLlvmData *llvm_data, int on)
+{
+    llvm_data->code_cache().set_enabled(on);
+}
+
+int
+PyJitCodeCache_IsEnabled(PyGlobalLlvmData *llvm_data)
+{
+    return llvm_data->code_cache().enabled();
+}
+
+void
+PyJitCodeCache_Apply(PyGlobalLlvmData *llvm_data, PyCodeObject *code)
+{
+    PyJitCodeCache &cache = llvm_data->code_cache();
+    if (cache.enabled())
+        cache.Apply(code);
+}
+
+void
+PyJitCodeCache_Flush(PyGlobalLlvmData *llvm_data)
+{
+    llvm_data->code_cache().Flush();
+}
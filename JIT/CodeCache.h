@@ -0,0 +1,84 @@
+// -*- C++ -*-
+#ifndef UTIL_CODECACHE_H
+#define UTIL_CODECACHE_H
+
+#ifndef __cplusplus
+#error This header expects to be included only in C++ source
+#endif
+
+#include "Python.h"
+
+#include "llvm/ADT/StringMap.h"
+
+#include <map>
+#include <string>
+
+// Once a code object is compiled from the cache's head start, it still needs
+// this much co_hotness (about 100 calls) to reach its tier, so that it
+// gathers some runtime feedback first.
+#define PY_CODE_CACHE_WARMUP 1000
+
+// Every process starts cold: hot code has to earn PY_HOTNESS_THRESHOLD worth
+// of calls and loop iterations in the interpreter before it is compiled, on
+// every restart.  The code cache is a warm-up hint: it remembers across
+// processes which code objects were compiled under -j whenhot, and at which
+// optimization level, in a file next to each module's .pyc (foo.py ->
+// foo.pyj).  When a module is imported, the code objects that were compiled
+// last time get a head start on co_hotness and are compiled after
+// PY_CODE_CACHE_WARMUP instead of the full warm-up.
+//
+// It does not save the compile itself: every process still generates,
+// optimizes and emits its own machine code.  The IR we generate embeds the
+// addresses of live Python objects (see PyConstantMirror) and the feedback
+// it specializes on is made of object pointers, so caching bitcode would
+// mean relocating every mirrored constant and re-validating the feedback on
+// load, which we don't do.  Code compiled after a head start watches the
+// live globals and builtins through _PyCode_WatchDict() like any other code,
+// and a stale or corrupt cache can cost compile time but never correctness.
+//
+// Entries are keyed by a digest of the code object.  Each file is tagged with
+// the interpreter build that wrote it; files from other builds are ignored
+// and replaced.
+//
+// All methods must be called with the GIL held.
+class PyJitCodeCache {
+public:
+    PyJitCodeCache();
+
+    bool enabled() const { return this->enabled_; }
+    void set_enabled(bool on) { this->enabled_ = on; }
+
+    // Gives code, and every code object nested in it, its head start if the
+    // cache says it was compiled last time.
+    void Apply(PyCodeObject *code);
+
+    // Notes that code was compiled to opt_level.
+    void Record(PyCodeObject *code, int opt_level);
+
+    // Writes out every cache file Record() changed.  Errors are ignored;
+    // the cache is only advisory.
+    void Flush();
+
+private:
+    // Maps code digests to optimization levels.
+    typedef std::map<uint64_t, int> Entries;
+    struct File {
+        File() : loaded(false), dirty(false) {}
+        Entries entries;
+        bool loaded;  // True once we've tried to read the file.
+        bool dirty;   // True if entries has changed since it was written.
+    };
+
+    // Returns the entries for the module code came from, reading its
+    // cache file the first time.  Returns NULL if code didn't come from a
+    // file.
+    File *GetFile(PyCodeObject *code);
+    void ReadFile(const std::string &path, File &file);
+    void WriteFile(const std::string &path, const File &file);
+
+    llvm::StringMap<File> files_;
+    const uint64_t build_id_;
+    bool enabled_;
+};
+
+#endif  // UTIL_CODECACHE_H
@@ -0,0 +1,23 @@
+#ifndef UTIL_CODECACHE_FWD_H
+#define UTIL_CODECACHE_FWD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct PyGlobalLlvmData;
+
+/* C wrappers around PyJitCodeCache; see JIT/CodeCache.h.
+   PyJitCodeCache_Apply() does nothing unless the cache is enabled. */
+PyAPI_FUNC(void) PyJitCodeCache_SetEnabled(struct PyGlobalLlvmData *,
+                                           int on);
+PyAPI_FUNC(int) PyJitCodeCache_IsEnabled(struct PyGlobalLlvmData *);
+PyAPI_FUNC(void) PyJitCodeCache_Apply(struct PyGlobalLlvmData *,
+                                      PyCodeObject *code);
+PyAPI_FUNC(void) PyJitCodeCache_Flush(struct PyGlobalLlvmData *);
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif  /* UTIL_CODECACHE_FWD_H */
@@ -0,0 +1,115 @@
+#include "JIT/CompileBudget.h"
+
+#include "Python.h"
+#include "code.h"
+#include "_llvmfunctionobject.h"
+#include "JIT/CompileBudget_fwd.h"
+#include "JIT/global_llvm_data.h"
+#include "JIT/llvm_compile.h"
+
+#include <algorithm>
+
+#if HAVE_GETTIMEOFDAY
+#include <sys/time.h>
+#endif
+
+// Our guess at the cost of a line of IR until we've timed a compilation.
+static const double INITIAL_US_PER_IR_LINE = 10.0;
+
+PyJitCompileBudget::PyJitCompileBudget()
+    : rate_(0),
+      available_us_(0),
+      last_refill_us_(0),
+      us_per_ir_line_(INITIAL_US_PER_IR_LINE),
+      deferrals_(0)
+{
+}
+
+int64_t
+PyJitCompileBudget::Now()
+{
+#if HAVE_GETTIMEOFDAY
+    struct timeval tv;
+#ifdef GETTIMEOFDAY_NO_TZ
+    gettimeofday(&tv);
+#else
+    gettimeofday(&tv, 0);
+#endif
+    return int64_t(tv.tv_sec) * 1000000 + int64_t(tv.tv_usec);
+#else
+    return 0;
+#endif
+}
+
+void
+PyJitCompileBudget::set_rate(double rate)
+{
+    this->rate_ = rate;
+    // Start with a full bucket, so that turning the budget on doesn't stall
+    // whatever is about to be compiled.
+    this->available_us_ = this->capacity();
+    this->last_refill_us_ = Now();
+}
+
+void
+PyJitCompileBudget::Refill()
+{
+    int64_t now = Now();
+    int64_t accrued = int64_t((now - this->last_refill_us_) * this->rate_);
+    this->last_refill_us_ = now;
+    this->available_us_ = std::min(this->available_us_ + accrued,
+                                   this->capacity());
+}
+
+bool
+PyJitCompileBudget::CanCompile(PyCodeObject *code)
+{
+    if (this->rate_ == 0)
+        return true;
+    this->Refill();
+    // Avoid walking the bytecode in the common cases.  Anything bigger than
+    // the whole bucket gets compiled once the bucket is full, or it would
+    // never be compiled at all.
+    if (this->available_us_ >= this->capacity())
+        return true;
+    if (this->available_us_ > 0) {
+        int64_t predicted = int64_t(_PyCode_EstimateIrSize(code) *
+                                    this->us_per_ir_line_);
+        if (this->available_us_ >= predicted)
+            return true;
+    }
+    ++this->deferrals_;
+    return false;
+}
+
+void
+PyJitCompileBudget::Charge(int64_t elapsed_us, Py_ssize_t ir_size)
+{
+    if (ir_size > 0) {
+        // An exponential moving average, so the estimate follows changes
+        // in machine load and optimization level without jumping around on
+        // any one outlier.
+        double observed = double(elapsed_us) / ir_size;
+        this->us_per_ir_line_ = 0.75 * this->us_per_ir_line_ + 0.25 * observed;
+    }
+    if (this->rate_ != 0)
+        this->available_us_ -= elapsed_us;
+}
+
+void
+PyJitCompileBudget_SetRate(PyGlobalLlvmData *llvm_data, double rate)
+{
+    llvm_data->compile_budget().set_rate(rate);
+}
+
+double
+PyJitCompileBudget_GetRate(PyGlobalLlvmData *llvm_data)
+{
+    return llvm_data->compile_budget().rate();
+}
+
+unsigned long
+PyJitCompileBudget_GetDeferrals(PyGlobalLlvmData *llvm_data)
+{
+    return llvm_data->compile_budget().deferrals();
+}
@@ -0,0 +1,67 @@
+// -*- C++ -*-
+#ifndef UTIL_COMPILEBUDGET_H
+#define UTIL_COMPILEBUDGET_H
+
+#ifndef __cplusplus
+#error This header expects to be included only in C++ source
+#endif
+
+#include "Python.h"
+
+// A program that warms up many functions at once -- a big module's worth of
+// code all crossing PY_QUICK_HOTNESS_THRESHOLD in the same second -- can
+// spend most of that second in LLVM instead of running Python.  The compile
+// budget caps the fraction of wall-clock time the process spends compiling.
+// It is a token bucket of microseconds: it fills at rate() seconds per
+// second, holds at most one second's worth, and every foreground or
+// background compilation is charged for the time it took.  maybe_compile()
+// asks CanCompile() before compiling a code object under -j whenhot; code
+// that doesn't fit keeps running in the interpreter (or its current tier's
+// machine code) and asks again on a later call, by which time the bucket has
+// refilled.
+//
+// The cost of a compilation is predicted from _PyCode_EstimateIrSize() and a
+// running average of the time each line of IR has actually taken, so one
+// huge function can't drain the budget for everything behind it.
+//
+// The budget is off (rate() == 0) by default.  All methods must be called
+// with the GIL held.
+class PyJitCompileBudget {
+public:
+    PyJitCompileBudget();
+
+    // Seconds of compilation allowed per second of wall-clock time, or 0 if
+    // compilation is unlimited.
+    double rate() const { return this->rate_; }
+    void set_rate(double rate);
+
+    // Returns true if code's compilation fits in the budget right now.
+    // Otherwise counts a deferral and returns false.
+    bool CanCompile(PyCodeObject *code);
+
+    // Charges a compilation that took elapsed_us microseconds to the budget,
+    // and folds it into the per-line cost estimate.  ir_size is the code
+    // object's _PyCode_EstimateIrSize().
+    void Charge(int64_t elapsed_us, Py_ssize_t ir_size);
+
+    // The number of times CanCompile() has said no.
+    unsigned long deferrals() const { return this->deferrals_; }
+
+    // Returns the current time in microseconds, or 0 if we can't tell time
+    // on this platform, which makes every compilation free.
+    static int64_t Now();
+
+private:
+    // Adds the budget accrued since the last call, up to one second's worth.
+    void Refill();
+    int64_t capacity() const { return int64_t(this->rate_ * 1000000); }
+
+    double rate_;
+    // May go negative if a compilation took longer than predicted.
+    int64_t available_us_;
+    int64_t last_refill_us_;
+    double us_per_ir_line_;
+    unsigned long deferrals_;
+};
+
+#endif  // UTIL_COMPILEBUDGET_H
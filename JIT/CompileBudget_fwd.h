@@ -0,0 +1,22 @@
+#ifndef UTIL_COMPILEBUDGET_FWD_H
+#define UTIL_COMPILEBUDGET_FWD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct PyGlobalLlvmData;
+
+/* C wrappers around PyJitCompileBudget; see JIT/CompileBudget.h.  A rate of
+   0 means compilation is unlimited. */
+PyAPI_FUNC(void) PyJitCompileBudget_SetRate(struct PyGlobalLlvmData *,
+                                            double rate);
+PyAPI_FUNC(double) PyJitCompileBudget_GetRate(struct PyGlobalLlvmData *);
+PyAPI_FUNC(unsigned long) PyJitCompileBudget_GetDeferrals(
+    struct PyGlobalLlvmData *);
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif  /* UTIL_COMPILEBUDGET_FWD_H */
@@ -0,0 +1,391 @@
+#include "JIT/CompileQueue.h"
+
+#include "Python.h"
+#include "code.h"
+#include "pythread.h"
+#include "_llvmfunctionobject.h"
+#include "JIT/CodeCache.h"
+#include "JIT/CompileBudget.h"
+#include "JIT/CompileQueue_fwd.h"
+#include "JIT/global_llvm_data.h"
+#include "JIT/llvm_compile.h"
+#include "Util/Stats.h"
+
+#include "llvm/Support/ManagedStatic.h"
+
+#include <algorithm>
+
+#ifdef Py_WITH_INSTRUMENTATION
+// How long each code object keeps the compiler thread busy, and how much of
+// that time is spent without the GIL.
+class BackgroundCompileTimes : public DataVectorStats<int64_t> {
+public:
+    BackgroundCompileTimes()
+        : DataVectorStats<int64_t>("Time in background compile in ns") {}
+};
+class BackgroundCompileNoGilTimes : public DataVectorStats<int64_t> {
+public:
+    BackgroundCompileNoGilTimes()
+        : DataVectorStats<int64_t>(
+            "Time in background compile without the GIL in ns") {}
+};
+
+static llvm::ManagedStatic<BackgroundCompileTimes> background_compile_times;
+static llvm::ManagedStatic<BackgroundCompileNoGilTimes>
+    background_compile_nogil_times;
+#endif  // Py_WITH_INSTRUMENTATION
+
+PyJitCompileQueue::PyJitCompileQueue(PyGlobalLlvmData *llvm_data)
+    : llvm_data_(llvm_data),
+      interp_(NULL),
+      current_code_(NULL),
+      enabled_(false),
+      running_(false),
+      stopping_(false)
+#ifdef WITH_THREAD
+      , work_available_(NULL),
+      signaled_(false),
+      idle_lock_(NULL),
+      busy_(false),
+      thread_exited_(NULL)
+#endif
+{
+}
+
+PyJitCompileQueue::~PyJitCompileQueue()
+{
+    assert(!this->running_ &&
+           "The compiler thread must be stopped before deleting its queue");
+    assert(this->jobs_.empty() && "Leaking queued code objects");
+#ifdef WITH_THREAD
+    if (this->work_available_ != NULL)
+        PyThread_free_lock(this->work_available_);
+    if (this->idle_lock_ != NULL)
+        PyThread_free_lock(this->idle_lock_);
+    if (this->thread_exited_ != NULL)
+        PyThread_free_lock(this->thread_exited_);
+#endif
+}
+
+int
+PyJitCompileQueue::SetEnabled(bool on)
+{
+    if (on && !this->running_ && this->StartThread() < 0)
+        return -1;
+    this->enabled_ = on;
+    return 0;
+}
+
+int
+PyJitCompileQueue::StartThread()
+{
+#ifdef WITH_THREAD
+    if (this->work_available_ == NULL) {
+        this->work_available_ = PyThread_allocate_lock();
+        this->idle_lock_ = PyThread_allocate_lock();
+        this->thread_exited_ = PyThread_allocate_lock();
+        if (this->work_available_ == NULL || this->idle_lock_ == NULL ||
+            this->thread_exited_ == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+    }
+    // Nothing to do until someone calls Enqueue().
+    PyThread_acquire_lock(this->work_available_, NOWAIT_LOCK);
+    this->signaled_ = false;
+    this->busy_ = false;
+    PyThread_acquire_lock(this->thread_exited_, NOWAIT_LOCK);
+    this->stopping_ = false;
+
+    this->interp_ = PyThreadState_GET()->interp;
+    // The compiler thread runs the optimization passes without the GIL.
+    this->llvm_data_->PrepareOptimizations();
+    PyEval_InitThreads();
+    if (PyThread_start_new_thread(&PyJitCompileQueue::ThreadMain,
+                                  this) == -1) {
+        PyThread_release_lock(this->thread_exited_);
+        PyErr_SetString(PyExc_RuntimeError,
+                        "can't start the background compiler thread");
+        return -1;
+    }
+    this->running_ = true;
+    return 0;
+#else
+    PyErr_SetString(PyExc_RuntimeError,
+                    "background compilation requires thread support");
+    return -1;
+#endif
+}
+
+bool
+PyJitCompileQueue::Enqueue(PyCodeObject *code, int opt_level)
+{
+    assert(this->enabled_ && "Enqueue() called while disabled");
+    if (code->co_compile_pending)
+        return true;
+    if (!this->running_ && this->StartThread() < 0) {
+        // Most likely out of threads.  Fall back to compiling in the
+        // foreground rather than failing whatever call got us here.
+        PyErr_WriteUnraisable(NULL);
+        this->enabled_ = false;
+        return false;
+    }
+    Py_INCREF(code);
+    code->co_compile_pending = 1;
+    Job job = { code, opt_level };
+    this->jobs_.push_back(job);
+#ifdef WITH_THREAD
+    if (!this->busy_) {
+        // WaitUntilIdle() only holds idle_lock_ momentarily and never needs
+        // the GIL to let go of it, so waiting here can't deadlock.
+        PyThread_acquire_lock(this->idle_lock_, WAIT_LOCK);
+        this->busy_ = true;
+    }
+    if (!this->signaled_) {
+        this->signaled_ = true;
+        PyThread_release_lock(this->work_available_);
+    }
+#endif
+    return true;
+}
+
+void
+PyJitCompileQueue::WaitUntilIdle()
+{
+#ifdef WITH_THREAD
+    while (this->running_ && this->busy_) {
+        Py_BEGIN_ALLOW_THREADS
+        PyThread_acquire_lock(this->idle_lock_, WAIT_LOCK);
+        PyThread_release_lock(this->idle_lock_);
+        Py_END_ALLOW_THREADS
+    }
+#endif
+}
+
+void
+PyJitCompileQueue::Stop()
+{
+    this->enabled_ = false;
+#ifdef WITH_THREAD
+    if (this->running_) {
+        this->stopping_ = true;
+        if (!this->signaled_) {
+            this->signaled_ = true;
+            PyThread_release_lock(this->work_available_);
+        }
+        Py_BEGIN_ALLOW_THREADS
+        PyThread_acquire_lock(this->thread_exited_, WAIT_LOCK);
+        PyThread_release_lock(this->thread_exited_);
+        Py_END_ALLOW_THREADS
+        this->running_ = false;
+    }
+#endif
+    this->ClearJobs();
+}
+
+void
+PyJitCompileQueue::AfterFork()
+{
+#ifdef WITH_THREAD
+    if (!this->running_)
+        return;
+    // Our locks may have been held by the compiler thread, which no longer
+    // exists.  Like PyEval_ReInitThreads(), leak them rather than risk
+    // freeing a lock that's held.
+    this->work_available_ = NULL;
+    this->idle_lock_ = NULL;
+    this->thread_exited_ = NULL;
+    this->running_ = false;
+    this->busy_ = false;
+    this->signaled_ = false;
+    // The code object the compiler thread was working on keeps the
+    // reference the thread held; that's better than freeing it under the
+    // parent's feet.
+    if (this->current_code_ != NULL) {
+        this->current_code_->co_compile_pending = 0;
+        this->current_code_ = NULL;
+    }
+    this->ClearJobs();
+    // If we're still enabled, the next Enqueue() starts a new thread.  We
+    // can't do that here: PyOS_AfterFork() calls PyThread_ReInitTLS() after
+    // us, which would throw away the new thread's TLS entry.
+#endif
+}
+
+void
+PyJitCompileQueue::ClearJobs()
+{
+    while (!this->jobs_.empty()) {
+        PyCodeObject *code = this->jobs_.front().code;
+        this->jobs_.pop_front();
+        code->co_compile_pending = 0;
+        Py_DECREF(code);
+    }
+}
+
+void
+PyJitCompileQueue::ThreadMain(void *queue_raw)
+{
+#ifdef WITH_THREAD
+    PyJitCompileQueue *queue = static_cast<PyJitCompileQueue *>(queue_raw);
+    PyThreadState *tstate = PyThreadState_New(queue->interp_);
+
+    PyEval_AcquireThread(tstate);
+    queue->Run();
+    PyThreadState_Clear(tstate);
+    PyThread_type_lock thread_exited = queue->thread_exited_;
+    PyThreadState_DeleteCurrent();
+    // Don't touch queue after this: Stop() may return and the interpreter
+    // may be torn down as soon as we release the lock.
+    PyThread_release_lock(thread_exited);
+    PyThread_exit_thread();
+#endif
+}
+
+// Runs on the compiler thread with the GIL held.
+void
+PyJitCompileQueue::Run()
+{
+#ifdef WITH_THREAD
+    while (!this->stopping_) {
+        if (!this->jobs_.empty()) {
+            Job job = this->jobs_.front();
+            this->jobs_.pop_front();
+            this->current_code_ = job.code;
+            this->CompileJob(job);
+            this->current_code_ = NULL;
+            Py_DECREF(job.code);
+            continue;
+        }
+        if (this->busy_) {
+            this->busy_ = false;
+            PyThread_release_lock(this->idle_lock_);
+        }
+        Py_BEGIN_ALLOW_THREADS
+        PyThread_acquire_lock(this->work_available_, WAIT_LOCK);
+        Py_END_ALLOW_THREADS
+        this->signaled_ = false;
+    }
+    if (this->busy_) {
+        this->busy_ = false;
+        PyThread_release_lock(this->idle_lock_);
+    }
+#endif
+}
+
+// Runs on the compiler thread.  Called with the GIL held, but releases it for
+// optimization and codegen.
+void
+PyJitCompileQueue::CompileJob(const Job &job)
+{
+    PyCodeObject *code = job.code;
+#ifdef Py_WITH_INSTRUMENTATION
+    Timer timer(*background_compile_times);
+#endif
+    const int64_t start = PyJitCompileBudget::Now();
+    // This may release the GIL while it waits, so check whether the job is
+    // still worth doing only after we have the lock.
+    this->llvm_data_->LockLlvm();
+    // The code object may have been invalidated or compiled in the
+    // foreground (e.g. after switching to -j always) while it was waiting.
+    if (!code->co_use_jit ||
+        code->co_fatalbailcount >= PY_MAX_FATALBAILCOUNT ||
+        (code->co_native_function != NULL &&
+         code->co_optimization >= job.opt_level)) {
+        this->llvm_data_->UnlockLlvm();
+        code->co_compile_pending = 0;
+        return;
+    }
+    // Code queued for the quick tier may have gotten hot while it waited;
+    // don't make it go through the queue twice.
+    int job_opt_level = job.opt_level;
+    if (_PyCode_HOTNESS(code) > PY_HOTNESS_THRESHOLD)
+        job_opt_level = std::max(job_opt_level, Py_DEFAULT_JIT_OPT_LEVEL);
+
+    // Build the IR without optimizing it.  This reads the code object and
+    // its feedback, so it has to happen under the GIL.  If the code is
+    // already running machine code from a lower tier, or its machine code was
+    // invalidated, throw away that IR and regenerate it from the feedback
+    // gathered since; frames keep running the old machine code until we
+    // publish the new one.
+    int r;
+    if (code->co_native_function != NULL || code->co_needs_recompile)
+        r = _PyCode_RecompileLlvmIr(code, -1);
+    else
+        r = _PyCode_ToOptimizedLlvmIr(code, code->co_optimization);
+    if (r != 0) {
+        this->llvm_data_->UnlockLlvm();
+        if (r < 0)
+            PyErr_WriteUnraisable((PyObject *)code);
+        // As in maybe_compile(), if this was a tier-up, keep running the
+        // old machine code.  Only give up on the JIT if there's no valid
+        // machine code to fall back on.
+        if (code->co_native_function == NULL || code->co_needs_recompile)
+            code->co_use_jit = 0;
+        code->co_compile_pending = 0;
+        return;
+    }
+    _LlvmFunction *function = code->co_llvm_function;
+    const int cur_opt_level = code->co_optimization;
+    const int opt_level = std::max(job_opt_level, cur_opt_level);
+    PyEvalFrameFunction native_func;
+    int optimize_result = 0;
+
+    Py_BEGIN_ALLOW_THREADS
+    {
+#ifdef Py_WITH_INSTRUMENTATION
+        Timer nogil_timer(*background_compile_nogil_times);
+#endif
+        if (cur_opt_level < opt_level)
+            optimize_result = _LlvmFunction_Optimize(this->llvm_data_,
+                                                     function, opt_level);
+        native_func = optimize_result < 0 ? NULL :
+            _LlvmFunction_Jit(this->llvm_data_, function);
+        this->llvm_data_->UnlockLlvm();
+    }
+    Py_END_ALLOW_THREADS
+
+    // The compiler thread's time comes out of the same budget as the
+    // foreground's; see maybe_compile().
+    this->llvm_data_->compile_budget().Charge(
+        PyJitCompileBudget::Now() - start, _PyCode_EstimateIrSize(code));
+    code->co_compile_pending = 0;
+    if (native_func == NULL) {
+        code->co_use_jit = 0;
+        return;
+    }
+    // Only publish the machine code if nobody replaced the IR or
+    // invalidated the code object while we weren't holding the GIL.
+    if (code->co_llvm_function == function && code->co_use_jit &&
+        !code->co_needs_recompile) {
+        code->co_optimization = opt_level;
+        code->co_native_function = native_func;
+        PyJitCodeCache &cache = this->llvm_data_->code_cache();
+        if (cache.enabled())
+            cache.Record(code, opt_level);
+    }
+}
+
+int
+PyJitCompileQueue_SetEnabled(PyGlobalLlvmData *llvm_data, int on)
+{
+    return llvm_data->compile_queue().SetEnabled(on);
+}
+
+int
+PyJitCompileQueue_IsEnabled(PyGlobalLlvmData *llvm_data)
+{
+    return llvm_data->compile_queue().enabled();
+}
+
+void
+PyJitCompileQueue_WaitUntilIdle(PyGlobalLlvmData *llvm_data)
+{
+    llvm_data->compile_queue().WaitUntilIdle();
+}
+
+void
+PyJitCompileQueue_Stop(PyGlobalLlvmData *llvm_data)
+{
+    llvm_data->compile_queue().Stop();
+}
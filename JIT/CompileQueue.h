@@ -0,0 +1,105 @@
+// -*- C++ -*-
+#ifndef UTIL_COMPILEQUEUE_H
+#define UTIL_COMPILEQUEUE_H
+
+#ifndef __cplusplus
+#error This header expects to be included only in C++ source
+#endif
+
+#include "Python.h"
+#include "pythread.h"
+
+#include <deque>
+
+struct PyGlobalLlvmData;
+
+// Hot code objects are normally compiled synchronously by whichever thread
+// pushed them over PY_HOTNESS_THRESHOLD, which stalls that thread for as long
+// as it takes to build IR, optimize it and emit machine code.  When the
+// compile queue is enabled, maybe_compile() instead hands the code object to
+// a dedicated compiler thread and keeps running the bytecode; the next call
+// after the compiler thread publishes co_native_function picks up the
+// machine code.
+//
+// Bytecode-to-IR translation reads the code object, its runtime feedback and
+// the Python objects it refers to, so it still runs with the GIL held.  The
+// expensive part, optimization and codegen, runs with only the LLVM lock
+// (PyGlobalLlvmData::LockLlvm()) held.  Since the IR is built under the GIL,
+// it reflects a consistent snapshot of co_runtime_feedback.
+//
+// Unless otherwise noted, all methods must be called with the GIL held.
+class PyJitCompileQueue {
+public:
+    explicit PyJitCompileQueue(PyGlobalLlvmData *llvm_data);
+    // The compiler thread must already have been stopped with Stop().
+    ~PyJitCompileQueue();
+
+    bool enabled() const { return this->enabled_; }
+
+    // Turns background compilation on or off, starting the compiler thread
+    // if it isn't running.  Turning it off only stops new code objects from
+    // being queued; the thread still compiles whatever is already queued.
+    // Returns 0 on success, or -1 with a Python exception set.
+    int SetEnabled(bool on);
+
+    // Adds code to the queue and sets co_compile_pending.  The compiler
+    // thread will compile it to optimization level opt_level.  Code objects
+    // that are already pending are ignored.  Only call this while enabled().
+    // Returns false, and disables the queue, if the compiler thread wasn't
+    // running and couldn't be started; the caller should compile code
+    // itself.
+    bool Enqueue(PyCodeObject *code, int opt_level);
+
+    // Blocks, with the GIL released, until the queue is empty and the
+    // compiler thread isn't working on anything.
+    void WaitUntilIdle();
+
+    // Shuts down the compiler thread and drops any code objects still in the
+    // queue.  Called from Py_Finalize().
+    void Stop();
+
+    // Called in the child process after a fork().  The compiler thread
+    // didn't survive the fork, so forget about it and its queue.  If we're
+    // still enabled, the next Enqueue() starts a new thread.
+    void AfterFork();
+
+private:
+    struct Job {
+        PyCodeObject *code;  // Owned reference.
+        int opt_level;
+    };
+
+    int StartThread();
+    static void ThreadMain(void *queue);
+    void Run();
+    void CompileJob(const Job &job);
+    // Drops every queued job without compiling it.
+    void ClearJobs();
+
+    PyGlobalLlvmData *const llvm_data_;
+    PyInterpreterState *interp_;
+
+    std::deque<Job> jobs_;
+    // The code object the compiler thread is working on, or NULL.
+    PyCodeObject *current_code_;
+
+    bool enabled_;
+    bool running_;
+    bool stopping_;
+
+#ifdef WITH_THREAD
+    // Released whenever jobs_ has something in it or stopping_ is set.
+    // signaled_ tracks whether it has been released since the compiler
+    // thread last took it.
+    PyThread_type_lock work_available_;
+    bool signaled_;
+    // Held while busy_ is true, i.e., while the queue is non-empty or the
+    // compiler thread is working on a job.  WaitUntilIdle() waits on it.
+    PyThread_type_lock idle_lock_;
+    bool busy_;
+    // Held for as long as the compiler thread is alive.
+    PyThread_type_lock thread_exited_;
+#endif
+};
+
+#endif  // UTIL_COMPILEQUEUE_H
@@ -0,0 +1,23 @@
+#ifndef UTIL_COMPILEQUEUE_FWD_H
+#define UTIL_COMPILEQUEUE_FWD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct PyGlobalLlvmData;
+
+/* C wrappers around PyJitCompileQueue; see JIT/CompileQueue.h.
+   PyJitCompileQueue_SetEnabled() returns 0 on success, or -1 with an
+   exception set. */
+PyAPI_FUNC(int) PyJitCompileQueue_SetEnabled(struct PyGlobalLlvmData *,
+                                             int on);
+PyAPI_FUNC(int) PyJitCompileQueue_IsEnabled(struct PyGlobalLlvmData *);
+PyAPI_FUNC(void) PyJitCompileQueue_WaitUntilIdle(struct PyGlobalLlvmData *);
+PyAPI_FUNC(void) PyJitCompileQueue_Stop(struct PyGlobalLlvmData *);
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif  /* UTIL_COMPILEQUEUE_FWD_H */
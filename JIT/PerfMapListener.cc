@@ -0,0 +1,102 @@
+#include "Python.h"
+
+#include "JIT/PerfMapListener.h"
+
+#include "llvm/Analysis/DebugInfo.h"
+#include "llvm/BasicBlock.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/Function.h"
+#include "llvm/Instruction.h"
+#include "llvm/LLVMContext.h"
+#include "llvm/Metadata.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <stdio.h>
+#include <string>
+
+namespace {
+
+using llvm::BasicBlock;
+using llvm::Function;
+using llvm::MDNode;
+
+// Returns the name perf should show for f.  The JIT names every function
+// "#u#<co_name>", which doesn't say which of the many functions called
+// "__init__" it was, so look for the DISubprogram hanging off the first
+// instruction with a debug location instead.  Functions without debug info,
+// like runtime helpers JITted along with their callers, keep their LLVM
+// name.
+static std::string
+describe_function(const Function &f)
+{
+    unsigned dbg_kind = f.getContext().getMDKindID("dbg");
+    for (Function::const_iterator bb = f.begin(), bb_end = f.end();
+         bb != bb_end; ++bb) {
+        for (BasicBlock::const_iterator inst = bb->begin(),
+                 inst_end = bb->end(); inst != inst_end; ++inst) {
+            MDNode *loc = inst->getMetadata(dbg_kind);
+            if (loc == NULL)
+                continue;
+            llvm::DISubprogram subprogram(
+                llvm::DILocation(loc).getScope().getNode());
+            if (subprogram.getNode() == NULL)
+                break;
+            std::string result;
+            llvm::raw_string_ostream out(result);
+            out << "py::" << subprogram.getName()
+                << ":" << subprogram.getFilename()
+                << ":" << subprogram.getLineNumber();
+            return out.str();
+        }
+    }
+    return f.getName().str();
+}
+
+class PerfMapListener : public llvm::JITEventListener {
+public:
+    PerfMapListener() : file_(NULL), pid_(0) {}
+
+    virtual void NotifyFunctionEmitted(const Function &f,
+                                       void *code, size_t size,
+                                       const EmittedFunctionDetails &)
+    {
+        FILE *file = this->GetFile();
+        if (file == NULL)
+            return;
+        fprintf(file, "%lx %lx %s\n",
+                (unsigned long)(uintptr_t)code, (unsigned long)size,
+                describe_function(f).c_str());
+        // perf may read the map while we're still running, or after we
+        // crash, so don't leave entries sitting in the buffer.
+        fflush(file);
+    }
+
+private:
+    // Opens /tmp/perf-<pid>.map the first time it's needed.  A child
+    // process forked after code was emitted starts a map of its own, which
+    // only covers the code it compiles itself.
+    FILE *GetFile()
+    {
+        pid_t pid = getpid();
+        if (this->file_ != NULL && this->pid_ == pid)
+            return this->file_;
+        if (this->file_ != NULL)
+            fclose(this->file_);
+        char path[64];
+        PyOS_snprintf(path, sizeof(path), "/tmp/perf-%ld.map", (long)pid);
+        this->file_ = fopen(path, "a");
+        this->pid_ = pid;
+        return this->file_;
+    }
+
+    FILE *file_;
+    pid_t pid_;
+};
+
+}  // anonymous namespace
+
+llvm::JITEventListener *
+PyCreatePerfMapListener()
+{
+    return new PerfMapListener;
+}
@@ -0,0 +1,22 @@
+// -*- C++ -*-
+#ifndef UTIL_PERFMAPLISTENER_H
+#define UTIL_PERFMAPLISTENER_H
+
+#ifndef __cplusplus
+#error This header expects to be included only in C++ source
+#endif
+
+namespace llvm {
+class JITEventListener;
+}
+
+// Returns a JIT event listener that appends a line to /tmp/perf-<pid>.map
+// for every function the JIT emits, in the format Linux perf reads for
+// JIT-compiled code: "<start address> <size> <name>", both in hex.  Python
+// functions are named "py::<co_name>:<co_filename>:<co_firstlineno>", taken
+// from the debug info LlvmFunctionBuilder attaches to the IR, so that
+// `perf report` attributes samples in machine code to the Python function
+// they came from.  Like LLVM's OProfile listener, the result is never freed.
+llvm::JITEventListener *PyCreatePerfMapListener();
+
+#endif  // UTIL_PERFMAPLISTENER_H
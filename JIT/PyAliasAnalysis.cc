@@ -76,7 +76,11 @@ public:
           global_data_(global_data),
           tracing_possible_(NULL),
           profiling_possible_(NULL),
-          py_ticker_(NULL) {}
+          py_ticker_(NULL),
+          object_type_(NULL),
+          type_type_(NULL),
+          string_type_(NULL),
+          unicode_type_(NULL) {}
 
     // Exists for the pass registration infrastructure.
     PyAliasAnalysis()
@@ -84,7 +88,11 @@ public:
           global_data_(*PyGlobalLlvmData::Get()),
           tracing_possible_(NULL),
           profiling_possible_(NULL),
-          py_ticker_(NULL) {}
+          py_ticker_(NULL),
+          object_type_(NULL),
+          type_type_(NULL),
+          string_type_(NULL),
+          unicode_type_(NULL) {}
 
     virtual void getAnalysisUsage(llvm::AnalysisUsage &usage) const {
         AliasAnalysis::getAnalysisUsage(usage);
@@ -157,8 +165,14 @@ private:
         types_with_constant_values_;
     // Things like the PyFooMethods fields in constant PyTypeObjects.
     SmallPtrSet<const GlobalVariable*, 8> fully_constant_values_;
-    // Special case because one field is mutable.
-    GlobalVariable *string_type_;
+    // The structs we need to pick apart objects.  These come from the module
+    // in doInitialization() rather than from PyTypeBuilder because the
+    // compiler thread runs this pass without the GIL, where
+    // PyGlobalLlvmData::Get() doesn't work.
+    const StructType *object_type_;
+    const StructType *type_type_;
+    const StructType *string_type_;
+    const StructType *unicode_type_;
 };
 
 // The address of this variable identifies the pass.  See
@@ -184,6 +198,17 @@ PyAliasAnalysis::doInitialization(Module& module)
     this->py_ticker_ =
         module.getGlobalVariable("_Py_Ticker");
 
+    // Clang's names for PyObject, PyTypeObject, PyStringObject and
+    // PyUnicodeObject.
+    this->object_type_ =
+        cast<StructType>(module.getTypeByName("struct._object"));
+    this->type_type_ =
+        cast<StructType>(module.getTypeByName("struct._typeobject"));
+    this->string_type_ =
+        cast<StructType>(module.getTypeByName("struct.PyStringObject"));
+    this->unicode_type_ =
+        cast<StructType>(module.getTypeByName("struct.PyUnicodeObject"));
+
     this->constant_types_.clear();
     this->types_with_constant_values_.clear();
     this->fully_constant_values_.clear();
@@ -356,7 +381,7 @@ PyAliasAnalysis::PointsToConstFieldInPyObject(const Value *v)
     // The fields up to and including the refcount are mutable.
     const int refcnt_index = py::ObjectTy::ob_refcnt_index(*this->context_);
     std::pair<uint64_t, uint64_t> refcnt_range =
-        this->GetByteRangeOfField(py::ObjectTy::get(*this->context_),
+        this->GetByteRangeOfField(this->object_type_,
                                   refcnt_index);
     if (this->MayOverlapByteRange(gv_scev, s,
                                   std::make_pair(0, refcnt_range.second)))
@@ -366,7 +391,7 @@ PyAliasAnalysis::PointsToConstFieldInPyObject(const Value *v)
         // This is a known builtin type that can't change, except for
         // the refcount and a couple fields at the end.
         const StructLayout *type_layout =
-            getTargetData()->getStructLayout(py::TypeTy::get(*this->context_));
+            getTargetData()->getStructLayout(this->type_type_);
 #ifdef COUNT_ALLOCS
         uint64_t tp_allocs_offset =
             type_layout->getElementOffset(
@@ -410,7 +435,7 @@ PyAliasAnalysis::PointsToConstFieldInPyObject(const Value *v)
         // Right size to be the type pointer.
         const SCEV *offset = this->scev_->getMinusSCEV(s, gv_scev);
         const SCEV *type_field = this->scev_->getOffsetOfExpr(
-            py::ObjectTy::get(*this->context_),
+            this->object_type_,
             py::ObjectTy::ob_type_index(*this->context_));
         if (offset == type_field)
             return true;
@@ -426,7 +451,7 @@ PyAliasAnalysis::IsConstStringField(const SCEV *string_gv, const SCEV *field)
     // ConstantMirror::GetGlobalVariable hashes the string before mirroring it.
     std::pair<uint64_t, uint64_t> sstate_range =
         this->GetByteRangeOfField(
-            py::StringTy::get(*this->context_),
+            this->string_type_,
             py::StringTy::ob_sstate_index(*this->context_));
     return !this->MayOverlapByteRange(string_gv, field, sstate_range);
 }
@@ -438,7 +463,7 @@ PyAliasAnalysis::IsConstUnicodeField(const SCEV *unicode_gv, const SCEV *field)
     // ConstantMirror::GetGlobalVariable hashes the unicode before mirroring it.
     std::pair<uint64_t, uint64_t> defenc_range =
         this->GetByteRangeOfField(
-            PyTypeBuilder<PyUnicodeObject>::get(*this->context_),
+            this->unicode_type_,
             PyTypeBuilder<PyUnicodeObject>::defenc_index(*this->context_));
     return !this->MayOverlapByteRange(unicode_gv, field, defenc_range);
 }
@@ -451,8 +476,7 @@ PyAliasAnalysis::IsPyObject(const GlobalVariable *gv)
     // A non-struct can't be a PyObject.
     if (gv_type == NULL)
         return false;
-    const StructType *pyobject_type =
-        PyTypeBuilder<PyObject>::get(*this->context_);
+    const StructType *pyobject_type = this->object_type_;
     // PyObjects always have at least as many fields as PyObject itself.
     if (gv_type->getNumElements() < pyobject_type->getNumElements())
         return false;
@@ -31,14 +31,13 @@ using llvm::isa;
 
 // This function unwinds casts and GEPs until it finds an instruction with
 // a TBAA Metadata node. Returns NULL if no metadata is found. Automatically
-// tags pointers to PyObject.
+// tags pointers to PyObject, which must be passed in as pyobject_type.
 static MDNode *getFirstMDNode(const PyGlobalLlvmData *const llvm_data,
+                              const llvm::Type *const pyobject_type,
                               const unsigned kind, const Value *V)
 {
     unsigned MaxLookup = 10;
     bool is_pyobject = false;
-    const llvm::Type *pyobject_type =
-        PyTypeBuilder<PyObject*>::get(V->getContext());
 
     do {
         if (const Instruction *instr = dyn_cast<Instruction>(V))
@@ -76,6 +75,15 @@ static MDNode *getFirstMDNode(const PyGlobalLlvmData *const llvm_data,
 }
 
 
+// Returns PyObject*.  The compiler thread runs these passes without the GIL,
+// where PyTypeBuilder can't find the module through PyGlobalLlvmData::Get(),
+// so the passes look their types up once, when they're created.
+static const llvm::Type *getPyObjectPtrType(const PyGlobalLlvmData &llvm_data)
+{
+    // Clang's name for the PyObject struct.
+    return llvm::PointerType::getUnqual(
+        llvm_data.module()->getTypeByName("struct._object"));
+}
 
 class PyTBAliasAnalysis : public FunctionPass, public AliasAnalysis {
 public:
@@ -83,12 +91,13 @@ public:
     PyTBAliasAnalysis(PyGlobalLlvmData &global_data)
         : FunctionPass(&ID), context_(&global_data.context()),
           llvm_data_(&global_data),
+          pyobject_type_(getPyObjectPtrType(global_data)),
           kind_(global_data.GetTBAAKind())
     {}
 
     PyTBAliasAnalysis()
         : FunctionPass(&ID), context_(NULL), llvm_data_(NULL),
-          kind_(0)
+          pyobject_type_(NULL), kind_(0)
     {}
 
     virtual void getAnalysisUsage(llvm::AnalysisUsage &usage) const {
@@ -112,6 +121,7 @@ private:
 
     const LLVMContext *const context_;
     const PyGlobalLlvmData *const llvm_data_;
+    const llvm::Type *const pyobject_type_;
     const unsigned kind_;
 };
 
@@ -140,9 +150,11 @@ AliasAnalysis::AliasResult
 PyTBAliasAnalysis::alias(const Value *V1, unsigned V1Size,
                          const Value *V2, unsigned V2Size)
 {
-    MDNode *T1 = getFirstMDNode(this->llvm_data_, this->kind_,
+    MDNode *T1 = getFirstMDNode(this->llvm_data_, this->pyobject_type_,
+                                this->kind_,
                                 const_cast<Value*>(V1));
-    MDNode *T2 = getFirstMDNode(this->llvm_data_, this->kind_,
+    MDNode *T2 = getFirstMDNode(this->llvm_data_, this->pyobject_type_,
+                                this->kind_,
                                 const_cast<Value*>(V2));
 
     if (T1 == NULL || T2 == NULL) {
@@ -306,9 +318,11 @@ public:
     PyTypeGuardRemovalPass(PyGlobalLlvmData &global_data);
 
     PyTypeGuardRemovalPass()
-        : FunctionPass(&ID), context_(NULL), llvm_data_(NULL), kind_(0)
+        : FunctionPass(&ID), context_(NULL), llvm_data_(NULL),
+          pyobject_type_(NULL), type_object_type_(NULL), kind_(0)
     {}
 
+    virtual bool doInitialization(Module&);
     virtual bool runOnFunction(Function&);
 
 private:
@@ -317,6 +331,8 @@ private:
 
     LLVMContext *const context_;
     const PyGlobalLlvmData *const llvm_data_;
+    const llvm::Type *const pyobject_type_;
+    const llvm::Type *const type_object_type_;
     const unsigned kind_;
 
     typedef llvm::ValueMap<const Value *,
@@ -339,6 +355,10 @@ X("python-typeguard", "Python-specific Type Guard Removal Pass", false, true);
 PyTypeGuardRemovalPass::PyTypeGuardRemovalPass(PyGlobalLlvmData &global_data)
     : FunctionPass(&ID), context_(&global_data.context()),
       llvm_data_(&global_data),
+      pyobject_type_(getPyObjectPtrType(global_data)),
+      // Clang's name for the PyTypeObject struct.
+      type_object_type_(llvm::PointerType::getUnqual(
+          global_data.module()->getTypeByName("struct._typeobject"))),
       kind_(global_data.GetTBAAKind())
 {
 }
@@ -352,18 +372,26 @@ PyTypeGuardRemovalPass::addGuardType(PyObject *obj, const PyTBAAType &type)
 }
 
 bool
-PyTypeGuardRemovalPass::runOnFunction(Function &F)
+PyTypeGuardRemovalPass::doInitialization(Module &module)
 {
+    // GetGlobalVariable does not work during init, and needs the GIL, so
+    // PyGlobalLlvmData::PrepareOptimizations() calls this before the
+    // compiler thread can run the pass.
+    // Connects type objects with Metadata. Do this for every
+    // *_CheckExact you want to remove.
+    this->addGuardType((PyObject *)&PyInt_Type,
+                       llvm_data_->tbaa_PyIntObject);
+    this->addGuardType((PyObject *)&PyFloat_Type,
+                       llvm_data_->tbaa_PyFloatObject);
+    return false;
+}
 
-    if (type_map_.empty()) {
-        // Lazy initialisation. GetGlobalVariable does not work during init.
-        // Connects type objects with Metadata. Do this for every
-        // *_CheckExact you want to remove.
-        this->addGuardType((PyObject *)&PyInt_Type,
-                           llvm_data_->tbaa_PyIntObject);
-        this->addGuardType((PyObject *)&PyFloat_Type,
-                           llvm_data_->tbaa_PyFloatObject);
-    }
+bool
+PyTypeGuardRemovalPass::runOnFunction(Function &F)
+{
+    // Lazy initialisation, if nobody ran doInitialization.
+    if (type_map_.empty())
+        this->doInitialization(*F.getParent());
 
     bool changed = false;
 
@@ -381,8 +409,7 @@ PyTypeGuardRemovalPass::runOnFunction(Function &F)
 bool
 PyTypeGuardRemovalPass::checkICmp(ICmpInst *icmpInst)
 {
-    const llvm::Type *type_object =
-        PyTypeBuilder<PyTypeObject*>::get(*this->context_);
+    const llvm::Type *type_object = this->type_object_type_;
 
     if (icmpInst->getPredicate() != ICmpInst::ICMP_EQ) {
         return false;
@@ -401,7 +428,8 @@ PyTypeGuardRemovalPass::checkICmp(ICmpInst *icmpInst)
 
     Value *src = loadInst->getOperand(0);
 
-    MDNode *type_hint = getFirstMDNode(this->llvm_data_, this->kind_, src);
+    MDNode *type_hint = getFirstMDNode(this->llvm_data_, this->pyobject_type_,
+                                       this->kind_, src);
 
     if (type_hint == NULL)
         return false;
@@ -493,6 +493,7 @@ public:
     DEFINE_FIELD(PyFrameObject, f_iblock)
     DEFINE_FIELD(PyFrameObject, f_bailed_from_llvm)
     DEFINE_FIELD(PyFrameObject, f_guard_type)
+    DEFINE_FIELD(PyFrameObject, f_virtual)
     DEFINE_FIELD(PyFrameObject, f_blockstack)
     DEFINE_FIELD(PyFrameObject, f_localsplus)
 };
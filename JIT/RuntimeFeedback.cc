@@ -1,10 +1,14 @@
 #include "Python.h"
+#include "opcode.h"
+#include "JIT/PyBytecodeIterator.h"
 #include "JIT/RuntimeFeedback.h"
 
 #include "llvm/ADT/PointerIntPair.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/raw_ostream.h"
 
 #include <algorithm>
 
@@ -12,6 +16,147 @@ using llvm::PointerIntPair;
 using llvm::PointerLikeTypeTraits;
 using llvm::SmallPtrSet;
 using llvm::SmallVector;
+using llvm::SmallVectorImpl;
+
+#ifdef Py_WITH_INSTRUMENTATION
+
+class FeedbackHistogramStats {
+public:
+    FeedbackHistogramStats()
+        : promotions(0), refused(0), peak_live(0) {
+    }
+
+    ~FeedbackHistogramStats() {
+        llvm::errs() << "\nFeedback histograms:\n";
+        llvm::errs() << "Promotions: " << this->promotions << "\n";
+        llvm::errs() << "Promotions refused (over limit): "
+                     << this->refused << "\n";
+        llvm::errs() << "Peak live histograms: " << this->peak_live << "\n";
+        llvm::errs() << "Peak histogram memory (bytes): "
+                     << this->peak_live * sizeof(PyFeedbackHistogram) << "\n";
+    }
+
+    // Number of feedback entries promoted to histograms.
+    unsigned promotions;
+    // Number of feedback entries that overflowed while PY_FDO_MAX_HISTOGRAMS
+    // histograms were alive.
+    unsigned refused;
+    // The most histograms alive at once.
+    unsigned peak_live;
+};
+
+static llvm::ManagedStatic<FeedbackHistogramStats> histogram_stats;
+
+#define HISTOGRAM_INC_STATS(field) histogram_stats->field++
+#else
+#define HISTOGRAM_INC_STATS(field)
+#endif  /* Py_WITH_INSTRUMENTATION */
+
+// The number of PyFeedbackHistograms currently alive.  Protected by the GIL.
+static unsigned live_histograms = 0;
+
+
+PyFeedbackHistogram::PyFeedbackHistogram()
+    : size_(0), total_(0)
+{
+    ++live_histograms;
+#ifdef Py_WITH_INSTRUMENTATION
+    if (live_histograms > histogram_stats->peak_live)
+        histogram_stats->peak_live = live_histograms;
+#endif
+}
+
+PyFeedbackHistogram *
+PyFeedbackHistogram::New()
+{
+    if (live_histograms >= PY_FDO_MAX_HISTOGRAMS) {
+        HISTOGRAM_INC_STATS(refused);
+        return NULL;
+    }
+    HISTOGRAM_INC_STATS(promotions);
+    return new PyFeedbackHistogram;
+}
+
+PyFeedbackHistogram::~PyFeedbackHistogram()
+{
+    for (unsigned i = 0; i < this->size_; ++i) {
+        Py_DECREF(this->entries_[i].obj);
+    }
+    --live_histograms;
+}
+
+PyFeedbackHistogram *
+PyFeedbackHistogram::Clone() const
+{
+    PyFeedbackHistogram *copy = new PyFeedbackHistogram;
+    for (unsigned i = 0; i < this->size_; ++i) {
+        copy->entries_[i] = this->entries_[i];
+        Py_INCREF(copy->entries_[i].obj);
+    }
+    copy->size_ = this->size_;
+    copy->total_ = this->total_;
+    return copy;
+}
+
+void
+PyFeedbackHistogram::Add(PyObject *obj, void *extra)
+{
+    assert(obj != NULL);
+    // Saturate rather than wrapping, like the counters.
+    if (this->total_ + 1 == 0)
+        return;
+    ++this->total_;
+
+    for (unsigned i = 0; i < this->size_; ++i) {
+        Entry &entry = this->entries_[i];
+        if (entry.obj == obj && entry.extra == extra) {
+            ++entry.count;
+            return;
+        }
+    }
+    if (this->size_ < kMaxEntries) {
+        Entry &entry = this->entries_[this->size_++];
+        Py_INCREF(obj);
+        entry.obj = obj;
+        entry.extra = extra;
+        entry.count = 1;
+    }
+}
+
+namespace {
+// Orders histogram entry indices by decreasing count.
+struct MoreFrequent {
+    explicit MoreFrequent(const PyFeedbackHistogram &histogram)
+        : histogram_(histogram) {}
+    bool operator()(unsigned a, unsigned b) const {
+        return this->histogram_.GetCount(a) > this->histogram_.GetCount(b);
+    }
+    const PyFeedbackHistogram &histogram_;
+};
+}  // anonymous namespace
+
+void
+PyFeedbackHistogram::GetDominantEntriesInto(SmallVectorImpl<unsigned> &result,
+                                            unsigned max_entries) const
+{
+    result.clear();
+    if (this->total_ < PY_FDO_MIN_HISTOGRAM_SAMPLES)
+        return;
+
+    unsigned order[kMaxEntries];
+    for (unsigned i = 0; i < this->size_; ++i)
+        order[i] = i;
+    std::stable_sort(order, order + this->size_, MoreFrequent(*this));
+
+    for (unsigned i = 0; i < this->size_ && result.size() < max_entries; ++i) {
+        // Compare in a way that can't overflow: count / total >= percent / 100.
+        uintptr_t count = this->entries_[order[i]].count;
+        if (count < this->total_ / 100 * PY_FDO_DOMINANT_PERCENT +
+                    this->total_ % 100 * PY_FDO_DOMINANT_PERCENT / 100)
+            break;
+        result.push_back(order[i]);
+    }
+}
 
 
 PyLimitedFeedback::PyLimitedFeedback()
@@ -20,6 +165,13 @@ PyLimitedFeedback::PyLimitedFeedback()
 
 PyLimitedFeedback::PyLimitedFeedback(const PyLimitedFeedback &src)
 {
+    if (PyFeedbackHistogram *histogram = src.GetHistogram()) {
+        for (int i = 0; i < PyLimitedFeedback::NUM_POINTERS; ++i) {
+            this->data_[i] = src.data_[i];
+        }
+        this->data_[0].setPointer(histogram->Clone());
+        return;
+    }
     for (int i = 0; i < PyLimitedFeedback::NUM_POINTERS; ++i) {
         if (src.InObjectMode()) {
             PyObject *value = (PyObject *)src.data_[i].getPointer();
@@ -105,6 +257,12 @@ PyLimitedFeedback::Clear()
 {
     bool object_mode = this->InObjectMode();
 
+    if (PyFeedbackHistogram *histogram = this->GetHistogram()) {
+        // The histogram owns the only references.
+        delete histogram;
+        this->data_[0].setPointer(NULL);
+    }
+
     for (int i = 0; i < PyLimitedFeedback::NUM_POINTERS; ++i) {
         if (object_mode) {
             Py_XDECREF((PyObject *)this->data_[i].getPointer());
@@ -124,6 +282,12 @@ PyLimitedFeedback::AddObjectSeen(PyObject *obj)
         SetFlagBit(SAW_A_NULL_OBJECT_BIT, true);
         return;
     }
+    if (PyFeedbackHistogram *histogram = this->GetHistogram()) {
+        histogram->Add(obj, NULL);
+        return;
+    }
+    if (GetFlagBit(SAW_MORE_THAN_THREE_OBJS_BIT))
+        return;
     for (int i = 0; i < PyLimitedFeedback::NUM_POINTERS; ++i) {
         PyObject *value = (PyObject *)data_[i].getPointer();
         if (value == obj)
@@ -136,6 +300,38 @@ PyLimitedFeedback::AddObjectSeen(PyObject *obj)
     }
     // Record overflow.
     SetFlagBit(SAW_MORE_THAN_THREE_OBJS_BIT, true);
+    this->PromoteToHistogram();
+    if (PyFeedbackHistogram *histogram = this->GetHistogram()) {
+        histogram->Add(obj, NULL);
+    }
+}
+
+void
+PyLimitedFeedback::PromoteToHistogram()
+{
+    assert(this->GetHistogram() == NULL);
+    PyFeedbackHistogram *histogram = PyFeedbackHistogram::New();
+    if (histogram == NULL)
+        return;
+
+    if (this->GetFlagBit(FUNC_MODE_BIT)) {
+        PyObject *type = (PyObject *)this->data_[0].getPointer();
+        PyMethodDef *ml = (PyMethodDef *)this->data_[1].getPointer();
+        histogram->Add(type, ml);
+        // Like Clear(), we leave the reference to type alone in function
+        // mode.
+    } else {
+        for (int i = 0; i < PyLimitedFeedback::NUM_POINTERS; ++i) {
+            PyObject *value = (PyObject *)this->data_[i].getPointer();
+            histogram->Add(value, NULL);
+            Py_DECREF(value);
+        }
+    }
+    for (int i = 0; i < PyLimitedFeedback::NUM_POINTERS; ++i) {
+        this->data_[i].setPointer(NULL);
+    }
+    this->data_[0].setPointer(histogram);
+    this->SetFlagBit(HISTOGRAM_BIT, true);
 }
 
 void
@@ -148,6 +344,14 @@ PyLimitedFeedback::GetSeenObjectsInto(SmallVector<PyObject*, 3> &result) const
         // Saw a NULL value, so add NULL to the result.
         result.push_back(NULL);
     }
+    if (PyFeedbackHistogram *histogram = this->GetHistogram()) {
+        // Report the same objects we would have without the histogram.
+        for (unsigned i = 0; i < histogram->size() &&
+                 i < (unsigned)PyLimitedFeedback::NUM_POINTERS; ++i) {
+            result.push_back(histogram->GetObject(i));
+        }
+        return;
+    }
     for (int i = 0; i < PyLimitedFeedback::NUM_POINTERS; ++i) {
         PyObject *value = (PyObject *)data_[i].getPointer();
         if (value == NULL)
@@ -156,13 +360,31 @@ PyLimitedFeedback::GetSeenObjectsInto(SmallVector<PyObject*, 3> &result) const
     }
 }
 
+void
+PyLimitedFeedback::GetDominantObjectsInto(SmallVector<PyObject*, 3> &result,
+                                          unsigned max_objects) const
+{
+    assert(this->InObjectMode());
+
+    result.clear();
+    PyFeedbackHistogram *histogram = this->GetHistogram();
+    if (histogram == NULL)
+        return;
+    SmallVector<unsigned, PyFeedbackHistogram::kMaxEntries> dominant;
+    histogram->GetDominantEntriesInto(dominant, max_objects);
+    for (unsigned i = 0; i < dominant.size(); ++i) {
+        result.push_back(histogram->GetObject(dominant[i]));
+    }
+}
+
 void
 PyLimitedFeedback::AddFuncSeen(PyObject *obj)
 {
     assert(this->InFuncMode());
     this->SetFlagBit(FUNC_MODE_BIT, true);
 
-    if (this->GetFlagBit(SAW_MORE_THAN_THREE_OBJS_BIT))
+    PyFeedbackHistogram *histogram = this->GetHistogram();
+    if (histogram == NULL && this->GetFlagBit(SAW_MORE_THAN_THREE_OBJS_BIT))
         return;
     if (obj == NULL) {
         this->SetFlagBit(SAW_A_NULL_OBJECT_BIT, true);
@@ -179,6 +401,11 @@ PyLimitedFeedback::AddFuncSeen(PyObject *obj)
         ml = ((PyMethodDescrObject *)obj)->d_method;
     }
 
+    if (histogram != NULL) {
+        histogram->Add((PyObject *)type, ml);
+        return;
+    }
+
     PyTypeObject *old_type = (PyTypeObject *)this->data_[0].getPointer();
     PyMethodDef *old_ml = (PyMethodDef *)this->data_[1].getPointer();
     if (old_type == NULL) {
@@ -191,6 +418,10 @@ PyLimitedFeedback::AddFuncSeen(PyObject *obj)
         // call site is polymorphic, even if we haven't seen more than three
         // objects.
         this->SetFlagBit(SAW_MORE_THAN_THREE_OBJS_BIT, true);
+        this->PromoteToHistogram();
+        if ((histogram = this->GetHistogram()) != NULL) {
+            histogram->Add((PyObject *)type, ml);
+        }
     }
     // The call site is monomorphic, so we leave it as is.
 }
@@ -209,9 +440,33 @@ PyLimitedFeedback::GetSeenFuncsInto(
     }
     PyTypeObject *type = (PyTypeObject *)this->data_[0].getPointer();
     PyMethodDef *ml = (PyMethodDef *)this->data_[1].getPointer();
+    if (PyFeedbackHistogram *histogram = this->GetHistogram()) {
+        // Report the function we would have without the histogram.
+        type = (PyTypeObject *)histogram->GetObject(0);
+        ml = (PyMethodDef *)histogram->GetExtra(0);
+    }
     result.push_back(std::make_pair<PyTypeObject*, PyMethodDef*>(type, ml));
 }
 
+void
+PyLimitedFeedback::GetDominantFuncsInto(
+    SmallVector<PyTypeMethodPair, 3> &result, unsigned max_funcs) const
+{
+    assert(this->InFuncMode());
+
+    result.clear();
+    PyFeedbackHistogram *histogram = this->GetHistogram();
+    if (histogram == NULL)
+        return;
+    SmallVector<unsigned, PyFeedbackHistogram::kMaxEntries> dominant;
+    histogram->GetDominantEntriesInto(dominant, max_funcs);
+    for (unsigned i = 0; i < dominant.size(); ++i) {
+        result.push_back(std::make_pair(
+            (PyTypeObject *)histogram->GetObject(dominant[i]),
+            (PyMethodDef *)histogram->GetExtra(dominant[i])));
+    }
+}
+
 
 PyFullFeedback::PyFullFeedback()
     : counters_(/* Zero out the array. */),
@@ -354,6 +609,24 @@ PyFullFeedback::GetSeenFuncsInto(
     }
 }
 
+void
+PyFullFeedback::GetDominantObjectsInto(SmallVector<PyObject*, 3> &result,
+                                       unsigned max_objects) const
+{
+    assert(this->InObjectMode());
+    assert(0 && "PyFullFeedback never overflows; use GetSeenObjectsInto()");
+    result.clear();
+}
+
+void
+PyFullFeedback::GetDominantFuncsInto(SmallVector<PyTypeMethodPair, 3> &result,
+                                     unsigned max_funcs) const
+{
+    assert(this->InFuncMode());
+    assert(0 && "PyFullFeedback never overflows; use GetSeenFuncsInto()");
+    result.clear();
+}
+
 void
 PyFullFeedback::IncCounter(unsigned counter_id)
 {
@@ -378,9 +651,9 @@ PyFullFeedback::GetCounter(unsigned counter_id) const
 }
 
 PyFeedbackMap *
-PyFeedbackMap_New()
+PyFeedbackMap_New(PyCodeObject *code)
 {
-    return new PyFeedbackMap;
+    return new PyFeedbackMap(code);
 }
 
 void
@@ -395,29 +668,131 @@ PyFeedbackMap_Clear(PyFeedbackMap *map)
     map->Clear();
 }
 
-const PyRuntimeFeedback *
-PyFeedbackMap::GetFeedbackEntry(unsigned opcode_index, unsigned arg_index) const
-{
-    llvm::DenseMap<std::pair<unsigned, unsigned>,
-                   PyRuntimeFeedback>::const_iterator result =
-        this->entries_.find(std::make_pair(opcode_index, arg_index));
-    if (result == this->entries_.end())
-        return NULL;
-    return &result->second;
+// Returns how many argument indices the eval loop records feedback under for
+// opcode.  Keep this in sync with the RECORD_* and INC_COUNTER uses in
+// Python/eval.cc; in debug builds, eval.cc asserts that every entry it
+// records into exists.
+static unsigned
+num_feedback_slots(int opcode, int oparg)
+{
+    switch (opcode) {
+    case UNARY_POSITIVE:
+    case UNARY_NEGATIVE:
+    case UNARY_NOT:
+    case UNARY_CONVERT:
+    case UNARY_INVERT:
+    case UNPACK_SEQUENCE:
+    case LOAD_ATTR:
+    case STORE_ATTR:
+    case DELETE_ATTR:
+    case STORE_MAP:
+    case GET_ITER:
+    case FOR_ITER:
+    case IMPORT_NAME:
+    case POP_JUMP_IF_FALSE:
+    case POP_JUMP_IF_TRUE:
+    case JUMP_IF_FALSE_OR_POP:
+    case JUMP_IF_TRUE_OR_POP:
+        return 1;
+
+    case BINARY_POWER:
+    case BINARY_MULTIPLY:
+    case BINARY_DIVIDE:
+    case BINARY_TRUE_DIVIDE:
+    case BINARY_FLOOR_DIVIDE:
+    case BINARY_MODULO:
+    case BINARY_ADD:
+    case BINARY_SUBTRACT:
+    case BINARY_SUBSCR:
+    case BINARY_LSHIFT:
+    case BINARY_RSHIFT:
+    case BINARY_AND:
+    case BINARY_XOR:
+    case BINARY_OR:
+    case INPLACE_POWER:
+    case INPLACE_MULTIPLY:
+    case INPLACE_DIVIDE:
+    case INPLACE_TRUE_DIVIDE:
+    case INPLACE_FLOOR_DIVIDE:
+    case INPLACE_MODULO:
+    case INPLACE_ADD:
+    case INPLACE_SUBTRACT:
+    case INPLACE_LSHIFT:
+    case INPLACE_RSHIFT:
+    case INPLACE_AND:
+    case INPLACE_XOR:
+    case INPLACE_OR:
+    case LIST_APPEND:
+    case STORE_SUBSCR:
+    case DELETE_SUBSCR:
+    case COMPARE_OP:
+    case LOAD_METHOD:
+        return 2;
+
+    case SLICE_NONE:
+    case SLICE_LEFT:
+    case SLICE_RIGHT:
+    case SLICE_BOTH:
+    case STORE_SLICE_NONE:
+    case STORE_SLICE_LEFT:
+    case STORE_SLICE_RIGHT:
+    case STORE_SLICE_BOTH:
+    case DELETE_SLICE_NONE:
+    case DELETE_SLICE_LEFT:
+    case DELETE_SLICE_RIGHT:
+    case DELETE_SLICE_BOTH:
+    case RAISE_VARARGS_ZERO:
+    case RAISE_VARARGS_ONE:
+    case RAISE_VARARGS_TWO:
+    case RAISE_VARARGS_THREE:
+        return 3;
+
+    // Calls with keyword arguments record nothing.  Otherwise there's the
+    // function, the types of its positional arguments (CALL_FUNCTION only)
+    // and the callee's code.
+    case CALL_FUNCTION:
+        if ((oparg >> 8) & 0xff)
+            return 0;
+        return (oparg & 0xff) + 2;
+    case CALL_METHOD:
+        if ((oparg >> 8) & 0xff)
+            return 0;
+        return 2;
+
+    default:
+        return 0;
+    }
 }
 
-PyRuntimeFeedback &
-PyFeedbackMap::GetOrCreateFeedbackEntry(
-    unsigned opcode_index, unsigned arg_index)
+PyFeedbackMap::PyFeedbackMap(PyCodeObject *code)
 {
-    return this->entries_[std::make_pair(opcode_index, arg_index)];
+    assert(PyString_Check(code->co_code));
+    size_t code_size = PyString_GET_SIZE(code->co_code);
+    this->slot_starts_.resize(code_size + 1, 0);
+
+    unsigned num_slots = 0;
+    size_t index = 0;
+    PyBytecodeIterator iter(code->co_code);
+    for (; !iter.Done() && !iter.Error(); iter.Advance()) {
+        for (; index <= iter.CurIndex(); ++index)
+            this->slot_starts_[index] = num_slots;
+        num_slots += num_feedback_slots(iter.Opcode(), iter.Oparg());
+    }
+    if (iter.Error()) {
+        // Malformed bytecode will fail to compile anyway; just don't record
+        // feedback for the rest of it.
+        PyErr_Clear();
+    }
+    for (; index <= code_size; ++index)
+        this->slot_starts_[index] = num_slots;
+    this->entries_.resize(num_slots);
 }
 
 void
 PyFeedbackMap::Clear()
 {
-    for (FeedbackMap::iterator it = this->entries_.begin(),
+    for (std::vector<PyRuntimeFeedback>::iterator it = this->entries_.begin(),
             end = this->entries_.end(); it != end; ++it) {
-        it->second.Clear();
+        it->Clear();
     }
 }
@@ -16,6 +16,12 @@
 // representation that can store all the data we could possibly
 // collect.  PyLimitedFeedback stores up to three objects, while
 // PyFullFeedback uses an unbounded set.
+//
+// When a PyLimitedFeedback overflows, it promotes itself to a
+// PyFeedbackHistogram if it can, and keeps counting how often it sees each
+// value.  The GetDominant*Into() methods then let the compiler specialize a
+// megamorphic site on the one or two values it sees most, with a generic
+// fallback for the rest.
 
 #ifndef UTIL_RUNTIMEFEEDBACK_H
 #define UTIL_RUNTIMEFEEDBACK_H
@@ -29,9 +35,11 @@
 #include "llvm/ADT/PointerIntPair.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include <string>
+#include <vector>
 
 namespace llvm {
 template<typename, unsigned> class SmallVector;
+template<typename> class SmallVectorImpl;
 }
 
 typedef std::pair<PyTypeObject*, PyMethodDef*> PyTypeMethodPair;
@@ -44,6 +52,72 @@ enum { PY_FDO_JUMP_TRUE = 0, PY_FDO_JUMP_FALSE, PY_FDO_JUMP_NON_BOOLEAN };
 // These are the counters used for feedback in the LOAD_METHOD opcode.
 enum { PY_FDO_LOADMETHOD_METHOD = 0, PY_FDO_LOADMETHOD_OTHER };
 
+// CALL_FUNCTION and CALL_METHOD record the code objects of the Python
+// functions they call under this argument index, so that small callees can be
+// inlined.  Indices 0 through 255 hold the function and the argument types;
+// PyFeedbackMap stores the code object after the last of those.
+enum { PY_FDO_CALLEE_CODE = 256 };
+
+// The most PyFeedbackHistograms that may be alive at once.  This bounds the
+// extra memory that megamorphic sites can use to about 1MB.
+#define PY_FDO_MAX_HISTOGRAMS 4096
+// A histogram needs at least this many observations before any of its
+// values are considered dominant.
+#define PY_FDO_MIN_HISTOGRAM_SAMPLES 32
+// A value is dominant if it accounts for at least this percentage of the
+// observations in its histogram.
+#define PY_FDO_DOMINANT_PERCENT 25
+
+// A bounded frequency count of the values seen at one feedback site.  It
+// counts the first kMaxEntries distinct values individually, in the order
+// they were first seen, and lumps everything after that together.  Each
+// value is a PyObject (the object in object mode, the function's type in
+// function mode), of which the histogram owns a reference, plus an
+// optional pointer that isn't refcounted (the PyMethodDef in function mode).
+//
+// These are only created by PyLimitedFeedback.  Like the rest of the
+// feedback, they must only be touched with the GIL held.
+class PyFeedbackHistogram {
+public:
+    enum { kMaxEntries = 8 };
+
+    // Returns NULL if PY_FDO_MAX_HISTOGRAMS histograms already exist.
+    static PyFeedbackHistogram *New();
+    ~PyFeedbackHistogram();
+
+    // Returns a copy of this histogram.  This always succeeds, even over
+    // the limit, since feedback entries are copied when the map holding them
+    // grows and the original is destroyed right after.
+    PyFeedbackHistogram *Clone() const;
+
+    // Counts one observation of (obj, extra).
+    void Add(PyObject *obj, void *extra);
+
+    unsigned size() const { return this->size_; }
+    PyObject *GetObject(unsigned i) const { return this->entries_[i].obj; }
+    void *GetExtra(unsigned i) const { return this->entries_[i].extra; }
+    uintptr_t GetCount(unsigned i) const { return this->entries_[i].count; }
+    // The total number of observations, including those that didn't fit.
+    uintptr_t total() const { return this->total_; }
+
+    // Clears result and fills it with the indices of at most max_entries
+    // dominant entries, most frequent first.
+    void GetDominantEntriesInto(llvm::SmallVectorImpl<unsigned> &result,
+                                unsigned max_entries) const;
+
+private:
+    PyFeedbackHistogram();
+
+    struct Entry {
+        PyObject *obj;
+        void *extra;
+        uintptr_t count;
+    };
+    Entry entries_[kMaxEntries];
+    unsigned size_;
+    uintptr_t total_;
+};
+
 class PyLimitedFeedback {
 public:
     PyLimitedFeedback();
@@ -57,6 +131,11 @@ public:
     bool ObjectsOverflowed() const {
         return GetFlagBit(SAW_MORE_THAN_THREE_OBJS_BIT);
     }
+    // If the objects overflowed and we kept counting them, clears result
+    // and fills it with at most max_objects dominant objects, most frequent
+    // first.  Otherwise just clears result.
+    void GetDominantObjectsInto(llvm::SmallVector<PyObject*, 3> &result,
+                                unsigned max_objects) const;
 
     // Record that a given function was called.
     void AddFuncSeen(PyObject *obj);
@@ -66,6 +145,9 @@ public:
     bool FuncsOverflowed() const {
         return GetFlagBit(SAW_MORE_THAN_THREE_OBJS_BIT);
     }
+    // Like GetDominantObjectsInto(), for functions.
+    void GetDominantFuncsInto(llvm::SmallVector<PyTypeMethodPair, 3> &result,
+                              unsigned max_funcs) const;
 
     // There are three counters available.  Their storage space
     // overlaps with the object record, so you can't use both.  They
@@ -86,6 +168,16 @@ private:
 
     void Swap(PyLimitedFeedback *other);
 
+    // Returns the histogram we promoted ourselves to, or NULL.
+    PyFeedbackHistogram *GetHistogram() const {
+        if (!GetFlagBit(HISTOGRAM_BIT))
+            return NULL;
+        return (PyFeedbackHistogram *)this->data_[0].getPointer();
+    }
+    // Called when we first overflow.  Moves whatever we've recorded so far
+    // into a new histogram, unless we're out of histograms.
+    void PromoteToHistogram();
+
     enum { NUM_POINTERS  = 3 };
     enum Bits {
     // We have 6 bits available here to use to store flags (we get 2
@@ -102,7 +194,9 @@ private:
         OBJECT_MODE_BIT = 3,
     //   4: True if this instance is being used in function-gathering mode.
         FUNC_MODE_BIT = 4,
-    //   5: Unused.
+    //   5: True if we've overflowed and data_[0] points to a
+    //      PyFeedbackHistogram.  The other pointers are then NULL.
+        HISTOGRAM_BIT = 5,
     };
     //
     // The pointers in this array start out NULL and are filled from
@@ -144,6 +238,14 @@ public:
     void GetSeenFuncsInto(llvm::SmallVector<PyTypeMethodPair, 3> &result) const;
     bool FuncsOverflowed() const { return false; }
 
+    // We never overflow and keep no counts, so callers have no reason to ask
+    // for dominant entries.  These assert, and just clear result in release
+    // builds.
+    void GetDominantObjectsInto(llvm::SmallVector<PyObject*, 3> &result,
+                                unsigned max_objects) const;
+    void GetDominantFuncsInto(llvm::SmallVector<PyTypeMethodPair, 3> &result,
+                              unsigned max_funcs) const;
+
     void IncCounter(unsigned counter_id);
     uintptr_t GetCounter(unsigned counter_id) const;
 
@@ -185,22 +287,49 @@ private:
 
 typedef PyLimitedFeedback PyRuntimeFeedback;
 
+// The feedback recorded for one code object.  Each opcode that records
+// feedback owns a fixed run of entries, one per argument index it records
+// under, and all of them are laid out in a single array when the map is
+// created.  Finding an entry is then a couple of loads instead of a hash
+// lookup, which matters because the eval loop does it for almost every
+// instruction it executes until the code is compiled.  The array never
+// grows, so entries don't move while the compiler reads them.
+//
 // "struct" to make C and VC++ happy at the same time.
 struct PyFeedbackMap {
-    PyRuntimeFeedback &GetOrCreateFeedbackEntry(
-        unsigned opcode_index, unsigned arg_index);
+    explicit PyFeedbackMap(PyCodeObject *code);
+
+    // Returns the entry for arg_index of the opcode at opcode_index, or NULL
+    // if that opcode doesn't record anything under arg_index.
+    PyRuntimeFeedback *GetFeedbackEntry(unsigned opcode_index,
+                                        unsigned arg_index)
+    {
+        assert(opcode_index + 1 < this->slot_starts_.size());
+        unsigned begin = this->slot_starts_[opcode_index];
+        unsigned num_slots = this->slot_starts_[opcode_index + 1] - begin;
+        // The callee's code comes after the function and its arguments.
+        if (arg_index == PY_FDO_CALLEE_CODE)
+            arg_index = num_slots - 1;
+        if (arg_index >= num_slots)
+            return NULL;
+        return &this->entries_[begin + arg_index];
+    }
 
-    const PyRuntimeFeedback *GetFeedbackEntry(
-        unsigned opcode_index, unsigned arg_index) const;
+    const PyRuntimeFeedback *GetFeedbackEntry(unsigned opcode_index,
+                                              unsigned arg_index) const
+    {
+        return const_cast<PyFeedbackMap*>(this)->GetFeedbackEntry(
+            opcode_index, arg_index);
+    }
 
     void Clear();
 
 private:
-    // The key is a (opcode_index, arg_index) pair.
-    typedef std::pair<unsigned, unsigned> FeedbackKey;
-    typedef llvm::DenseMap<FeedbackKey, PyRuntimeFeedback> FeedbackMap;
-
-    FeedbackMap entries_;
+    // The entries for the opcode at index i are
+    // entries_[slot_starts_[i]] up to entries_[slot_starts_[i + 1]].
+    // Indices that aren't the start of an opcode own no entries.
+    std::vector<unsigned> slot_starts_;
+    std::vector<PyRuntimeFeedback> entries_;
 };
 
 #endif  // UTIL_RUNTIMEFEEDBACK_H
@@ -6,8 +6,10 @@ extern "C" {
 #endif
 
 struct PyFeedbackMap;
+struct PyCodeObject;
 
-struct PyFeedbackMap *PyFeedbackMap_New(void);
+/* Creates an empty feedback map laid out for code's bytecode. */
+struct PyFeedbackMap *PyFeedbackMap_New(struct PyCodeObject *code);
 void PyFeedbackMap_Del(struct PyFeedbackMap *);
 PyAPI_FUNC(void) PyFeedbackMap_Clear(struct PyFeedbackMap *);
 
@@ -3,9 +3,13 @@
 
 #include "osdefs.h"
 #undef MAXPATHLEN  /* Conflicts with definition in LLVM's config.h */
+#include "JIT/CodeCache.h"
+#include "JIT/CompileBudget.h"
+#include "JIT/CompileQueue.h"
 #include "JIT/ConstantMirror.h"
 #include "JIT/DeadGlobalElim.h"
 #include "JIT/global_llvm_data.h"
+#include "JIT/PerfMapListener.h"
 #include "JIT/PyAliasAnalysis.h"
 #include "JIT/PyTBAliasAnalysis.h"
 #include "JIT/SingleFunctionInliner.h"
@@ -30,6 +34,7 @@
 #include "llvm/Support/ValueHandle.h"
 #include "llvm/System/Path.h"
 #include "llvm/Target/TargetData.h"
+#include "llvm/Target/TargetOptions.h"
 #include "llvm/Target/TargetSelect.h"
 #include "llvm/Transforms/Scalar.h"
 
@@ -63,6 +68,65 @@ PyGlobalLlvmData::Get()
     return PyThreadState_GET()->interp->global_llvm_data;
 }
 
+void
+PyGlobalLlvmData::LockLlvm()
+{
+#ifdef WITH_THREAD
+    long me = PyThread_get_thread_ident();
+    if (this->llvm_lock_owner_ == me) {
+        ++this->llvm_lock_depth_;
+        return;
+    }
+    if (!PyThread_acquire_lock(this->llvm_lock_, NOWAIT_LOCK)) {
+        // The compiler thread holds the lock.  It may need the GIL before
+        // it can let go, so we must not hold onto the GIL while we wait.
+        if (_PyThreadState_Current != NULL) {
+            Py_BEGIN_ALLOW_THREADS
+            PyThread_acquire_lock(this->llvm_lock_, WAIT_LOCK);
+            Py_END_ALLOW_THREADS
+        }
+        else {
+            PyThread_acquire_lock(this->llvm_lock_, WAIT_LOCK);
+        }
+    }
+    this->llvm_lock_owner_ = me;
+    this->llvm_lock_depth_ = 1;
+#endif
+}
+
+void
+PyGlobalLlvmData::UnlockLlvm()
+{
+#ifdef WITH_THREAD
+    assert(this->llvm_lock_owner_ == PyThread_get_thread_ident() &&
+           "Unlocking the LLVM lock from a thread that doesn't hold it");
+    if (--this->llvm_lock_depth_ > 0)
+        return;
+    this->llvm_lock_owner_ = -1;
+    PyThread_release_lock(this->llvm_lock_);
+#endif
+}
+
+void
+PyGlobalLlvmData::AfterFork()
+{
+    // os.fork() holds the LLVM lock across the fork, so LLVM state is
+    // consistent here; only the compiler thread is gone.
+    this->compile_queue_->AfterFork();
+}
+
+void
+PyGlobalLlvmData_Lock(PyGlobalLlvmData *global_data)
+{
+    global_data->LockLlvm();
+}
+
+void
+PyGlobalLlvmData_Unlock(PyGlobalLlvmData *global_data)
+{
+    global_data->UnlockLlvm();
+}
+
 #define STRINGIFY(X) STRINGIFY2(X)
 #define STRINGIFY2(X) #X
 // The basename of the bitcode file holding the standard library.
@@ -106,8 +170,18 @@ find_stdlib_bc()
 PyGlobalLlvmData::PyGlobalLlvmData()
     : optimized_ops(),
       optimizations_(3, (FunctionPassManager*)NULL),
+      llvm_lock_(NULL),
+      llvm_lock_owner_(-1),
+      llvm_lock_depth_(0),
       num_globals_after_last_gc_(0)
 {
+#ifdef WITH_THREAD
+    this->llvm_lock_ = PyThread_allocate_lock();
+    if (this->llvm_lock_ == NULL) {
+        Py_FatalError("Could not allocate the LLVM lock");
+    }
+#endif
+
     std::string error;
     llvm::MemoryBuffer *stdlib_file = find_stdlib_bc();
     this->module_ =
@@ -118,6 +192,15 @@ PyGlobalLlvmData::PyGlobalLlvmData()
 
     this->debug_info_.reset(new llvm::DIFactory(*this->module_));
 
+    // Describe each function's machine code to gdb through its JIT
+    // interface (__jit_debug_register_code), so backtraces through compiled
+    // code unwind and name the functions.  This costs an in-memory object
+    // file per function, so it's off unless asked for.  It has to be set
+    // before the JIT is created.
+    const char *p;
+    if ((p = Py_GETENV("PYTHONJITGDB")) && *p != '\0')
+        llvm::JITEmitDebugInfo = true;
+
     llvm::InitializeNativeTarget();
     engine_ = llvm::ExecutionEngine::create(
         this->module_,
@@ -135,6 +218,8 @@ PyGlobalLlvmData::PyGlobalLlvmData()
     }
 
     engine_->RegisterJITEventListener(llvm::createOProfileJITEventListener());
+    if ((p = Py_GETENV("PYTHONJITPERFMAP")) && *p != '\0')
+        engine_->RegisterJITEventListener(PyCreatePerfMapListener());
 
     // When we ask to JIT a function, we should also JIT other
     // functions that function depends on.  This lets us JIT in a
@@ -145,6 +230,10 @@ PyGlobalLlvmData::PyGlobalLlvmData()
 
     this->constant_mirror_.reset(new PyConstantMirror(this));
 
+    this->compile_queue_.reset(new PyJitCompileQueue(this));
+    this->code_cache_.reset(new PyJitCodeCache());
+    this->compile_budget_.reset(new PyJitCompileBudget());
+
     this->InstallInitialModule();
 
     this->InitializeTBAA();
@@ -284,12 +373,18 @@ PyGlobalLlvmData::InitializeTBAA()
 
 PyGlobalLlvmData::~PyGlobalLlvmData()
 {
+    // The compiler thread is normally stopped by Py_Finalize(); this just
+    // makes sure it can't outlive engine_.
+    this->compile_queue_.reset();
     this->bitcode_gvs_.clear();  // Stop asserting values aren't destroyed.
     this->constant_mirror_->python_shutting_down_ = true;
     for (size_t i = 0; i < this->optimizations_.size(); ++i) {
         delete this->optimizations_[i];
     }
     delete this->engine_;
+#ifdef WITH_THREAD
+    PyThread_free_lock(this->llvm_lock_);
+#endif
 }
 
 int
@@ -305,6 +400,15 @@ PyGlobalLlvmData::Optimize(llvm::Function &f, int level)
     return 0;
 }
 
+void
+PyGlobalLlvmData::PrepareOptimizations()
+{
+    for (size_t i = 0; i < this->optimizations_.size(); ++i) {
+        if (this->optimizations_[i] != NULL)
+            this->optimizations_[i]->doInitialization();
+    }
+}
+
 int
 PyGlobalLlvmData_Optimize(struct PyGlobalLlvmData *global_data,
                           _LlvmFunction *llvm_function,
@@ -372,7 +476,9 @@ PyGlobalLlvmData::CollectUnusedGlobals()
 void
 PyGlobalLlvmData_CollectUnusedGlobals(struct PyGlobalLlvmData *global_data)
 {
+    global_data->LockLlvm();
     global_data->CollectUnusedGlobals();
+    global_data->UnlockLlvm();
 }
 
 llvm::Value *
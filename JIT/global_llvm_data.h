@@ -11,6 +11,7 @@
 
 #ifdef WITH_LLVM
 #include "JIT/global_llvm_data_fwd.h"
+#include "pythread.h"
 
 #include "llvm/LLVMContext.h"
 #include "llvm/Metadata.h"
@@ -36,6 +37,9 @@ class Value;
 }
 
 class PyConstantMirror;
+class PyJitCodeCache;
+class PyJitCompileBudget;
+class PyJitCompileQueue;
 
 class PyTBAAType {
     unsigned pytbaa_kind_;
@@ -178,6 +182,21 @@ public:
                  _PyLlvm_BinDiv_Int);
     INLINABLE_OP(PyNumber_Remainder, PyInt_Type, PyInt_Type,
                  _PyLlvm_BinMod_Int);
+    // Classic division of ints already floors.
+    INLINABLE_OP(PyNumber_FloorDivide, PyInt_Type, PyInt_Type,
+                 _PyLlvm_BinDiv_Int);
+    INLINABLE_OP(PyNumber_TrueDivide, PyInt_Type, PyInt_Type,
+                 _PyLlvm_BinTrueDiv_Int);
+    INLINABLE_OP(PyNumber_Lshift, PyInt_Type, PyInt_Type,
+                 _PyLlvm_BinLshift_Int);
+    INLINABLE_OP(PyNumber_Rshift, PyInt_Type, PyInt_Type,
+                 _PyLlvm_BinRshift_Int);
+    INLINABLE_OP(PyNumber_And, PyInt_Type, PyInt_Type,
+                 _PyLlvm_BinAnd_Int);
+    INLINABLE_OP(PyNumber_Or, PyInt_Type, PyInt_Type,
+                 _PyLlvm_BinOr_Int);
+    INLINABLE_OP(PyNumber_Xor, PyInt_Type, PyInt_Type,
+                 _PyLlvm_BinXor_Int);
 
     // Float specializations
     INLINABLE_OP(PyNumber_Add, PyFloat_Type, PyFloat_Type,
@@ -188,12 +207,42 @@ public:
                  _PyLlvm_BinMult_Float);
     INLINABLE_OP(PyNumber_Divide, PyFloat_Type, PyFloat_Type,
                  _PyLlvm_BinDiv_Float);
+    INLINABLE_OP(PyNumber_TrueDivide, PyFloat_Type, PyFloat_Type,
+                 _PyLlvm_BinDiv_Float);
+    INLINABLE_OP(PyNumber_Remainder, PyFloat_Type, PyFloat_Type,
+                 _PyLlvm_BinMod_Float);
+    INLINABLE_OP(PyNumber_FloorDivide, PyFloat_Type, PyFloat_Type,
+                 _PyLlvm_BinFloorDiv_Float);
 
     // Int combined with float
+    INLINABLE_OP(PyNumber_Add, PyFloat_Type, PyInt_Type,
+                 _PyLlvm_BinAdd_FloatInt);
+    INLINABLE_OP(PyNumber_Subtract, PyFloat_Type, PyInt_Type,
+                 _PyLlvm_BinSub_FloatInt);
     INLINABLE_OP(PyNumber_Multiply, PyFloat_Type, PyInt_Type,
                  _PyLlvm_BinMul_FloatInt);
     INLINABLE_OP(PyNumber_Divide, PyFloat_Type, PyInt_Type,
                  _PyLlvm_BinDiv_FloatInt);
+    INLINABLE_OP(PyNumber_TrueDivide, PyFloat_Type, PyInt_Type,
+                 _PyLlvm_BinDiv_FloatInt);
+    INLINABLE_OP(PyNumber_Add, PyInt_Type, PyFloat_Type,
+                 _PyLlvm_BinAdd_IntFloat);
+    INLINABLE_OP(PyNumber_Subtract, PyInt_Type, PyFloat_Type,
+                 _PyLlvm_BinSub_IntFloat);
+    INLINABLE_OP(PyNumber_Multiply, PyInt_Type, PyFloat_Type,
+                 _PyLlvm_BinMul_IntFloat);
+    INLINABLE_OP(PyNumber_Divide, PyInt_Type, PyFloat_Type,
+                 _PyLlvm_BinDiv_IntFloat);
+    INLINABLE_OP(PyNumber_TrueDivide, PyInt_Type, PyFloat_Type,
+                 _PyLlvm_BinDiv_IntFloat);
+
+    // Long specializations, for values that fit in one digit.
+    INLINABLE_OP(PyNumber_Add, PyLong_Type, PyLong_Type,
+                 _PyLlvm_BinAdd_Long);
+    INLINABLE_OP(PyNumber_Subtract, PyLong_Type, PyLong_Type,
+                 _PyLlvm_BinSub_Long);
+    INLINABLE_OP(PyNumber_Multiply, PyLong_Type, PyLong_Type,
+                 _PyLlvm_BinMult_Long);
 
     // List specializations
     INLINABLE_OP(PyObject_GetItem, PyList_Type, PyInt_Type,
@@ -203,6 +252,16 @@ public:
     INLINABLE_OP(PyObject_GetItem, PyTuple_Type, PyInt_Type,
                  _PyLlvm_BinSubscr_Tuple);
 
+    // String and unicode specializations
+    INLINABLE_OP(PyObject_GetItem, PyString_Type, PyInt_Type,
+                 _PyLlvm_BinSubscr_Str);
+    INLINABLE_OP(PyObject_GetItem, PyUnicode_Type, PyInt_Type,
+                 _PyLlvm_BinSubscr_Unicode);
+    INLINABLE_OP(PyNumber_Add, PyString_Type, PyString_Type,
+                 _PyLlvm_BinAdd_Str);
+    INLINABLE_OP(PyNumber_Add, PyUnicode_Type, PyUnicode_Type,
+                 _PyLlvm_BinAdd_Unicode);
+
     // Cmpop Integer specializations
     INLINABLE_OP(PyCmp_LT, PyInt_Type, PyInt_Type, _PyLlvm_BinLt_Int);
     INLINABLE_OP(PyCmp_LE, PyInt_Type, PyInt_Type, _PyLlvm_BinLe_Int);
@@ -211,8 +270,45 @@ public:
     INLINABLE_OP(PyCmp_GT, PyInt_Type, PyInt_Type, _PyLlvm_BinGt_Int);
     INLINABLE_OP(PyCmp_GE, PyInt_Type, PyInt_Type, _PyLlvm_BinGe_Int);
 
-    // Cmpop Float specialization
+    // Cmpop Float specializations
+    INLINABLE_OP(PyCmp_LT, PyFloat_Type, PyFloat_Type, _PyLlvm_BinLt_Float);
+    INLINABLE_OP(PyCmp_LE, PyFloat_Type, PyFloat_Type, _PyLlvm_BinLe_Float);
+    INLINABLE_OP(PyCmp_EQ, PyFloat_Type, PyFloat_Type, _PyLlvm_BinEq_Float);
+    INLINABLE_OP(PyCmp_NE, PyFloat_Type, PyFloat_Type, _PyLlvm_BinNe_Float);
     INLINABLE_OP(PyCmp_GT, PyFloat_Type, PyFloat_Type, _PyLlvm_BinGt_Float);
+    INLINABLE_OP(PyCmp_GE, PyFloat_Type, PyFloat_Type, _PyLlvm_BinGe_Float);
+
+    // Cmpop int combined with float
+    INLINABLE_OP(PyCmp_LT, PyFloat_Type, PyInt_Type, _PyLlvm_BinLt_FloatInt);
+    INLINABLE_OP(PyCmp_LE, PyFloat_Type, PyInt_Type, _PyLlvm_BinLe_FloatInt);
+    INLINABLE_OP(PyCmp_EQ, PyFloat_Type, PyInt_Type, _PyLlvm_BinEq_FloatInt);
+    INLINABLE_OP(PyCmp_NE, PyFloat_Type, PyInt_Type, _PyLlvm_BinNe_FloatInt);
+    INLINABLE_OP(PyCmp_GT, PyFloat_Type, PyInt_Type, _PyLlvm_BinGt_FloatInt);
+    INLINABLE_OP(PyCmp_GE, PyFloat_Type, PyInt_Type, _PyLlvm_BinGe_FloatInt);
+    INLINABLE_OP(PyCmp_LT, PyInt_Type, PyFloat_Type, _PyLlvm_BinLt_IntFloat);
+    INLINABLE_OP(PyCmp_LE, PyInt_Type, PyFloat_Type, _PyLlvm_BinLe_IntFloat);
+    INLINABLE_OP(PyCmp_EQ, PyInt_Type, PyFloat_Type, _PyLlvm_BinEq_IntFloat);
+    INLINABLE_OP(PyCmp_NE, PyInt_Type, PyFloat_Type, _PyLlvm_BinNe_IntFloat);
+    INLINABLE_OP(PyCmp_GT, PyInt_Type, PyFloat_Type, _PyLlvm_BinGt_IntFloat);
+    INLINABLE_OP(PyCmp_GE, PyInt_Type, PyFloat_Type, _PyLlvm_BinGe_IntFloat);
+
+    // Cmpop Long specializations
+    INLINABLE_OP(PyCmp_LT, PyLong_Type, PyLong_Type, _PyLlvm_BinLt_Long);
+    INLINABLE_OP(PyCmp_LE, PyLong_Type, PyLong_Type, _PyLlvm_BinLe_Long);
+    INLINABLE_OP(PyCmp_EQ, PyLong_Type, PyLong_Type, _PyLlvm_BinEq_Long);
+    INLINABLE_OP(PyCmp_NE, PyLong_Type, PyLong_Type, _PyLlvm_BinNe_Long);
+    INLINABLE_OP(PyCmp_GT, PyLong_Type, PyLong_Type, _PyLlvm_BinGt_Long);
+    INLINABLE_OP(PyCmp_GE, PyLong_Type, PyLong_Type, _PyLlvm_BinGe_Long);
+
+    // Cmpop containment specializations; lhs is the item.
+    INLINABLE_OP(PyCmp_IN, PyString_Type, PyString_Type,
+                 _PyLlvm_Contains_Str);
+    INLINABLE_OP(PyCmp_NOT_IN, PyString_Type, PyString_Type,
+                 _PyLlvm_NotContains_Str);
+    INLINABLE_OP(PyCmp_IN, PyUnicode_Type, PyUnicode_Type,
+                 _PyLlvm_Contains_Unicode);
+    INLINABLE_OP(PyCmp_NOT_IN, PyUnicode_Type, PyUnicode_Type,
+                 _PyLlvm_NotContains_Unicode);
 
 #undef INLINABLE_OP
 
@@ -230,6 +326,12 @@ public:
     INLINABLE_OP_W(PyNumber_Remainder, PyUnicode_Type,
                  _PyLlvm_BinMod_Unicode);
 
+    // Unary operators have no rhs, so they're keyed like a wildcard.
+    INLINABLE_OP_W(PyNumber_Negative, PyInt_Type, _PyLlvm_UnaryNeg_Int);
+    INLINABLE_OP_W(PyNumber_Negative, PyFloat_Type, _PyLlvm_UnaryNeg_Float);
+    INLINABLE_OP_W(PyNumber_Negative, PyLong_Type, _PyLlvm_UnaryNeg_Long);
+    INLINABLE_OP_W(PyNumber_Invert, PyInt_Type, _PyLlvm_UnaryInvert_Int);
+
 #undef INLINEABLE_OP_W
 
     }
@@ -265,6 +367,12 @@ public:
     // range, for example).
     int Optimize(llvm::Function &f, int level);
 
+    // Runs the parts of the optimization passes' setup that need the GIL
+    // (they look up constants through the PyConstantMirror), so that the
+    // passes can run on the compiler thread without it.  Must be called
+    // with the GIL held, after construction.
+    void PrepareOptimizations();
+
     llvm::ExecutionEngine *getExecutionEngine() { return this->engine_; }
 
     // Use this accessor for the LLVMContext rather than
@@ -282,6 +390,36 @@ public:
     /// Can be used to add debug info to LLVM functions.
     llvm::DIFactory &DebugInfo() { return *this->debug_info_; }
 
+    // The queue feeding the background compiler thread.  See
+    // JIT/CompileQueue.h.
+    PyJitCompileQueue &compile_queue() const
+    {
+        return *this->compile_queue_;
+    }
+
+    // Remembers which code was compiled across process restarts.  See
+    // JIT/CodeCache.h.
+    PyJitCodeCache &code_cache() const
+    {
+        return *this->code_cache_;
+    }
+
+    // Caps the fraction of time spent compiling.  See JIT/CompileBudget.h.
+    PyJitCompileBudget &compile_budget() const
+    {
+        return *this->compile_budget_;
+    }
+
+    // Take and release the lock that serializes access to module_, engine_
+    // and the rest of the LLVM state.  See PyGlobalLlvmData_Lock() in
+    // global_llvm_data_fwd.h.
+    void LockLlvm();
+    void UnlockLlvm();
+
+    // Called in the child after a fork().  The compiler thread doesn't
+    // survive the fork, so this forgets about it and any queued work.
+    void AfterFork();
+
     // Runs globaldce to remove unreferenced global variables.
     // Globals still used in machine code must be referenced from IR or this
     // pass will delete them and crash.
@@ -360,6 +498,18 @@ private:
 
     llvm::OwningPtr<PyConstantMirror> constant_mirror_;
 
+    llvm::OwningPtr<PyJitCompileQueue> compile_queue_;
+
+    llvm::OwningPtr<PyJitCodeCache> code_cache_;
+
+    llvm::OwningPtr<PyJitCompileBudget> compile_budget_;
+
+    // See LockLlvm().  llvm_lock_owner_ is the thread ident of the current
+    // holder, or -1; it is only written by the holder.
+    PyThread_type_lock llvm_lock_;
+    volatile long llvm_lock_owner_;
+    unsigned llvm_lock_depth_;
+
     unsigned num_globals_after_last_gc_;
 
     // The MetadataKind we register our type information with
@@ -18,9 +18,16 @@ void PyGlobalLlvmData_Clear(struct PyGlobalLlvmData *);
 void PyGlobalLlvmData_Free(struct PyGlobalLlvmData *);
 
 #define Py_MIN_LLVM_OPT_LEVEL 0
+/* The cheap tier used for warm code; see PY_QUICK_HOTNESS_THRESHOLD. */
+#define Py_QUICK_JIT_OPT_LEVEL 1
 #define Py_DEFAULT_JIT_OPT_LEVEL 2
 #define Py_MAX_LLVM_OPT_LEVEL 3
 
+/* The passes above Py_QUICK_JIT_OPT_LEVEL take superlinear time in the size
+   of the function; functions with more lines of unoptimized IR than this
+   get the Py_QUICK_JIT_OPT_LEVEL pipeline instead. */
+#define Py_MAX_IR_SIZE_FOR_FULL_OPT 20000
+
 /* See global_llvm_data.h:PyGlobalLlvmData::Optimize for documentation. */
 PyAPI_FUNC(int) PyGlobalLlvmData_Optimize(struct PyGlobalLlvmData *,
                                           _LlvmFunction *, int);
@@ -28,6 +35,14 @@ PyAPI_FUNC(int) PyGlobalLlvmData_Optimize(struct PyGlobalLlvmData *,
 PyAPI_FUNC(void) PyGlobalLlvmData_CollectUnusedGlobals(
     struct PyGlobalLlvmData *);
 
+/* Serialize access to the LLVM module and ExecutionEngine.  The background
+   compiler thread (see JIT/CompileQueue.h) optimizes and emits machine code
+   without holding the GIL, so everything else that reads or modifies LLVM
+   state has to hold this lock too.  The lock is recursive.  If another
+   thread holds it, the GIL is released while waiting. */
+PyAPI_FUNC(void) PyGlobalLlvmData_Lock(struct PyGlobalLlvmData *);
+PyAPI_FUNC(void) PyGlobalLlvmData_Unlock(struct PyGlobalLlvmData *);
+
 /* Initializes LLVM and all of the LLVM wrapper types. */
 int _PyLlvm_Init(void);
 
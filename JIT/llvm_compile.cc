@@ -312,6 +312,179 @@ find_basic_blocks(PyObject *bytecode, py::LlvmFunctionBuilder &fbuilder,
     return 0;
 }
 
+// Finds the arithmetic opcodes whose result is stored straight into a local,
+// as in "total = total + x" or "i += 1", and records them in
+// fbuilder.accumulators().  If the local's old value is the left operand and
+// nothing else refers to it, OpcodeBinops can store the result in it instead
+// of allocating a new int or float on every trip around the loop.  That is
+// only safe if nothing can observe the local between the two opcodes, so the
+// STORE_FAST mustn't start a new block (which another path could reach) or a
+// new line (which could fire the line tracer).  Must be run after
+// find_basic_blocks and validate_bytecode.
+static void
+find_accumulators(PyCodeObject *code, py::LlvmFunctionBuilder &fbuilder,
+                  const std::vector<InstrInfo>& instr_info)
+{
+    PyBytecodeIterator iter(code->co_code);
+    for (; !iter.Done() && !iter.Error(); iter.Advance()) {
+        switch (iter.Opcode()) {
+        case BINARY_ADD:
+        case BINARY_SUBTRACT:
+        case BINARY_MULTIPLY:
+        case BINARY_DIVIDE:
+        case BINARY_MODULO:
+        case INPLACE_ADD:
+        case INPLACE_SUBTRACT:
+        case INPLACE_MULTIPLY:
+        case INPLACE_MODULO:
+            break;
+        default:
+            continue;
+        }
+        size_t next_index = iter.NextIndex();
+        if (next_index >= instr_info.size() ||
+            instr_info[next_index].block_ != NULL ||
+            instr_info[next_index].line_number_ !=
+            instr_info[iter.CurIndex()].line_number_) {
+            continue;
+        }
+        PyBytecodeIterator next(iter, next_index);
+        if (next.Opcode() == STORE_FAST) {
+            fbuilder.accumulators()[iter.CurIndex()] = next.Oparg();
+        }
+    }
+}
+
+// Rough per-instruction and per-jump costs, in lines of unoptimized IR.
+// Each opcode expands to a call or an inline fast path plus its error
+// checks; each jump adds the blocks on either side of it, and the
+// line-tracing and backedge bookkeeping that goes with them.  Malformed
+// bytecode is reported by _PyCode_ToLlvmIr(), not here.
+static const Py_ssize_t IR_LINES_PER_INSTRUCTION = 25;
+static const Py_ssize_t IR_LINES_PER_JUMP = 10;
+
+extern "C" Py_ssize_t
+_PyCode_EstimateIrSize(PyCodeObject *code)
+{
+    Py_ssize_t instructions = 0;
+    Py_ssize_t jumps = 0;
+    PyBytecodeIterator iter(code->co_code);
+    for (; !iter.Done() && !iter.Error(); iter.Advance()) {
+        ++instructions;
+        switch (iter.Opcode()) {
+            case JUMP_IF_FALSE_OR_POP:
+            case JUMP_IF_TRUE_OR_POP:
+            case JUMP_ABSOLUTE:
+            case POP_JUMP_IF_FALSE:
+            case POP_JUMP_IF_TRUE:
+            case CONTINUE_LOOP:
+            case FOR_ITER:
+            case JUMP_FORWARD:
+            case SETUP_LOOP:
+            case SETUP_EXCEPT:
+            case SETUP_FINALLY:
+                ++jumps;
+                break;
+        }
+    }
+    if (iter.Error())
+        PyErr_Clear();
+    return instructions * IR_LINES_PER_INSTRUCTION + jumps * IR_LINES_PER_JUMP;
+}
+
+// Returns true if code is a leaf whose machine code can run in a virtual
+// frame (see Include/frameobject.h).  A virtual frame isn't linked into
+// tstate->frame, so anything that runs Python code underneath it -- a call,
+// a property, an __add__ method, a __del__ -- would see the caller as its
+// parent in sys._getframe(), warnings and inspect.  So a leaf may only use
+// opcodes that can't run Python code at all, plus those fbuilder compiled in
+// a form that can't (see LlvmFunctionBuilder::MarkCannotRunPython()), where
+// a failed guard bails and the interpreter carries on in a real frame.
+// Storing to an argument could drop the last reference to an object the
+// caller passed in, so that rules out a leaf too.  Try blocks are out
+// because they save the caught exception in the frame (see set_exc_info()),
+// which only works for the frame in tstate->frame.  Call this after
+// generating the IR.
+static bool
+can_elide_frame(PyCodeObject *code, const py::LlvmFunctionBuilder &fbuilder)
+{
+    const int flags_required = CO_OPTIMIZED | CO_NEWLOCALS | CO_NOFREE;
+    if ((code->co_flags & (flags_required | CO_GENERATOR | CO_USES_EXEC)) !=
+        flags_required)
+        return false;
+    PyBytecodeIterator iter(code->co_code);
+    for (; !iter.Done() && !iter.Error(); iter.Advance()) {
+        switch (iter.Opcode()) {
+            case NOP:
+            case POP_TOP:
+            case ROT_TWO:
+            case ROT_THREE:
+            case ROT_FOUR:
+            case DUP_TOP:
+            case DUP_TOPX:
+            case LOAD_CONST:
+            case LOAD_FAST:
+            case LOAD_GLOBAL:
+            case BUILD_TUPLE:
+            case BUILD_LIST:
+            case JUMP_FORWARD:
+            case JUMP_ABSOLUTE:
+            case SETUP_LOOP:
+            case POP_BLOCK:
+            case BREAK_LOOP:
+            case RETURN_VALUE:
+                break;
+            case STORE_FAST:
+            case DELETE_FAST:
+                if (iter.Oparg() < code->co_argcount)
+                    return false;
+                break;
+            case COMPARE_OP:
+                if (iter.Oparg() == PyCmp_IS || iter.Oparg() == PyCmp_IS_NOT)
+                    break;
+                if (!fbuilder.CannotRunPython(iter.CurIndex()))
+                    return false;
+                break;
+            case LOAD_ATTR:
+            case BINARY_ADD:
+            case BINARY_SUBTRACT:
+            case BINARY_MULTIPLY:
+            case BINARY_DIVIDE:
+            case BINARY_TRUE_DIVIDE:
+            case BINARY_FLOOR_DIVIDE:
+            case BINARY_MODULO:
+            case BINARY_LSHIFT:
+            case BINARY_RSHIFT:
+            case BINARY_AND:
+            case BINARY_OR:
+            case BINARY_XOR:
+            case BINARY_SUBSCR:
+            case INPLACE_ADD:
+            case INPLACE_SUBTRACT:
+            case INPLACE_MULTIPLY:
+            case INPLACE_DIVIDE:
+            case INPLACE_TRUE_DIVIDE:
+            case INPLACE_FLOOR_DIVIDE:
+            case INPLACE_MODULO:
+            case INPLACE_LSHIFT:
+            case INPLACE_RSHIFT:
+            case INPLACE_AND:
+            case INPLACE_OR:
+            case INPLACE_XOR:
+                if (!fbuilder.CannotRunPython(iter.CurIndex()))
+                    return false;
+                break;
+            default:
+                return false;
+        }
+    }
+    if (iter.Error()) {
+        PyErr_Clear();
+        return false;
+    }
+    return true;
+}
+
 extern "C" _LlvmFunction *
 _PyCode_ToLlvmIr(PyCodeObject *code)
 {
@@ -348,6 +521,7 @@ _PyCode_ToLlvmIr(PyCodeObject *code)
     // This calculates the absolute stack offsets for each opcode.
     // Must be run after validate_bytecode.
     fbuilder.UpdateStackInfo();
+    find_accumulators(code, fbuilder, instr_info);
 
     py::PyBytecodeDispatch dispatch(&fbuilder);
     PyBytecodeIterator iter(code->co_code);
@@ -550,9 +724,12 @@ _PyCode_ToLlvmIr(PyCodeObject *code)
             fbuilder.FillBackedgeLanding(info.backedge_block_, info.block_,
                                          backedge_is_to_start_of_line,
                                          info.line_number_);
+            fbuilder.AddOsrEntry(i, info.block_);
         }
     }
 
+    fbuilder.LayOutColdBlocks();
+
     if (llvm::verifyFunction(*fbuilder.function(), llvm::PrintMessageAction)) {
         PyErr_SetString(PyExc_SystemError, "invalid LLVM IR produced");
         return NULL;
@@ -567,5 +744,7 @@ _PyCode_ToLlvmIr(PyCodeObject *code)
     // Make sure the function survives global optimizations.
     fbuilder.function()->setLinkage(llvm::GlobalValue::ExternalLinkage);
 
+    code->co_elide_frame = can_elide_frame(code, fbuilder);
+
     return _LlvmFunction_New(fbuilder.function());
 }
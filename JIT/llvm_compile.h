@@ -8,6 +8,16 @@ extern "C" {
 
 #ifdef WITH_LLVM
 PyAPI_FUNC(_LlvmFunction *) _PyCode_ToLlvmIr(PyCodeObject *code);
+
+/* Estimates how many lines of unoptimized LLVM IR _PyCode_ToLlvmIr() would
+   produce for code, from its instruction and jump counts, without building
+   any IR.  Optimization and codegen time grow with this number. */
+PyAPI_FUNC(Py_ssize_t) _PyCode_EstimateIrSize(PyCodeObject *code);
+
+/* Code objects whose estimated IR is bigger than this stay in the
+   interpreter; compiling them would stall the program for longer than the
+   machine code could pay back. */
+#define PY_MAX_ESTIMATED_IR_SIZE 50000
 #endif
 
 #ifdef __cplusplus
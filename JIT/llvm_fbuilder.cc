@@ -178,6 +178,7 @@ LlvmFunctionBuilder::LlvmFunctionBuilder(
                             llvm::DIType(),
                             false,   // Not local to unit.
                             true)),  // Is definition.
+      f_lasti_(-1),
       stack_info_(0),
       error_(false),
       is_generator_(code_object->co_flags & CO_GENERATOR),
@@ -198,6 +199,9 @@ LlvmFunctionBuilder::LlvmFunctionBuilder(
         this->state()->CreateBasicBlock("propagate_exception");
     this->unwind_block_ = this->state()->CreateBasicBlock("unwind_block");
     this->do_return_block_ = this->state()->CreateBasicBlock("do_return");
+    this->MarkCold(this->unreachable_block_);
+    this->MarkCold(this->bail_to_interpreter_block_);
+    this->MarkCold(this->propagate_exception_block_);
 
     this->builder_.SetInsertPoint(entry);
     // CreateAllocaInEntryBlock will insert alloca's here, before
@@ -234,6 +238,20 @@ LlvmFunctionBuilder::LlvmFunctionBuilder(
                 NULL,
                 "local_" + pystring_to_stringref(local_name)));
     }
+    for (int i = 0; i < PyTuple_GET_SIZE(code_object->co_cellvars); ++i) {
+        PyObject *cell_name = PyTuple_GET_ITEM(code_object->co_cellvars, i);
+        this->cell_contents_.push_back(
+            this->builder_.CreateAlloca(
+                PyTypeBuilder<PyObject*>::get(this->context_),
+                NULL,
+                "cell_" + pystring_to_stringref(cell_name)));
+    }
+    for (int i = 0; i < code_object->co_stacksize; ++i) {
+        this->stack_slots_.push_back(
+            this->builder_.CreateAlloca(
+                PyTypeBuilder<PyObject*>::get(this->context_),
+                NULL, "stack_slot"));
+    }
 
     this->tstate_ = this->state()->CreateCall(
             this->state()->GetGlobalFunction<PyThreadState*()>(
@@ -242,11 +260,31 @@ LlvmFunctionBuilder::LlvmFunctionBuilder(
         FrameTy::f_valuestack(this->builder_, this->frame_),
         "stack_bottom");
     this->llvm_data_->tbaa_stack.MarkInstruction(this->stack_bottom_);
+    Value *entry_lasti = NULL;
     if (this->is_generator_) {
         // When we're re-entering a generator, we have to copy the stack
-        // pointer, block stack and locals from the frame.
-        this->CopyFromFrameObject();
+        // pointer, block stack and locals from the frame.  Only the
+        // resume point knows how deep the stack is, so each yield's resume
+        // block reloads its own live slots (see YIELD_VALUE), as does each
+        // loop header's OSR entry (see AddOsrEntry()).
+        this->CopyFromFrameObject(0);
     } else {
+        // The interpreter may hand us a frame in the middle of a loop (see
+        // AddOsrEntry()); it leaves the loop header's index in f_lasti.
+        // Otherwise f_lasti is still -1 from PyFrame_New().
+        BasicBlock *start_function =
+            this->state()->CreateBasicBlock("start_function");
+        BasicBlock *osr_entry = this->state()->CreateBasicBlock("osr_entry");
+        BasicBlock *entered = this->state()->CreateBasicBlock("entered");
+        entry_lasti = this->builder_.CreateLoad(
+            FrameTy::f_lasti(this->builder_, this->frame_), "entry_lasti");
+        this->builder_.CreateCondBr(
+            this->builder_.CreateICmpEQ(
+                entry_lasti,
+                ConstantInt::getSigned(entry_lasti->getType(), -1)),
+            start_function, osr_entry);
+
+        this->builder_.SetInsertPoint(start_function);
         // If this isn't a generator, the stack pointer always starts at
         // the bottom of the stack.
         this->builder_.CreateStore(this->stack_bottom_,
@@ -261,7 +299,16 @@ LlvmFunctionBuilder::LlvmFunctionBuilder(
             this->num_blocks_addr_);
 
         // If this isn't a generator, we only need to copy the locals.
-        this->CopyLocalsFromFrameObject();
+        this->CopyLocalsFromFrameObject(false);
+        this->builder_.CreateBr(entered);
+
+        // Entering in the middle of the function looks just like resuming
+        // a generator.
+        this->builder_.SetInsertPoint(osr_entry);
+        this->CopyFromFrameObject(this->stack_slots_.size());
+        this->builder_.CreateBr(entered);
+
+        this->builder_.SetInsertPoint(entered);
     }
 
     Value *use_tracing = this->builder_.CreateLoad(
@@ -275,6 +322,11 @@ LlvmFunctionBuilder::LlvmFunctionBuilder(
                                 trace_enter_function, continue_entry);
 
     this->builder_.SetInsertPoint(trace_enter_function);
+    this->MarkCold(trace_enter_function);
+    // The bail block writes every stack slot back to the frame, so a
+    // generator has to pick up the ones it hasn't loaded yet.
+    if (this->is_generator_)
+        this->ReloadValueStack(0, this->stack_slots_.size());
     // Don't touch f_lasti since we just entered the function..
     this->builder_.CreateStore(
         ConstantInt::get(PyTypeBuilder<char>::get(this->context_),
@@ -287,6 +339,11 @@ LlvmFunctionBuilder::LlvmFunctionBuilder(
         FrameTy::f_code(this->builder_, this->frame_),
         "frame->f_code");
     this->use_jit_addr_ = CodeTy::co_use_jit(this->builder_, frame_code);
+    this->hotness_addr_ = NULL;
+    if (Py_JitControl == PY_JIT_WHENHOT &&
+        _PyCode_HOTNESS(this->code_object_) <= PY_HOTNESS_THRESHOLD) {
+        this->hotness_addr_ = CodeTy::co_hotness(this->builder_, frame_code);
+    }
 #ifndef NDEBUG
     // Assert that the code object we pull out of the frame is the
     // same as the one passed into this object.
@@ -319,6 +376,25 @@ LlvmFunctionBuilder::LlvmFunctionBuilder(
                                       this->code_object_->co_nlocals);
     this->freevars_ =
         this->builder_.CreateGEP(this->fastlocals_, nlocals, "freevars");
+    const int ncells = PyTuple_GET_SIZE(this->code_object_->co_cellvars) +
+        PyTuple_GET_SIZE(this->code_object_->co_freevars);
+    Function *cell_contents = this->state()->GetGlobalFunction<
+        PyObject *(PyObject *)>("_PyLlvm_Cell_Contents");
+    for (int i = 0; i < ncells; ++i) {
+        Value *cell = this->builder_.CreateLoad(
+            this->builder_.CreateGEP(
+                this->freevars_,
+                ConstantInt::get(Type::getInt32Ty(this->context_), i)),
+            "cell");
+        this->cells_.push_back(cell);
+        // This runs on every entry, including resuming a generator, so the
+        // mirrors never see a stale value.
+        if (i < (int)this->cell_contents_.size()) {
+            this->builder_.CreateStore(
+                this->state()->CreateCall(cell_contents, cell),
+                this->cell_contents_[i]);
+        }
+    }
     this->globals_ =
         this->builder_.CreateBitCast(
             this->builder_.CreateLoad(
@@ -350,6 +426,8 @@ LlvmFunctionBuilder::LlvmFunctionBuilder(
           propagate_generator_throw, continue_generator_or_start_func);
 
       this->builder_.SetInsertPoint(propagate_generator_throw);
+      // Unwinding pops whatever is on the frame's value stack.
+      this->ReloadValueStack(0, this->stack_slots_.size());
       PropagateException();
 
       this->builder_.SetInsertPoint(continue_generator_or_start_func);
@@ -359,16 +437,17 @@ LlvmFunctionBuilder::LlvmFunctionBuilder(
       // switch.  eval.cc just assigns the new IP, allowing wild jumps,
       // but LLVM won't let us do that so we default to jumping to the
       // unreachable block.
-      this->yield_resume_switch_ =
+      this->resume_switch_ =
           this->builder_.CreateSwitch(resume_block, this->unreachable_block_);
-
-      this->yield_resume_switch_->addCase(
-          ConstantInt::getSigned(PyTypeBuilder<int>::get(this->context_), -1),
-          start);
     } else {
-      // This function is not a generator, so we just jump to the start.
-      this->builder_.CreateBr(start);
+      // This function is not a generator, so we jump to the start unless
+      // we're entering at a loop header.
+      this->resume_switch_ =
+          this->builder_.CreateSwitch(entry_lasti, this->unreachable_block_);
     }
+    this->resume_switch_->addCase(
+        ConstantInt::getSigned(PyTypeBuilder<int>::get(this->context_), -1),
+        start);
 
     this->builder_.SetInsertPoint(this->unreachable_block_);
 #ifndef NDEBUG
@@ -396,6 +475,100 @@ LlvmFunctionBuilder::UpdateStackInfo()
         .resize(PyString_GET_SIZE(this->code_object_->co_code), -1);
     PyBytecodeIterator iter(this->code_object_->co_code);
     find_stack_top(iter, 0, this->stack_info_);
+    this->cannot_run_python_.assign(this->stack_info_.size(), false);
+
+    this->try_blocks_.assign(this->stack_info_.size(), TryBlock());
+    if (!this->FindTryBlocks(PyBytecodeIterator(this->code_object_->co_code),
+                             std::vector<TryBlock>()))
+        this->try_blocks_.clear();
+}
+
+bool
+LlvmFunctionBuilder::FindTryBlocks(const PyBytecodeIterator &start,
+                                   std::vector<TryBlock> blocks)
+{
+    // This follows the same paths as find_stack_top(), except that opcodes
+    // that always unwind end the path instead of falling through into
+    // dead code.
+    PyBytecodeIterator iter(start);
+    for (; !iter.Done() && !iter.Error(); iter.Advance()) {
+        TryBlock innermost;
+        for (size_t i = blocks.size(); i > 0; --i) {
+            if (blocks[i - 1].block_type != ::SETUP_LOOP) {
+                innermost = blocks[i - 1];
+                break;
+            }
+        }
+        innermost.num_blocks = blocks.size();
+        TryBlock &seen = this->try_blocks_[iter.CurIndex()];
+        if (seen.num_blocks >= 0) {
+            return seen.num_blocks == innermost.num_blocks &&
+                seen.handler_opindex == innermost.handler_opindex;
+        }
+        seen = innermost;
+
+        switch (iter.Opcode()) {
+        case RETURN_VALUE:
+        case RAISE_VARARGS_ZERO:
+        case RAISE_VARARGS_ONE:
+        case RAISE_VARARGS_TWO:
+        case RAISE_VARARGS_THREE:
+        case BREAK_LOOP:
+        case CONTINUE_LOOP:
+            return true;
+
+        case JUMP_IF_FALSE_OR_POP:
+        case JUMP_IF_TRUE_OR_POP:
+        case POP_JUMP_IF_FALSE:
+        case POP_JUMP_IF_TRUE:
+            if (!this->FindTryBlocks(PyBytecodeIterator(iter, iter.Oparg()),
+                                     blocks))
+                return false;
+            break;
+
+        case JUMP_ABSOLUTE:
+            return this->FindTryBlocks(PyBytecodeIterator(iter, iter.Oparg()),
+                                       blocks);
+
+        case JUMP_FORWARD:
+            return this->FindTryBlocks(
+                PyBytecodeIterator(iter, iter.NextIndex() + iter.Oparg()),
+                blocks);
+
+        case FOR_ITER:
+            if (!this->FindTryBlocks(
+                    PyBytecodeIterator(iter,
+                                       iter.NextIndex() + iter.Oparg()),
+                    blocks))
+                return false;
+            break;
+
+        case SETUP_LOOP:
+        case SETUP_EXCEPT:
+        case SETUP_FINALLY: {
+            TryBlock block;
+            block.handler_opindex = iter.NextIndex() + iter.Oparg();
+            block.block_type = iter.Opcode();
+            block.stack_level = this->stack_info_[iter.CurIndex()];
+            block.blocks_below = blocks.size();
+            // By the time the handler runs, its block is off the stack.
+            if (!this->FindTryBlocks(
+                    PyBytecodeIterator(iter, block.handler_opindex), blocks))
+                return false;
+            if (blocks.size() >= CO_MAXBLOCKS)
+                return false;
+            blocks.push_back(block);
+            break;
+        }
+
+        case POP_BLOCK:
+            if (blocks.empty())
+                return false;
+            blocks.pop_back();
+            break;
+        }
+    }
+    return !iter.Error();
 }
 
 void
@@ -407,6 +580,12 @@ LlvmFunctionBuilder::FillPropagateExceptionBlock()
     this->builder_.CreateStore(ConstantInt::get(Type::getInt8Ty(this->context_),
                                                 UNWIND_EXCEPTION),
                                this->unwind_reason_addr_);
+    this->AddTracebackEntry(this->unwind_block_);
+}
+
+void
+LlvmFunctionBuilder::AddTracebackEntry(BasicBlock *next)
+{
     this->state()->CreateCall(
         this->state()->GetGlobalFunction<int(PyFrameObject*)>(
             "PyTraceBack_Here"),
@@ -416,15 +595,16 @@ LlvmFunctionBuilder::FillPropagateExceptionBlock()
     Value *tracefunc = this->builder_.CreateLoad(
         ThreadStateTy::c_tracefunc(this->builder_, this->tstate_));
     this->builder_.CreateCondBr(this->state()->IsNull(tracefunc),
-                                this->unwind_block_, call_exc_trace);
+                                next, call_exc_trace);
 
     this->builder_.SetInsertPoint(call_exc_trace);
+    this->MarkCold(call_exc_trace);
     this->state()->CreateCall(
              this->state()->GetGlobalFunction<
                  void(PyThreadState *, PyFrameObject *)>(
             "_PyEval_CallExcTrace"),
         this->tstate_, this->frame_);
-    this->builder_.CreateBr(this->unwind_block_);
+    this->builder_.CreateBr(next);
 }
 
 void
@@ -586,17 +766,6 @@ LlvmFunctionBuilder::FillUnwindBlock()
                                     push_exception, unwind_loop_header);
 
         this->builder_.SetInsertPoint(push_exception);
-        // We need an alloca here so _PyLlvm_FastEnterExceptOrFinally
-        // can return into it.  This alloca _won't_ be optimized by
-        // mem2reg because its address is taken.
-        Value *exc_info = this->state()->CreateAllocaInEntryBlock(
-            PyTypeBuilder<PyExcInfo>::get(this->context_), NULL, "exc_info");
-        this->state()->CreateCall(
-            this->state()->GetGlobalFunction<void(PyExcInfo*, int)>(
-                "_PyLlvm_FastEnterExceptOrFinally"),
-            exc_info,
-            block_type);
-
         // We don't know for sure what the absolute stack position will be
         // after handling an exception. We store the exception in allocas,
         // the opcode implementation must take care to copy it on the stack.
@@ -612,22 +781,7 @@ LlvmFunctionBuilder::FillUnwindBlock()
             PyTypeBuilder<PyObject*>::get(this->context_),
             NULL,
             "exception_exc");
-
-        this->builder_.CreateStore(
-            this->builder_.CreateLoad(
-                this->builder_.CreateStructGEP(
-                    exc_info, PyTypeBuilder<PyExcInfo>::FIELD_TB)),
-            this->exception_tb_);
-        this->builder_.CreateStore(
-            this->builder_.CreateLoad(
-                this->builder_.CreateStructGEP(
-                    exc_info, PyTypeBuilder<PyExcInfo>::FIELD_VAL)),
-            this->exception_val_);
-        this->builder_.CreateStore(
-            this->builder_.CreateLoad(
-                this->builder_.CreateStructGEP(
-                    exc_info, PyTypeBuilder<PyExcInfo>::FIELD_EXC)),
-            this->exception_exc_);
+        this->EnterExceptOrFinally(block_type);
         this->builder_.CreateBr(goto_block_handler);
 
         this->builder_.SetInsertPoint(handle_finally);
@@ -804,9 +958,18 @@ LlvmFunctionBuilder::FillDoReturnBlock()
         this->state()->CreateBasicBlock("no_frame_exception");
     BasicBlock *finish_return =
         this->state()->CreateBasicBlock("finish_return");
+    BasicBlock *check_tstate_frame =
+        this->state()->CreateBasicBlock("check_tstate_frame");
     Value *tstate_frame = this->builder_.CreateLoad(
         ThreadStateTy::frame(this->builder_, this->tstate_),
         "tstate->frame");
+    // A virtual frame (see Include/frameobject.h) is never tstate->frame,
+    // and only runs code that can't catch exceptions.
+    this->builder_.CreateCondBr(
+        this->builder_.CreateICmpEQ(tstate_frame, this->frame_),
+        check_tstate_frame, finish_return);
+
+    this->builder_.SetInsertPoint(check_tstate_frame);
     Value *f_exc_type = this->builder_.CreateLoad(
         FrameTy::f_exc_type(this->builder_, tstate_frame),
         "tstate->frame->f_exc_type");
@@ -855,7 +1018,9 @@ LlvmFunctionBuilder::FillBailToInterpreterBlock()
         ConstantInt::get(PyTypeBuilder<int>::get(this->context_), 0),
         FrameTy::f_use_jit(this->builder_, this->frame_));
     // Fill the frame object with any information that was in allocas here.
-    this->CopyToFrameObject();
+    // We don't know how deep the stack is at the bail site, so write out
+    // every slot; the ones above the stack pointer are never read.
+    this->CopyToFrameObject(this->stack_slots_.size());
 
     // Tail-call back to the interpreter.  As of 2009-06-12 this isn't
     // codegen'ed as a tail call
@@ -877,10 +1042,94 @@ LlvmFunctionBuilder::GetBailBlock() const
 }
 
 llvm::BasicBlock *
-LlvmFunctionBuilder::GetExceptionBlock() const
+LlvmFunctionBuilder::GetExceptionBlock()
 {
-    // TODO(collinwinter): exception block chaining needs to change this.
-    return this->propagate_exception_block_;
+    // Only opcodes have a known block stack.  The generator entry code
+    // runs before the first one.
+    if (this->f_lasti_ < 0 || this->try_blocks_.empty())
+        return this->propagate_exception_block_;
+    const TryBlock &block = this->try_blocks_[this->f_lasti_];
+    if (block.num_blocks < 0 || block.handler_opindex < 0)
+        return this->propagate_exception_block_;
+
+    BasicBlock *&landing = this->exception_landings_[block.handler_opindex];
+    if (landing != NULL)
+        return landing;
+    // The SETUP_EXCEPT or SETUP_FINALLY registered its handler with the
+    // unwind switch; that's where the unwind loop would end up too.
+    unsigned handler_case = this->unwind_target_switch_->findCaseValue(
+        ConstantInt::get(Type::getInt32Ty(this->context_),
+                         block.handler_opindex));
+    if (handler_case == 0)
+        return this->propagate_exception_block_;
+    BasicBlock *handler =
+        this->unwind_target_switch_->getSuccessor(handler_case);
+
+    // Do what the unwind loop would do for this block, with everything
+    // it would look up in the block stack known up front.
+    BasicBlock *saved_block = this->builder_.GetInsertBlock();
+    BasicBlock::iterator saved_point = this->builder_.GetInsertPoint();
+
+    landing = this->state()->CreateBasicBlock("exception_landing");
+    BasicBlock *enter_handler =
+        this->state()->CreateBasicBlock("exception_landing_enter_handler");
+    this->builder_.SetInsertPoint(landing);
+    this->builder_.CreateStore(this->state()->GetNull<PyObject*>(),
+                               this->retval_addr_);
+    this->AddTracebackEntry(enter_handler);
+
+    this->builder_.SetInsertPoint(enter_handler);
+    // Any loops between the raise and this block just get popped.
+    this->PopAndDecrefTo(
+        this->builder_.CreateGEP(
+            this->stack_bottom_,
+            ConstantInt::get(Type::getInt32Ty(this->context_),
+                             block.stack_level)));
+    this->builder_.CreateStore(
+        ConstantInt::get(PyTypeBuilder<char>::get(this->context_),
+                         block.blocks_below),
+        this->num_blocks_addr_);
+    this->EnterExceptOrFinally(
+        ConstantInt::get(PyTypeBuilder<int>::get(this->context_),
+                         block.block_type));
+    this->builder_.CreateStore(
+        ConstantInt::get(Type::getInt8Ty(this->context_), UNWIND_NOUNWIND),
+        this->unwind_reason_addr_);
+    this->builder_.CreateBr(handler);
+
+    this->builder_.SetInsertPoint(saved_block, saved_point);
+    return landing;
+}
+
+void
+LlvmFunctionBuilder::EnterExceptOrFinally(Value *block_type)
+{
+    // We need an alloca here so _PyLlvm_FastEnterExceptOrFinally
+    // can return into it.  This alloca _won't_ be optimized by
+    // mem2reg because its address is taken.
+    Value *exc_info = this->state()->CreateAllocaInEntryBlock(
+        PyTypeBuilder<PyExcInfo>::get(this->context_), NULL, "exc_info");
+    this->state()->CreateCall(
+        this->state()->GetGlobalFunction<void(PyExcInfo*, int)>(
+            "_PyLlvm_FastEnterExceptOrFinally"),
+        exc_info,
+        block_type);
+
+    this->builder_.CreateStore(
+        this->builder_.CreateLoad(
+            this->builder_.CreateStructGEP(
+                exc_info, PyTypeBuilder<PyExcInfo>::FIELD_TB)),
+        this->exception_tb_);
+    this->builder_.CreateStore(
+        this->builder_.CreateLoad(
+            this->builder_.CreateStructGEP(
+                exc_info, PyTypeBuilder<PyExcInfo>::FIELD_VAL)),
+        this->exception_val_);
+    this->builder_.CreateStore(
+        this->builder_.CreateLoad(
+            this->builder_.CreateStructGEP(
+                exc_info, PyTypeBuilder<PyExcInfo>::FIELD_EXC)),
+        this->exception_exc_);
 }
 
 void
@@ -897,10 +1146,24 @@ LlvmFunctionBuilder::PushException()
 void
 LlvmFunctionBuilder::PopAndDecrefTo(Value *target_stack_pointer)
 {
+    BasicBlock *pop_start = this->state()->CreateBasicBlock("pop_start");
+    BasicBlock *flush_stack = this->state()->CreateBasicBlock("flush_stack");
     BasicBlock *pop_loop = this->state()->CreateBasicBlock("pop_loop");
     BasicBlock *pop_block = this->state()->CreateBasicBlock("pop_stack");
     BasicBlock *pop_done = this->state()->CreateBasicBlock("pop_done");
 
+    // PopRel() reads the frame's value stack, so write it out first, but
+    // only if there's anything to pop: returns and POP_BLOCK usually find
+    // the stack already at the target.
+    this->FallThroughTo(pop_start);
+    Value *start_pointer = this->builder_.CreateLoad(this->stack_pointer_addr_);
+    this->llvm_data_->tbaa_stack.MarkInstruction(start_pointer);
+    this->builder_.CreateCondBr(
+        this->builder_.CreateICmpULE(start_pointer, target_stack_pointer),
+        pop_done, flush_stack);
+
+    this->builder_.SetInsertPoint(flush_stack);
+    this->FlushValueStack(this->stack_slots_.size());
     this->FallThroughTo(pop_loop);
     Value *stack_pointer = this->builder_.CreateLoad(this->stack_pointer_addr_);
     this->llvm_data_->tbaa_stack.MarkInstruction(stack_pointer);
@@ -917,8 +1180,9 @@ LlvmFunctionBuilder::PopAndDecrefTo(Value *target_stack_pointer)
 }
 
 void
-LlvmFunctionBuilder::CopyToFrameObject()
+LlvmFunctionBuilder::CopyToFrameObject(int stack_depth)
 {
+    this->FlushValueStack(stack_depth);
     // Save the current stack pointer into the frame.
     // Note that locals are mirrored to the frame as they're modified.
     Value *stack_pointer = this->builder_.CreateLoad(this->stack_pointer_addr_);
@@ -934,7 +1198,7 @@ LlvmFunctionBuilder::CopyToFrameObject()
 }
 
 void
-LlvmFunctionBuilder::CopyFromFrameObject()
+LlvmFunctionBuilder::CopyFromFrameObject(int stack_depth)
 {
     Value *f_stacktop = FrameTy::f_stacktop(this->builder_, this->frame_);
     Value *stack_pointer =
@@ -953,7 +1217,47 @@ LlvmFunctionBuilder::CopyFromFrameObject()
             FrameTy::f_blockstack(this->builder_, this->frame_), 0),
         num_blocks);
 
-    this->CopyLocalsFromFrameObject();
+    this->ReloadValueStack(0, stack_depth);
+    this->CopyLocalsFromFrameObject(true);
+}
+
+void
+LlvmFunctionBuilder::FlushValueStack(int stack_depth)
+{
+    assert(stack_depth <= (int)this->stack_slots_.size() &&
+           "Flushing more of the value stack than the code object has");
+    for (int i = 0; i < stack_depth; ++i) {
+        Value *value = this->builder_.CreateLoad(this->stack_slots_[i]);
+        Value *frame_slot = this->builder_.CreateGEP(
+            this->stack_bottom_,
+            ConstantInt::get(Type::getInt32Ty(this->context_), i));
+        this->builder_.CreateStore(value, frame_slot);
+        this->llvm_data_->tbaa_stack.MarkInstruction(frame_slot);
+    }
+}
+
+void
+LlvmFunctionBuilder::ReloadValueStack(int begin, int end)
+{
+    assert(end <= (int)this->stack_slots_.size() &&
+           "Reloading more of the value stack than the code object has");
+    for (int i = begin; i < end; ++i) {
+        Value *frame_slot = this->builder_.CreateGEP(
+            this->stack_bottom_,
+            ConstantInt::get(Type::getInt32Ty(this->context_), i));
+        this->llvm_data_->tbaa_stack.MarkInstruction(frame_slot);
+        this->builder_.CreateStore(this->builder_.CreateLoad(frame_slot),
+                                   this->stack_slots_[i]);
+    }
+}
+
+Value *
+LlvmFunctionBuilder::MaterializeStack()
+{
+    this->FlushValueStack(this->stack_top_);
+    Value *stack_pointer = this->builder_.CreateLoad(this->stack_pointer_addr_);
+    this->llvm_data_->tbaa_stack.MarkInstruction(stack_pointer);
+    return stack_pointer;
 }
 
 int
@@ -966,16 +1270,17 @@ LlvmFunctionBuilder::GetParamCount() const
 
 
 // Rules for copying locals from the frame:
-// - If this is a generator, copy everything from the frame.
-// - If this is a regular function, only copy the function's parameters; these
-//   can never be NULL. Set all other locals to NULL explicitly. This gives
-//   LLVM's optimizers more information.
+// - If we're resuming a generator or entering in the middle of a loop
+//   (copy_all is true), copy everything from the frame.
+// - If we're starting a regular function, only copy the function's
+//   parameters; these can never be NULL. Set all other locals to NULL
+//   explicitly. This gives LLVM's optimizers more information.
 //
 // TODO(collinwinter): when LLVM's metadata supports it, mark all parameters
 // as "not-NULL" so that constant propagation can have more information to work
 // with.
 void
-LlvmFunctionBuilder::CopyLocalsFromFrameObject()
+LlvmFunctionBuilder::CopyLocalsFromFrameObject(bool copy_all)
 {
     const Type *int_type = Type::getInt32Ty(this->context_);
     Value *locals =
@@ -992,7 +1297,7 @@ LlvmFunctionBuilder::CopyLocalsFromFrameObject()
         PyObject *pyname =
             PyTuple_GET_ITEM(this->code_object_->co_varnames, i);
 
-        if (this->is_generator_ || i < param_count) {
+        if (copy_all || i < param_count) {
             Value *local_slot = this->builder_.CreateLoad(
                 this->builder_.CreateGEP(
                     locals, ConstantInt::get(int_type, i)),
@@ -1044,6 +1349,14 @@ LlvmFunctionBuilder::FillBackedgeLanding(BasicBlock *backedge_landing,
     }
 
     this->builder_.SetInsertPoint(backedge_landing);
+    if (this->hotness_addr_ != NULL) {
+        Value *hotness = this->builder_.CreateLoad(this->hotness_addr_,
+                                                   "co_hotness");
+        this->builder_.CreateStore(
+            this->builder_.CreateAdd(
+                hotness, ConstantInt::get(hotness->getType(), 1)),
+            this->hotness_addr_);
+    }
     this->CheckPyTicker(continue_backedge);
 
     if (!to_start_of_line) {
@@ -1067,29 +1380,23 @@ void
 LlvmFunctionBuilder::MaybeCallLineTrace(BasicBlock *fallthrough_block,
                                         char direction)
 {
-    BasicBlock *call_trace = this->state()->CreateBasicBlock("call_trace");
-
     Value *tracing_possible = this->builder_.CreateLoad(
         this->GET_GLOBAL_VARIABLE(int, _Py_TracingPossible));
     this->builder_.CreateCondBr(this->state()->IsNonZero(tracing_possible),
-                                call_trace, fallthrough_block);
-
-    this->builder_.SetInsertPoint(call_trace);
-    this->CreateBailPoint(direction);
+                                this->GetBailPointBlock(this->f_lasti_,
+                                                        direction),
+                                fallthrough_block);
 }
 
 void
 LlvmFunctionBuilder::BailIfProfiling(llvm::BasicBlock *fallthrough_block)
 {
-    BasicBlock *profiling = this->state()->CreateBasicBlock("profiling");
-
     Value *profiling_possible = this->builder_.CreateLoad(
         this->GET_GLOBAL_VARIABLE(int, _Py_ProfilingPossible));
     this->builder_.CreateCondBr(this->state()->IsNonZero(profiling_possible),
-                                profiling, fallthrough_block);
-
-    this->builder_.SetInsertPoint(profiling);
-    this->CreateBailPoint(_PYFRAME_CALL_PROFILE);
+                                this->GetBailPointBlock(this->f_lasti_,
+                                                        _PYFRAME_CALL_PROFILE),
+                                fallthrough_block);
 }
 
 void
@@ -1161,6 +1468,21 @@ LlvmFunctionBuilder::GetTypeFeedback(unsigned arg_index) const
     return (PyTypeObject*)types[0];
 }
 
+const PyTypeObject *
+LlvmFunctionBuilder::GetDominantTypeFeedback(unsigned arg_index) const
+{
+    const PyRuntimeFeedback *feedback = this->GetFeedback(arg_index);
+    if (feedback == NULL || !feedback->ObjectsOverflowed())
+        return NULL;
+
+    llvm::SmallVector<PyObject*, 3> types;
+    feedback->GetDominantObjectsInto(types, 1);
+    if (types.empty() || !PyType_CheckExact(types[0]))
+        return NULL;
+
+    return (PyTypeObject*)types[0];
+}
+
 const PyRuntimeFeedback *
 LlvmFunctionBuilder::GetFeedback(unsigned arg_index) const
 {
@@ -1170,9 +1492,35 @@ LlvmFunctionBuilder::GetFeedback(unsigned arg_index) const
     return map->GetFeedbackEntry(this->f_lasti_, arg_index);
 }
 
-void
-LlvmFunctionBuilder::CreateBailPoint(unsigned bail_idx, char reason)
+BasicBlock *
+LlvmFunctionBuilder::GetBailPointBlock(unsigned bail_idx, char reason,
+                                       int guard_type)
 {
+#ifndef Py_WITH_INSTRUMENTATION
+    // Only instrumented builds record the guard type, so don't split the
+    // stubs on it otherwise.
+    guard_type = -1;
+#endif
+    BailPointKey key(bail_idx, std::make_pair(reason, guard_type));
+    std::map<BailPointKey, BasicBlock*>::iterator it =
+        this->bail_points_.find(key);
+    if (it != this->bail_points_.end())
+        return it->second;
+
+    BasicBlock *bail_point = this->state()->CreateBasicBlock("bail_point");
+    this->bail_points_[key] = bail_point;
+    this->MarkCold(bail_point);
+
+    BasicBlock *current = this->builder_.GetInsertBlock();
+    this->builder_.SetInsertPoint(bail_point);
+#ifdef Py_WITH_INSTRUMENTATION
+    if (guard_type >= 0) {
+        this->builder_.CreateStore(
+            ConstantInt::get(PyTypeBuilder<char>::get(this->context_),
+                             guard_type),
+            FrameTy::f_guard_type(this->builder_, this->frame_));
+    }
+#endif
     this->builder_.CreateStore(
         // -1 so that next_instr gets set right in EvalFrame.
         this->state()->GetSigned<int>(bail_idx - 1),
@@ -1181,17 +1529,24 @@ LlvmFunctionBuilder::CreateBailPoint(unsigned bail_idx, char reason)
         ConstantInt::get(PyTypeBuilder<char>::get(this->context_), reason),
         FrameTy::f_bailed_from_llvm(this->builder_, this->frame_));
     this->builder_.CreateBr(this->GetBailBlock());
+
+    this->builder_.SetInsertPoint(current);
+    return bail_point;
+}
+
+void
+LlvmFunctionBuilder::CreateBailPoint(unsigned bail_idx, char reason)
+{
+    this->MarkCold(this->builder_.GetInsertBlock());
+    this->builder_.CreateBr(this->GetBailPointBlock(bail_idx, reason));
 }
 
 void
 LlvmFunctionBuilder::CreateGuardBailPoint(unsigned bail_idx, char reason)
 {
-#ifdef Py_WITH_INSTRUMENTATION
-    this->builder_.CreateStore(
-        ConstantInt::get(PyTypeBuilder<char>::get(this->context_), reason),
-        FrameTy::f_guard_type(this->builder_, this->frame_));
-#endif
-    this->CreateBailPoint(bail_idx, _PYFRAME_GUARD_FAIL);
+    this->MarkCold(this->builder_.GetInsertBlock());
+    this->builder_.CreateBr(
+        this->GetBailPointBlock(bail_idx, _PYFRAME_GUARD_FAIL, reason));
 }
 
 void
@@ -1203,12 +1558,8 @@ LlvmFunctionBuilder::Push(Value *value)
         stack_pointer, ConstantInt::get(Type::getInt32Ty(this->context_), 1));
     this->llvm_data_->tbaa_stack.MarkInstruction(stack_pointer);
     this->builder_.CreateStore(new_stack_pointer, this->stack_pointer_addr_);
-    
-    Value *from_bottom = this->builder_.CreateGEP(
-        this->stack_bottom_,
-        ConstantInt::get(Type::getInt32Ty(this->context_), this->stack_top_));
-    this->builder_.CreateStore(value, from_bottom);
-    this->llvm_data_->tbaa_stack.MarkInstruction(from_bottom);
+
+    this->builder_.CreateStore(value, this->GetStackSlot(this->stack_top_));
     ++this->stack_top_;
 }
 
@@ -1224,12 +1575,15 @@ LlvmFunctionBuilder::Pop()
     this->builder_.CreateStore(new_stack_pointer, this->stack_pointer_addr_);
 
     --this->stack_top_;
-    Value *from_bottom = this->builder_.CreateGEP(
-        this->stack_bottom_,
-        ConstantInt::get(Type::getInt32Ty(this->context_), this->stack_top_));
+    return this->builder_.CreateLoad(this->GetStackSlot(this->stack_top_));
+}
 
-    Value *former_top = this->builder_.CreateLoad(from_bottom);
-    return former_top;
+Value *
+LlvmFunctionBuilder::GetStackSlot(int i) const
+{
+    assert(i >= 0 && i < (int)this->stack_slots_.size() &&
+           "Value stack index out of range");
+    return this->stack_slots_[i];
 }
 
 Value *
@@ -1301,12 +1655,7 @@ LlvmFunctionBuilder::BeginOpcodeImpl()
 Value *
 LlvmFunctionBuilder::GetOpcodeArg(int i)
 {
-    Value *from_bottom = this->builder_.CreateGEP(
-        this->stack_bottom_,
-        ConstantInt::get(Type::getInt32Ty(this->context_),
-                         this->stack_top_ + i));
-    this->llvm_data_->tbaa_stack.MarkInstruction(from_bottom);
-    return this->builder_.CreateLoad(from_bottom);
+    return this->builder_.CreateLoad(this->GetStackSlot(this->stack_top_ + i));
 }
 
 void
@@ -1321,12 +1670,7 @@ LlvmFunctionBuilder::SetOpcodeResult(int i, llvm::Value *value)
     this->llvm_data_->tbaa_stack.MarkInstruction(new_stack_pointer);
     this->builder_.CreateStore(new_stack_pointer, this->stack_pointer_addr_);
 
-    Value *from_bottom = this->builder_.CreateGEP(
-        this->stack_bottom_,
-        ConstantInt::get(Type::getInt32Ty(this->context_),
-                         this->stack_top_ + i));
-    this->builder_.CreateStore(value, from_bottom);
-    this->llvm_data_->tbaa_stack.MarkInstruction(from_bottom);
+    this->builder_.CreateStore(value, this->GetStackSlot(this->stack_top_ + i));
 }
 
 void
@@ -1368,49 +1712,30 @@ LlvmFunctionBuilder::CreateRet(llvm::Value *retval)
 void
 LlvmFunctionBuilder::PropagateExceptionOnNull(Value *value)
 {
-    BasicBlock *propagate =
-        this->state()->CreateBasicBlock("PropagateExceptionOnNull_propagate");
     BasicBlock *pass =
         this->state()->CreateBasicBlock("PropagateExceptionOnNull_pass");
-    this->builder_.CreateCondBr(this->state()->IsNull(value), propagate, pass);
-
-    this->builder_.SetInsertPoint(propagate);
-    this->PropagateException();
-
+    this->builder_.CreateCondBr(this->state()->IsNull(value),
+                                this->GetExceptionBlock(), pass);
     this->builder_.SetInsertPoint(pass);
 }
 
 void
 LlvmFunctionBuilder::PropagateExceptionOnNegative(Value *value)
 {
-    BasicBlock *propagate =
-        this->state()->CreateBasicBlock(
-            "PropagateExceptionOnNegative_propagate");
     BasicBlock *pass =
         this->state()->CreateBasicBlock("PropagateExceptionOnNegative_pass");
     this->builder_.CreateCondBr(this->state()->IsNegative(value),
-                                propagate, pass);
-
-    this->builder_.SetInsertPoint(propagate);
-    this->PropagateException();
-
+                                this->GetExceptionBlock(), pass);
     this->builder_.SetInsertPoint(pass);
 }
 
 void
 LlvmFunctionBuilder::PropagateExceptionOnNonZero(Value *value)
 {
-    BasicBlock *propagate =
-        this->state()->CreateBasicBlock(
-            "PropagateExceptionOnNonZero_propagate");
     BasicBlock *pass =
         this->state()->CreateBasicBlock("PropagateExceptionOnNonZero_pass");
     this->builder_.CreateCondBr(this->state()->IsNonZero(value),
-                                propagate, pass);
-
-    this->builder_.SetInsertPoint(propagate);
-    this->PropagateException();
-
+                                this->GetExceptionBlock(), pass);
     this->builder_.SetInsertPoint(pass);
 }
 
@@ -1426,7 +1751,7 @@ LlvmFunctionBuilder::LookupName(int name_index)
 }
 
 llvm::Value *
-LlvmFunctionBuilder::IsPythonTrue(Value *value)
+LlvmFunctionBuilder::IsPythonTrue(Value *value, bool expect_bool)
 {
     BasicBlock *not_py_true =
         this->state()->CreateBasicBlock("IsPythonTrue_is_not_PyTrue");
@@ -1456,12 +1781,16 @@ LlvmFunctionBuilder::IsPythonTrue(Value *value)
     this->builder_.CreateCondBr(is_not_PyFalse, not_py_false, decref_value);
 
     this->builder_.SetInsertPoint(not_py_false);
+    if (expect_bool)
+        this->MarkCold(not_py_false);
     Function *pyobject_istrue =
         this->state()->GetGlobalFunction<int(PyObject *)>("PyObject_IsTrue");
     Value *istrue_result = this->state()->CreateCall(
         pyobject_istrue, value, "PyObject_IsTrue_result");
     this->state()->DecRef(value);
     this->PropagateExceptionOnNegative(istrue_result);
+    if (expect_bool)
+        this->MarkCold(this->builder_.GetInsertBlock());
     this->builder_.CreateStore(
         this->state()->IsPositive(istrue_result),
         result_addr);
@@ -1485,6 +1814,14 @@ void
 LlvmFunctionBuilder::WatchDict(int reason)
 {
     this->uses_watched_dicts_.set(reason);
+    this->uses_whole_dicts_.set(reason);
+}
+
+void
+LlvmFunctionBuilder::WatchDictKey(int reason, PyObject *key)
+{
+    this->uses_watched_dicts_.set(reason);
+    this->watched_keys_[reason].insert(key);
 }
 
 
@@ -1500,7 +1837,82 @@ void
 LlvmFunctionBuilder::AddYieldResumeBB(llvm::ConstantInt *number,
                                       llvm::BasicBlock *block)
 {
-    this->yield_resume_switch_->addCase(number, block);
+    this->resume_switch_->addCase(number, block);
+}
+
+void
+LlvmFunctionBuilder::AddOsrEntry(int loop_header_index,
+                                 llvm::BasicBlock *block)
+{
+    ConstantInt *index = ConstantInt::getSigned(
+        PyTypeBuilder<int>::get(this->context_), loop_header_index);
+    // A loop header can't also be a yield, but don't let a bad guess about
+    // that turn into invalid IR.
+    if (this->resume_switch_->findCaseValue(index) != 0)
+        return;
+    if (this->is_generator_) {
+        // A generator's entry block doesn't reload the value stack (see
+        // YIELD_VALUE), so pick up whatever is live at the loop header,
+        // such as FOR_ITER's iterator, before jumping into the loop.
+        BasicBlock *saved_block = this->builder_.GetInsertBlock();
+        BasicBlock::iterator saved_point = this->builder_.GetInsertPoint();
+        BasicBlock *reload = this->state()->CreateBasicBlock("osr_reload");
+        this->builder_.SetInsertPoint(reload);
+        this->ReloadValueStack(0, this->stack_info_[loop_header_index]);
+        this->builder_.CreateBr(block);
+        this->builder_.SetInsertPoint(saved_block, saved_point);
+        block = reload;
+    }
+    this->resume_switch_->addCase(index, block);
+}
+
+int
+LlvmFunctionBuilder::SetWatchedKeys(ReasonWatched reason)
+{
+    // Only changes to the keys we embedded values for need to invalidate
+    // the machine code; a module that keeps rebinding one global shouldn't
+    // knock every other function in it back to the interpreter.
+    if (this->uses_whole_dicts_.test(reason)) {
+        return _PyCode_SetWatchedKeys(this->code_object_, reason, NULL);
+    }
+    PyObject *keys = PyDict_New();
+    if (keys == NULL) {
+        return -1;
+    }
+    typedef llvm::SmallPtrSet<PyObject*, 8> KeySet;
+    const KeySet &watched = this->watched_keys_[reason];
+    for (KeySet::const_iterator i = watched.begin(), e = watched.end();
+         i != e; ++i) {
+        if (PyDict_SetItem(keys, *i, Py_None) < 0) {
+            Py_DECREF(keys);
+            return -1;
+        }
+    }
+    return _PyCode_SetWatchedKeys(this->code_object_, reason, keys);
+}
+
+void
+LlvmFunctionBuilder::MarkCold(BasicBlock *block)
+{
+    if (block != &this->function_->getEntryBlock())
+        this->cold_blocks_.push_back(block);
+}
+
+void
+LlvmFunctionBuilder::LayOutColdBlocks()
+{
+    // Without branch probabilities, LLVM's code generator lays blocks out
+    // in the order they appear in the function.  Moving the cold ones to
+    // the end keeps each opcode's fast path next to the one that follows
+    // it instead of interleaved with its error handling.
+    BasicBlock *entry = &this->function_->getEntryBlock();
+    for (std::vector<BasicBlock*>::const_iterator
+             i = this->cold_blocks_.begin(), e = this->cold_blocks_.end();
+         i != e; ++i) {
+        BasicBlock *last = &this->function_->back();
+        if (*i != entry && *i != last)
+            (*i)->moveAfter(last);
+    }
 }
 
 int
@@ -1514,6 +1926,9 @@ LlvmFunctionBuilder::FinishFunction()
             if (!this->uses_watched_dicts_.test(i)) {
                 _PyCode_IgnoreDict(code, (ReasonWatched)i);
             }
+            else if (this->SetWatchedKeys((ReasonWatched)i) < 0) {
+                return -1;
+            }
         }
     }
 
@@ -11,6 +11,7 @@
 #include "JIT/PyTypeBuilder.h"
 #include "JIT/RuntimeFeedback.h"
 #include "Util/EventTimer.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SparseBitVector.h"
 #include "llvm/ADT/Twine.h"
@@ -23,8 +24,12 @@
 #include "llvm/Support/TargetFolder.h"
 
 #include <bitset>
+#include <map>
 #include <string>
+#include <utility>
+#include <vector>
 
+class PyBytecodeIterator;
 struct PyCodeObject;
 struct PyGlobalLlvmData;
 
@@ -50,6 +55,23 @@ public:
     llvm::LLVMContext& context() { return this->context_; } 
     bool &uses_delete_fast() { return this->uses_delete_fast_; }
     std::vector<bool> &loads_optimized() { return this->loads_optimized_; }
+    /// Maps the index of each arithmetic opcode whose result goes straight
+    /// into a local to that local's index.  See find_accumulators() in
+    /// llvm_compile.cc.
+    llvm::DenseMap<int, int> &accumulators() { return this->accumulators_; }
+
+    /// Records that the current opcode, as compiled, can't run Python code:
+    /// it was specialized for builtin types, and a failed guard bails rather
+    /// than falling back to the generic operation.  See
+    /// can_elide_frame() in llvm_compile.cc.
+    void MarkCannotRunPython()
+    {
+        this->cannot_run_python_[this->f_lasti_] = true;
+    }
+    bool CannotRunPython(int opindex) const
+    {
+        return this->cannot_run_python_[opindex];
+    }
 
     llvm::BasicBlock *unreachable_block() const
     { 
@@ -92,6 +114,17 @@ public:
     bool is_generator() const { return this->is_generator_; }
 
     llvm::Value *GetLocal(int i) const { return this->locals_[i]; }
+    /// Returns the cell object for the i'th entry of the frame's
+    /// freevars (cell variables first, then free variables).
+    llvm::Value *GetCell(int i) const { return this->cells_[i]; }
+    /// Returns the alloca mirroring the contents of the i'th cell, or NULL
+    /// if i names a free variable, whose cell someone else may write.
+    llvm::Value *GetCellContents(int i) const
+    {
+        if (i < (int)this->cell_contents_.size())
+            return this->cell_contents_[i];
+        return NULL;
+    }
 
     void UpdateStackInfo();
     bool Error() { return this->error_; }
@@ -113,8 +146,9 @@ public:
     /// backedge needs to check if it needs to handle signals or
     /// switch threads.  If the backedge doesn't land at the start of
     /// a line, it also needs to update the line number and check
-    /// whether line tracing has been turned on.  This function leaves
-    /// the insert point in a block with a terminator already added,
+    /// whether line tracing has been turned on.  Quick-tier code also
+    /// bumps co_hotness here, like the interpreter does.  This function
+    /// leaves the insert point in a block with a terminator already added,
     /// so the caller should re-set the insert point.
     void FillBackedgeLanding(llvm::BasicBlock *backedge_landing,
                              llvm::BasicBlock *target,
@@ -126,6 +160,16 @@ public:
     /// have a terminator instruction.
     void FallThroughTo(llvm::BasicBlock *next_block);
 
+    /// Records that block only runs on the way out of the fast path: a
+    /// bail to the interpreter, exception propagation, or a branch the
+    /// runtime feedback says is never taken.  The entry block is never cold.
+    void MarkCold(llvm::BasicBlock *block);
+
+    /// Moves every block passed to MarkCold() to the end of the function,
+    /// so the code generator emits the hot path contiguously and the
+    /// cold stubs after it.  Call once all the code has been emitted.
+    void LayOutColdBlocks();
+
     /// Register callbacks that might invalidate native code based on the
     /// optimizations performed in the generated code.
     int FinishFunction();
@@ -176,17 +220,33 @@ public:
     /// until it gets there, decref'ing as it goes.
     void PopAndDecrefTo(llvm::Value *target_stack_pointer);
 
-    /// The PyFrameObject holds several values, like the block stack
-    /// and stack pointer, that we store in allocas inside this
-    /// function.  When we suspend or resume a generator, or bail out
+    /// The PyFrameObject holds several values, like the block stack,
+    /// stack pointer and value stack, that we store in allocas inside
+    /// this function.  When we suspend or resume a generator, or bail out
     /// to the interpreter, we need to transfer those values between
-    /// the frame and the allocas.
-    void CopyToFrameObject();
-    void CopyFromFrameObject();
+    /// the frame and the allocas.  Both only move the bottom stack_depth
+    /// entries of the value stack; the rest are dead at that point.
+    void CopyToFrameObject(int stack_depth);
+    void CopyFromFrameObject(int stack_depth);
+
+    /// The value stack lives in one alloca per slot, which mem2reg turns
+    /// into SSA values, so pushes and pops never touch the frame.  Code
+    /// that reads the frame's stack through a stack pointer -- runtime
+    /// calls, the unwinder, bails and yields -- needs it written out
+    /// first.  FlushValueStack() copies slots [0, stack_depth) into
+    /// frame->f_valuestack; ReloadValueStack() copies [begin, end) back
+    /// after the runtime has written to it.
+    void FlushValueStack(int stack_depth);
+    void ReloadValueStack(int begin, int end);
+
+    /// Flushes the current value stack and returns the stack pointer, for
+    /// runtime functions that take their arguments off the frame's stack.
+    llvm::Value *MaterializeStack();
 
     /// We copy the function's locals into an LLVM alloca so that LLVM can
-    /// better reason about them.
-    void CopyLocalsFromFrameObject();
+    /// better reason about them.  If copy_all is false, only the
+    /// parameters are copied and the other locals start out NULL.
+    void CopyLocalsFromFrameObject(bool copy_all);
 
     /// Returns the difference between the current stack pointer and
     /// the base of the stack.
@@ -200,6 +260,11 @@ public:
     }
     const PyRuntimeFeedback *GetFeedback(unsigned arg_index) const;
     const PyTypeObject *GetTypeFeedback(unsigned arg_index) const;
+    /// For sites whose type feedback overflowed: returns the type they see
+    /// most often if it is dominant (see PyFeedbackHistogram), or NULL.
+    /// Code specialized on this type should fall back to a generic path,
+    /// not bail, when the type doesn't match.
+    const PyTypeObject *GetDominantTypeFeedback(unsigned arg_index) const;
 
     // Look up a name in the function's names list, returning the
     // PyStringObject for the name_index.
@@ -221,8 +286,10 @@ public:
     llvm::ReturnInst *CreateRet(llvm::Value *retval);
 
     // Returns an i1, true if value is a PyObject considered true.
-    // Steals the reference to value.
-    llvm::Value *IsPythonTrue(llvm::Value *value);
+    // Steals the reference to value.  If expect_bool is true, the call to
+    // PyObject_IsTrue() for values other than True and False is laid out
+    // with the cold blocks.
+    llvm::Value *IsPythonTrue(llvm::Value *value, bool expect_bool = false);
 
     /// During stack unwinding it may be necessary to jump back into
     /// the function to handle a finally or except block.  Since LLVM
@@ -241,13 +308,15 @@ public:
     // appropriate unwind reason set.
     void PropagateException();
 
-    // Set up a block preceding the bail-to-interpreter block.
+    // Ends the current block with a branch to the bail-to-interpreter
+    // block, resuming at bail_idx.  The current block is marked cold.
     void CreateBailPoint(unsigned bail_idx, char reason);
     void CreateBailPoint(char reason) {
         CreateBailPoint(this->f_lasti_, reason);
     }
 
-    // Set up a block preceding the bail-to-interpreter block.
+    // Like CreateBailPoint(bail_idx, _PYFRAME_GUARD_FAIL), but also
+    // records which kind of guard failed for instrumented builds.
     void CreateGuardBailPoint(unsigned bail_idx, char reason);
     void CreateGuardBailPoint(char reason) {
         CreateGuardBailPoint(this->f_lasti_, reason);
@@ -268,6 +337,14 @@ public:
     void FillPropagateExceptionBlock();
     // Only for use in the constructor: Fills in the unwind block.
     void FillUnwindBlock();
+    // Adds the current frame to the traceback of the exception being
+    // raised, calls the tracer's exception hook if there is one, and
+    // branches to next.
+    void AddTracebackEntry(llvm::BasicBlock *next);
+    // Fetches the current exception into exception_tb_, exception_val_ and
+    // exception_exc_ for an except or finally handler, the way
+    // fast_block_end in PyEval_EvalFrame() does.
+    void EnterExceptOrFinally(llvm::Value *block_type);
     // Only for use in the constructor: Fills in the block that
     // actually handles returning from the function.
     void FillDoReturnBlock();
@@ -299,15 +376,31 @@ public:
     /// interpreter.
     llvm::BasicBlock *GetBailBlock() const;
 
+    /// Returns a cold block that sets frame->f_lasti and
+    /// frame->f_bailed_from_llvm for a bail at bail_idx and then jumps to
+    /// GetBailBlock().  All bails with the same index and reason share one
+    /// block, so each guard adds only a conditional branch to the hot path.
+    /// guard_type is the _PYGUARD_* constant for guard failures, or -1.
+    llvm::BasicBlock *GetBailPointBlock(unsigned bail_idx, char reason,
+                                        int guard_type = -1);
+
     /// Return the BasicBlock we should jump to in order to handle a Python
-    /// exception.
-    llvm::BasicBlock *GetExceptionBlock() const;
+    /// exception.  Inside an except or finally block whose extent we know
+    /// at compile time, this is a landing pad that goes straight to the
+    /// block's handler; otherwise it's the start of the unwind loop.
+    llvm::BasicBlock *GetExceptionBlock();
     void PushException();
 
     // Add a Type to the watch list.
     void WatchType(PyTypeObject *type);
 
+    // Makes the machine code depend on every key of the dict the code object
+    // watches for reason: any change to that dict invalidates it.
     void WatchDict(int reason);
+    // Makes the machine code depend on just one key of the dict the code
+    // object watches for reason, so that changes to other keys leave it
+    // valid.  key must outlive this builder; names from co_names do.
+    void WatchDictKey(int reason, PyObject *key);
 
     // Return a i1 which is true when the use_jit field is set in the
     // code object
@@ -315,11 +408,29 @@ public:
 
     void AddYieldResumeBB(llvm::ConstantInt *number, llvm::BasicBlock *block);
 
+    /// Lets the interpreter transfer a running frame into this function at
+    /// the loop header with opcode index loop_header_index (on-stack
+    /// replacement).  The interpreter stores the stack pointer and block
+    /// stack into the frame, as for a suspended generator, and sets f_lasti
+    /// to loop_header_index; we then copy the frame's state into our allocas
+    /// and jump to block.  Generators reload the loop header's live stack
+    /// slots on the way, since their entry block leaves that to each resume
+    /// point.
+    void AddOsrEntry(int loop_header_index, llvm::BasicBlock *block);
+
 private:
+    // Returns the alloca holding entry i of the value stack.
+    llvm::Value *GetStackSlot(int i) const;
+
     // Stack pointer relative push and pop methods are for internal
-    // use only.
+    // use only.  PopRel() reads the frame's copy of the stack.
     llvm::Value *PopRel();
 
+    // Tells the code object which keys of the dict it watches for reason
+    // the machine code depends on.  Returns -1 with a Python exception set
+    // on failure.
+    int SetWatchedKeys(ReasonWatched reason);
+
     LlvmFunctionState *state_;
     PyGlobalLlvmData *const llvm_data_;
     // The code object is used for looking up peripheral information
@@ -340,6 +451,10 @@ private:
     // Flags to indicate whether the code object is watching any of the
     // watchable dicts.
     std::bitset<NUM_WATCHING_REASONS> uses_watched_dicts_;
+    // Of those, the dicts we depend on in their entirety.  For the others,
+    // watched_keys_ holds the keys we depend on.
+    std::bitset<NUM_WATCHING_REASONS> uses_whole_dicts_;
+    llvm::SmallPtrSet<PyObject*, 8> watched_keys_[NUM_WATCHING_REASONS];
 
     // The following pointers hold values created in the function's
     // entry block. They're constant after construction.
@@ -348,6 +463,11 @@ private:
     // Address of code_object_->co_use_jit, used for guards.
     llvm::Value *use_jit_addr_;
 
+    // Address of code_object_->co_hotness, or NULL if this function doesn't
+    // count backedges.  Only code compiled before it's fully hot counts them;
+    // see PY_QUICK_HOTNESS_THRESHOLD.
+    llvm::Value *hotness_addr_;
+
     llvm::Value *tstate_;
     llvm::Value *stack_bottom_;
     llvm::Value *stack_pointer_addr_;
@@ -376,11 +496,31 @@ private:
     // array allocas.
     std::vector<llvm::Value*> locals_;
 
+    // The cells in the frame's freevars.  A frame keeps the same cells for
+    // its whole life, so we load the pointers once on entry and let the
+    // closure opcodes reuse them instead of reloading them from the frame.
+    std::vector<llvm::Value*> cells_;
+    // Borrowed copies of the contents of the cells for co_cellvars.  Nested
+    // functions can only read those cells, so this frame is their only
+    // writer: we load them on entry, and STORE_DEREF writes both the cell
+    // and the alloca.  Like locals_, this lets LLVM keep a closed-over
+    // variable in a register across calls.
+    std::vector<llvm::Value*> cell_contents_;
+
+    // The value stack, one alloca per slot up to co_stacksize.  The frame's
+    // f_valuestack is only brought up to date where something reads it;
+    // see FlushValueStack().  A bail's copy of the stack is therefore built
+    // from the phis mem2reg puts in the shared bail block, so each guard
+    // site's stack values reach the frame only on its cold edge.
+    std::vector<llvm::Value*> stack_slots_;
+
     llvm::BasicBlock *unreachable_block_;
 
-    // In generators, we use this switch to jump back to the most
-    // recently executed yield instruction.
-    llvm::SwitchInst *yield_resume_switch_;
+    // Dispatches on f_lasti when the function is entered.  -1 means start
+    // at the top; in generators, we use this switch to jump back to the
+    // most recently executed yield instruction, and in any function it can
+    // jump to a loop header for on-stack replacement.
+    llvm::SwitchInst *resume_switch_;
 
     llvm::BasicBlock *bail_to_interpreter_block_;
 
@@ -400,6 +540,12 @@ private:
 
     llvm::SmallPtrSet<PyTypeObject*, 5> types_used_;
 
+    // See GetBailPointBlock().  Keyed by (bail_idx, (reason, guard_type)).
+    typedef std::pair<unsigned, std::pair<char, int> > BailPointKey;
+    std::map<BailPointKey, llvm::BasicBlock*> bail_points_;
+    // See MarkCold().  In the order they should be laid out.
+    std::vector<llvm::BasicBlock*> cold_blocks_;
+
     // A stack that corresponds to LOAD_METHOD/CALL_METHOD pairs.  For every
     // load, we push on a boolean for whether or not the load was optimized.
     // The call uses this value to decide whether to expect an extra "self"
@@ -409,6 +555,36 @@ private:
 
     // Stores information about the stack top for every opcode
     std::vector<int> stack_info_;
+
+    // See MarkCannotRunPython().  Indexed by opcode.
+    std::vector<bool> cannot_run_python_;
+
+    // An entry on the block stack, as far as we can tell at compile time.
+    struct TryBlock {
+        TryBlock()
+            : handler_opindex(-1), block_type(0), stack_level(0),
+              blocks_below(0), num_blocks(-1) {}
+        // -1 if this doesn't describe a block.
+        int handler_opindex;
+        int block_type;
+        // The block's b_level.
+        int stack_level;
+        // How many blocks are under this one on the block stack.
+        int blocks_below;
+        // How many blocks are on the block stack at the opcode this
+        // describes, or -1 if no path from the entry reaches it.
+        int num_blocks;
+    };
+    // Fills try_blocks_ for the opcodes reachable from start, given the
+    // block stack there.  Returns false if two paths reach an opcode with
+    // different block stacks.
+    bool FindTryBlocks(const PyBytecodeIterator &start,
+                       std::vector<TryBlock> blocks);
+    // For every opcode, the innermost SETUP_EXCEPT or SETUP_FINALLY block
+    // around it.  Empty if the block stack isn't fixed at compile time.
+    std::vector<TryBlock> try_blocks_;
+    // See GetExceptionBlock().  Keyed by the handler's opindex.
+    std::map<int, llvm::BasicBlock*> exception_landings_;
     int stack_top_;
 
     // True if something went wrong and we need to stop compilation without
@@ -418,6 +594,7 @@ private:
 
     const bool is_generator_;
     bool uses_delete_fast_;
+    llvm::DenseMap<int, int> accumulators_;
 };
 
 }  // namespace py
@@ -15,6 +15,12 @@
 
 #include "Util/EventTimer.h"
 
+/* fastsearch() is a static inline function; this gives us the str
+   flavour of it. */
+#define STRINGLIB_CHAR char
+#include "Objects/stringlib/fastsearch.h"
+#undef STRINGLIB_CHAR
+
 int __attribute__((always_inline))
 _PyLlvm_WrapIntCheck(PyObject *obj)
 {
@@ -398,6 +404,52 @@ _PyLlvm_Object_GenericSetAttr(PyObject *obj, PyObject *value,
     return -1;
 }
 
+/* The operands of the optimized arithmetic functions below are references
+   owned by the caller's value stack, which drops them as soon as we return.
+   An operand with no other reference is a temporary that is about to be
+   freed, so instead of allocating an object for the result and freeing the
+   temporary right after, store the result in the temporary.  Nothing else
+   can see the change.  Results that PyInt_FromLong() would take from its
+   small int cache still come from there, so that they stay shared. */
+
+/* Keep these in sync with Objects/intobject.c. */
+#define PY_NSMALLPOSINTS 257
+#define PY_NSMALLNEGINTS 5
+
+static inline PyObject *
+int_result(PyObject *v, PyObject *w, long i)
+{
+    PyObject *temp = NULL;
+
+    if (i >= -PY_NSMALLNEGINTS && i < PY_NSMALLPOSINTS)
+        return PyInt_FromLong(i);
+    if (Py_REFCNT(v) == 1)
+        temp = v;
+    else if (Py_REFCNT(w) == 1)
+        temp = w;
+    else
+        return PyInt_FromLong(i);
+    ((PyIntObject *)temp)->ob_ival = i;
+    Py_INCREF(temp);
+    return temp;
+}
+
+static inline PyObject *
+float_result(PyObject *v, PyObject *w, double d)
+{
+    PyObject *temp = NULL;
+
+    if (Py_REFCNT(v) == 1 && PyFloat_CheckExact(v))
+        temp = v;
+    else if (Py_REFCNT(w) == 1 && PyFloat_CheckExact(w))
+        temp = w;
+    else
+        return PyFloat_FromDouble(d);
+    ((PyFloatObject *)temp)->ob_fval = d;
+    Py_INCREF(temp);
+    return temp;
+}
+
 /* Optimized BINARY_OP functions for several datatypes */
 PyObject * __attribute__((always_inline))
 _PyLlvm_BinAdd_Int(PyObject *v, PyObject *w)
@@ -415,7 +467,7 @@ _PyLlvm_BinAdd_Int(PyObject *v, PyObject *w)
     if ((i^a) < 0 && (i^b) < 0)
         return NULL;
 
-    return PyInt_FromLong(i);
+    return int_result(v, w, i);
 }
 
 PyObject * __attribute__((always_inline))
@@ -434,7 +486,7 @@ _PyLlvm_BinSub_Int(PyObject *v, PyObject *w)
     if ((i^a) < 0 && (i^~b) < 0)
         return NULL;
 
-    return PyInt_FromLong(i);
+    return int_result(v, w, i);
 }
 
 PyObject * __attribute__((always_inline))
@@ -455,7 +507,7 @@ _PyLlvm_BinMult_Int(PyObject *v, PyObject *w)
     if ((double)i != di)
         return NULL;
 
-    return PyInt_FromLong(i);
+    return int_result(v, w, i);
 }
 
 #define UNARY_NEG_WOULD_OVERFLOW(x) \
@@ -493,7 +545,7 @@ _PyLlvm_BinDiv_Int(PyObject *v, PyObject *w)
         assert(xmody && ((y ^ xmody) >= 0));
     }
 
-    return PyInt_FromLong(xdivy);
+    return int_result(v, w, xdivy);
 }
 
 PyObject * __attribute__((always_inline))
@@ -527,7 +579,7 @@ _PyLlvm_BinMod_Int(PyObject *v, PyObject *w)
         assert(xmody && ((y ^ xmody) >= 0));
     }
 
-    return PyInt_FromLong(xmody);
+    return int_result(v, w, xmody);
 }
 
 PyObject * __attribute__((always_inline))
@@ -543,7 +595,7 @@ _PyLlvm_BinAdd_Float(PyObject *v, PyObject *w)
     PyFPE_START_PROTECT("add", return 0)
     i = a + b;
     PyFPE_END_PROTECT(i)
-    return PyFloat_FromDouble(i);
+    return float_result(v, w, i);
 
 }
 
@@ -560,7 +612,7 @@ _PyLlvm_BinSub_Float(PyObject *v, PyObject *w)
     PyFPE_START_PROTECT("subtract", return 0)
     i = a - b;
     PyFPE_END_PROTECT(i)
-    return PyFloat_FromDouble(i);
+    return float_result(v, w, i);
 }
 
 PyObject * __attribute__((always_inline))
@@ -576,7 +628,7 @@ _PyLlvm_BinMult_Float(PyObject *v, PyObject *w)
     PyFPE_START_PROTECT("multiply", return 0)
     i = a * b;
     PyFPE_END_PROTECT(i)
-    return PyFloat_FromDouble(i);
+    return float_result(v, w, i);
 }
 
 PyObject * __attribute__((always_inline))
@@ -598,7 +650,7 @@ _PyLlvm_BinDiv_Float(PyObject *v, PyObject *w)
     PyFPE_START_PROTECT("divide", return 0)
     i = a / b;
     PyFPE_END_PROTECT(i)
-    return PyFloat_FromDouble(i);
+    return float_result(v, w, i);
 }
 
 PyObject * __attribute__((always_inline))
@@ -615,7 +667,7 @@ _PyLlvm_BinMul_FloatInt(PyObject *v, PyObject *w)
     PyFPE_START_PROTECT("multiply", return 0)
     i = a * b;
     PyFPE_END_PROTECT(i)
-    return PyFloat_FromDouble(i);
+    return float_result(v, w, i);
 }
 
 PyObject * __attribute__((always_inline))
@@ -635,12 +687,330 @@ _PyLlvm_BinDiv_FloatInt(PyObject *v, PyObject *w)
     }
 #endif
 
+    PyFPE_START_PROTECT("divide", return 0)
+    i = a / b;
+    PyFPE_END_PROTECT(i)
+    return float_result(v, w, i);
+}
+
+/* Int combined with float.  Python converts the int with a plain cast
+   (see convert_to_double() in Objects/floatobject.c), so we do too. */
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinAdd_FloatInt(PyObject *v, PyObject *w)
+{
+    double a, b, i;
+    if (!(PyFloat_CheckExact(v) && PyInt_CheckExact(w))) {
+        return NULL;
+    }
+
+    a = PyFloat_AS_DOUBLE(v);
+    b = (double)PyInt_AS_LONG(w);
+    PyFPE_START_PROTECT("add", return 0)
+    i = a + b;
+    PyFPE_END_PROTECT(i)
+    return float_result(v, w, i);
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinSub_FloatInt(PyObject *v, PyObject *w)
+{
+    double a, b, i;
+    if (!(PyFloat_CheckExact(v) && PyInt_CheckExact(w))) {
+        return NULL;
+    }
+
+    a = PyFloat_AS_DOUBLE(v);
+    b = (double)PyInt_AS_LONG(w);
+    PyFPE_START_PROTECT("subtract", return 0)
+    i = a - b;
+    PyFPE_END_PROTECT(i)
+    return float_result(v, w, i);
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinAdd_IntFloat(PyObject *v, PyObject *w)
+{
+    double a, b, i;
+    if (!(PyInt_CheckExact(v) && PyFloat_CheckExact(w))) {
+        return NULL;
+    }
+
+    a = (double)PyInt_AS_LONG(v);
+    b = PyFloat_AS_DOUBLE(w);
+    PyFPE_START_PROTECT("add", return 0)
+    i = a + b;
+    PyFPE_END_PROTECT(i)
+    return float_result(v, w, i);
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinSub_IntFloat(PyObject *v, PyObject *w)
+{
+    double a, b, i;
+    if (!(PyInt_CheckExact(v) && PyFloat_CheckExact(w))) {
+        return NULL;
+    }
+
+    a = (double)PyInt_AS_LONG(v);
+    b = PyFloat_AS_DOUBLE(w);
+    PyFPE_START_PROTECT("subtract", return 0)
+    i = a - b;
+    PyFPE_END_PROTECT(i)
+    return float_result(v, w, i);
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinMul_IntFloat(PyObject *v, PyObject *w)
+{
+    double a, b, i;
+    if (!(PyInt_CheckExact(v) && PyFloat_CheckExact(w))) {
+        return NULL;
+    }
+
+    a = (double)PyInt_AS_LONG(v);
+    b = PyFloat_AS_DOUBLE(w);
+    PyFPE_START_PROTECT("multiply", return 0)
+    i = a * b;
+    PyFPE_END_PROTECT(i)
+    return float_result(v, w, i);
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinDiv_IntFloat(PyObject *v, PyObject *w)
+{
+    double a, b, i;
+    if (!(PyInt_CheckExact(v) && PyFloat_CheckExact(w))) {
+        return NULL;
+    }
+
+    a = (double)PyInt_AS_LONG(v);
+    b = PyFloat_AS_DOUBLE(w);
+
+#ifdef Py_NAN
+    if (b == 0.0) {
+        return NULL;
+    }
+#endif
+
+    PyFPE_START_PROTECT("divide", return 0)
+    i = a / b;
+    PyFPE_END_PROTECT(i)
+    return float_result(v, w, i);
+}
+
+/* int / int under "from __future__ import division"; see int_true_divide()
+   in Objects/intobject.c. */
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinTrueDiv_Int(PyObject *v, PyObject *w)
+{
+    double a, b, i;
+    if (!(PyInt_CheckExact(v) && PyInt_CheckExact(w))) {
+        return NULL;
+    }
+
+    a = (double)PyInt_AS_LONG(v);
+    b = (double)PyInt_AS_LONG(w);
+
+    if (b == 0.0) {
+        return NULL;
+    }
+
     PyFPE_START_PROTECT("divide", return 0)
     i = a / b;
     PyFPE_END_PROTECT(i)
     return PyFloat_FromDouble(i);
 }
 
+/* Keep these two in sync with float_rem() and float_divmod() in
+   Objects/floatobject.c. */
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinMod_Float(PyObject *v, PyObject *w)
+{
+    double vx, wx, mod;
+
+    if (!(PyFloat_CheckExact(v) && PyFloat_CheckExact(w)))
+        return NULL;
+
+    vx = PyFloat_AS_DOUBLE(v);
+    wx = PyFloat_AS_DOUBLE(w);
+
+    if (wx == 0.0)
+        return NULL;
+
+    PyFPE_START_PROTECT("modulo", return 0)
+    mod = fmod(vx, wx);
+    if (mod && ((wx < 0) != (mod < 0))) {
+        mod += wx;
+    }
+    PyFPE_END_PROTECT(mod)
+    return float_result(v, w, mod);
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinFloorDiv_Float(PyObject *v, PyObject *w)
+{
+    double vx, wx, div, mod, floordiv;
+
+    if (!(PyFloat_CheckExact(v) && PyFloat_CheckExact(w)))
+        return NULL;
+
+    vx = PyFloat_AS_DOUBLE(v);
+    wx = PyFloat_AS_DOUBLE(w);
+
+    if (wx == 0.0)
+        return NULL;
+
+    PyFPE_START_PROTECT("divmod", return 0)
+    mod = fmod(vx, wx);
+    div = (vx - mod) / wx;
+    if (mod && ((wx < 0) != (mod < 0))) {
+        div -= 1.0;
+    }
+    if (div) {
+        floordiv = floor(div);
+        if (div - floordiv > 0.5)
+            floordiv += 1.0;
+    }
+    else {
+        div *= div;     /* hide "div = +0" from optimizers */
+        floordiv = div * vx / wx;   /* zero w/ sign of vx/wx */
+    }
+    PyFPE_END_PROTECT(floordiv)
+    return float_result(v, w, floordiv);
+}
+
+/* Keep the shifts in sync with int_lshift() and int_rshift() in
+   Objects/intobject.c.  Anything that would need a long bails. */
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinLshift_Int(PyObject *v, PyObject *w)
+{
+    long a, b, c;
+
+    if (!(PyInt_CheckExact(v) && PyInt_CheckExact(w)))
+        return NULL;
+
+    a = PyInt_AS_LONG(v);
+    b = PyInt_AS_LONG(w);
+
+    if (b < 0 || b >= LONG_BIT)
+        return NULL;
+
+    c = (long)((unsigned long)a << b);
+    if (a != Py_ARITHMETIC_RIGHT_SHIFT(long, c, b))
+        return NULL;
+
+    return int_result(v, w, c);
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinRshift_Int(PyObject *v, PyObject *w)
+{
+    long a, b;
+
+    if (!(PyInt_CheckExact(v) && PyInt_CheckExact(w)))
+        return NULL;
+
+    a = PyInt_AS_LONG(v);
+    b = PyInt_AS_LONG(w);
+
+    if (b < 0)
+        return NULL;
+
+    if (b >= LONG_BIT)
+        a = a < 0 ? -1 : 0;
+    else
+        a = Py_ARITHMETIC_RIGHT_SHIFT(long, a, b);
+
+    return int_result(v, w, a);
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinAnd_Int(PyObject *v, PyObject *w)
+{
+    if (!(PyInt_CheckExact(v) && PyInt_CheckExact(w)))
+        return NULL;
+
+    return int_result(v, w, PyInt_AS_LONG(v) & PyInt_AS_LONG(w));
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinOr_Int(PyObject *v, PyObject *w)
+{
+    if (!(PyInt_CheckExact(v) && PyInt_CheckExact(w)))
+        return NULL;
+
+    return int_result(v, w, PyInt_AS_LONG(v) | PyInt_AS_LONG(w));
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinXor_Int(PyObject *v, PyObject *w)
+{
+    if (!(PyInt_CheckExact(v) && PyInt_CheckExact(w)))
+        return NULL;
+
+    return int_result(v, w, PyInt_AS_LONG(v) ^ PyInt_AS_LONG(w));
+}
+
+/* Longs that fit in a single digit are common as loop counters and
+   accumulators in code that was written to never overflow.  Arithmetic on
+   them can't overflow a C long either, so do it there and skip
+   Objects/longobject.c's digit-by-digit algorithms. */
+static inline int
+small_long_value(PyObject *v, long *value)
+{
+    PyLongObject *l = (PyLongObject *)v;
+
+    if (!PyLong_CheckExact(v))
+        return 0;
+    switch (Py_SIZE(l)) {
+    case 0:
+        *value = 0;
+        return 1;
+    case 1:
+        *value = (long)l->ob_digit[0];
+        return 1;
+    case -1:
+        *value = -(long)l->ob_digit[0];
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinAdd_Long(PyObject *v, PyObject *w)
+{
+    long a, b;
+
+    if (!(small_long_value(v, &a) && small_long_value(w, &b)))
+        return NULL;
+
+    return PyLong_FromLong(a + b);
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinSub_Long(PyObject *v, PyObject *w)
+{
+    long a, b;
+
+    if (!(small_long_value(v, &a) && small_long_value(w, &b)))
+        return NULL;
+
+    return PyLong_FromLong(a - b);
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinMult_Long(PyObject *v, PyObject *w)
+{
+    long a, b;
+
+    if (!(small_long_value(v, &a) && small_long_value(w, &b)))
+        return NULL;
+
+    /* Two digits of PyLong_SHIFT bits each still fit in a C long. */
+    return PyLong_FromLong(a * b);
+}
+
 PyObject * __attribute__((always_inline))
 _PyLlvm_BinMod_Str(PyObject *format, PyObject *args)
 {
@@ -657,6 +1027,214 @@ _PyLlvm_BinMod_Unicode(PyObject *format, PyObject *args)
     return PyUnicode_Format(format, args);
 }
 
+/* str and unicode fast paths.  Keep these in sync with string_item(),
+   string_concat(), string_slice() and string_contains() in
+   Objects/stringobject.c, and their unicode equivalents.  Single
+   characters and empty strings come from the types' own caches, because
+   PyString_FromStringAndSize() and PyUnicode_FromUnicode() check those
+   first. */
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinSubscr_Str(PyObject *v, PyObject *w)
+{
+    Py_ssize_t i;
+    if (!(PyString_CheckExact(v) && PyInt_CheckExact(w)))
+        return NULL;
+
+    i = PyInt_AS_LONG(w);
+    if (i < 0)
+        i += Py_SIZE(v);
+    if (i < 0 || i >= Py_SIZE(v))
+        return NULL;
+    return PyString_FromStringAndSize(PyString_AS_STRING(v) + i, 1);
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinSubscr_Unicode(PyObject *v, PyObject *w)
+{
+    Py_ssize_t i;
+    if (!(PyUnicode_CheckExact(v) && PyInt_CheckExact(w)))
+        return NULL;
+
+    i = PyInt_AS_LONG(w);
+    if (i < 0)
+        i += PyUnicode_GET_SIZE(v);
+    if (i < 0 || i >= PyUnicode_GET_SIZE(v))
+        return NULL;
+    return PyUnicode_FromUnicode(PyUnicode_AS_UNICODE(v) + i, 1);
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinAdd_Str(PyObject *v, PyObject *w)
+{
+    Py_ssize_t v_size, w_size;
+    PyObject *result;
+
+    if (!(PyString_CheckExact(v) && PyString_CheckExact(w)))
+        return NULL;
+
+    v_size = Py_SIZE(v);
+    w_size = Py_SIZE(w);
+    if (w_size == 0) {
+        Py_INCREF(v);
+        return v;
+    }
+    if (v_size == 0) {
+        Py_INCREF(w);
+        return w;
+    }
+    if (v_size > PY_SSIZE_T_MAX - w_size)
+        return NULL;
+
+    result = PyString_FromStringAndSize(NULL, v_size + w_size);
+    if (result == NULL)
+        return NULL;
+    memcpy(PyString_AS_STRING(result), PyString_AS_STRING(v), v_size);
+    memcpy(PyString_AS_STRING(result) + v_size, PyString_AS_STRING(w),
+           w_size);
+    return result;
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinAdd_Unicode(PyObject *v, PyObject *w)
+{
+    if (!(PyUnicode_CheckExact(v) && PyUnicode_CheckExact(w)))
+        return NULL;
+
+    return PyUnicode_Concat(v, w);
+}
+
+/* Clamps a classic slice bound the way _PyEval_SliceIndex() and
+   PySequence_GetSlice() do.  Only ints and missing bounds are handled. */
+static inline int
+slice_bound(PyObject *bound, Py_ssize_t size, Py_ssize_t *result)
+{
+    Py_ssize_t i;
+
+    if (bound == NULL)
+        return 1;
+    if (!PyInt_CheckExact(bound))
+        return 0;
+    i = PyInt_AS_LONG(bound);
+    if (i < 0) {
+        i += size;
+        if (i < 0)
+            i = 0;
+    }
+    if (i > size)
+        i = size;
+    *result = i;
+    return 1;
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_Slice_Str(PyObject *seq, PyObject *start, PyObject *stop)
+{
+    Py_ssize_t size, i = 0, j;
+
+    if (!PyString_CheckExact(seq))
+        return NULL;
+
+    size = j = Py_SIZE(seq);
+    if (!(slice_bound(start, size, &i) && slice_bound(stop, size, &j)))
+        return NULL;
+
+    if (i == 0 && j == size) {
+        Py_INCREF(seq);
+        return seq;
+    }
+    if (j < i)
+        j = i;
+    return PyString_FromStringAndSize(PyString_AS_STRING(seq) + i, j - i);
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_Slice_Unicode(PyObject *seq, PyObject *start, PyObject *stop)
+{
+    Py_ssize_t size, i = 0, j;
+
+    if (!PyUnicode_CheckExact(seq))
+        return NULL;
+
+    size = j = PyUnicode_GET_SIZE(seq);
+    if (!(slice_bound(start, size, &i) && slice_bound(stop, size, &j)))
+        return NULL;
+
+    if (i == 0 && j == size) {
+        Py_INCREF(seq);
+        return seq;
+    }
+    if (j < i)
+        j = i;
+    return PyUnicode_FromUnicode(PyUnicode_AS_UNICODE(seq) + i, j - i);
+}
+
+/* The containment functions take their arguments in COMPARE_OP order,
+   (item, container). */
+static inline int
+str_contains(PyObject *container, PyObject *item)
+{
+    Py_ssize_t item_size = Py_SIZE(item);
+
+    if (item_size == 0)
+        return 1;
+    if (item_size == 1)
+        return memchr(PyString_AS_STRING(container),
+                      PyString_AS_STRING(item)[0],
+                      Py_SIZE(container)) != NULL;
+    if (item_size == Py_SIZE(container))
+        return memcmp(PyString_AS_STRING(container),
+                      PyString_AS_STRING(item), item_size) == 0;
+    return fastsearch(PyString_AS_STRING(container), Py_SIZE(container),
+                      PyString_AS_STRING(item), item_size,
+                      FAST_SEARCH) != -1;
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_Contains_Str(PyObject *item, PyObject *container)
+{
+    if (!(PyString_CheckExact(item) && PyString_CheckExact(container)))
+        return NULL;
+
+    return PyBool_FromLong(str_contains(container, item));
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_NotContains_Str(PyObject *item, PyObject *container)
+{
+    if (!(PyString_CheckExact(item) && PyString_CheckExact(container)))
+        return NULL;
+
+    return PyBool_FromLong(!str_contains(container, item));
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_Contains_Unicode(PyObject *item, PyObject *container)
+{
+    int result;
+
+    if (!(PyUnicode_CheckExact(item) && PyUnicode_CheckExact(container)))
+        return NULL;
+
+    result = PyUnicode_Contains(container, item);
+    if (result < 0)
+        return NULL;
+    return PyBool_FromLong(result);
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_NotContains_Unicode(PyObject *item, PyObject *container)
+{
+    int result;
+
+    if (!(PyUnicode_CheckExact(item) && PyUnicode_CheckExact(container)))
+        return NULL;
+
+    result = PyUnicode_Contains(container, item);
+    if (result < 0)
+        return NULL;
+    return PyBool_FromLong(!result);
+}
+
 /* Work directly on the tuple data structure */
 PyObject * __attribute__((always_inline))
 _PyLlvm_BinSubscr_Tuple(PyObject *v, PyObject *w)
@@ -731,6 +1309,60 @@ _PyLlvm_StoreSubscr_List(PyObject *o, PyObject *key, PyObject *value)
     return 0;
 }
 
+/* FOR_ITER fast paths.  The caller has already checked the iterator's
+   type.  Each of these returns the next item, or NULL once the iterator is
+   exhausted; only the xrange iterator can also fail, when it runs out of
+   memory for the int it returns. */
+PyObject * __attribute__((always_inline))
+_PyLlvm_IterNext_List(PyObject *iter)
+{
+    _PyListIterObject *it = (_PyListIterObject *)iter;
+    PyListObject *seq = it->it_seq;
+    PyObject *item;
+
+    if (seq == NULL)
+        return NULL;
+    if (it->it_index < PyList_GET_SIZE(seq)) {
+        item = PyList_GET_ITEM(seq, it->it_index);
+        ++it->it_index;
+        Py_INCREF(item);
+        return item;
+    }
+    it->it_seq = NULL;
+    Py_DECREF(seq);
+    return NULL;
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_IterNext_Tuple(PyObject *iter)
+{
+    _PyTupleIterObject *it = (_PyTupleIterObject *)iter;
+    PyTupleObject *seq = it->it_seq;
+    PyObject *item;
+
+    if (seq == NULL)
+        return NULL;
+    if (it->it_index < PyTuple_GET_SIZE(seq)) {
+        item = PyTuple_GET_ITEM(seq, it->it_index);
+        ++it->it_index;
+        Py_INCREF(item);
+        return item;
+    }
+    it->it_seq = NULL;
+    Py_DECREF(seq);
+    return NULL;
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_IterNext_Range(PyObject *iter)
+{
+    _PyRangeIterObject *r = (_PyRangeIterObject *)iter;
+
+    if (r->index < r->len)
+        return PyInt_FromLong(r->start + (r->index++) * r->step);
+    return NULL;
+}
+
 PyObject * __attribute__((always_inline))
 _PyLlvm_BinLt_Int(PyObject *v, PyObject *w)
 {
@@ -802,6 +1434,171 @@ _PyLlvm_BinGt_Float(PyObject *v, PyObject *w)
     return PyBool_FromLong(PyFloat_AS_DOUBLE(v) > PyFloat_AS_DOUBLE(w));
 }
 
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinLt_Float(PyObject *v, PyObject *w)
+{
+    if (!(PyFloat_CheckExact(v) && PyFloat_CheckExact(w))) {
+        return NULL;
+    }
+
+    return PyBool_FromLong(PyFloat_AS_DOUBLE(v) < PyFloat_AS_DOUBLE(w));
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinLe_Float(PyObject *v, PyObject *w)
+{
+    if (!(PyFloat_CheckExact(v) && PyFloat_CheckExact(w))) {
+        return NULL;
+    }
+
+    return PyBool_FromLong(PyFloat_AS_DOUBLE(v) <= PyFloat_AS_DOUBLE(w));
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinEq_Float(PyObject *v, PyObject *w)
+{
+    if (!(PyFloat_CheckExact(v) && PyFloat_CheckExact(w))) {
+        return NULL;
+    }
+
+    return PyBool_FromLong(PyFloat_AS_DOUBLE(v) == PyFloat_AS_DOUBLE(w));
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinNe_Float(PyObject *v, PyObject *w)
+{
+    if (!(PyFloat_CheckExact(v) && PyFloat_CheckExact(w))) {
+        return NULL;
+    }
+
+    return PyBool_FromLong(PyFloat_AS_DOUBLE(v) != PyFloat_AS_DOUBLE(w));
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_BinGe_Float(PyObject *v, PyObject *w)
+{
+    if (!(PyFloat_CheckExact(v) && PyFloat_CheckExact(w))) {
+        return NULL;
+    }
+
+    return PyBool_FromLong(PyFloat_AS_DOUBLE(v) >= PyFloat_AS_DOUBLE(w));
+}
+
+/* float_richcompare() compares a float with an int as doubles only when
+   the int fits in 48 bits; bigger ones take a PyLong path we don't
+   duplicate here. */
+static inline int
+int_as_exact_double(PyObject *w, double *value)
+{
+    long l = PyInt_AS_LONG(w);
+#if SIZEOF_LONG > 6
+    /* -l would overflow for LONG_MIN. */
+    unsigned long abs = l < 0 ? 0UL - (unsigned long)l : (unsigned long)l;
+    if (abs >> 48)
+        return 0;
+#endif
+    *value = (double)l;
+    return 1;
+}
+
+#define FLOAT_INT_CMPOP(NAME, OP) \
+PyObject * __attribute__((always_inline)) \
+_PyLlvm_Bin##NAME##_FloatInt(PyObject *v, PyObject *w) \
+{ \
+    double b; \
+    if (!(PyFloat_CheckExact(v) && PyInt_CheckExact(w) && \
+          int_as_exact_double(w, &b))) { \
+        return NULL; \
+    } \
+    return PyBool_FromLong(PyFloat_AS_DOUBLE(v) OP b); \
+} \
+\
+PyObject * __attribute__((always_inline)) \
+_PyLlvm_Bin##NAME##_IntFloat(PyObject *v, PyObject *w) \
+{ \
+    double a; \
+    if (!(PyInt_CheckExact(v) && PyFloat_CheckExact(w) && \
+          int_as_exact_double(v, &a))) { \
+        return NULL; \
+    } \
+    return PyBool_FromLong(a OP PyFloat_AS_DOUBLE(w)); \
+}
+
+FLOAT_INT_CMPOP(Lt, <)
+FLOAT_INT_CMPOP(Le, <=)
+FLOAT_INT_CMPOP(Eq, ==)
+FLOAT_INT_CMPOP(Ne, !=)
+FLOAT_INT_CMPOP(Gt, >)
+FLOAT_INT_CMPOP(Ge, >=)
+
+#undef FLOAT_INT_CMPOP
+
+#define SMALL_LONG_CMPOP(NAME, OP) \
+PyObject * __attribute__((always_inline)) \
+_PyLlvm_Bin##NAME##_Long(PyObject *v, PyObject *w) \
+{ \
+    long a, b; \
+    if (!(small_long_value(v, &a) && small_long_value(w, &b))) { \
+        return NULL; \
+    } \
+    return PyBool_FromLong(a OP b); \
+}
+
+SMALL_LONG_CMPOP(Lt, <)
+SMALL_LONG_CMPOP(Le, <=)
+SMALL_LONG_CMPOP(Eq, ==)
+SMALL_LONG_CMPOP(Ne, !=)
+SMALL_LONG_CMPOP(Gt, >)
+SMALL_LONG_CMPOP(Ge, >=)
+
+#undef SMALL_LONG_CMPOP
+
+/* Optimized UNARY_OP functions.  The operand is passed twice to
+   int_result() and float_result(), which only look at reference counts. */
+PyObject * __attribute__((always_inline))
+_PyLlvm_UnaryNeg_Int(PyObject *v)
+{
+    long a;
+
+    if (!PyInt_CheckExact(v))
+        return NULL;
+
+    a = PyInt_AS_LONG(v);
+    if (UNARY_NEG_WOULD_OVERFLOW(a))
+        return NULL;
+
+    return int_result(v, v, -a);
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_UnaryInvert_Int(PyObject *v)
+{
+    if (!PyInt_CheckExact(v))
+        return NULL;
+
+    return int_result(v, v, ~PyInt_AS_LONG(v));
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_UnaryNeg_Float(PyObject *v)
+{
+    if (!PyFloat_CheckExact(v))
+        return NULL;
+
+    return float_result(v, v, -PyFloat_AS_DOUBLE(v));
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_UnaryNeg_Long(PyObject *v)
+{
+    long a;
+
+    if (!small_long_value(v, &a))
+        return NULL;
+
+    return PyLong_FromLong(-a);
+}
+
 
 // TODO(jyasskin): remove these in favor of Clang-based top-down inlining. These
 // establish a baseline the more sophisticated system will need to meet or
@@ -856,6 +1653,24 @@ _PyLlvm_BuiltinLen_Dict(PyObject *o)
     return PyInt_FromSsize_t(size);
 }
 
+/* LOAD_DEREF and STORE_DEREF.  The frame's freevars only ever hold cells,
+   so these skip PyCell_Get()'s and PyCell_Set()'s type checks.
+   _PyLlvm_Cell_Contents() returns a borrowed reference, or NULL if the cell
+   is empty.  _PyLlvm_Cell_Set() steals a reference to value. */
+PyObject * __attribute__((always_inline))
+_PyLlvm_Cell_Contents(PyObject *cell)
+{
+    return PyCell_GET(cell);
+}
+
+void __attribute__((always_inline))
+_PyLlvm_Cell_Set(PyObject *cell, PyObject *value)
+{
+    PyObject *old_value = PyCell_GET(cell);
+    PyCell_SET(cell, value);
+    Py_XDECREF(old_value);
+}
+
 /* Define a global using PyTupleObject so we can look it up from
    TypeBuilder<PyTupleObject>. */
 PyTupleObject *_dummy_TupleObject;
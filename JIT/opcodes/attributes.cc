@@ -28,8 +28,11 @@ class AccessAttrStats {
 public:
     AccessAttrStats()
         : loads(0), stores(0), optimized_loads(0), optimized_stores(0),
+          polymorphic_loads(0), polymorphic_stores(0), polymorphic_entries(0),
           no_opt_no_data(0), no_opt_no_mcache(0), no_opt_overrode_access(0),
-          no_opt_polymorphic(0), no_opt_nonstring_name(0) {
+          megamorphic_dominant(0), no_opt_polymorphic(0),
+          no_opt_megamorphic(0),
+          no_opt_nonstring_name(0) {
     }
 
     ~AccessAttrStats() {
@@ -43,12 +46,21 @@ public:
         errs() << "STORE_ATTR opcodes: " << this->stores << "\n";
         errs() << "Optimized STORE_ATTR opcodes: "
                << this->optimized_stores << "\n";
+        errs() << "Polymorphic LOAD_ATTR opcodes: "
+               << this->polymorphic_loads << "\n";
+        errs() << "Polymorphic STORE_ATTR opcodes: "
+               << this->polymorphic_stores << "\n";
+        errs() << "Polymorphic cache entries: "
+               << this->polymorphic_entries << "\n";
+        errs() << "Megamorphic opcodes cached on dominant types: "
+               << this->megamorphic_dominant << "\n";
         errs() << "No opt: no data: " << this->no_opt_no_data << "\n";
         errs() << "No opt: no mcache support: "
                << this->no_opt_no_mcache << "\n";
         errs() << "No opt: overrode getattr: "
                << this->no_opt_overrode_access << "\n";
         errs() << "No opt: polymorphic: " << this->no_opt_polymorphic << "\n";
+        errs() << "No opt: megamorphic: " << this->no_opt_megamorphic << "\n";
         errs() << "No opt: non-string name: "
                << this->no_opt_nonstring_name << "\n";
     }
@@ -61,6 +73,14 @@ public:
     unsigned optimized_loads;
     // Number of stores we optimized.
     unsigned optimized_stores;
+    // Number of the optimized loads and stores that use a polymorphic inline
+    // cache, and the total number of types cached by them.
+    unsigned polymorphic_loads;
+    unsigned polymorphic_stores;
+    unsigned polymorphic_entries;
+    // Number of megamorphic sites whose feedback showed dominant types that
+    // we tried to cache.
+    unsigned megamorphic_dominant;
     // Number of opcodes we were unable to optimize due to missing data.
     unsigned no_opt_no_data;
     // Number of opcodes we were unable to optimize because the type didn't
@@ -69,8 +89,12 @@ public:
     // Number of opcodes we were unable to optimize because the type overrode
     // tp_getattro.
     unsigned no_opt_overrode_access;
-    // Number of opcodes we were unable to optimize due to polymorphism.
+    // Number of polymorphic opcodes we were unable to optimize because none
+    // of their types could be cached.
     unsigned no_opt_polymorphic;
+    // Number of opcodes we were unable to optimize because they had seen too
+    // many types to cache.
+    unsigned no_opt_megamorphic;
     // Number of opcodes we were unable to optimize because the attribute name
     // was not a string.
     unsigned no_opt_nonstring_name;
@@ -120,7 +144,8 @@ void
 OpcodeAttributes::LOAD_ATTR(int names_index)
 {
     ACCESS_ATTR_INC_STATS(loads);
-    if (!this->LOAD_ATTR_fast(names_index)) {
+    if (!this->LOAD_ATTR_fast(names_index) &&
+        !this->LOAD_ATTR_polymorphic(names_index)) {
         this->LOAD_ATTR_safe(names_index);
     }
 }
@@ -153,6 +178,12 @@ OpcodeAttributes::LOAD_ATTR_fast(int names_index)
     }
     ACCESS_ATTR_INC_STATS(optimized_loads);
 
+    // As in OpcodeCall::PlanInline(), member descriptors are the only
+    // getters we know can't run Python code.
+    if (accessor.descr_get_ == NULL ||
+        accessor.guard_descr_type_ == &PyMemberDescr_Type)
+        this->fbuilder_->MarkCannotRunPython();
+
     this->fbuilder_->SetOpcodeArgsWithGuard(1);
 
     // Emit the appropriate guards.
@@ -190,11 +221,82 @@ OpcodeAttributes::LOAD_ATTR_fast(int names_index)
     return true;
 }
 
+bool
+OpcodeAttributes::LOAD_ATTR_polymorphic(int names_index)
+{
+    PyObject *name =
+        PyTuple_GET_ITEM(this->fbuilder_->code_object()->co_names, names_index);
+    PolymorphicAttributeAccessor accessor(this->fbuilder_, name,
+                                          ATTR_ACCESS_LOAD);
+
+    if (!accessor.CanOptimizeAttrAccess()) {
+        return false;
+    }
+    ACCESS_ATTR_INC_STATS(optimized_loads);
+    ACCESS_ATTR_INC_STATS(polymorphic_loads);
+
+    // Every path through the type switch produces a new reference or NULL
+    // in result_addr.
+    this->fbuilder_->SetOpcodeArguments(1);
+    Value *obj_v = this->fbuilder_->GetOpcodeArg(0);
+    Value *result_addr = this->state_->CreateAllocaInEntryBlock(
+        PyTypeBuilder<PyObject*>::get(this->fbuilder_->context()),
+        NULL, "LOAD_ATTR_result_addr");
+    BasicBlock *generic =
+        this->state_->CreateBasicBlock("LOAD_ATTR_generic");
+    BasicBlock *done = this->state_->CreateBasicBlock("LOAD_ATTR_done");
+    llvm::SmallVector<BasicBlock*, PolymorphicAttributeAccessor::kMaxEntries>
+        hit_blocks;
+    accessor.EmitTypeSwitch(obj_v, hit_blocks, generic);
+
+    PyConstantMirror &mirror = llvm_data_->constant_mirror();
+    Value *getattr_func = this->state_->GetGlobalFunction<
+        PyObject *(PyObject *obj, PyTypeObject *type, PyObject *name,
+                   long dictoffset, PyObject *descr, descrgetfunc descr_get,
+                   char is_data_descr)>("_PyLlvm_Object_GenericGetAttr");
+    for (unsigned i = 0; i < hit_blocks.size(); ++i) {
+        AttributeAccessor &entry = accessor.entries_[i];
+        this->builder_.SetInsertPoint(hit_blocks[i]);
+        Value *descr_get_v = mirror.GetGlobalForFunctionPointer<descrgetfunc>(
+                (void*)entry.descr_get_, "");
+        Value *args[] = {
+            obj_v,
+            entry.guard_type_v_,
+            entry.name_v_,
+            entry.dictoffset_v_,
+            entry.descr_v_,
+            descr_get_v,
+            entry.is_data_descr_v_
+        };
+        this->builder_.CreateStore(
+            this->state_->CreateCall(getattr_func, args, array_endof(args)),
+            result_addr);
+        this->builder_.CreateBr(done);
+    }
+
+    this->builder_.SetInsertPoint(generic);
+    Function *pyobj_getattr = this->state_->GetGlobalFunction<
+        PyObject *(PyObject *, PyObject *)>("PyObject_GetAttr");
+    this->builder_.CreateStore(
+        this->state_->CreateCall(pyobj_getattr, obj_v,
+                                 this->fbuilder_->LookupName(names_index)),
+        result_addr);
+    this->builder_.CreateBr(done);
+
+    this->builder_.SetInsertPoint(done);
+    Value *result = this->builder_.CreateLoad(result_addr, "LOAD_ATTR_result");
+    this->state_->DecRef(obj_v);
+    this->fbuilder_->PropagateExceptionOnNull(result);
+    this->fbuilder_->SetOpcodeResult(0, result);
+    return true;
+}
+
 void
 OpcodeAttributes::STORE_ATTR(int names_index)
 {
     ACCESS_ATTR_INC_STATS(stores);
-    if (!this->STORE_ATTR_fast(names_index)) {
+    if (!this->STORE_ATTR_fast(names_index) &&
+        !this->STORE_ATTR_polymorphic(names_index)) {
         this->STORE_ATTR_safe(names_index);
     }
 }
@@ -266,6 +368,78 @@ OpcodeAttributes::STORE_ATTR_fast(int names_index)
     return true;
 }
 
+bool
+OpcodeAttributes::STORE_ATTR_polymorphic(int names_index)
+{
+    PyObject *name =
+        PyTuple_GET_ITEM(this->fbuilder_->code_object()->co_names, names_index);
+    PolymorphicAttributeAccessor accessor(this->fbuilder_, name,
+                                          ATTR_ACCESS_STORE);
+
+    if (!accessor.CanOptimizeAttrAccess()) {
+        return false;
+    }
+    ACCESS_ATTR_INC_STATS(optimized_stores);
+    ACCESS_ATTR_INC_STATS(polymorphic_stores);
+
+    this->fbuilder_->SetOpcodeArguments(2);
+    Value *val_v = this->fbuilder_->GetOpcodeArg(0);
+    Value *obj_v = this->fbuilder_->GetOpcodeArg(1);
+    Value *result_addr = this->state_->CreateAllocaInEntryBlock(
+        PyTypeBuilder<int>::get(this->fbuilder_->context()),
+        NULL, "STORE_ATTR_result_addr");
+    BasicBlock *generic =
+        this->state_->CreateBasicBlock("STORE_ATTR_generic");
+    BasicBlock *done = this->state_->CreateBasicBlock("STORE_ATTR_done");
+    llvm::SmallVector<BasicBlock*, PolymorphicAttributeAccessor::kMaxEntries>
+        hit_blocks;
+    accessor.EmitTypeSwitch(obj_v, hit_blocks, generic);
+
+    PyConstantMirror &mirror = llvm_data_->constant_mirror();
+    Value *setattr_func = this->state_->GetGlobalFunction<
+        int (PyObject *obj, PyObject *val, PyTypeObject *type, PyObject *name,
+             long dictoffset, PyObject *descr, descrsetfunc descr_set,
+             char is_data_descr)>("_PyLlvm_Object_GenericSetAttr");
+    for (unsigned i = 0; i < hit_blocks.size(); ++i) {
+        AttributeAccessor &entry = accessor.entries_[i];
+        this->builder_.SetInsertPoint(hit_blocks[i]);
+        Value *descr_set_v = mirror.GetGlobalForFunctionPointer<descrsetfunc>(
+            (void*)entry.descr_set_, "");
+        Value *args[] = {
+            obj_v,
+            val_v,
+            entry.guard_type_v_,
+            entry.name_v_,
+            entry.dictoffset_v_,
+            entry.descr_v_,
+            descr_set_v,
+            entry.is_data_descr_v_
+        };
+        this->builder_.CreateStore(
+            this->state_->CreateCall(setattr_func, args, array_endof(args)),
+            result_addr);
+        this->builder_.CreateBr(done);
+    }
+
+    this->builder_.SetInsertPoint(generic);
+    Function *pyobj_setattr = this->state_->GetGlobalFunction<
+        int(PyObject *, PyObject *, PyObject *)>("PyObject_SetAttr");
+    this->builder_.CreateStore(
+        this->state_->CreateCall(pyobj_setattr, obj_v,
+                                 this->fbuilder_->LookupName(names_index),
+                                 val_v),
+        result_addr);
+    this->builder_.CreateBr(done);
+
+    this->builder_.SetInsertPoint(done);
+    Value *result =
+        this->builder_.CreateLoad(result_addr, "STORE_ATTR_result");
+    this->state_->DecRef(obj_v);
+    this->state_->DecRef(val_v);
+    this->fbuilder_->PropagateExceptionOnNonZero(result);
+    return true;
+}
+
 void
 OpcodeAttributes::LOAD_METHOD(int names_index)
 {
@@ -427,7 +601,8 @@ AttributeAccessor::CanOptimizeAttrAccess()
         return false;
     }
 
-    // Only optimize monomorphic load sites with data.
+    // Only optimize monomorphic load sites with data.  Polymorphic sites are
+    // left to PolymorphicAttributeAccessor, which does its own accounting.
     const PyRuntimeFeedback *feedback = this->fbuilder_->GetFeedback();
     if (feedback == NULL) {
         ACCESS_ATTR_INC_STATS(no_opt_no_data);
@@ -435,25 +610,33 @@ AttributeAccessor::CanOptimizeAttrAccess()
     }
 
     if (feedback->ObjectsOverflowed()) {
-        ACCESS_ATTR_INC_STATS(no_opt_polymorphic);
         return false;
     }
     llvm::SmallVector<PyObject*, 3> types_seen;
     feedback->GetSeenObjectsInto(types_seen);
+    if (types_seen.empty()) {
+        ACCESS_ATTR_INC_STATS(no_opt_no_data);
+        return false;
+    }
     if (types_seen.size() != 1) {
-        ACCESS_ATTR_INC_STATS(no_opt_polymorphic);
         return false;
     }
 
+    PyObject *type_obj = types_seen[0];
+    assert(PyType_Check(type_obj));
+    return this->CanOptimizeAttrAccessForType((PyTypeObject*)type_obj);
+}
+
+bool
+AttributeAccessor::CanOptimizeAttrAccessForType(PyTypeObject *type)
+{
     // During the course of the compilation, we borrow a reference to the type
     // object from the feedback.  When compilation finishes, we listen for type
     // object modifications.  When a type object is freed, it notifies its
     // listeners, and the code object will be invalidated.  All other
     // references are borrowed from the type object, which cannot change
     // without invalidating the code.
-    PyObject *type_obj = types_seen[0];
-    assert(PyType_Check(type_obj));
-    PyTypeObject *type = this->guard_type_ = (PyTypeObject*)type_obj;
+    this->guard_type_ = type;
 
     // The type must support the method cache so we can listen for
     // modifications to it.
@@ -532,29 +715,45 @@ AttributeAccessor::GuardAttributeAccess(Value *obj_v, BasicBlock *do_access)
     BuilderT &builder = this->fbuilder_->builder();
     LlvmFunctionState *state = this->fbuilder_->state();
 
-    // Now that we know for sure that we are going to optimize this lookup, add
-    // the type to the list of types we need to listen for modifications from
-    // and make the llvm::Values.
-    fbuilder->WatchType(this->guard_type_);
-    this->MakeLlvmValues();
-
     BasicBlock *bail_block = state->CreateBasicBlock("ATTR_bail_block");
     BasicBlock *guard_type = state->CreateBasicBlock("ATTR_check_valid");
-    BasicBlock *guard_descr = state->CreateBasicBlock("ATTR_check_descr");
     this->bail_block_ = bail_block;
 
     // Make sure that the code object is still valid.  This may fail if the
     // code object is invalidated inside of a call to the code object.
     builder.CreateCondBr(fbuilder->GetUseJitCond(), guard_type, bail_block);
 
-    // Compare ob_type against type and bail if it's the wrong type.  Since
+    builder.SetInsertPoint(guard_type);
+    Value *type_v = builder.CreateLoad(ObjectTy::ob_type(builder, obj_v));
+    this->GuardType(type_v, do_access, bail_block);
+
+    // Fill in the bail bb.
+    builder.SetInsertPoint(bail_block);
+    fbuilder->CreateGuardBailPoint(_PYGUARD_ATTR);
+}
+
+void
+AttributeAccessor::GuardType(Value *type_v, BasicBlock *do_access,
+                             BasicBlock *miss)
+{
+    LlvmFunctionBuilder *fbuilder = this->fbuilder_;
+    BuilderT &builder = this->fbuilder_->builder();
+    LlvmFunctionState *state = this->fbuilder_->state();
+
+    // Now that we know for sure that we are going to optimize this lookup, add
+    // the type to the list of types we need to listen for modifications from
+    // and make the llvm::Values.
+    fbuilder->WatchType(this->guard_type_);
+    this->MakeLlvmValues();
+
+    BasicBlock *guard_descr = state->CreateBasicBlock("ATTR_check_descr");
+
+    // Compare ob_type against type and miss if it's the wrong type.  Since
     // we've subscribed to the type object for modification updates, the code
     // will be invalidated before the type object is freed.  Therefore we don't
     // need to incref it, or any of its members.
-    builder.SetInsertPoint(guard_type);
-    Value *type_v = builder.CreateLoad(ObjectTy::ob_type(builder, obj_v));
     Value *is_right_type = builder.CreateICmpEQ(type_v, this->guard_type_v_);
-    builder.CreateCondBr(is_right_type, guard_descr, bail_block);
+    builder.CreateCondBr(is_right_type, guard_descr, miss);
 
     // If there is a descriptor, we need to guard on the descriptor type.  This
     // means emitting one more guard as well as subscribing to changes in the
@@ -568,14 +767,90 @@ AttributeAccessor::GuardAttributeAccess(Value *obj_v, BasicBlock *do_access)
             state->EmbedPointer<PyTypeObject*>(this->guard_descr_type_);
         Value *is_right_descr_type =
             builder.CreateICmpEQ(descr_type_v, guard_descr_type_v);
-        builder.CreateCondBr(is_right_descr_type, do_access, bail_block);
+        builder.CreateCondBr(is_right_descr_type, do_access, miss);
     } else {
         builder.CreateBr(do_access);
     }
+}
 
-    // Fill in the bail bb.
-    builder.SetInsertPoint(bail_block);
-    fbuilder->CreateGuardBailPoint(_PYGUARD_ATTR);
+bool
+PolymorphicAttributeAccessor::CanOptimizeAttrAccess()
+{
+    // AttributeAccessor::CanOptimizeAttrAccess() has already counted sites
+    // with non-string names or no data.
+    if (!PyString_Check(this->name_)) {
+        return false;
+    }
+    const PyRuntimeFeedback *feedback = this->fbuilder_->GetFeedback();
+    if (feedback == NULL) {
+        return false;
+    }
+
+    llvm::SmallVector<PyObject*, 3> types_seen;
+    if (feedback->ObjectsOverflowed()) {
+        feedback->GetDominantObjectsInto(types_seen, kMaxDominantEntries);
+        if (types_seen.empty()) {
+            ACCESS_ATTR_INC_STATS(no_opt_megamorphic);
+            return false;
+        }
+        ACCESS_ATTR_INC_STATS(megamorphic_dominant);
+    } else {
+        feedback->GetSeenObjectsInto(types_seen);
+        if (types_seen.size() > kMaxEntries) {
+            ACCESS_ATTR_INC_STATS(no_opt_megamorphic);
+            return false;
+        }
+        if (types_seen.size() < 2) {
+            return false;
+        }
+    }
+
+    for (unsigned i = 0; i < types_seen.size(); ++i) {
+        assert(PyType_Check(types_seen[i]));
+        AttributeAccessor entry(this->fbuilder_, this->name_,
+                                this->access_kind_);
+        if (entry.CanOptimizeAttrAccessForType(
+                (PyTypeObject*)types_seen[i])) {
+            this->entries_.push_back(entry);
+        }
+    }
+    if (this->entries_.empty()) {
+        ACCESS_ATTR_INC_STATS(no_opt_polymorphic);
+        return false;
+    }
+#ifdef Py_WITH_INSTRUMENTATION
+    access_attr_stats->polymorphic_entries += this->entries_.size();
+#endif
+    return true;
+}
+
+void
+PolymorphicAttributeAccessor::EmitTypeSwitch(
+    Value *obj_v, llvm::SmallVectorImpl<BasicBlock*> &hit_blocks,
+    BasicBlock *miss)
+{
+    LlvmFunctionBuilder *fbuilder = this->fbuilder_;
+    BuilderT &builder = this->fbuilder_->builder();
+    LlvmFunctionState *state = this->fbuilder_->state();
+
+    // If the code object has been invalidated, the cached descriptors may be
+    // stale, so go straight to the generic path.
+    BasicBlock *load_type = state->CreateBasicBlock("ATTR_check_valid");
+    builder.CreateCondBr(fbuilder->GetUseJitCond(), load_type, miss);
+    builder.SetInsertPoint(load_type);
+    Value *type_v = builder.CreateLoad(ObjectTy::ob_type(builder, obj_v));
+
+    hit_blocks.clear();
+    for (unsigned i = 0; i < this->entries_.size(); ++i) {
+        BasicBlock *hit = state->CreateBasicBlock("ATTR_cache_hit");
+        BasicBlock *next = miss;
+        if (i + 1 < this->entries_.size()) {
+            next = state->CreateBasicBlock("ATTR_check_next_type");
+        }
+        this->entries_[i].GuardType(type_v, hit, next);
+        hit_blocks.push_back(hit);
+        builder.SetInsertPoint(next);
+    }
 }
 
 void
@@ -6,6 +6,7 @@
 #error This header expects to be included only in C++ source
 #endif
 
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/Support/IRBuilder.h"
 #include "llvm/Support/TargetFolder.h"
 
@@ -60,15 +61,27 @@ public:
           bail_block_(0) { }
 
     // This helper method returns false if a LOAD_ATTR or STORE_ATTR opcode
-    // cannot be optimized.  If the opcode can be optimized, it fills in
-    // all of the fields of this object by reading the feedback from the
-    // code object.
+    // cannot be optimized for a single receiver type.  If the opcode can be
+    // optimized, it fills in all of the fields of this object by reading the
+    // feedback from the code object.
     bool CanOptimizeAttrAccess();
 
+    // Like CanOptimizeAttrAccess(), but uses the given receiver type instead
+    // of reading it from the feedback.
+    bool CanOptimizeAttrAccessForType(PyTypeObject *type);
+
     // This helper method emits the common type guards for an optimized
-    // LOAD_ATTR or STORE_ATTR.
+    // LOAD_ATTR or STORE_ATTR.  If the guards fail, we bail to the
+    // interpreter.
     void GuardAttributeAccess(llvm::Value *obj_v, llvm::BasicBlock *do_access);
 
+    // Emits the guards for this type alone, starting at the current insert
+    // point.  type_v is the type of the receiver.  Control flows to
+    // do_access if the receiver has guard_type_ and the cached descriptor is
+    // still valid, and to miss otherwise.
+    void GuardType(llvm::Value *type_v, llvm::BasicBlock *do_access,
+                   llvm::BasicBlock *miss);
+
     LlvmFunctionBuilder *fbuilder_;
     AttrAccessKind access_kind_;
 
@@ -121,6 +134,53 @@ private:
 };
 
 
+// This class implements a polymorphic inline cache for LOAD_ATTR and
+// STORE_ATTR sites that have seen a handful of receiver types.  It keeps one
+// AttributeAccessor per cacheable type from the feedback, and emits a type
+// switch that compares the receiver's type against each of them in turn.
+// Unlike the monomorphic guards, a miss does not bail: it falls through to
+// the generic PyObject_GetAttr/PyObject_SetAttr path, since the feedback has
+// already told us this site sees more than one type.
+class PolymorphicAttributeAccessor {
+public:
+    // The most types we cache at one site.  Sites that have seen more
+    // types than this are megamorphic.  They cache at most
+    // kMaxDominantEntries types, if their feedback shows that those types
+    // dominate (see PyFeedbackHistogram), and use the generic path alone
+    // otherwise.
+    enum { kMaxEntries = 3, kMaxDominantEntries = 2 };
+
+    PolymorphicAttributeAccessor(LlvmFunctionBuilder *fbuilder,
+                                 PyObject *name, AttrAccessKind kind)
+        : fbuilder_(fbuilder), access_kind_(kind), name_(name) { }
+
+    // Returns false unless the feedback shows between two and kMaxEntries
+    // receiver types, or dominant types at a megamorphic site, and at least
+    // one of them can be cached.  Types that
+    // can't be cached (for example, because they override tp_getattro) are
+    // left to the generic path.
+    bool CanOptimizeAttrAccess();
+
+    // Emits the type switch, starting at the current insert point.  Fills
+    // hit_blocks with one block per entry in entries_, which control reaches
+    // if the receiver has that entry's type.  Control reaches miss if the
+    // receiver has none of the cached types, or if the code object has been
+    // invalidated since it was compiled.
+    void EmitTypeSwitch(llvm::Value *obj_v,
+                        llvm::SmallVectorImpl<llvm::BasicBlock*> &hit_blocks,
+                        llvm::BasicBlock *miss);
+
+    llvm::SmallVector<AttributeAccessor, kMaxEntries> entries_;
+
+private:
+    typedef llvm::IRBuilder<true, llvm::TargetFolder> BuilderT;
+
+    LlvmFunctionBuilder *fbuilder_;
+    AttrAccessKind access_kind_;
+    PyObject *name_;
+};
+
+
 // This class includes all code related to access attributes.
 class OpcodeAttributes
 {
@@ -136,10 +196,14 @@ private:
     // LOAD/STORE_ATTR_safe always works, while LOAD/STORE_ATTR_fast is
     // optimized to skip the descriptor/method lookup on the type if the object
     // type matches.  It will return false if it fails.
+    // LOAD/STORE_ATTR_polymorphic do the same for sites that have seen a few
+    // types, falling back to the safe path on a cache miss.
     void LOAD_ATTR_safe(int names_index);
     bool LOAD_ATTR_fast(int names_index);
+    bool LOAD_ATTR_polymorphic(int names_index);
     void STORE_ATTR_safe(int names_index);
     bool STORE_ATTR_fast(int names_index);
+    bool STORE_ATTR_polymorphic(int names_index);
     bool LOAD_METHOD_known(int names_index);
     bool LOAD_METHOD_unknown(int names_index);
 
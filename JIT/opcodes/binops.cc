@@ -26,6 +26,24 @@ static llvm::ManagedStatic<
 
 #define BINOP_INC_STATS(field) binary_operator_stats->field++
 
+class AccumulatorStats {
+public:
+    AccumulatorStats() : accumulated(0) {}
+
+    ~AccumulatorStats() {
+        errs() << "\nBinary operators storing into their operand's local: "
+               << this->accumulated << "\n";
+    }
+
+    // Number of optimized binary opcodes that lend the local they store
+    // into to the operation (see CallAccumulatingOp()).
+    unsigned accumulated;
+};
+
+static llvm::ManagedStatic<AccumulatorStats> accumulator_stats;
+
+#define ACCUMULATOR_INC_STATS(field) accumulator_stats->field++
+
 void
 py::OpcodeBinops::IncStatsOptimized()
 {
@@ -46,6 +64,7 @@ py::OpcodeBinops::IncStatsTotal()
 
 #else
 #define BINOP_INC_STATS(field)
+#define ACCUMULATOR_INC_STATS(field)
 #endif /* Py_WITH_INSTRUMENTATION */
 
 namespace py {
@@ -71,10 +90,22 @@ OpcodeBinops::GenericBinOp(const char *apifunc)
 }
 
 void
-OpcodeBinops::OptimizedBinOp(const char *apifunc)
+OpcodeBinops::OptimizedBinOp(const char *apifunc, const char *binary_apifunc)
 {
     const PyTypeObject *lhs_type = this->fbuilder_->GetTypeFeedback(0);
     const PyTypeObject *rhs_type = this->fbuilder_->GetTypeFeedback(1);
+    // An operand that has seen too many types to predict may still have a
+    // dominant one.  We can specialize on that, as long as we fall back to
+    // the generic operation rather than bailing when it doesn't match.
+    bool generic_fallback = false;
+    if (lhs_type == NULL &&
+        (lhs_type = this->fbuilder_->GetDominantTypeFeedback(0)) != NULL) {
+        generic_fallback = true;
+    }
+    if (rhs_type == NULL &&
+        (rhs_type = this->fbuilder_->GetDominantTypeFeedback(1)) != NULL) {
+        generic_fallback = true;
+    }
     if (lhs_type == NULL || rhs_type == NULL) {
         BINOP_INC_STATS(unpredictable);
         this->GenericBinOp(apifunc);
@@ -84,21 +115,31 @@ OpcodeBinops::OptimizedBinOp(const char *apifunc)
     // We're always specializing the receiver, so don't check the lhs for
     // wildcards.
     const char *name = this->fbuilder_->llvm_data()->optimized_ops.
-        Find(apifunc, lhs_type, rhs_type);
+        Find(binary_apifunc, lhs_type, rhs_type);
 
+    bool exact_types = true;
     if (name == NULL) {
         name = this->fbuilder_->llvm_data()->optimized_ops.
-            Find(apifunc, lhs_type, Wildcard);
+            Find(binary_apifunc, lhs_type, Wildcard);
         if (name == NULL) {
             BINOP_INC_STATS(omitted);
             this->GenericBinOp(apifunc);
             return;
         }
+        exact_types = false;
     }
 
+    // Operations on a known pair of builtin types never call back into
+    // Python, but one with a wildcard, like str % x, may call x's __str__.
+    if (exact_types && !generic_fallback)
+        this->fbuilder_->MarkCannotRunPython();
+
     this->fbuilder_->SetOpcodeArgsWithGuard(2);
 
     BINOP_INC_STATS(optimized);
+    if (generic_fallback) {
+        BINOP_INC_STATS(dominant);
+    }
     BasicBlock *success = this->state_->CreateBasicBlock("BINOP_OPT_success");
     BasicBlock *bailpoint = this->state_->CreateBasicBlock("BINOP_OPT_bail");
 
@@ -112,35 +153,115 @@ OpcodeBinops::OptimizedBinOp(const char *apifunc)
     // etc.
     Function *op =
         this->state_->GetGlobalFunction<PyObject*(PyObject*, PyObject*)>(name);
-    Value *result = this->state_->CreateCall(op, lhs, rhs, "binop_result");
-    this->fbuilder_->builder().CreateCondBr(this->state_->IsNull(result),
-                                            bailpoint, success);
-
-    this->fbuilder_->builder().SetInsertPoint(bailpoint);
-    this->fbuilder_->CreateGuardBailPoint(_PYGUARD_BINOP);
+    Value *result = this->CallAccumulatingOp(op, lhs, lhs_type, rhs);
+    if (generic_fallback) {
+        // Both paths leave a new reference, or NULL with an exception set,
+        // in result_addr, with the operands still on the stack, and meet in
+        // success to finish the opcode.
+        Value *result_addr = this->state_->CreateAllocaInEntryBlock(
+            PyTypeBuilder<PyObject*>::get(this->fbuilder_->context()),
+            NULL, "BINOP_OPT_result_addr");
+        this->fbuilder_->builder().CreateStore(result, result_addr);
+        this->fbuilder_->builder().CreateCondBr(
+            this->state_->IsNull(result), bailpoint, success);
+
+        this->fbuilder_->builder().SetInsertPoint(bailpoint);
+        Function *generic_op = this->state_->GetGlobalFunction<
+            PyObject*(PyObject*, PyObject*)>(apifunc);
+        this->fbuilder_->builder().CreateStore(
+            this->state_->CreateCall(generic_op, lhs, rhs,
+                                     "binop_generic_result"),
+            result_addr);
+        this->fbuilder_->builder().CreateBr(success);
+
+        this->fbuilder_->builder().SetInsertPoint(success);
+        result = this->fbuilder_->builder().CreateLoad(result_addr,
+                                                       "binop_result");
+    } else {
+        this->fbuilder_->builder().CreateCondBr(
+            this->state_->IsNull(result), bailpoint, success);
+        this->fbuilder_->builder().SetInsertPoint(bailpoint);
+        this->fbuilder_->CreateGuardBailPoint(_PYGUARD_BINOP);
+        this->fbuilder_->builder().SetInsertPoint(success);
+    }
 
-    this->fbuilder_->builder().SetInsertPoint(success);
     this->fbuilder_->BeginOpcodeImpl();
     this->state_->DecRef(lhs);
     this->state_->DecRef(rhs);
+    if (generic_fallback)
+        this->fbuilder_->PropagateExceptionOnNull(result);
     this->fbuilder_->SetOpcodeResult(0, result);
 }
 
-#define BINOP_METH(OPCODE, APIFUNC)     \
-void                                    \
-OpcodeBinops::OPCODE()                  \
-{                                       \
-    BINOP_INC_STATS(total);             \
-    BINOP_INC_STATS(omitted);           \
-    this->GenericBinOp(#APIFUNC);       \
+// The optimized int and float operations store their result in an operand
+// that only our value stack refers to, rather than allocating a new object
+// (see int_result() in llvm_inline_functions.c).  In a loop like
+//     for x in data:
+//         total = total + x
+// the old value of total is also referenced by the local, so it never
+// qualifies, even though STORE_FAST is about to drop that reference.  When
+// the result goes straight into a local (see find_accumulators() in
+// llvm_compile.cc) and lhs is that local's value, we lend the local's
+// reference to op for the duration of the call.  No Python code runs in op,
+// and the local is overwritten right after, so nobody can see the old value
+// change.
+Value *
+OpcodeBinops::CallAccumulatingOp(Function *op, Value *lhs,
+                                 const PyTypeObject *lhs_type, Value *rhs)
+{
+    llvm::DenseMap<int, int>::iterator accumulator =
+        this->fbuilder_->accumulators().find(this->fbuilder_->GetLasti());
+    if (accumulator == this->fbuilder_->accumulators().end() ||
+        (lhs_type != &PyInt_Type && lhs_type != &PyFloat_Type)) {
+        return this->state_->CreateCall(op, lhs, rhs, "binop_result");
+    }
+    ACCUMULATOR_INC_STATS(accumulated);
+
+    BasicBlock *lend = this->state_->CreateBasicBlock("BINOP_OPT_lend");
+    BasicBlock *call = this->state_->CreateBasicBlock("BINOP_OPT_call");
+    BasicBlock *give_back =
+        this->state_->CreateBasicBlock("BINOP_OPT_give_back");
+    BasicBlock *called = this->state_->CreateBasicBlock("BINOP_OPT_called");
+
+    Value *local = this->fbuilder_->builder().CreateLoad(
+        this->fbuilder_->GetLocal(accumulator->second), "accumulator");
+    Value *is_local =
+        this->fbuilder_->builder().CreateICmpEQ(lhs, local, "lhs_is_local");
+    this->fbuilder_->builder().CreateCondBr(is_local, lend, call);
+
+    // The value stack holds another reference to lhs, so this can't free it.
+    this->fbuilder_->builder().SetInsertPoint(lend);
+    this->state_->DecRef(lhs);
+    this->fbuilder_->builder().CreateBr(call);
+
+    this->fbuilder_->builder().SetInsertPoint(call);
+    Value *result = this->state_->CreateCall(op, lhs, rhs, "binop_result");
+    this->fbuilder_->builder().CreateCondBr(is_local, give_back, called);
+
+    this->fbuilder_->builder().SetInsertPoint(give_back);
+    this->state_->IncRef(lhs);
+    this->fbuilder_->builder().CreateBr(called);
+
+    this->fbuilder_->builder().SetInsertPoint(called);
+    return result;
+}
+
+#define BINOP_OPT(OPCODE, APIFUNC)              \
+void                                            \
+OpcodeBinops::OPCODE()                          \
+{                                               \
+    BINOP_INC_STATS(total);                     \
+    this->OptimizedBinOp(#APIFUNC, #APIFUNC);   \
 }
 
-#define BINOP_OPT(OPCODE, APIFUNC)      \
-void                                    \
-OpcodeBinops::OPCODE()                  \
-{                                       \
-    BINOP_INC_STATS(total);             \
-    this->OptimizedBinOp(#APIFUNC);     \
+// None of the types we have optimized operations for implement the in-place
+// number methods, so for them the in-place operator is the binary one.
+#define INPLACE_OPT(OPCODE, APIFUNC, BINARY_APIFUNC)    \
+void                                                    \
+OpcodeBinops::OPCODE()                                  \
+{                                                       \
+    BINOP_INC_STATS(total);                             \
+    this->OptimizedBinOp(#APIFUNC, #BINARY_APIFUNC);    \
 }
 
 BINOP_OPT(BINARY_ADD, PyNumber_Add)
@@ -149,30 +270,31 @@ BINOP_OPT(BINARY_MULTIPLY, PyNumber_Multiply)
 BINOP_OPT(BINARY_DIVIDE, PyNumber_Divide)
 BINOP_OPT(BINARY_MODULO, PyNumber_Remainder)
 BINOP_OPT(BINARY_SUBSCR, PyObject_GetItem)
+BINOP_OPT(BINARY_TRUE_DIVIDE, PyNumber_TrueDivide)
+BINOP_OPT(BINARY_LSHIFT, PyNumber_Lshift)
+BINOP_OPT(BINARY_RSHIFT, PyNumber_Rshift)
+BINOP_OPT(BINARY_OR, PyNumber_Or)
+BINOP_OPT(BINARY_XOR, PyNumber_Xor)
+BINOP_OPT(BINARY_AND, PyNumber_And)
+BINOP_OPT(BINARY_FLOOR_DIVIDE, PyNumber_FloorDivide)
+
+INPLACE_OPT(INPLACE_ADD, PyNumber_InPlaceAdd, PyNumber_Add)
+INPLACE_OPT(INPLACE_SUBTRACT, PyNumber_InPlaceSubtract, PyNumber_Subtract)
+INPLACE_OPT(INPLACE_MULTIPLY, PyNumber_InPlaceMultiply, PyNumber_Multiply)
+INPLACE_OPT(INPLACE_TRUE_DIVIDE, PyNumber_InPlaceTrueDivide,
+            PyNumber_TrueDivide)
+INPLACE_OPT(INPLACE_DIVIDE, PyNumber_InPlaceDivide, PyNumber_Divide)
+INPLACE_OPT(INPLACE_MODULO, PyNumber_InPlaceRemainder, PyNumber_Remainder)
+INPLACE_OPT(INPLACE_LSHIFT, PyNumber_InPlaceLshift, PyNumber_Lshift)
+INPLACE_OPT(INPLACE_RSHIFT, PyNumber_InPlaceRshift, PyNumber_Rshift)
+INPLACE_OPT(INPLACE_OR, PyNumber_InPlaceOr, PyNumber_Or)
+INPLACE_OPT(INPLACE_XOR, PyNumber_InPlaceXor, PyNumber_Xor)
+INPLACE_OPT(INPLACE_AND, PyNumber_InPlaceAnd, PyNumber_And)
+INPLACE_OPT(INPLACE_FLOOR_DIVIDE, PyNumber_InPlaceFloorDivide,
+            PyNumber_FloorDivide)
 
-BINOP_METH(BINARY_TRUE_DIVIDE, PyNumber_TrueDivide)
-BINOP_METH(BINARY_LSHIFT, PyNumber_Lshift)
-BINOP_METH(BINARY_RSHIFT, PyNumber_Rshift)
-BINOP_METH(BINARY_OR, PyNumber_Or)
-BINOP_METH(BINARY_XOR, PyNumber_Xor)
-BINOP_METH(BINARY_AND, PyNumber_And)
-BINOP_METH(BINARY_FLOOR_DIVIDE, PyNumber_FloorDivide)
-
-BINOP_METH(INPLACE_ADD, PyNumber_InPlaceAdd)
-BINOP_METH(INPLACE_SUBTRACT, PyNumber_InPlaceSubtract)
-BINOP_METH(INPLACE_MULTIPLY, PyNumber_InPlaceMultiply)
-BINOP_METH(INPLACE_TRUE_DIVIDE, PyNumber_InPlaceTrueDivide)
-BINOP_METH(INPLACE_DIVIDE, PyNumber_InPlaceDivide)
-BINOP_METH(INPLACE_MODULO, PyNumber_InPlaceRemainder)
-BINOP_METH(INPLACE_LSHIFT, PyNumber_InPlaceLshift)
-BINOP_METH(INPLACE_RSHIFT, PyNumber_InPlaceRshift)
-BINOP_METH(INPLACE_OR, PyNumber_InPlaceOr)
-BINOP_METH(INPLACE_XOR, PyNumber_InPlaceXor)
-BINOP_METH(INPLACE_AND, PyNumber_InPlaceAnd)
-BINOP_METH(INPLACE_FLOOR_DIVIDE, PyNumber_InPlaceFloorDivide)
-
-#undef BINOP_METH
 #undef BINOP_OPT
+#undef INPLACE_OPT
 
 // PyNumber_Power() and PyNumber_InPlacePower() take three arguments, the
 // third should be Py_None when calling from BINARY_POWER/INPLACE_POWER.
@@ -8,6 +8,11 @@
 
 #include "Python.h"
 
+namespace llvm {
+    class Function;
+    class Value;
+}
+
 namespace py {
 
 class LlvmFunctionBuilder;
@@ -64,7 +69,14 @@ private:
     // GenericBinOp's apifunc is "PyObject *(*)(PyObject *, PyObject *)"
     void GenericBinOp(const char *apifunc);
     // Like GenericBinOp(), but uses an optimized version if available.
-    void OptimizedBinOp(const char *apifunc);
+    // binary_apifunc names the operation to look up in OptimizedOps; it
+    // differs from apifunc for the in-place operators.
+    void OptimizedBinOp(const char *apifunc, const char *binary_apifunc);
+    // Emits a call to the optimized operation op, lending it the reference
+    // held by the local the result is stored into, if any.
+    llvm::Value *CallAccumulatingOp(llvm::Function *op, llvm::Value *lhs,
+                                    const PyTypeObject *lhs_type,
+                                    llvm::Value *rhs);
     // GenericPowOp's is "PyObject *(*)(PyObject *, PyObject *, PyObject *)"
     void GenericPowOp(const char *apifunc);
 
@@ -1,10 +1,16 @@
 #include "Python.h"
+#include "code.h"
+#include "opcode.h"
 
 #include "JIT/ConstantMirror.h"
+#include "JIT/PyBytecodeIterator.h"
+#include "JIT/RuntimeFeedback.h"
 #include "JIT/global_llvm_data.h"
 #include "JIT/llvm_fbuilder.h"
+#include "JIT/opcodes/attributes.h"
 #include "JIT/opcodes/call.h"
 
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/BasicBlock.h"
 #include "llvm/Function.h"
 #include "llvm/Instructions.h"
@@ -17,13 +23,23 @@ using llvm::ConstantInt;
 using llvm::Function;
 using llvm::Type;
 using llvm::Value;
+using llvm::array_endof;
 using llvm::errs;
 
+// Use like "this->GET_GLOBAL_VARIABLE(Type, variable)".
+#define GET_GLOBAL_VARIABLE(TYPE, VARIABLE) \
+    GetGlobalVariable<TYPE>(&VARIABLE, #VARIABLE)
+
+// Python functions whose bodies are longer than this many opcodes are never
+// inlined.
+#define PY_MAX_INLINE_OPCODES 8
+
 #ifdef Py_WITH_INSTRUMENTATION
 class CallFunctionStats {
 public:
     CallFunctionStats()
-        : total(0), direct_calls(0), inlined(0),
+        : total(0), direct_calls(0), dominant(0), inlined(0),
+          inlined_python(0), python_calls(0), no_inline_body(0),
           no_opt_kwargs(0), no_opt_params(0),
           no_opt_no_data(0), no_opt_polymorphic(0) {
     }
@@ -32,7 +48,15 @@ public:
         errs() << "\nCALL_FUNCTION optimization:\n";
         errs() << "Total opcodes: " << this->total << "\n";
         errs() << "Direct C calls: " << this->direct_calls << "\n";
+        errs() << "Direct C calls to a dominant function: "
+               << this->dominant << "\n";
         errs() << "Inlined: " << this->inlined << "\n";
+        errs() << "Inlined Python functions: "
+               << this->inlined_python << "\n";
+        errs() << "Calls to Python functions: "
+               << this->python_calls << "\n";
+        errs() << "No inline: Python function body: "
+               << this->no_inline_body << "\n";
         errs() << "No opt: callsite kwargs: " << this->no_opt_kwargs << "\n";
         errs() << "No opt: function params: " << this->no_opt_params << "\n";
         errs() << "No opt: not C function: " << this->no_opt_not_cfunc << "\n";
@@ -45,8 +69,19 @@ public:
     // How many CALL_FUNCTION opcodes were optimized to direct calls to C
     // functions.
     unsigned direct_calls;
+    // How many of those direct calls were at polymorphic callsites, for the
+    // function the site calls most, with a generic call for the rest.
+    unsigned dominant;
     // How many calls were inlined into the caller.
     unsigned inlined;
+    // How many calls to Python functions were inlined into the caller.
+    unsigned inlined_python;
+    // How many CALL_FUNCTION opcodes call Python functions through
+    // _PyEval_CallPyFunction().
+    unsigned python_calls;
+    // How many calls to a single Python function weren't inlined because
+    // the function's body was too long or did something we can't inline.
+    unsigned no_inline_body;
     // We only optimize call sites without keyword, *args or **kwargs arguments.
     unsigned no_opt_kwargs;
     // We only optimize METH_ARG_RANGE functions so far.
@@ -94,21 +129,29 @@ OpcodeCall::CALL_FUNCTION_fast(int oparg)
         CF_INC_STATS(no_opt_no_data);
         return false;
     }
-    if (feedback->FuncsOverflowed()) {
-        CF_INC_STATS(no_opt_polymorphic);
-        return false;
-    }
-
     llvm::SmallVector<PyTypeMethodPair, 3> fdo_data;
-    feedback->GetSeenFuncsInto(fdo_data);
-    if (fdo_data.size() != 1) {
-#ifdef Py_WITH_INSTRUMENTATION
-        if (fdo_data.size() == 0)
-            CF_INC_STATS(no_opt_no_data);
-        else
+    // A polymorphic callsite may still call one function most of the time.
+    // If so, we specialize on that function, and make a generic call instead
+    // of bailing when it calls something else.
+    bool generic_fallback = false;
+    if (feedback->FuncsOverflowed()) {
+        feedback->GetDominantFuncsInto(fdo_data, 1);
+        if (fdo_data.empty()) {
             CF_INC_STATS(no_opt_polymorphic);
+            return false;
+        }
+        generic_fallback = true;
+    } else {
+        feedback->GetSeenFuncsInto(fdo_data);
+        if (fdo_data.size() != 1) {
+#ifdef Py_WITH_INSTRUMENTATION
+            if (fdo_data.size() == 0)
+                CF_INC_STATS(no_opt_no_data);
+            else
+                CF_INC_STATS(no_opt_polymorphic);
 #endif
-        return false;
+            return false;
+        }
     }
 
     PyMethodDef *func_record = fdo_data[0].second;
@@ -158,18 +201,18 @@ OpcodeCall::CALL_FUNCTION_fast(int oparg)
     this->fbuilder_->BailIfProfiling(not_profiling);
 
     // Handle bailing back to the interpreter if the assumptions below don't
-    // hold.
-    this->builder_.SetInsertPoint(invalid_assumptions);
-    this->fbuilder_->CreateGuardBailPoint(_PYGUARD_CFUNC);
+    // hold.  With a generic fallback, we fill this in at the end instead.
+    if (!generic_fallback) {
+        this->builder_.SetInsertPoint(invalid_assumptions);
+        this->fbuilder_->CreateGuardBailPoint(_PYGUARD_CFUNC);
+    }
 
     this->builder_.SetInsertPoint(not_profiling);
 #ifdef WITH_TSC
     this->state_->LogTscEvent(CALL_START_LLVM);
 #endif
     // Retrieve the function to call from the Python stack.
-    Value *stack_pointer =
-        this->builder_.CreateLoad(this->fbuilder_->stack_pointer_addr());
-    llvm_data_->tbaa_stack.MarkInstruction(stack_pointer);
+    Value *stack_pointer = this->fbuilder_->MaterializeStack();
 
     Value *actual_func = this->builder_.CreateLoad(
         this->builder_.CreateGEP(
@@ -226,7 +269,9 @@ OpcodeCall::CALL_FUNCTION_fast(int oparg)
     this->builder_.SetInsertPoint(all_assumptions_valid);
 
     // Check if we are calling a built-in function that can be specialized.
-    if (cfunc_ptr == _PyBuiltin_Len) {
+    // These specializations bail after popping the arguments, so they can't
+    // be combined with the generic fallback.
+    if (cfunc_ptr == _PyBuiltin_Len && !generic_fallback) {
         // Feedback index 0 is the function itself, index 1 is the first
         // argument.
         const PyTypeObject *arg1_type = this->fbuilder_->GetTypeFeedback(1);
@@ -309,6 +354,22 @@ OpcodeCall::CALL_FUNCTION_fast(int oparg)
     // Check signals and maybe switch threads after each function call.
     this->fbuilder_->CheckPyTicker();
 
+    if (generic_fallback) {
+        BasicBlock *done =
+            this->state_->CreateBasicBlock("CALL_FUNCTION_done");
+        this->builder_.CreateBr(done);
+
+        // CALL_FUNCTION_safe() pops the same arguments the direct call just
+        // did, so restore the stack top it expects before emitting it.
+        this->fbuilder_->FinishOpcodeImpl(num_args + 1);
+        this->builder_.SetInsertPoint(invalid_assumptions);
+        this->CALL_FUNCTION_safe(oparg);
+        this->builder_.CreateBr(done);
+
+        this->builder_.SetInsertPoint(done);
+        CF_INC_STATS(dominant);
+    }
+
     CF_INC_STATS(direct_calls);
     return true;
 }
@@ -347,9 +408,7 @@ OpcodeCall::CALL_FUNCTION_safe(int oparg)
 #ifdef WITH_TSC
     this->state_->LogTscEvent(CALL_START_LLVM);
 #endif
-    Value *stack_pointer =
-        this->builder_.CreateLoad(this->fbuilder_->stack_pointer_addr());
-    llvm_data_->tbaa_stack.MarkInstruction(stack_pointer);
+    Value *stack_pointer = this->fbuilder_->MaterializeStack();
 
     int num_args = oparg & 0xff;
     int num_kwargs = (oparg>>8) & 0xff;
@@ -372,11 +431,500 @@ OpcodeCall::CALL_FUNCTION_safe(int oparg)
     this->fbuilder_->CheckPyTicker();
 }
 
+struct OpcodeCall::InlinePlan {
+    struct Step {
+        int opcode;
+        int oparg;
+        // For binary operators, the optimized version to call.
+        const char *binop_func;
+        // For LOAD_ATTR, the index of its accessor in accessors.
+        unsigned accessor;
+    };
+
+    llvm::SmallVector<Step, PY_MAX_INLINE_OPCODES> steps;
+    llvm::SmallVector<AttributeAccessor, 2> accessors;
+};
+
+// Returns the only type the callee's feedback has seen for the given argument
+// of the opcode at opcode_index, or NULL.
+static PyTypeObject *
+GetCalleeTypeFeedback(PyCodeObject *callee, unsigned opcode_index,
+                      unsigned arg_index)
+{
+    const PyFeedbackMap *map = callee->co_runtime_feedback;
+    if (map == NULL)
+        return NULL;
+    const PyRuntimeFeedback *feedback =
+        map->GetFeedbackEntry(opcode_index, arg_index);
+    if (feedback == NULL || feedback->ObjectsOverflowed())
+        return NULL;
+
+    llvm::SmallVector<PyObject*, 3> types;
+    feedback->GetSeenObjectsInto(types);
+    if (types.size() != 1 || types[0] == NULL || !PyType_CheckExact(types[0]))
+        return NULL;
+    return (PyTypeObject*)types[0];
+}
+
+// Returns the C API function that implements the given binary operator, or
+// NULL if we don't inline it.
+static const char *
+GetBinopApiFunc(int opcode)
+{
+    switch (opcode) {
+    case BINARY_ADD:
+        return "PyNumber_Add";
+    case BINARY_SUBTRACT:
+        return "PyNumber_Subtract";
+    case BINARY_MULTIPLY:
+        return "PyNumber_Multiply";
+    case BINARY_DIVIDE:
+        return "PyNumber_Divide";
+    case BINARY_MODULO:
+        return "PyNumber_Remainder";
+    case BINARY_SUBSCR:
+        return "PyObject_GetItem";
+    default:
+        return NULL;
+    }
+}
+
+// We only inline callees that compute a single expression from their
+// arguments and constants: attribute loads, arithmetic on a few builtin
+// types, and identity tests.  None of these run Python code when their guards
+// pass, so nothing can tell that the callee never got a frame.  Everything
+// that might need one (a profiler, an exception, a Python-level __getattr__
+// or __add__) makes a regular call instead, which creates the frame then.
+// Since the inlined code has no side effects until every guard has passed,
+// that call starts from scratch.
+bool
+OpcodeCall::PlanInline(PyCodeObject *callee, int num_args, InlinePlan &plan)
+{
+    const int required_flags = CO_OPTIMIZED | CO_NEWLOCALS | CO_NOFREE;
+    const int forbidden_flags = CO_VARARGS | CO_VARKEYWORDS | CO_GENERATOR;
+    if ((callee->co_flags & required_flags) != required_flags ||
+        (callee->co_flags & forbidden_flags) != 0 ||
+        callee->co_argcount != num_args) {
+        return false;
+    }
+
+    // How many values the callee's stack holds before each opcode.
+    int depth = 0;
+    PyBytecodeIterator iter(callee->co_code);
+    for (; !iter.Done() && !iter.Error(); iter.Advance()) {
+        if (plan.steps.size() == PY_MAX_INLINE_OPCODES)
+            return false;
+        InlinePlan::Step step = { iter.Opcode(), iter.Oparg(), NULL, 0 };
+        switch (step.opcode) {
+        case LOAD_FAST:
+            // Other locals haven't been assigned yet.
+            if (step.oparg >= num_args)
+                return false;
+            ++depth;
+            break;
+        case LOAD_CONST:
+            ++depth;
+            break;
+        case LOAD_ATTR: {
+            PyObject *name = PyTuple_GET_ITEM(callee->co_names, step.oparg);
+            PyTypeObject *type =
+                GetCalleeTypeFeedback(callee, iter.CurIndex(), 0);
+            if (depth < 1 || type == NULL || !PyString_Check(name))
+                return false;
+            AttributeAccessor accessor(this->fbuilder_, name,
+                                       ATTR_ACCESS_LOAD);
+            if (!accessor.CanOptimizeAttrAccessForType(type))
+                return false;
+            // Member descriptors (__slots__) are the only getters we know
+            // can't run Python code.
+            if (accessor.descr_get_ != NULL &&
+                accessor.guard_descr_type_ != &PyMemberDescr_Type)
+                return false;
+            step.accessor = plan.accessors.size();
+            plan.accessors.push_back(accessor);
+            break;
+        }
+        case BINARY_ADD:
+        case BINARY_SUBTRACT:
+        case BINARY_MULTIPLY:
+        case BINARY_DIVIDE:
+        case BINARY_MODULO:
+        case BINARY_SUBSCR: {
+            const char *api_func = GetBinopApiFunc(step.opcode);
+            const PyTypeObject *lhs_type =
+                GetCalleeTypeFeedback(callee, iter.CurIndex(), 0);
+            const PyTypeObject *rhs_type =
+                GetCalleeTypeFeedback(callee, iter.CurIndex(), 1);
+            if (depth < 2 || lhs_type == NULL || rhs_type == NULL)
+                return false;
+            OptimizedOps &optimized_ops = this->llvm_data_->optimized_ops;
+            step.binop_func = optimized_ops.Find(api_func, lhs_type, rhs_type);
+            if (step.binop_func == NULL)
+                step.binop_func =
+                    optimized_ops.Find(api_func, lhs_type, Wildcard);
+            if (step.binop_func == NULL)
+                return false;
+            --depth;
+            break;
+        }
+        case COMPARE_OP:
+            if (depth < 2 ||
+                (step.oparg != PyCmp_IS && step.oparg != PyCmp_IS_NOT))
+                return false;
+            --depth;
+            break;
+        case RETURN_VALUE:
+            // Anything after the first RETURN_VALUE is unreachable, since
+            // we don't allow jumps.
+            if (depth != 1)
+                return false;
+            plan.steps.push_back(step);
+            return true;
+        default:
+            return false;
+        }
+        plan.steps.push_back(step);
+    }
+    if (iter.Error())
+        PyErr_Clear();
+    return false;
+}
+
+void
+OpcodeCall::EmitInlineFailure(const llvm::SmallVectorImpl<Value*> &owned,
+                              BasicBlock *generic)
+{
+    for (unsigned i = 0; i < owned.size(); ++i) {
+        this->state_->DecRef(owned[i]);
+    }
+    this->builder_.CreateBr(generic);
+}
+
+Value *
+OpcodeCall::EmitInlinedBody(PyCodeObject *callee, InlinePlan &plan,
+                            const llvm::SmallVectorImpl<Value*> &args,
+                            BasicBlock *generic)
+{
+    // The callee's value stack.  Like the real one, it holds new
+    // references.
+    llvm::SmallVector<Value*, PY_MAX_INLINE_OPCODES> stack;
+    PyConstantMirror &mirror = this->llvm_data_->constant_mirror();
+
+    for (unsigned i = 0; i < plan.steps.size(); ++i) {
+        const InlinePlan::Step &step = plan.steps[i];
+        switch (step.opcode) {
+        case LOAD_FAST: {
+            Value *arg = args[step.oparg];
+            this->state_->IncRef(arg);
+            stack.push_back(arg);
+            break;
+        }
+        case LOAD_CONST: {
+            Value *const_ = this->builder_.CreateBitCast(
+                this->state_->GetGlobalVariableFor(
+                    PyTuple_GET_ITEM(callee->co_consts, step.oparg)),
+                PyTypeBuilder<PyObject*>::get(this->fbuilder_->context()));
+            this->state_->IncRef(const_);
+            stack.push_back(const_);
+            break;
+        }
+        case LOAD_ATTR: {
+            AttributeAccessor &accessor = plan.accessors[step.accessor];
+            Value *obj = stack.back();
+            BasicBlock *do_access =
+                this->state_->CreateBasicBlock("CALL_FUNCTION_inline_getattr");
+            BasicBlock *miss =
+                this->state_->CreateBasicBlock("CALL_FUNCTION_inline_miss");
+            BasicBlock *failed =
+                this->state_->CreateBasicBlock("CALL_FUNCTION_inline_failed");
+            BasicBlock *got_attr =
+                this->state_->CreateBasicBlock("CALL_FUNCTION_inline_got_attr");
+
+            BasicBlock *guard_type =
+                this->state_->CreateBasicBlock("CALL_FUNCTION_inline_guard");
+
+            // The accessor borrows the descriptor and dictoffset on the
+            // promise that we're invalidated when the type changes, and
+            // an earlier step of the body may have run a property.
+            this->builder_.CreateCondBr(this->fbuilder_->GetUseJitCond(),
+                                        guard_type, miss);
+            this->builder_.SetInsertPoint(guard_type);
+            Value *type_v = this->builder_.CreateLoad(
+                ObjectTy::ob_type(this->builder_, obj));
+            accessor.GuardType(type_v, do_access, miss);
+            this->builder_.SetInsertPoint(miss);
+            this->EmitInlineFailure(stack, generic);
+
+            this->builder_.SetInsertPoint(do_access);
+            Value *getattr_func = this->state_->GetGlobalFunction<
+                PyObject *(PyObject *obj, PyTypeObject *type, PyObject *name,
+                           long dictoffset, PyObject *descr,
+                           descrgetfunc descr_get, char is_data_descr)>(
+                               "_PyLlvm_Object_GenericGetAttr");
+            Value *descr_get_v =
+                mirror.GetGlobalForFunctionPointer<descrgetfunc>(
+                    (void*)accessor.descr_get_, "");
+            Value *getattr_args[] = {
+                obj,
+                accessor.guard_type_v_,
+                accessor.name_v_,
+                accessor.dictoffset_v_,
+                accessor.descr_v_,
+                descr_get_v,
+                accessor.is_data_descr_v_
+            };
+            Value *attr = this->state_->CreateCall(
+                getattr_func, getattr_args, array_endof(getattr_args));
+            this->builder_.CreateCondBr(this->state_->IsNull(attr),
+                                        failed, got_attr);
+
+            // The attribute wasn't there.  The regular call will raise the
+            // AttributeError again, this time with the callee's frame in the
+            // traceback.
+            this->builder_.SetInsertPoint(failed);
+            Function *pyerr_clear =
+                this->state_->GetGlobalFunction<void()>("PyErr_Clear");
+            this->state_->CreateCall(pyerr_clear);
+            this->EmitInlineFailure(stack, generic);
+
+            this->builder_.SetInsertPoint(got_attr);
+            this->state_->DecRef(obj);
+            stack.back() = attr;
+            break;
+        }
+        case BINARY_ADD:
+        case BINARY_SUBTRACT:
+        case BINARY_MULTIPLY:
+        case BINARY_DIVIDE:
+        case BINARY_MODULO:
+        case BINARY_SUBSCR: {
+            Value *rhs = stack[stack.size() - 1];
+            Value *lhs = stack[stack.size() - 2];
+            BasicBlock *failed =
+                this->state_->CreateBasicBlock("CALL_FUNCTION_inline_failed");
+            BasicBlock *success =
+                this->state_->CreateBasicBlock("CALL_FUNCTION_inline_binop");
+            // Like OpcodeBinops::OptimizedBinOp(), this returns NULL without
+            // setting an exception if the operands aren't what it expects.
+            Function *op = this->state_->GetGlobalFunction<
+                PyObject*(PyObject*, PyObject*)>(step.binop_func);
+            Value *result = this->state_->CreateCall(op, lhs, rhs,
+                                                     "binop_result");
+            this->builder_.CreateCondBr(this->state_->IsNull(result),
+                                        failed, success);
+
+            this->builder_.SetInsertPoint(failed);
+            this->EmitInlineFailure(stack, generic);
+
+            this->builder_.SetInsertPoint(success);
+            this->state_->DecRef(lhs);
+            this->state_->DecRef(rhs);
+            stack.pop_back();
+            stack.back() = result;
+            break;
+        }
+        case COMPARE_OP: {
+            Value *rhs = stack[stack.size() - 1];
+            Value *lhs = stack[stack.size() - 2];
+            stack.pop_back();
+            stack.pop_back();
+            Value *is_same = this->builder_.CreateICmpEQ(lhs, rhs);
+            if (step.oparg == PyCmp_IS_NOT)
+                is_same = this->builder_.CreateNot(is_same);
+            this->state_->DecRef(lhs);
+            this->state_->DecRef(rhs);
+            Value *result = this->builder_.CreateSelect(
+                is_same,
+                this->state_->GetGlobalVariableFor(
+                    (PyObject*)&_Py_TrueStruct),
+                this->state_->GetGlobalVariableFor(
+                    (PyObject*)&_Py_ZeroStruct),
+                "COMPARE_OP_result");
+            this->state_->IncRef(result);
+            stack.push_back(result);
+            break;
+        }
+        case RETURN_VALUE:
+            assert(stack.size() == 1);
+            return stack.back();
+        default:
+            assert(0 && "PlanInline() accepted an unknown opcode");
+        }
+    }
+    assert(0 && "PlanInline() accepted a body without RETURN_VALUE");
+    return NULL;
+}
+
+bool
+OpcodeCall::CALL_FUNCTION_inline(int oparg)
+{
+    if ((oparg >> 8) & 0xff)
+        return false;
+
+    // The feedback records the code of every Python function called here.
+    // If there's more than one, we may still inline the one called most,
+    // since we make a regular call whenever the guards fail.
+    const PyRuntimeFeedback *feedback =
+        this->fbuilder_->GetFeedback(PY_FDO_CALLEE_CODE);
+    if (feedback == NULL)
+        return false;
+    llvm::SmallVector<PyObject*, 3> codes;
+    if (feedback->ObjectsOverflowed())
+        feedback->GetDominantObjectsInto(codes, 1);
+    else
+        feedback->GetSeenObjectsInto(codes);
+    if (codes.size() != 1 || codes[0] == NULL || !PyCode_Check(codes[0]))
+        return false;
+
+    // The feedback's reference to callee can go away under us (see
+    // _llvm.clear_feedback()), so the guard below refers to callee through GetGlobalVariableFor(),
+    // which keeps it, and with it the constants we embed, alive for as long
+    // as this machine code.
+    PyCodeObject *callee = (PyCodeObject *)codes[0];
+    int num_args = oparg & 0xff;
+    InlinePlan plan;
+    if (!this->PlanInline(callee, num_args, plan)) {
+        CF_INC_STATS(no_inline_body);
+        return false;
+    }
+
+    BasicBlock *check_profiling =
+        this->state_->CreateBasicBlock(
+            "CALL_FUNCTION_inline_check_profiling");
+    BasicBlock *check_func =
+        this->state_->CreateBasicBlock("CALL_FUNCTION_inline_check_func");
+    BasicBlock *check_code =
+        this->state_->CreateBasicBlock("CALL_FUNCTION_inline_check_code");
+    BasicBlock *body =
+        this->state_->CreateBasicBlock("CALL_FUNCTION_inline_body");
+    BasicBlock *generic =
+        this->state_->CreateBasicBlock("CALL_FUNCTION_inline_generic");
+    BasicBlock *done = this->state_->CreateBasicBlock("CALL_FUNCTION_done");
+
+    // Once this code is invalidated, nothing the inlined body relies on is
+    // guaranteed to still hold, so make the regular call.
+    this->builder_.CreateCondBr(this->fbuilder_->GetUseJitCond(),
+                                check_profiling, generic);
+
+    // A profiler expects to see a call event for every Python function, so
+    // make a regular call if one might be installed.
+    this->builder_.SetInsertPoint(check_profiling);
+    Value *profiling_possible = this->builder_.CreateLoad(
+        this->state_->GET_GLOBAL_VARIABLE(int, _Py_ProfilingPossible));
+    this->builder_.CreateCondBr(this->state_->IsNonZero(profiling_possible),
+                                generic, check_func);
+
+    this->builder_.SetInsertPoint(check_func);
+    Value *stack_pointer = this->fbuilder_->MaterializeStack();
+    Value *actual_func = this->builder_.CreateLoad(
+        this->builder_.CreateGEP(
+            stack_pointer,
+            ConstantInt::getSigned(
+                Type::getInt64Ty(this->fbuilder_->context()),
+                -num_args - 1)));
+    Value *actual_type = this->builder_.CreateLoad(
+        ObjectTy::ob_type(this->builder_, actual_func));
+    Value *is_function = this->builder_.CreateICmpEQ(
+        actual_type,
+        this->state_->EmbedPointer<PyTypeObject*>(&PyFunction_Type),
+        "is_function");
+    this->builder_.CreateCondBr(is_function, check_code, generic);
+
+    // Functions share code objects, and a function's code can be replaced,
+    // so guard on the code rather than the function.  The body uses neither
+    // globals nor defaults, so this is all we need to check.
+    this->builder_.SetInsertPoint(check_code);
+    Value *as_function = this->builder_.CreateBitCast(
+        actual_func,
+        PyTypeBuilder<PyFunctionObject *>::get(this->fbuilder_->context()));
+    Value *actual_code = this->builder_.CreateLoad(
+        FunctionTy::func_code(this->builder_, as_function),
+        "CALL_FUNCTION_actual_code");
+    Value *is_same_code = this->builder_.CreateICmpEQ(
+        actual_code,
+        this->builder_.CreateBitCast(
+            this->state_->GetGlobalVariableFor((PyObject *)callee),
+            PyTypeBuilder<PyObject*>::get(this->fbuilder_->context())));
+    this->builder_.CreateCondBr(is_same_code, body, generic);
+
+    this->builder_.SetInsertPoint(body);
+    llvm::SmallVector<Value*, 8> args;
+    for (int i = num_args; i >= 1; --i) {
+        args.push_back(
+            this->builder_.CreateLoad(
+                this->builder_.CreateGEP(
+                    stack_pointer,
+                    ConstantInt::getSigned(
+                        Type::getInt64Ty(this->fbuilder_->context()), -i))));
+    }
+    Value *result = this->EmitInlinedBody(callee, plan, args, generic);
+
+    this->state_->DecRef(actual_func);
+    for (unsigned i = 0; i < args.size(); ++i) {
+        this->state_->DecRef(args[i]);
+    }
+    this->fbuilder_->SetOpcodeArguments(num_args + 1);
+    this->fbuilder_->SetOpcodeResult(0, result);
+    this->builder_.CreateBr(done);
+
+    // The regular call pops the same arguments the inlined body just did, so
+    // restore the stack top it expects before emitting it.
+    this->fbuilder_->FinishOpcodeImpl(num_args + 1);
+    this->builder_.SetInsertPoint(generic);
+    if (!this->CALL_FUNCTION_python(oparg))
+        this->CALL_FUNCTION_safe(oparg);
+    this->builder_.CreateBr(done);
+
+    this->builder_.SetInsertPoint(done);
+    CF_INC_STATS(inlined_python);
+    return true;
+}
+
+bool
+OpcodeCall::CALL_FUNCTION_python(int oparg)
+{
+    if ((oparg >> 8) & 0xff)
+        return false;
+    const PyRuntimeFeedback *feedback = this->fbuilder_->GetFeedback();
+    if (feedback == NULL || feedback->FuncsOverflowed())
+        return false;
+    llvm::SmallVector<PyTypeMethodPair, 3> fdo_data;
+    feedback->GetSeenFuncsInto(fdo_data);
+    if (fdo_data.size() != 1 || fdo_data[0].first != &PyFunction_Type)
+        return false;
+
+#ifdef WITH_TSC
+    this->state_->LogTscEvent(CALL_START_LLVM);
+#endif
+    Value *stack_pointer = this->fbuilder_->MaterializeStack();
+
+    int num_args = oparg & 0xff;
+    Function *call_function = this->state_->GetGlobalFunction<
+        PyObject *(PyObject **, int)>("_PyEval_CallPyFunction");
+    Value *result = this->state_->CreateCall(
+        call_function,
+        stack_pointer,
+        ConstantInt::get(PyTypeBuilder<int>::get(this->fbuilder_->context()),
+                         num_args),
+        "CALL_FUNCTION_result");
+
+    this->fbuilder_->SetOpcodeArguments(num_args + 1);
+    this->fbuilder_->PropagateExceptionOnNull(result);
+    this->fbuilder_->SetOpcodeResult(0, result);
+
+    // Check signals and maybe switch threads after each function call.
+    this->fbuilder_->CheckPyTicker();
+    CF_INC_STATS(python_calls);
+    return true;
+}
+
 void
 OpcodeCall::CALL_FUNCTION(int oparg)
 {
     CF_INC_STATS(total);
-    if (!this->CALL_FUNCTION_fast(oparg)) {
+    if (!this->CALL_FUNCTION_inline(oparg) &&
+        !this->CALL_FUNCTION_fast(oparg) &&
+        !this->CALL_FUNCTION_python(oparg)) {
         this->CALL_FUNCTION_safe(oparg);
     }
 }
@@ -405,8 +953,7 @@ OpcodeCall::CALL_METHOD(int oparg)
     int num_stack_slots = num_args + 2 * num_kwargs + 1 + 1;
 
     // Look down the stack for the cell that is either padding or a method.
-    Value *stack_pointer =
-        this->builder_.CreateLoad(this->fbuilder_->stack_pointer_addr());
+    Value *stack_pointer = this->fbuilder_->MaterializeStack();
     Value *stack_idx =
         ConstantInt::getSigned(Type::getInt32Ty(this->fbuilder_->context()),
                                -num_stack_slots);
@@ -460,9 +1007,7 @@ OpcodeCall::CallVarKwFunction(int oparg, int call_flag)
 #ifdef WITH_TSC
     this->state_->LogTscEvent(CALL_START_LLVM);
 #endif
-    Value *stack_pointer =
-        this->builder_.CreateLoad(this->fbuilder_->stack_pointer_addr());
-    llvm_data_->tbaa_stack.MarkInstruction(stack_pointer);
+    Value *stack_pointer = this->fbuilder_->MaterializeStack();
 
     int num_args = oparg & 0xff;
     int num_kwargs = (oparg>>8) & 0xff;
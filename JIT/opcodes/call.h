@@ -6,6 +6,7 @@
 #error This header expects to be included only in C++ source
 #endif
 
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/Support/IRBuilder.h"
 #include "llvm/Support/TargetFolder.h"
 
@@ -40,6 +41,38 @@ private:
     void CALL_FUNCTION_safe(int num_args);
     bool CALL_FUNCTION_fast(int num_args);
 
+    // Inlines the body of a small Python function if the feedback shows that
+    // this callsite calls one, or mostly calls one.  The inlined code guards
+    // on the identity of the function's code object, and makes a regular
+    // call when that or any other guard fails.  Returns false without
+    // emitting anything if the callee can't be inlined.
+    bool CALL_FUNCTION_inline(int num_args);
+
+    // The opcodes of a Python function body we know how to inline.  Filled
+    // in by PlanInline().
+    struct InlinePlan;
+
+    // Returns true if callee, called with num_args positional arguments, can
+    // be inlined.  If so, fills in plan.
+    bool PlanInline(PyCodeObject *callee, int num_args, InlinePlan &plan);
+
+    // Emits the inlined body of the callee described by plan, applied to
+    // args, and returns its result as a new reference.  If any of the
+    // callee's guards fail, control goes to generic with no references held.
+    llvm::Value *EmitInlinedBody(PyCodeObject *callee, InlinePlan &plan,
+                                 const llvm::SmallVectorImpl<llvm::Value*> &args,
+                                 llvm::BasicBlock *generic);
+
+    // Decrefs each value in owned, then branches to generic.
+    void EmitInlineFailure(const llvm::SmallVectorImpl<llvm::Value*> &owned,
+                           llvm::BasicBlock *generic);
+
+    // If the feedback shows that this callsite only calls Python functions,
+    // calls them through _PyEval_CallPyFunction(), which enters their
+    // machine code directly if they have any.  Returns false without
+    // emitting anything otherwise.
+    bool CALL_FUNCTION_python(int num_args);
+
     // Specialized version of CALL_FUNCTION for len() on certain types.
     void CALL_FUNCTION_fast_len(llvm::Value *actual_func,
                                 llvm::Value *stack_pointer,
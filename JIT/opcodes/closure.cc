@@ -26,11 +26,7 @@ OpcodeClosure::OpcodeClosure(LlvmFunctionBuilder *fbuilder) :
 void
 OpcodeClosure::LOAD_CLOSURE(int freevars_index)
 {
-    Value *cell = this->builder_.CreateLoad(
-        this->builder_.CreateGEP(
-            this->fbuilder_->freevars(),
-            ConstantInt::get(Type::getInt32Ty(this->fbuilder_->context()),
-                             freevars_index)));
+    Value *cell = this->fbuilder_->GetCell(freevars_index);
     this->state_->IncRef(cell);
     this->fbuilder_->Push(cell);
 }
@@ -98,36 +94,31 @@ OpcodeClosure::MAKE_CLOSURE(int num_defaults)
 void
 OpcodeClosure::LOAD_DEREF(int index)
 {
-    BasicBlock *failed_load =
-        this->state_->CreateBasicBlock("LOAD_DEREF_failed_load");
     BasicBlock *unbound_local =
         this->state_->CreateBasicBlock("LOAD_DEREF_unbound_local");
-    BasicBlock *error =
-        this->state_->CreateBasicBlock("LOAD_DEREF_error");
     BasicBlock *success =
         this->state_->CreateBasicBlock("LOAD_DEREF_success");
 
-    Value *cell = this->builder_.CreateLoad(
-        this->builder_.CreateGEP(
-            this->fbuilder_->freevars(),
-            ConstantInt::get(Type::getInt32Ty(this->fbuilder_->context()),
-                             index)));
-    Function *pycell_get = this->state_->GetGlobalFunction<
-        PyObject *(PyObject *)>("PyCell_Get");
-    Value *value = this->state_->CreateCall(
-        pycell_get, cell, "LOAD_DEREF_cell_contents");
+    // Cell variables come from the frame's mirror of their contents; free
+    // variables have to be read from the cell each time.
+    Value *value;
+    Value *contents_addr = this->fbuilder_->GetCellContents(index);
+    if (contents_addr != NULL) {
+        value = this->builder_.CreateLoad(contents_addr,
+                                          "LOAD_DEREF_cell_contents");
+    }
+    else {
+        Function *cell_contents = this->state_->GetGlobalFunction<
+            PyObject *(PyObject *)>("_PyLlvm_Cell_Contents");
+        value = this->state_->CreateCall(
+            cell_contents, this->fbuilder_->GetCell(index),
+            "LOAD_DEREF_cell_contents");
+    }
     this->builder_.CreateCondBr(this->state_->IsNull(value),
-                                failed_load, success);
-
-    this->builder_.SetInsertPoint(failed_load);
-    Function *pyerr_occurred =
-        this->state_->GetGlobalFunction<PyObject *()>("PyErr_Occurred");
-    Value *was_err =
-        this->state_->CreateCall(pyerr_occurred, "LOAD_DEREF_err_occurred");
-    this->builder_.CreateCondBr(this->state_->IsNull(was_err),
-                                unbound_local, error);
+                                unbound_local, success);
 
     this->builder_.SetInsertPoint(unbound_local);
+    this->fbuilder_->MarkCold(unbound_local);
     Function *do_raise =
         this->state_->GetGlobalFunction<void(PyFrameObject*, int)>(
             "_PyEval_RaiseForUnboundFreeVar");
@@ -135,11 +126,10 @@ OpcodeClosure::LOAD_DEREF(int index)
         do_raise, this->fbuilder_->frame(),
         ConstantInt::get(PyTypeBuilder<int>::get(this->fbuilder_->context()),
                          index));
-
-    this->fbuilder_->FallThroughTo(error);
     this->fbuilder_->PropagateException();
 
     this->builder_.SetInsertPoint(success);
+    this->state_->IncRef(value);
     this->fbuilder_->Push(value);
 }
 
@@ -147,19 +137,15 @@ void
 OpcodeClosure::STORE_DEREF(int index)
 {
     Value *value = this->fbuilder_->Pop();
-    Value *cell = this->builder_.CreateLoad(
-        this->builder_.CreateGEP(
-            this->fbuilder_->freevars(),
-            ConstantInt::get(Type::getInt32Ty(this->fbuilder_->context()),
-                             index)));
-    Function *pycell_set = this->state_->GetGlobalFunction<
-        int(PyObject *, PyObject *)>("PyCell_Set");
-    Value *result = this->state_->CreateCall(
-        pycell_set, cell, value, "STORE_DEREF_result");
-    this->state_->DecRef(value);
-    // eval.cc doesn't actually check the return value of this, I guess
-    // we are a little more likely to do things wrong.
-    this->fbuilder_->PropagateExceptionOnNonZero(result);
+    Value *cell = this->fbuilder_->GetCell(index);
+    // Steals our reference to value, the way eval.cc's PyCell_Set() and
+    // Py_DECREF() pair does.
+    Function *cell_set = this->state_->GetGlobalFunction<
+        void(PyObject *, PyObject *)>("_PyLlvm_Cell_Set");
+    this->state_->CreateCall(cell_set, cell, value);
+    Value *contents_addr = this->fbuilder_->GetCellContents(index);
+    if (contents_addr != NULL)
+        this->builder_.CreateStore(value, contents_addr);
 }
 
 }
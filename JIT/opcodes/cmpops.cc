@@ -44,7 +44,8 @@ OpcodeCmpops::OpcodeCmpops(LlvmFunctionBuilder *fbuilder) :
 
 bool
 OpcodeCmpops::COMPARE_OP_fast(int cmp_op, const PyTypeObject *lhs_type,
-                                     const PyTypeObject *rhs_type)
+                                     const PyTypeObject *rhs_type,
+                                     bool generic_fallback)
 {
     const char *api_func = NULL;
 
@@ -81,6 +82,12 @@ OpcodeCmpops::COMPARE_OP_fast(int cmp_op, const PyTypeObject *lhs_type,
     }
 
     CMPOP_INC_STATS(optimized);
+    if (generic_fallback) {
+        CMPOP_INC_STATS(dominant);
+    }
+    else {
+        this->fbuilder_->MarkCannotRunPython();
+    }
 
     BasicBlock *success = this->state_->CreateBasicBlock("CMPOP_OPT_success");
     BasicBlock *bailpoint = this->state_->CreateBasicBlock("CMPOP_OPT_bail");
@@ -93,16 +100,36 @@ OpcodeCmpops::COMPARE_OP_fast(int cmp_op, const PyTypeObject *lhs_type,
     Function *op =
         this->state_->GetGlobalFunction<PyObject*(PyObject*, PyObject*)>(name);
     Value *result = this->state_->CreateCall(op, lhs, rhs, "cmpop_result");
-    this->builder_.CreateCondBr(this->state_->IsNull(result),
-                                bailpoint, success);
+    if (generic_fallback) {
+        // As in OpcodeBinops::OptimizedBinOp(), both paths leave their
+        // result in result_addr and finish the opcode together in success.
+        Value *result_addr = this->state_->CreateAllocaInEntryBlock(
+            PyTypeBuilder<PyObject*>::get(this->fbuilder_->context()),
+            NULL, "CMPOP_OPT_result_addr");
+        this->builder_.CreateStore(result, result_addr);
+        this->builder_.CreateCondBr(this->state_->IsNull(result),
+                                    bailpoint, success);
 
-    this->builder_.SetInsertPoint(bailpoint);
-    this->fbuilder_->CreateBailPoint(_PYFRAME_GUARD_FAIL);
+        this->builder_.SetInsertPoint(bailpoint);
+        this->builder_.CreateStore(this->CallRichCompare(lhs, rhs, cmp_op),
+                                   result_addr);
+        this->builder_.CreateBr(success);
+
+        this->builder_.SetInsertPoint(success);
+        result = this->builder_.CreateLoad(result_addr, "cmpop_result");
+    } else {
+        this->builder_.CreateCondBr(this->state_->IsNull(result),
+                                    bailpoint, success);
+        this->builder_.SetInsertPoint(bailpoint);
+        this->fbuilder_->CreateBailPoint(_PYFRAME_GUARD_FAIL);
+        this->builder_.SetInsertPoint(success);
+    }
 
-    this->builder_.SetInsertPoint(success);
     this->fbuilder_->BeginOpcodeImpl();
     this->state_->DecRef(lhs);
     this->state_->DecRef(rhs);
+    if (generic_fallback)
+        this->fbuilder_->PropagateExceptionOnNull(result);
     this->fbuilder_->SetOpcodeResult(0, result);
     return true;
 }
@@ -113,9 +140,24 @@ OpcodeCmpops::COMPARE_OP(int cmp_op)
     CMPOP_INC_STATS(total);
     const PyTypeObject *lhs_type = this->fbuilder_->GetTypeFeedback(0);
     const PyTypeObject *rhs_type = this->fbuilder_->GetTypeFeedback(1);
+    // Rich comparisons can also be specialized on the dominant type of an
+    // unpredictable operand, falling back to PyObject_RichCompare() instead
+    // of bailing when the guess is wrong.
+    bool generic_fallback = false;
+    if (cmp_op >= PyCmp_LT && cmp_op <= PyCmp_GE) {
+        if (lhs_type == NULL &&
+            (lhs_type = this->fbuilder_->GetDominantTypeFeedback(0)) != NULL) {
+            generic_fallback = true;
+        }
+        if (rhs_type == NULL &&
+            (rhs_type = this->fbuilder_->GetDominantTypeFeedback(1)) != NULL) {
+            generic_fallback = true;
+        }
+    }
     if (lhs_type != NULL && rhs_type != NULL) {
         // Returning true means the op was successfully optimized.
-        if (this->COMPARE_OP_fast(cmp_op, lhs_type, rhs_type)) {
+        if (this->COMPARE_OP_fast(cmp_op, lhs_type, rhs_type,
+                                  generic_fallback)) {
             return;
         }
         CMPOP_INC_STATS(omitted);
@@ -185,16 +227,22 @@ OpcodeCmpops::COMPARE_OP_safe(int cmp_op)
     this->fbuilder_->SetOpcodeResult(0, value);
 }
 
-void
-OpcodeCmpops::RichCompare(Value *lhs, Value *rhs, int cmp_op)
+Value *
+OpcodeCmpops::CallRichCompare(Value *lhs, Value *rhs, int cmp_op)
 {
     Function *pyobject_richcompare = this->state_->GetGlobalFunction<
         PyObject *(PyObject *, PyObject *, int)>("PyObject_RichCompare");
-    Value *result = this->state_->CreateCall(
+    return this->state_->CreateCall(
         pyobject_richcompare, lhs, rhs,
         ConstantInt::get(
             PyTypeBuilder<int>::get(this->fbuilder_->context()), cmp_op),
         "COMPARE_OP_RichCompare_result");
+}
+
+void
+OpcodeCmpops::RichCompare(Value *lhs, Value *rhs, int cmp_op)
+{
+    Value *result = this->CallRichCompare(lhs, rhs, cmp_op);
     this->state_->DecRef(lhs);
     this->state_->DecRef(rhs);
     this->fbuilder_->PropagateExceptionOnNull(result);
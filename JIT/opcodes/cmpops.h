@@ -29,15 +29,23 @@ public:
 private:
     typedef llvm::IRBuilder<true, llvm::TargetFolder> BuilderT;
 
+    // If generic_fallback is true, we fall back to PyObject_RichCompare()
+    // instead of bailing when the types don't match.  Only use that for rich
+    // comparisons.
     bool COMPARE_OP_fast(int cmp_op,
                          const PyTypeObject *lhs_type,
-                         const PyTypeObject *rhs_type);
+                         const PyTypeObject *rhs_type,
+                         bool generic_fallback);
     void COMPARE_OP_safe(int cmp_op);
 
     // Call PyObject_RichCompare(lhs, rhs, cmp_op), pushing the result
     // onto the stack. cmp_op is one of Py_EQ, Py_NE, Py_LT, Py_LE, Py_GT
     // or Py_GE as defined in Python/object.h. Steals both references.
     void RichCompare(llvm::Value *lhs, llvm::Value *rhs, int cmp_op);
+    // Like RichCompare(), but just returns the new reference, or NULL on
+    // error, and leaves lhs, rhs and the stack alone.
+    llvm::Value *CallRichCompare(llvm::Value *lhs, llvm::Value *rhs,
+                                 int cmp_op);
 
     // Call PySequence_Contains(seq, item), returning the result as an i1.
     // Steals both references.
@@ -104,11 +104,82 @@ OpcodeContainer::BUILD_MAP(int size)
 void
 OpcodeContainer::UNPACK_SEQUENCE(int size)
 {
-    // TODO(twouters): We could do even better by combining this opcode and the
-    // STORE_* ones that follow into a single block of code circumventing the
-    // stack altogether. And omitting the horrible external stack munging that
-    // UnpackIterable does.
-    Value *iterable = this->fbuilder_->Pop();
+    const PyTypeObject *seq_type = this->fbuilder_->GetTypeFeedback(0);
+    if (seq_type == &PyTuple_Type) {
+        this->UNPACK_SEQUENCE_fast(size, &PyTuple_Type,
+                                   &LlvmFunctionState::GetTupleItemSlot);
+    }
+    else if (seq_type == &PyList_Type) {
+        this->UNPACK_SEQUENCE_fast(size, &PyList_Type,
+                                   &LlvmFunctionState::GetListItemSlot);
+    }
+    else {
+        Value *iterable = this->fbuilder_->Pop();
+        this->UNPACK_SEQUENCE_safe(size, iterable);
+    }
+}
+
+void
+OpcodeContainer::UNPACK_SEQUENCE_fast(
+    int size, PyTypeObject *seq_type,
+    Value *(LlvmFunctionState::*getitemslot)(Value *, int))
+{
+    BasicBlock *check_size =
+        this->state_->CreateBasicBlock("UNPACK_SEQUENCE_check_size");
+    BasicBlock *fast = this->state_->CreateBasicBlock("UNPACK_SEQUENCE_fast");
+    BasicBlock *generic =
+        this->state_->CreateBasicBlock("UNPACK_SEQUENCE_generic");
+    BasicBlock *done = this->state_->CreateBasicBlock("UNPACK_SEQUENCE_done");
+
+    this->fbuilder_->SetOpcodeArguments(1);
+    Value *seq = this->fbuilder_->GetOpcodeArg(0);
+    Value *actual_type = this->builder_.CreateLoad(
+        ObjectTy::ob_type(this->builder_, seq));
+    this->builder_.CreateCondBr(
+        this->builder_.CreateICmpEQ(
+            actual_type, this->state_->EmbedPointer<PyTypeObject*>(seq_type)),
+        check_size, generic);
+
+    this->builder_.SetInsertPoint(check_size);
+    Value *seq_size = this->builder_.CreateLoad(
+        VarObjectTy::ob_size(
+            this->builder_,
+            this->builder_.CreateBitCast(
+                seq,
+                PyTypeBuilder<PyVarObject*>::get(this->fbuilder_->context()))));
+    this->builder_.CreateCondBr(
+        this->builder_.CreateICmpEQ(
+            seq_size,
+            ConstantInt::get(
+                PyTypeBuilder<Py_ssize_t>::get(this->fbuilder_->context()),
+                size)),
+        fast, generic);
+
+    // Copy the items straight into our stack slots, last item deepest, as
+    // eval.cc does.  The STORE_FASTs that usually follow then become plain
+    // register moves once mem2reg has run.
+    this->builder_.SetInsertPoint(fast);
+    for (int i = 0; i < size; ++i) {
+        Value *item = this->builder_.CreateLoad(
+            (this->state_->*getitemslot)(seq, size - 1 - i));
+        this->state_->IncRef(item);
+        this->fbuilder_->SetOpcodeResult(i, item);
+    }
+    this->state_->DecRef(seq);
+    this->builder_.CreateBr(done);
+
+    this->builder_.SetInsertPoint(generic);
+    this->fbuilder_->MarkCold(generic);
+    this->fbuilder_->BeginOpcodeImpl();
+    this->UNPACK_SEQUENCE_safe(size, seq);
+    this->builder_.CreateBr(done);
+
+    this->builder_.SetInsertPoint(done);
+}
+
+void
+OpcodeContainer::UNPACK_SEQUENCE_safe(int size, Value *iterable)
+{
     Function *unpack_iterable = this->state_->GetGlobalFunction<
         int(PyObject *, int, PyObject **)>("_PyLlvm_FastUnpackIterable");
     Value *new_stack_pointer = this->builder_.CreateGEP(
@@ -126,6 +197,10 @@ OpcodeContainer::UNPACK_SEQUENCE(int size)
         new_stack_pointer);
     this->state_->DecRef(iterable);
     this->fbuilder_->PropagateExceptionOnNonZero(result);
+    // _PyLlvm_FastUnpackIterable wrote the items into the frame's copy of
+    // the stack, not into our stack slots.
+    this->fbuilder_->ReloadValueStack(this->fbuilder_->stack_top(),
+                                      this->fbuilder_->stack_top() + size);
     // Not setting the new stackpointer on failure does mean that if
     // _PyLlvm_FastUnpackIterable failed after pushing some values onto the
     // stack, and it didn't clean up after itself, we lose references.  This
@@ -322,10 +397,21 @@ OpcodeContainer::IMPORT_NAME_fast()
             PyErr_Clear();
             return false;
         }
+    }
 
-        fbuilder_->WatchDict(WATCHING_BUILTINS);
-        fbuilder_->WatchDict(WATCHING_SYS_MODULES);
+    // From the builtins, we only depend on __import__.  Register our
+    // dependencies even if an earlier compile already set up the watches;
+    // FinishFunction() drops any we don't register.
+    static PyObject *import_str = NULL;
+    if (import_str == NULL) {
+        import_str = PyString_InternFromString("__import__");
+        if (import_str == NULL) {
+            PyErr_Clear();
+            return false;
+        }
     }
+    fbuilder_->WatchDictKey(WATCHING_BUILTINS, import_str);
+    fbuilder_->WatchDict(WATCHING_SYS_MODULES);
 
     BasicBlock *keep_going =
         this->state_->CreateBasicBlock("IMPORT_NAME_keep_going");
@@ -47,6 +47,14 @@ private:
         int size, const char *createname,
         llvm::Value *(LlvmFunctionState::*getitemslot)(llvm::Value *, int));
 
+    // _safe is guaranteed to work on the already-popped iterable; _fast is
+    // specialized for a tuple or list (seq_type) of exactly size items, and
+    // falls back to _safe for anything else.
+    void UNPACK_SEQUENCE_safe(int size, llvm::Value *iterable);
+    void UNPACK_SEQUENCE_fast(
+        int size, PyTypeObject *seq_type,
+        llvm::Value *(LlvmFunctionState::*getitemslot)(llvm::Value *, int));
+
     // _safe is guaranteed to work; _list_int is specialized for indexing a list
     // with an int.
     void STORE_SUBSCR_safe();
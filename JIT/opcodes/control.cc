@@ -86,8 +86,8 @@ OpcodeControl::DoRaise(Value *exc_type, Value *exc_inst, Value *exc_tb)
     Value *is_reraise = this->state_->CreateCall(
         do_raise, exc_type, exc_inst, exc_tb, "raise_is_reraise");
     // If this is a "re-raise", we jump straight to the unwind block.
-    // If it's a new raise, we call PyTraceBack_Here from the
-    // propagate_exception_block_.
+    // If it's a new raise, GetExceptionBlock() calls PyTraceBack_Here on
+    // the way to the handler.
     this->builder_.CreateCondBr(
         this->builder_.CreateICmpEQ(
             is_reraise,
@@ -165,9 +165,9 @@ OpcodeControl::YIELD_VALUE()
 
     Value *retval = this->fbuilder_->Pop();
 
-    // Save everything to the frame object so it'll be there when we
-    // resume from the yield.
-    this->fbuilder_->CopyToFrameObject();
+    // Save the live part of the stack to the frame object so it'll be
+    // there when we resume from the yield.
+    this->fbuilder_->CopyToFrameObject(this->fbuilder_->stack_top());
 
     // Save the right block to jump back to when we resume this generator.
     this->builder_.CreateStore(yield_number, this->fbuilder_->f_lasti_addr());
@@ -185,6 +185,9 @@ OpcodeControl::YIELD_VALUE()
 
     // Continue inserting code inside the resume block.
     this->builder_.SetInsertPoint(yield_resume);
+    // Pick the live part of the stack back up, plus the value that
+    // gen_send_ex() pushed on top of it.  Nothing else survives the yield.
+    this->fbuilder_->ReloadValueStack(0, this->fbuilder_->stack_top() + 1);
     // Set frame->f_lasti back to negative so that exceptions are
     // generated with llvm-provided line numbers.
     this->builder_.CreateStore(
@@ -240,6 +243,21 @@ predict_branch_input(const PyRuntimeFeedback *feedback)
     return result;
 }
 
+// Returns true if the branch has only ever tested True and False, so that
+// IsPythonTrue() can lay out its PyObject_IsTrue() call as cold code.
+static bool
+predict_boolean_input(const PyRuntimeFeedback *feedback)
+{
+    if (feedback == NULL)
+        return false;
+    uintptr_t was_true = feedback->GetCounter(PY_FDO_JUMP_TRUE);
+    uintptr_t was_false = feedback->GetCounter(PY_FDO_JUMP_FALSE);
+    uintptr_t non_boolean = feedback->GetCounter(PY_FDO_JUMP_NON_BOOLEAN);
+    // Same threshold as predict_branch_input(); a wrong guess here only
+    // costs a jump, not a bail.
+    return was_true + was_false > 200 && non_boolean == 0;
+}
+
 void
 OpcodeControl::GetPyCondBranchBailBlock(unsigned true_idx,
                                         BasicBlock **true_block,
@@ -292,7 +310,8 @@ OpcodeControl::POP_JUMP_IF_FALSE(unsigned target_idx,
                                    &bail_idx, &bail_to);
 
     Value *test_value = this->fbuilder_->Pop();
-    Value *is_true = this->fbuilder_->IsPythonTrue(test_value);
+    Value *is_true = this->fbuilder_->IsPythonTrue(
+        test_value, predict_boolean_input(this->fbuilder_->GetFeedback()));
     this->builder_.CreateCondBr(is_true, fallthrough, target);
 
     if (bail_to)
@@ -312,7 +331,8 @@ OpcodeControl::POP_JUMP_IF_TRUE(unsigned target_idx,
                                    &bail_idx, &bail_to);
 
     Value *test_value = this->fbuilder_->Pop();
-    Value *is_true = this->fbuilder_->IsPythonTrue(test_value);
+    Value *is_true = this->fbuilder_->IsPythonTrue(
+        test_value, predict_boolean_input(this->fbuilder_->GetFeedback()));
     this->builder_.CreateCondBr(is_true, target, fallthrough);
 
     if (bail_to)
@@ -338,7 +358,8 @@ OpcodeControl::JUMP_IF_FALSE_OR_POP(unsigned target_idx,
     // IsPythonTrue() will steal the reference to test_value, so make sure
     // the stack owns one too.
     this->state_->IncRef(test_value);
-    Value *is_true = this->fbuilder_->IsPythonTrue(test_value);
+    Value *is_true = this->fbuilder_->IsPythonTrue(
+        test_value, predict_boolean_input(this->fbuilder_->GetFeedback()));
     this->builder_.CreateCondBr(is_true, true_path, target);
     this->builder_.SetInsertPoint(true_path);
     test_value = this->fbuilder_->Pop();
@@ -368,7 +389,8 @@ OpcodeControl::JUMP_IF_TRUE_OR_POP(unsigned target_idx,
     // IsPythonTrue() will steal the reference to test_value, so make sure
     // the stack owns one too.
     this->state_->IncRef(test_value);
-    Value *is_true = this->fbuilder_->IsPythonTrue(test_value);
+    Value *is_true = this->fbuilder_->IsPythonTrue(
+        test_value, predict_boolean_input(this->fbuilder_->GetFeedback()));
     this->builder_.CreateCondBr(is_true, target, false_path);
     this->builder_.SetInsertPoint(false_path);
     test_value = this->fbuilder_->Pop();
@@ -52,8 +52,11 @@ void OpcodeGlobals::LOAD_GLOBAL_fast(int index)
             return;
         }
     }
-    this->fbuilder_->WatchDict(WATCHING_GLOBALS);
-    this->fbuilder_->WatchDict(WATCHING_BUILTINS);
+    // We only depend on this name: rebinding it in the globals (or, for a
+    // builtin, shadowing it there) or in the builtins invalidates us, but
+    // writes to other globals don't.
+    this->fbuilder_->WatchDictKey(WATCHING_GLOBALS, name);
+    this->fbuilder_->WatchDictKey(WATCHING_BUILTINS, name);
 
     BasicBlock *keep_going =
         this->state_->CreateBasicBlock("LOAD_GLOBAL_keep_going");
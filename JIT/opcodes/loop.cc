@@ -1,8 +1,11 @@
 #include "Python.h"
 
 #include "JIT/opcodes/loop.h"
+#include "JIT/ConstantMirror.h"
+#include "JIT/global_llvm_data.h"
 #include "JIT/llvm_fbuilder.h"
 
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/BasicBlock.h"
 #include "llvm/Function.h"
 #include "llvm/Instructions.h"
@@ -39,29 +42,111 @@ OpcodeLoop::GET_ITER()
     this->fbuilder_->Push(iter);
 }
 
+// TODO: generators go through gen_iternext() like any other iterator, so
+// each item still resumes the generator's frame through its YIELD_VALUE
+// resume switch.  Fusing the generator's body into the consuming loop would
+// mean guarding FOR_ITER on the generator's code object, inlining that body
+// at its resume points (see AddYieldResumeBB()), and rebuilding the
+// generator's frame on a bail; none of that exists yet.
+
+// Iterator types that FOR_ITER knows how to advance without going through
+// tp_iternext.  helper names a function in llvm_inline_functions.c; without
+// one, we still call the type's tp_iternext directly.  None of these raise
+// StopIteration, so when can_fail is false NULL always means the loop is
+// over.
+struct InlineIterNext {
+    const PyTypeObject *type;
+    const char *helper;
+    bool can_fail;
+};
+
+static const InlineIterNext *
+find_inline_iternext(const PyTypeObject *type)
+{
+    static const InlineIterNext inline_iternexts[] = {
+        {&PyListIter_Type, "_PyLlvm_IterNext_List", false},
+        {&PyTupleIter_Type, "_PyLlvm_IterNext_Tuple", false},
+        {&PyRangeIter_Type, "_PyLlvm_IterNext_Range", true},
+        // The dict iterators raise RuntimeError if the dict changes size.
+        {&PyDictIterKey_Type, NULL, true},
+        {&PyDictIterValue_Type, NULL, true},
+        {&PyDictIterItem_Type, NULL, true},
+    };
+    if (type == NULL)
+        return NULL;
+    for (size_t i = 0; i < llvm::array_lengthof(inline_iternexts); ++i) {
+        if (inline_iternexts[i].type == type)
+            return &inline_iternexts[i];
+    }
+    return NULL;
+}
+
 void
 OpcodeLoop::FOR_ITER(llvm::BasicBlock *target,
                      llvm::BasicBlock *fallthrough)
 {
     Value *iter = this->fbuilder_->Pop();
+    Value *next_addr = this->state_->CreateAllocaInEntryBlock(
+        PyTypeBuilder<PyObject*>::get(this->fbuilder_->context()),
+        NULL, "FOR_ITER_next_addr");
+    BasicBlock *got_next = this->state_->CreateBasicBlock("got_next");
+    BasicBlock *next_null = this->state_->CreateBasicBlock("next_null");
+    BasicBlock *iter_ended = this->state_->CreateBasicBlock("iter_ended");
     Value *iter_tp = this->builder_.CreateBitCast(
         this->builder_.CreateLoad(
             ObjectTy::ob_type(this->builder_, iter)),
         PyTypeBuilder<PyTypeObject *>::get(this->fbuilder_->context()),
         "iter_type");
+
+    // If the feedback has only seen one of the iterator types above, check
+    // for it and advance it inline, so that LLVM can see the index
+    // arithmetic.  Anything else takes the generic path.
+    const InlineIterNext *inline_next =
+        find_inline_iternext(this->fbuilder_->GetTypeFeedback(0));
+    if (inline_next != NULL) {
+        BasicBlock *fast = this->state_->CreateBasicBlock("FOR_ITER_fast");
+        BasicBlock *generic =
+            this->state_->CreateBasicBlock("FOR_ITER_generic");
+        this->builder_.CreateCondBr(
+            this->builder_.CreateICmpEQ(
+                iter_tp,
+                this->state_->EmbedPointer<PyTypeObject*>(
+                    (void*)inline_next->type)),
+            fast, generic);
+
+        this->builder_.SetInsertPoint(fast);
+        Value *iternext;
+        if (inline_next->helper != NULL) {
+            iternext = this->state_->GetGlobalFunction<
+                PyObject *(PyObject *)>(inline_next->helper);
+        }
+        else {
+            iternext = this->fbuilder_->llvm_data()->constant_mirror().
+                GetGlobalForFunctionPointer<iternextfunc>(
+                    (void*)inline_next->type->tp_iternext, "");
+        }
+        Value *next = this->state_->CreateCall(iternext, iter, "next");
+        this->builder_.CreateStore(next, next_addr);
+        this->builder_.CreateCondBr(this->state_->IsNull(next),
+                                    inline_next->can_fail ?
+                                        next_null : iter_ended,
+                                    got_next);
+
+        this->builder_.SetInsertPoint(generic);
+        this->fbuilder_->MarkCold(generic);
+    }
+
     Value *iternext = this->builder_.CreateLoad(
         TypeTy::tp_iternext(this->builder_, iter_tp),
         "iternext");
     Value *next = this->state_->CreateCall(iternext, iter, "next");
-    BasicBlock *got_next = this->state_->CreateBasicBlock("got_next");
-    BasicBlock *next_null = this->state_->CreateBasicBlock("next_null");
+    this->builder_.CreateStore(next, next_addr);
     this->builder_.CreateCondBr(this->state_->IsNull(next),
                                 next_null, got_next);
 
     this->builder_.SetInsertPoint(next_null);
     Value *err_occurred = this->state_->CreateCall(
         this->state_->GetGlobalFunction<PyObject*()>("PyErr_Occurred"));
-    BasicBlock *iter_ended = this->state_->CreateBasicBlock("iter_ended");
     BasicBlock *exception = this->state_->CreateBasicBlock("exception");
     this->builder_.CreateCondBr(this->state_->IsNull(err_occurred),
                                 iter_ended, exception);
@@ -91,7 +176,7 @@ OpcodeLoop::FOR_ITER(llvm::BasicBlock *target,
 
     this->builder_.SetInsertPoint(got_next);
     this->fbuilder_->Push(iter);
-    this->fbuilder_->Push(next);
+    this->fbuilder_->Push(this->builder_.CreateLoad(next_addr, "next"));
 }
 
 void
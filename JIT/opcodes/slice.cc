@@ -50,40 +50,91 @@ OpcodeSlice::ApplySlice(Value *seq, Value *start, Value *stop)
     this->fbuilder_->Push(result);
 }
 
+// Returns the name of the inlinable slicing function for the predicted
+// types of this SLICE opcode's operands, or NULL if there is none.
+const char *
+OpcodeSlice::FindOptimizedSlice(bool has_start, bool has_stop)
+{
+    const PyTypeObject *seq_type = this->fbuilder_->GetTypeFeedback(0);
+    if (has_start && this->fbuilder_->GetTypeFeedback(1) != &PyInt_Type)
+        return NULL;
+    if (has_stop && this->fbuilder_->GetTypeFeedback(2) != &PyInt_Type)
+        return NULL;
+    if (seq_type == &PyString_Type)
+        return "_PyLlvm_Slice_Str";
+    if (seq_type == &PyUnicode_Type)
+        return "_PyLlvm_Slice_Unicode";
+    return NULL;
+}
+
+void
+OpcodeSlice::SLICE_common(bool has_start, bool has_stop)
+{
+    const char *name = this->FindOptimizedSlice(has_start, has_stop);
+    if (name == NULL) {
+        Value *stop = has_stop ? this->fbuilder_->Pop() :
+            this->state_->GetNull<PyObject*>();
+        Value *start = has_start ? this->fbuilder_->Pop() :
+            this->state_->GetNull<PyObject*>();
+        Value *seq = this->fbuilder_->Pop();
+        this->ApplySlice(seq, start, stop);
+        return;
+    }
+
+    int num_args = 1 + has_start + has_stop;
+    this->fbuilder_->SetOpcodeArgsWithGuard(num_args);
+
+    BasicBlock *success = this->state_->CreateBasicBlock("SLICE_OPT_success");
+    BasicBlock *bailpoint = this->state_->CreateBasicBlock("SLICE_OPT_bail");
+
+    Value *seq = this->fbuilder_->GetOpcodeArg(0);
+    Value *start = has_start ? this->fbuilder_->GetOpcodeArg(1) :
+        this->state_->GetNull<PyObject*>();
+    Value *stop = has_stop ? this->fbuilder_->GetOpcodeArg(num_args - 1) :
+        this->state_->GetNull<PyObject*>();
+
+    Function *op = this->state_->GetGlobalFunction<
+        PyObject *(PyObject *, PyObject *, PyObject *)>(name);
+    Value *result = this->state_->CreateCall(op, seq, start, stop,
+                                             "SLICE_OPT_result");
+    this->fbuilder_->builder().CreateCondBr(this->state_->IsNull(result),
+                                            bailpoint, success);
+
+    this->fbuilder_->builder().SetInsertPoint(bailpoint);
+    this->fbuilder_->CreateGuardBailPoint(_PYGUARD_SLICE);
+
+    this->fbuilder_->builder().SetInsertPoint(success);
+    this->fbuilder_->BeginOpcodeImpl();
+    this->state_->DecRef(seq);
+    if (has_start)
+        this->state_->DecRef(start);
+    if (has_stop)
+        this->state_->DecRef(stop);
+    this->fbuilder_->SetOpcodeResult(0, result);
+}
+
 void
 OpcodeSlice::SLICE_BOTH()
 {
-    Value *stop = this->fbuilder_->Pop();
-    Value *start = this->fbuilder_->Pop();
-    Value *seq = this->fbuilder_->Pop();
-    this->ApplySlice(seq, start, stop);
+    this->SLICE_common(true, true);
 }
 
 void
 OpcodeSlice::SLICE_LEFT()
 {
-    Value *stop = this->state_->GetNull<PyObject*>();
-    Value *start = this->fbuilder_->Pop();
-    Value *seq = this->fbuilder_->Pop();
-    this->ApplySlice(seq, start, stop);
+    this->SLICE_common(true, false);
 }
 
 void
 OpcodeSlice::SLICE_RIGHT()
 {
-    Value *stop = this->fbuilder_->Pop();
-    Value *start = this->state_->GetNull<PyObject*>();
-    Value *seq = this->fbuilder_->Pop();
-    this->ApplySlice(seq, start, stop);
+    this->SLICE_common(false, true);
 }
 
 void
 OpcodeSlice::SLICE_NONE()
 {
-    Value *stop = this->state_->GetNull<PyObject*>();
-    Value *start = this->state_->GetNull<PyObject*>();
-    Value *seq = this->fbuilder_->Pop();
-    this->ApplySlice(seq, start, stop);
+    this->SLICE_common(false, false);
 }
 
 void
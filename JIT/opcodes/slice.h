@@ -38,6 +38,11 @@ public:
     void BUILD_SLICE_THREE();
 
 private:
+    // SLICE_* helpers.  If the sequence is predicted to be a str or unicode
+    // and the bounds ints, slice it inline and bail on anything else;
+    // otherwise call ApplySlice().
+    const char *FindOptimizedSlice(bool has_start, bool has_stop);
+    void SLICE_common(bool has_start, bool has_stop);
     // Apply a classic slice to a sequence, pushing the result onto the
     // stack.  'start' and 'stop' can be Value*'s representing NULL to
     // indicate missing arguments, and all references are stolen.
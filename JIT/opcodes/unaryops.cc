@@ -31,6 +31,42 @@ OpcodeUnaryops::GenericUnaryOp(const char *apifunc)
     this->fbuilder_->Push(result);
 }
 
+void
+OpcodeUnaryops::OptimizedUnaryOp(const char *apifunc)
+{
+    const PyTypeObject *type = this->fbuilder_->GetTypeFeedback(0);
+    const char *name = NULL;
+    if (type != NULL) {
+        name = this->fbuilder_->llvm_data()->optimized_ops.
+            Find(apifunc, type, Wildcard);
+    }
+    if (name == NULL) {
+        this->GenericUnaryOp(apifunc);
+        return;
+    }
+
+    this->fbuilder_->SetOpcodeArgsWithGuard(1);
+
+    BasicBlock *success =
+        this->state_->CreateBasicBlock("UNARYOP_OPT_success");
+    BasicBlock *bailpoint = this->state_->CreateBasicBlock("UNARYOP_OPT_bail");
+
+    Value *value = this->fbuilder_->GetOpcodeArg(0);
+    Function *op =
+        this->state_->GetGlobalFunction<PyObject*(PyObject*)>(name);
+    Value *result = this->state_->CreateCall(op, value, "unaryop_result");
+    this->fbuilder_->builder().CreateCondBr(this->state_->IsNull(result),
+                                            bailpoint, success);
+
+    this->fbuilder_->builder().SetInsertPoint(bailpoint);
+    this->fbuilder_->CreateGuardBailPoint(_PYGUARD_BINOP);
+
+    this->fbuilder_->builder().SetInsertPoint(success);
+    this->fbuilder_->BeginOpcodeImpl();
+    this->state_->DecRef(value);
+    this->fbuilder_->SetOpcodeResult(0, result);
+}
+
 #define UNARYOP_METH(NAME, APIFUNC)			\
 void							\
 OpcodeUnaryops::NAME()				        \
@@ -38,12 +74,20 @@ OpcodeUnaryops::NAME()				        \
     this->GenericUnaryOp(#APIFUNC);			\
 }
 
+#define UNARYOP_OPT(NAME, APIFUNC)			\
+void							\
+OpcodeUnaryops::NAME()				        \
+{							\
+    this->OptimizedUnaryOp(#APIFUNC);			\
+}
+
 UNARYOP_METH(UNARY_CONVERT, PyObject_Repr)
-UNARYOP_METH(UNARY_INVERT, PyNumber_Invert)
+UNARYOP_OPT(UNARY_INVERT, PyNumber_Invert)
 UNARYOP_METH(UNARY_POSITIVE, PyNumber_Positive)
-UNARYOP_METH(UNARY_NEGATIVE, PyNumber_Negative)
+UNARYOP_OPT(UNARY_NEGATIVE, PyNumber_Negative)
 
 #undef UNARYOP_METH
+#undef UNARYOP_OPT
 
 void
 OpcodeUnaryops::UNARY_NOT()
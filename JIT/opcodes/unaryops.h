@@ -26,6 +26,9 @@ public:
 private:
     // GenericUnaryOp's is "PyObject *(*)(PyObject *)"
     void GenericUnaryOp(const char *apifunc);
+    // Like GenericUnaryOp(), but uses the version in OptimizedOps for the
+    // operand's predicted type if there is one, bailing if it fails.
+    void OptimizedUnaryOp(const char *apifunc);
 
     LlvmFunctionBuilder *fbuilder_;
     LlvmFunctionState *state_;
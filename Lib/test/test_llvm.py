@@ -13,7 +13,11 @@ import __builtin__
 import contextlib
 import functools
 import gc
+import os
+import shutil
+import subprocess
 import sys
+import tempfile
 import types
 import unittest
 import weakref
@@ -32,6 +36,7 @@ HOTNESS_LOOP = 1   # Points for a taken loop backedge.
 
 JIT_SPIN_COUNT = _llvm.get_hotness_threshold() / HOTNESS_CALL + 1000
 JIT_OPT_LEVEL = sys.flags.optimize if sys.flags.optimize > 2 else 2
+QUICK_JIT_OPT_LEVEL = max(sys.flags.optimize, 1)
 
 
 @contextlib.contextmanager
@@ -634,6 +639,60 @@ def catch(obj):
         self.assertRaises(ZeroDivisionError, catch, obj)
         self.assertEquals({"x": 2}, obj)
 
+    @at_each_optimization_level
+    def test_exceptions_caught_in_same_function(self, level):
+        # Exceptions raised inside a try go straight to its handler, past
+        # any loops in between and the values they left on the stack.
+        lookup = compile_for_llvm("lookup", """
+def lookup(d, keys):
+    found = []
+    missed = 0
+    for k in keys:
+        try:
+            for i in [1, 2]:
+                found.append((i, d[k]))
+        except KeyError:
+            missed += 1
+    return found, missed
+""", level)
+        self.assertEquals(lookup({1: "a"}, [1, 2, 1, 3]),
+                          ([(1, "a"), (2, "a"), (1, "a"), (2, "a")], 2))
+
+        handler = compile_for_llvm("handler", """
+def handler(obj):
+    try:
+        try:
+            (1, [2, obj.missing])
+        finally:
+            obj.finally_ran = True
+    except AttributeError, e:
+        return type(e), sys.exc_info()[0], e.args
+""", level)
+        class Obj(object):
+            pass
+        obj = Obj()
+        self.assertEquals(handler(obj),
+                          (AttributeError, AttributeError,
+                           ("'Obj' object has no attribute 'missing'",)))
+        self.assertTrue(obj.finally_ran)
+
+        # The traceback still points at the line that raised.
+        reraise = compile_for_llvm("reraise", """
+def reraise():
+    try:
+        {}[1]
+    except ValueError:
+        pass
+""", level)
+        try:
+            reraise()
+        except KeyError:
+            tb = sys.exc_info()[2]
+            self.assertEquals(tb.tb_next.tb_lineno,
+                              reraise.func_code.co_firstlineno + 2)
+        else:
+            self.fail("KeyError not raised")
+
     @at_each_optimization_level
     def test_delete_fast(self, level):
         delit = compile_for_llvm('delit', """
@@ -1417,6 +1476,32 @@ def generator(obj):
         self.assertRaises(StopIteration, g.next)
         self.assertEquals({"finally": 1}, obj)
 
+    @at_each_optimization_level
+    def test_generator_live_stack_across_yield(self, level):
+        # Values below the yield on the value stack have to survive the
+        # round trip through gen_send_ex(), including when resuming with
+        # throw() unwinds them.
+        generator = compile_for_llvm("generator", """
+def generator(a, b):
+    for i in range(3):
+        try:
+            x = (a, b, i, (yield i), [a, (yield b)])
+        except KeyError:
+            x = "caught"
+        yield x
+""", level)
+        g = generator(1, 2)
+        self.assertEquals(0, g.next())
+        self.assertEquals(2, g.send("c"))
+        self.assertEquals((1, 2, 0, "c", [1, "d"]), g.send("d"))
+        self.assertEquals(1, g.next())
+        self.assertEquals(2, g.send("e"))
+        self.assertEquals("caught", g.throw(KeyError))
+        self.assertEquals(2, g.next())
+        self.assertEquals(2, g.send(None))
+        self.assertEquals((1, 2, 2, None, [1, 5]), g.send(5))
+        self.assertRaises(StopIteration, g.next)
+
     # Getting this to work under -Xjit=always is a pain in the ass, and not
     # worth the effort IMHO.
     if _llvm.get_jit_control() != "always":
@@ -1472,6 +1557,64 @@ def unbound_freevar(level):
             ("free variable 'b' referenced before "
              "assignment in enclosing scope",), inner)
 
+    @at_each_optimization_level
+    def test_closure_cell_writes(self, level):
+        # The owning frame keeps its cell variables' contents in registers,
+        # so every write has to reach the cell for the closures to see it.
+        foo = compile_for_llvm('foo', '''
+def foo(n):
+    total = 0
+    get_total = lambda: total
+    seen = []
+    for i in range(n):
+        total = total + i
+        seen.append(get_total())
+    return total, seen
+''', level)
+        self.assertEquals(foo(4), (6, [0, 1, 3, 6]))
+
+        # A free variable can change under an inner function whenever it
+        # calls out, here by resuming its enclosing generator.
+        outer = compile_for_llvm('outer', '''
+def outer(level):
+    x = 1
+    def inner(g):
+        before = x
+        g.next()
+        return before, x
+    if level is not None:
+        inner.__code__.co_use_jit = True
+        inner.__code__.co_optimization = level
+    yield inner
+    x = 2
+    yield
+    x = 3
+    yield
+''', level)
+        g = outer(level)
+        inner = g.next()
+        self.assertEquals(inner(g), (1, 2))
+        self.assertEquals(inner(g), (2, 3))
+
+        # Cell variables have to be picked back up after a yield.
+        gen = compile_for_llvm('gen', '''
+def gen():
+    x = 0
+    bump = lambda: x + 1
+    while x < 3:
+        x = bump()
+        yield x
+''', level)
+        self.assertEquals(list(gen()), [1, 2, 3])
+
+        unbound = compile_for_llvm('unbound', '''
+def unbound():
+    f = lambda: x
+    x = x + 1
+''', level)
+        self.assertRaisesWithArgs(UnboundLocalError,
+            ("local variable 'x' referenced before assignment",), unbound)
+
     @at_each_optimization_level
     def test_closure_unbound_local(self, level):
         unbound_local = compile_for_llvm('unbound_local', '''
@@ -1675,6 +1818,25 @@ def foo():
         # Even though we bailed, the machine code is still valid.
         self.assertTrue(foo.__code__.co_use_jit)
 
+    def test_guard_bail_rebuilds_value_stack(self):
+        # The machine code keeps the value stack out of the frame; a guard
+        # failure has to write it back before the interpreter takes over.
+        # Here the for loop's iterator, the list's bound append method, x
+        # and the half-built tuple are all on the stack when a + b bails.
+        foo = compile_for_llvm("foo", '''
+def foo(xs, a, b):
+    result = []
+    for x in xs:
+        result.append((x, a + b, x))
+    return result
+''', optimization_level=None)
+        spin_until_hot(foo, [[1, 2], 3, 4])
+        self.assertTrue(foo.__code__.co_use_jit)
+        sys.setbailerror(False)
+        self.assertEqual(foo([1, 2], 3.0, 4.0), [(1, 7.0, 1), (2, 7.0, 2)])
+        self.assertEqual(foo("ab", "c", "d"), [("a", "cd", "a"),
+                                               ("b", "cd", "b")])
+
 
 # Tests for div/truediv won't work right if we enable true
 # division in this test.
@@ -2467,6 +2629,22 @@ class OptimizationTests(LlvmTestCase, ExtraAssertsTestCase):
         self.assertContains("getelementptr", str(foo.__code__.co_llvm))
         self.assertEqual(foo(), 5)
 
+    def test_cold_blocks_follow_hot_path(self):
+        foo = compile_for_llvm("foo", '''
+def foo(a, b):
+    x = a + b
+    y = len(x)
+    return y
+''', optimization_level=None)
+        foo.__code__.co_optimization = 0
+        ir = str(foo.__code__.co_llvm)
+        last_hot = ir.rindex("\nline_start")
+        for cold in ["\nbail_to_interpreter:", "\npropagate_exception:",
+                     "\nbail_point"]:
+            self.assertTrue(ir.index(cold) > last_hot, cold)
+        self.assertEqual(foo("ab", "c"), 3)
+        self.assertRaises(TypeError, foo, 1, 2)
+
     def test_hotness(self):
         foo = compile_for_llvm("foo", "def foo(): pass",
                                optimization_level=None)
@@ -2477,6 +2655,86 @@ class OptimizationTests(LlvmTestCase, ExtraAssertsTestCase):
         self.assertEqual(foo.__code__.co_optimization, JIT_OPT_LEVEL)
         self.assertContains("getelementptr", str(foo.__code__.co_llvm))
 
+    def test_quick_tier(self):
+        foo = compile_for_llvm("foo", "def foo(): pass",
+                               optimization_level=None)
+        # Warm code gets the quick pipeline...
+        iterations = _llvm.get_quick_hotness_threshold() / HOTNESS_CALL + 10
+        [foo() for _ in xrange(iterations)]
+        self.assertTrue(foo.__code__.co_use_jit)
+        self.assertEqual(foo.__code__.co_optimization, QUICK_JIT_OPT_LEVEL)
+        # ... and is recompiled with the full pipeline once it gets hot.
+        [foo() for _ in xrange(JIT_SPIN_COUNT)]
+        self.assertTrue(foo.__code__.co_use_jit)
+        self.assertEqual(foo.__code__.co_optimization, JIT_OPT_LEVEL)
+        self.assertEqual(foo(), None)
+
+    def test_quick_tier_counts_loop_hotness(self):
+        # Quick-tier machine code keeps counting loop backedges so that a
+        # long-running loop can still make its code hot.
+        foo = compile_for_llvm("foo", """
+def foo(n):
+    for x in xrange(n):
+        pass
+""", optimization_level=None)
+        spins = _llvm.get_quick_hotness_threshold() / HOTNESS_CALL + 10
+        [foo(0) for _ in xrange(spins)]
+        foo(0)
+        self.assertTrue(foo.__code__.co_use_jit)
+        self.assertEqual(foo.__code__.co_optimization, QUICK_JIT_OPT_LEVEL)
+        hotness = foo.__code__.co_hotness
+        foo(1000)
+        self.assertEqual(foo.__code__.co_hotness,
+                         hotness + HOTNESS_CALL + HOTNESS_LOOP * 1000)
+
+    def test_osr_for_loop(self):
+        # A loop that gets hot in the middle of its only call should finish
+        # in machine code.
+        foo = compile_for_llvm("foo", """
+def foo(n):
+    total = 0
+    for i in xrange(n):
+        total += i
+    return total
+""", optimization_level=None)
+        n = _llvm.get_quick_hotness_threshold() * 2
+        self.assertEqual(foo(n), sum(xrange(n)))
+        self.assertTrue(foo.__code__.co_use_jit)
+        self.assertEqual(foo.__code__.co_optimization, QUICK_JIT_OPT_LEVEL)
+
+    def test_osr_keeps_frame_state(self):
+        # Entering machine code mid-loop must pick up the locals, value stack
+        # and block stack the interpreter built.
+        foo = compile_for_llvm("foo", """
+def foo(n):
+    seen = []
+    try:
+        for i in xrange(n):
+            while i > 5:
+                i -= 5
+            seen.append(i)
+    finally:
+        seen.append(-1)
+    return seen
+""", optimization_level=None)
+        n = _llvm.get_quick_hotness_threshold()
+        expected = [i % 5 or (5 if i else 0) for i in xrange(n)] + [-1]
+        self.assertEqual(foo(n), expected)
+        self.assertTrue(foo.__code__.co_use_jit)
+
+    def test_osr_generator(self):
+        foo = compile_for_llvm("foo", """
+def foo(n):
+    total = 0
+    for i in xrange(n):
+        total += i
+    yield total
+    yield total + 1
+""", optimization_level=None)
+        n = _llvm.get_quick_hotness_threshold() * 2
+        self.assertEqual(list(foo(n)), [sum(xrange(n)), sum(xrange(n)) + 1])
+        self.assertTrue(foo.__code__.co_use_jit)
+
     def test_for_loop_hotness(self):
         # Test that long-running for loops count toward the hotness metric. A
         # function doing 1e6 iterations per call should be worthy of
@@ -2588,8 +2846,9 @@ def foo(iterations):
         iterations = JIT_SPIN_COUNT * HOTNESS_CALL / HOTNESS_LOOP
         for _ in foo(iterations):
             pass
-        # We don't currently increment the hotness counter on loop backedges in
-        # the compiled code, so the hotness stops growing when it passes the
+        # Only quick-tier machine code increments the hotness counter on loop
+        # backedges, so the hotness stops growing once the generator is
+        # recompiled with the full pipeline on the resume after it passes the
         # threshold.
         self.assertEqual(foo.__code__.co_hotness, 100001)
         self.assertTrue(foo.__code__.co_use_jit)
@@ -2697,6 +2956,31 @@ def foo(trigger):
         self.assertEquals(foo.__code__.co_fatalbailcount, 0)
         del match
 
+    def test_unrelated_global_writes_keep_machine_code(self):
+        # The optimized LOAD_GLOBAL only depends on the names it looked up,
+        # so writing other globals in the same module doesn't invalidate it.
+        globals_dict = {"y": 5}
+        foo = compile_for_llvm("foo", """
+def foo():
+    return y + len([])
+""", optimization_level=None, globals_dict=globals_dict)
+        spin_until_hot(foo, [])
+        self.assertEqual(foo.__code__.co_use_jit, True)
+
+        globals_dict["unrelated"] = 1
+        globals_dict.update(other=2)
+        del globals_dict["unrelated"]
+        globals_dict.pop("other")
+        self.assertEqual(foo.__code__.co_use_jit, True)
+        self.assertEqual(foo.__code__.co_fatalbailcount, 0)
+        self.assertEqual(foo(), 5)
+
+        # Rebinding a name it did look up still does.
+        globals_dict["y"] = 6
+        self.assertEqual(foo.__code__.co_use_jit, False)
+        self.assertEqual(foo.__code__.co_fatalbailcount, 1)
+        self.assertEqual(foo(), 6)
+
     def test_print_ir_after_LOAD_GLOBAL_fatal_bail(self):
         # Regression test: this used to segfault when trying to print co_llvm
         # after a fatal bail out of a function using the optimized LOAD_GLOBAL.
@@ -2754,28 +3038,56 @@ def foo():
         sys.setbailerror(False)
         self.assertEqual(foo(lambda x: 7), 7)
 
-    def test_guard_failure_blocks_native_code(self):
-        # Until we can recompile things, failing a guard should force use of the
-        # eval loop forever after. Even once we can recompile things, we should
-        # limit how often we're willing to recompile highly-dynamic functions.
-        # test_mutants has a good example of this.
+    def test_guard_failure_recompiles_with_backoff(self):
+        # Failing a fatal guard sends the code back to the eval loop to
+        # gather more feedback, and it is recompiled once it's hot again.
+        # Each failure doubles the warm-up, and highly-dynamic functions
+        # (test_mutants has a good example) are eventually left in the eval
+        # loop forever after.
 
         # Compile like this so we get a new code object every time.
         foo = compile_for_llvm("foo", "def foo(): return len([])",
                                optimization_level=None)
         spin_until_hot(foo, [])
-        self.assertEqual(foo.__code__.co_use_jit, True)
-        self.assertEqual(foo.__code__.co_fatalbailcount, 0)
+        code = foo.__code__
+        self.assertEqual(code.co_use_jit, True)
+        self.assertEqual(code.co_fatalbailcount, 0)
         self.assertEqual(foo(), 0)
 
-        with test_support.swap_attr(__builtin__, "len", lambda x: 7):
-            self.assertEqual(foo.__code__.co_use_jit, False)
-            self.assertEqual(foo.__code__.co_fatalbailcount, 1)
-            # Since we can't recompile things yet, co_use_jit should be left
-            # at False and execution should use the eval loop.
+        max_bails = _llvm.get_max_fatal_bail_count()
+        threshold = _llvm.get_quick_hotness_threshold()
+        real_len = len
+        try:
+            for bails in range(1, max_bails + 1):
+                # Each rebinding invalidates the code compiled for the last.
+                if bails % 2:
+                    __builtin__.len = lambda x: 7
+                else:
+                    __builtin__.len = real_len
+                expected = len([])
+                self.assertEqual(code.co_use_jit, False)
+                self.assertEqual(code.co_fatalbailcount, bails)
+                self.assertEqual(code.co_hotness, 0)
+                if bails == max_bails:
+                    break
+
+                recompile_hotness = _llvm.get_recompile_hotness(foo)
+                self.assertEqual(recompile_hotness, threshold << bails)
+                with set_jit_control("whenhot"):
+                    for _ in xrange(recompile_hotness):
+                        self.assertEqual(foo(), expected)
+                        if code.co_use_jit:
+                            break
+                self.assertEqual(code.co_use_jit, True)
+                self.assertTrue(code.co_hotness > recompile_hotness)
+                self.assertEqual(foo(), expected)
+
+            self.assertEqual(_llvm.get_recompile_hotness(foo), None)
             spin_until_hot(foo, [])
-            self.assertEqual(foo.__code__.co_use_jit, False)
-            self.assertEqual(foo(), 7)
+            self.assertEqual(code.co_use_jit, False)
+            self.assertEqual(foo(), expected)
+        finally:
+            __builtin__.len = real_len
 
     def test_fast_calls_method(self):
         # This used to crash at one point while developing CALL_FUNCTION's
@@ -2836,6 +3148,276 @@ def foo():
         self.assertRaises(TypeError, foo, 5)
         self.assertContains("@sum", str(foo.__code__.co_llvm))
 
+    def test_fast_calls_dominant_function(self):
+        # This callsite calls several C functions, but mostly len(), so we
+        # call len() directly and make a generic call for everything else.
+        foo = compile_for_llvm('foo', 'def foo(f, x): return f(x)',
+                               optimization_level=None)
+        training = [[len, "ab"]] * 4 + [[abs, -1], [hash, 1], [id, 1],
+                                        [repr, 1]]
+        spin_until_hot(foo, *training)
+        self.assertTrue(foo.__code__.co_use_jit)
+        self.assertContains("@len", str(foo.__code__.co_llvm))
+        self.assertEqual(foo(len, "abc"), 3)
+        # setbailerror is on, so these would raise RuntimeError if we bailed.
+        self.assertEqual(foo(abs, -2), 2)
+        self.assertEqual(foo(repr, 2), "2")
+        self.assertEqual(foo(lambda x: x + 1, 2), 3)
+        self.assertRaises(TypeError, foo, len, 5)
+
+    def test_inline_python_accessor(self):
+        class Point(object):
+            def __init__(self, x):
+                self.x = x
+            def get_x(self):
+                return self.x
+        foo = compile_for_llvm('foo', 'def foo(p): return p.get_x()',
+                               optimization_level=None)
+        spin_until_hot(foo, [Point(1)])
+        self.assertTrue(foo.__code__.co_use_jit)
+        self.assertContains("CALL_FUNCTION_inline_body",
+                            str(foo.__code__.co_llvm))
+        self.assertEqual(foo(Point(2)), 2)
+
+        # Missing attributes fall back to a regular call, which puts the
+        # callee in the traceback.  setbailerror is on, so these would raise
+        # RuntimeError if we bailed.
+        p = Point(3)
+        del p.x
+        try:
+            foo(p)
+        except AttributeError:
+            tb = sys.exc_info()[2]
+            while tb.tb_next is not None:
+                tb = tb.tb_next
+            self.assertEqual(tb.tb_frame.f_code.co_name, "get_x")
+        else:
+            self.fail("foo(p) should have raised AttributeError")
+
+    def test_inline_python_accessor_after_invalidation(self):
+        class Point(object):
+            def __init__(self, x):
+                self.x = x
+            def get_x(self, unused):
+                return self.x
+        foo = compile_for_llvm('foo', 'def foo(p, hook): return p.get_x(hook())',
+                               optimization_level=None)
+        spin_until_hot(foo, [Point(1), lambda: None])
+        self.assertContains("CALL_FUNCTION_inline_body",
+                            str(foo.__code__.co_llvm))
+
+        # Adding a data descriptor invalidates foo between loading the method
+        # and calling it.  The inlined body mustn't keep reading the instance
+        # dict; the regular call it falls back to doesn't bail.
+        def hook():
+            Point.x = property(lambda self: 10)
+        self.assertEqual(foo(Point(2), hook), 10)
+
+    def test_inline_python_helper(self):
+        def add(a, b):
+            return a + b
+        def sub(a, b):
+            return a - b
+        foo = compile_for_llvm('foo', 'def foo(f, a, b): return f(a, b)',
+                               optimization_level=None)
+        spin_until_hot(foo, [add, 1, 2])
+        self.assertTrue(foo.__code__.co_use_jit)
+        self.assertContains("CALL_FUNCTION_inline_body",
+                            str(foo.__code__.co_llvm))
+        self.assertEqual(foo(add, 3, 4), 7)
+        # Operands the inlined body doesn't handle, other functions and other
+        # callables all make regular calls.
+        self.assertEqual(foo(add, sys.maxint, 1), sys.maxint + 1)
+        self.assertEqual(foo(add, "a", "b"), "ab")
+        self.assertEqual(foo(sub, 3, 4), -1)
+        self.assertEqual(foo(max, 3, 4), 4)
+        add.__code__ = sub.__code__
+        self.assertEqual(foo(add, 3, 4), -1)
+        self.assertRaises(TypeError, foo, add, 1, "a")
+
+    def test_inline_python_sees_profiler(self):
+        def is_none(x):
+            return x is None
+        foo = compile_for_llvm('foo', 'def foo(f, x): return f(x)',
+                               optimization_level=None)
+        spin_until_hot(foo, [is_none, None], [is_none, 1])
+        self.assertContains("CALL_FUNCTION_inline_body",
+                            str(foo.__code__.co_llvm))
+        self.assertEqual(foo(is_none, None), True)
+        self.assertEqual(foo(is_none, 0), False)
+
+        calls = []
+        def profiler(frame, event, arg):
+            if event == "call":
+                calls.append(frame.f_code.co_name)
+        sys.setbailerror(False)
+        sys.setprofile(profiler)
+        try:
+            foo(is_none, None)
+        finally:
+            sys.setprofile(None)
+        self.assertContains("is_none", calls)
+
+    def test_python_calls_enter_machine_code(self):
+        callee = compile_for_llvm('callee', """
+def callee(x):
+    y = x * 2
+    return y
+""")
+        foo = compile_for_llvm('foo', 'def foo(f, x): return f(x)',
+                               optimization_level=None)
+        spin_until_hot(foo, [callee, 1])
+        self.assertTrue(foo.__code__.co_use_jit)
+        self.assertContains("@_PyEval_CallPyFunction",
+                            str(foo.__code__.co_llvm))
+        self.assertEqual(foo(callee, 3), 6)
+
+        # Functions without machine code and other callables take the
+        # regular path.
+        def plain(x, y=5):
+            z = x + y
+            return z
+        self.assertEqual(foo(plain, 1), 6)
+        self.assertEqual(foo(len, "ab"), 2)
+        self.assertRaises(TypeError, foo, plain, "a")
+
+        # Exceptions raised by the callee's machine code still show its
+        # frame in the traceback.
+        try:
+            foo(callee, None)
+        except TypeError:
+            tb = sys.exc_info()[2]
+            while tb.tb_next is not None:
+                tb = tb.tb_next
+            self.assertEqual(tb.tb_frame.f_code.co_name, "callee")
+        else:
+            self.fail("foo(callee, None) should have raised TypeError")
+
+    def test_python_calls_check_recursion_limit(self):
+        recurse = compile_for_llvm('recurse', """
+def recurse(f, n):
+    m = n + 1
+    return f(f, m)
+""", optimization_level=None)
+        spin_until_hot(recurse, [lambda f, n: n, 0])
+        self.assertContains("@_PyEval_CallPyFunction",
+                            str(recurse.__code__.co_llvm))
+        self.assertRaises(RuntimeError, recurse, recurse, 0)
+
+    def test_leaf_calls_run_in_virtual_frames(self):
+        callee = compile_for_llvm('callee', """
+def callee(x, y):
+    z = x + y
+    return z
+""", optimization_level=None)
+        foo = compile_for_llvm('foo', 'def foo(f, x, y): return f(x, y)',
+                               optimization_level=None)
+        spin_until_hot(callee, [1, 2])
+        spin_until_hot(foo, [callee, 1, 2])
+        self.assertTrue(callee.__code__.co_elide_frame)
+        self.assertFalse(foo.__code__.co_elide_frame)
+        self.assertEqual(foo(callee, 3, 4), 7)
+
+        # A guard failure hands the frame to the interpreter.
+        sys.setbailerror(False)
+        self.assertEqual(foo(callee, 3.0, 4.0), 7.0)
+
+        # The traceback keeps a copy of the frame that outlives the call.
+        try:
+            foo(callee, 1, None)
+        except TypeError:
+            tb = sys.exc_info()[2]
+            while tb.tb_next is not None:
+                tb = tb.tb_next
+            self.assertEqual(tb.tb_frame.f_code.co_name, "callee")
+            self.assertEqual(tb.tb_frame.f_locals, {"x": 1, "y": None})
+            self.assertEqual(tb.tb_frame.f_back.f_code.co_name, "foo")
+        else:
+            self.fail("foo(callee, 1, None) should have raised TypeError")
+
+    def test_property_under_leaf_sees_its_frame(self):
+        class Point(object):
+            @property
+            def x(self):
+                return sys._getframe(1).f_code.co_name
+        callee = compile_for_llvm('callee', 'def callee(p): return p.x',
+                                  optimization_level=None)
+        foo = compile_for_llvm('foo', 'def foo(f, p): return f(p)',
+                               optimization_level=None)
+        spin_until_hot(callee, [Point()])
+        spin_until_hot(foo, [callee, Point()])
+        self.assertFalse(callee.__code__.co_elide_frame)
+        self.assertEqual(foo(callee, Point()), "callee")
+
+    def test_non_leaf_code_keeps_its_frame(self):
+        for source in ["def foo(x): return len(x)",
+                       "def foo(x): return x.y",
+                       "def foo(x, y): return x + y",
+                       "def foo(x):\n    x = None\n    return 1",
+                       "def foo(x):\n    yield x",
+                       "def foo(x):\n    try: return x + 1\n"
+                       "    except TypeError: return x"]:
+            foo = compile_for_llvm('foo', source)
+            self.assertFalse(foo.__code__.co_elide_frame, source)
+
+    def test_for_iter_builtin_iterators(self):
+        d = {"a": 1, "b": 2}
+        for training, other in [([1, 2], [3, 4]),
+                                ((1, 2), (3, 4)),
+                                (xrange(2), xrange(3, -3, -2)),
+                                (d, {}),
+                                (d.itervalues(), {5: 6}.itervalues()),
+                                (d.iteritems(), {5: 6}.iteritems())]:
+            foo = compile_for_llvm('foo', """
+def foo(xs):
+    result = []
+    for x in xs:
+        result.append(x)
+    return result
+""", optimization_level=None)
+            spin_until_hot(foo, [training])
+            self.assertTrue(foo.__code__.co_use_jit)
+            self.assertEqual(foo(other), list(other))
+            # Other iterators take the generic path.
+            self.assertEqual(foo(x for x in [7, 8]), [7, 8])
+            self.assertEqual(foo("ab"), ["a", "b"])
+
+        # A list can grow while we iterate over it.
+        grow = compile_for_llvm('grow', """
+def grow(xs):
+    for x in xs:
+        if x < 3:
+            xs.append(x + 1)
+    return xs
+""", optimization_level=None)
+        spin_until_hot(grow, [[3]])
+        self.assertEqual(grow([0]), [0, 1, 2, 3])
+
+        # A dict can't change size.
+        mutate = compile_for_llvm('mutate', """
+def mutate(d, key):
+    for k in d:
+        d[key] = k
+""", optimization_level=None)
+        spin_until_hot(mutate, [{1: 1}, 1])
+        self.assertRaises(RuntimeError, mutate, {1: 1}, 2)
+
+    def test_unpack_sequence_with_feedback(self):
+        for training, other in [((1, (2, 3)), (4, (5, 6))),
+                                ([1, [2, 3]], [4, [5, 6]])]:
+            unpack = compile_for_llvm('unpack', """
+def unpack(x):
+    a, (b, c) = x
+    return a + b + c
+""", optimization_level=None)
+            spin_until_hot(unpack, [training])
+            self.assertTrue(unpack.__code__.co_use_jit)
+            self.assertEqual(unpack(other), 15)
+            # Other types and sizes take the generic path.
+            self.assertEqual(unpack(iter([4, iter([5, 6])])), 15)
+            self.assertRaises(ValueError, unpack, type(training)([1, 2, 3]))
+            self.assertRaises(TypeError, unpack, None)
+
     def test_fast_calls_same_method_different_invocant(self):
         # For all strings, x.join will resolve to the same C function, so
         # it should use the fast version of CALL_FUNCTION that calls the
@@ -2889,6 +3471,36 @@ def foo():
         self.assertEquals(mul(3, 4), 12)
         self.assertEquals(mul(3.0, 4.0), 12.0)
 
+    def test_megamorphic_binop_dominant_type(self):
+        # The operands see too many types to track, but mostly ints, so we
+        # inline the int version and fall back to PyNumber_Add for the rest.
+        add = compile_for_llvm("add", "def add(a, b): return a + b",
+                               optimization_level=None)
+        training = [[3, 4]] * 4 + [[3.0, 4.0], ["3", "4"], [[3], [4]],
+                                   [(3,), (4,)]]
+        spin_until_hot(add, *training)
+
+        self.assertTrue(add.__code__.co_use_jit)
+        self.assertEquals(add(3, 4), 7)
+        # setbailerror is on, so these would raise RuntimeError if we bailed.
+        self.assertEquals(add(3.0, 4.0), 7.0)
+        self.assertEquals(add("3", "4"), "34")
+        self.assertEquals(add(sys.maxint, 1), sys.maxint + 1)
+        self.assertRaises(TypeError, add, 3, "4")
+
+    def test_megamorphic_cmpop_dominant_type(self):
+        lt = compile_for_llvm("lt", "def lt(a, b): return a < b",
+                              optimization_level=None)
+        training = [[3, 4]] * 4 + [[3.0, 4.0], ["3", "4"], [[3], [4]],
+                                   [(3,), (4,)]]
+        spin_until_hot(lt, *training)
+
+        self.assertTrue(lt.__code__.co_use_jit)
+        self.assertTrue(lt(3, 4))
+        self.assertFalse(lt(4, 3))
+        self.assertTrue(lt("3", "4"))
+        self.assertFalse(lt([4], [3]))
+
     def test_inlining_modulo_ints(self):
         mod = compile_for_llvm("mod", "def mod(a, b): return a % b",
                                optimization_level=None)
@@ -3039,6 +3651,71 @@ def foo():
         self.assertEqual(mul_float_int(float(sys.maxint), sys.maxint),
                          float(sys.maxint) * sys.maxint)
 
+    def test_inlining_inplace_ops_on_ints_and_floats(self):
+        foo = compile_for_llvm('foo', """
+def foo(a, b):
+    a += b
+    a -= b
+    a *= b
+    a %= b
+    return a
+""", optimization_level=None)
+        spin_until_hot(foo, [7, 3])
+        self.assertTrue(foo.__code__.co_use_jit)
+        llvm_ir = str(foo.__code__.co_llvm)
+        for api_func in ["PyNumber_InPlaceAdd", "PyNumber_InPlaceSubtract",
+                         "PyNumber_InPlaceMultiply",
+                         "PyNumber_InPlaceRemainder"]:
+            self.assertFalse(api_func in llvm_ir, api_func)
+        self.assertEqual(foo(7, 3), 0)
+        self.assertEqual(foo(8, 5), 0)
+        self.assertRaises(RuntimeError, foo, 7.0, 3.0)
+        self.assertRaises(RuntimeError, foo, sys.maxint, 1)
+
+        sys.setbailerror(False)
+        self.assertEqual(foo(7.5, 2.0), 1.0)
+        self.assertEqual(foo(sys.maxint, 1), 0)
+        self.assertRaises(TypeError, foo, 7, "3")
+
+    def test_arithmetic_reuses_dying_temporaries(self):
+        # (a * b) and (a - b) are temporaries that nothing else refers to, so
+        # the add stores its result in one of them.  None of that may leak
+        # into objects the caller can see.
+        foo = compile_for_llvm('foo', """
+def foo(a, b):
+    return (a * b) + (a - b), a, b
+""", optimization_level=None)
+        spin_until_hot(foo, [1.5, 2.5], [1000, 2000])
+        self.assertTrue(foo.__code__.co_use_jit)
+        a, b = 1.5, 2.5
+        self.assertEqual(foo(a, b), (2.75, 1.5, 2.5))
+        self.assertEqual((a, b), (1.5, 2.5))
+        a, b = 1000, 2000
+        self.assertEqual(foo(a, b), (1999000, 1000, 2000))
+        self.assertEqual((a, b), (1000, 2000))
+        # Small ints must still come from the shared cache.
+        self.assertTrue(foo(3, 1)[0] is 5)
+
+    def test_accumulator_leaves_aliases_intact(self):
+        # total's old value is updated in place only when nothing but the
+        # local refers to it; the values saved in the list must not change.
+        foo = compile_for_llvm('foo', """
+def foo(total, step, n):
+    seen = []
+    for i in range(n):
+        seen.append(total)
+        total = total + step
+        total += step
+    return total, seen
+""", optimization_level=None)
+        spin_until_hot(foo, [1.0, 0.5, 3], [1000, 1000, 3])
+        self.assertTrue(foo.__code__.co_use_jit)
+        self.assertEqual(foo(1.0, 0.5, 3), (4.0, [1.0, 2.0, 3.0]))
+        self.assertEqual(foo(1000, 1000, 3), (7000, [1000, 3000, 5000]))
+        start = 1.0
+        self.assertEqual(foo(start, 0.5, 2), (3.0, [1.0, 2.0]))
+        self.assertEqual(start, 1.0)
+
     def getitem_inlining_test(self, getitem_type):
         # Test BINARY_SUBSCR specialization for indexing a sequence with an int.
         foo = compile_for_llvm('foo', 'def foo(a, b): return a[b]',
@@ -3202,6 +3879,317 @@ def foo():
             (3, 4.0),
         ])
 
+    def test_inline_float_cmpops(self):
+        self._test_inlining_cmpop_generic("<", [
+            (3.0, 4.0),
+            (4.0, 3.0),
+            (3, 4.0),
+            (3.0, 4),
+            (3.0, 4),
+            (4.0, 3),
+        ])
+        self._test_inlining_cmpop_generic("<=", [
+            (3.0, 3.0),
+            (4.0, 3.0),
+            (3, 4.0),
+            (3.0, 4),
+            (3.0, 3),
+            (4.0, 3),
+        ])
+        self._test_inlining_cmpop_generic("==", [
+            (3.0, 3.0),
+            (4.0, 3.0),
+            (3, 3.0),
+            (3.0, 3),
+            (3.0, 3),
+            (4.0, 3),
+        ])
+        self._test_inlining_cmpop_generic("!=", [
+            (4.0, 3.0),
+            (3.0, 3.0),
+            (3, 3.0),
+            (3.0, 3),
+            (4.0, 3),
+            (3.0, 3),
+        ])
+        self._test_inlining_cmpop_generic(">=", [
+            (4.0, 3.0),
+            (3.0, 4.0),
+            (3, 4.0),
+            (3.0, 4),
+            (3.0, 3),
+            (3.0, 4),
+        ])
+        # NaN compares unequal to everything, itself included.
+        ne = compile_for_llvm("ne", "def ne(a, b): return a != b",
+                              optimization_level=None)
+        spin_until_hot(ne, [1.0, 2.0])
+        nan = float("nan")
+        self.assertTrue(ne(nan, nan))
+
+    def test_inline_mixed_int_float_cmpops(self):
+        self._test_inlining_cmpop_generic("<", [
+            (3.0, 4),
+            (4.0, 3),
+            (3, 4),
+            (3.0, 4.0),
+            (3, 4.0),
+            (4, 3.0),
+        ])
+        self._test_inlining_cmpop_generic(">=", [
+            (4, 3.0),
+            (3, 4.0),
+            (4.0, 3.0),
+            (4, 3),
+            (4.0, 3),
+            (3.0, 4),
+        ])
+        # Ints too wide to compare exactly as doubles bail.
+        sys.setbailerror(True)
+        eq = compile_for_llvm("eq", "def eq(a, b): return a == b",
+                              optimization_level=None)
+        spin_until_hot(eq, [1.0, 1])
+        big = 2 ** 53 + 1
+        if big <= sys.maxint:
+            self.assertRaises(RuntimeError, eq, float(big), big)
+            sys.setbailerror(False)
+            self.assertFalse(eq(float(big), big))
+
+    def test_inline_small_long_cmpops(self):
+        self._test_inlining_cmpop_generic("<", [
+            (3L, 4L),
+            (4L, 3L),
+            (3, 4L),
+            (3L, 4),
+            (3, 4L),
+            (4L, 3),
+        ])
+        # Longs with more than one digit bail.
+        sys.setbailerror(True)
+        lt = compile_for_llvm("lt", "def lt(a, b): return a < b",
+                              optimization_level=None)
+        spin_until_hot(lt, [1L, 2L])
+        self.assertRaises(RuntimeError, lt, 2L ** 40, 2L ** 41)
+        self.assertTrue(lt(-5L, 0L))
+
+    def test_inlining_int_bitwise_ops(self):
+        foo = compile_for_llvm("foo", """
+def foo(a, b):
+    return a & b, a | b, a ^ b, a << b, a >> b, a // b
+""", optimization_level=None)
+        spin_until_hot(foo, [12, 3])
+        self.assertTrue(foo.__code__.co_use_jit)
+        llvm_ir = str(foo.__code__.co_llvm)
+        for api_func in ["PyNumber_And", "PyNumber_Or", "PyNumber_Xor",
+                         "PyNumber_Lshift", "PyNumber_Rshift",
+                         "PyNumber_FloorDivide"]:
+            self.assertFalse(api_func in llvm_ir, api_func)
+        self.assertEqual(foo(12, 3), (0, 15, 15, 96, 1, 4))
+        self.assertEqual(foo(-12, 3), (0, -9, -9, -96, -2, -4))
+
+        # Overflow, negative shifts and division by zero bail.
+        self.assertRaises(RuntimeError, foo, sys.maxint, 3)
+        self.assertRaises(RuntimeError, foo, 5, -1)
+        self.assertRaises(RuntimeError, foo, 5, 0)
+        self.assertRaises(RuntimeError, foo, 5, 3.0)
+
+        sys.setbailerror(False)
+        self.assertEqual(foo(sys.maxint, 3)[3], long(sys.maxint) << 3)
+        self.assertRaises(ValueError, foo, 5, -1)
+        self.assertRaises(ZeroDivisionError, foo, 5, 0)
+
+    def test_inlining_float_division_ops(self):
+        foo = compile_for_llvm("foo", """
+def foo(a, b):
+    return a // b, a % b
+""", optimization_level=None)
+        spin_until_hot(foo, [7.5, 2.0])
+        self.assertTrue(foo.__code__.co_use_jit)
+        llvm_ir = str(foo.__code__.co_llvm)
+        self.assertFalse("PyNumber_FloorDivide" in llvm_ir)
+        self.assertFalse("PyNumber_Remainder" in llvm_ir)
+        for a, b in [(7.5, 2.0), (-7.5, 2.0), (7.5, -2.0), (-7.5, -2.0),
+                     (0.0, -3.0), (1e300, 1e-300)]:
+            self.assertEqual(foo(a, b), divmod(a, b))
+        self.assertRaises(RuntimeError, foo, 1.0, 0.0)
+        sys.setbailerror(False)
+        self.assertRaises(ZeroDivisionError, foo, 1.0, 0.0)
+
+    def test_inlining_true_division(self):
+        foo = compile_for_llvm("foo", """
+from __future__ import division
+def foo(a, b):
+    return a / b
+""", optimization_level=None)
+        spin_until_hot(foo, [7, 2])
+        self.assertTrue(foo.__code__.co_use_jit)
+        self.assertFalse("PyNumber_TrueDivide" in str(foo.__code__.co_llvm))
+        self.assertEqual(foo(7, 2), 3.5)
+        self.assertEqual(foo(-1, 4), -0.25)
+        self.assertRaises(RuntimeError, foo, 7, 0)
+        self.assertRaises(RuntimeError, foo, 7.0, 2)
+
+    def test_inlining_int_float_promotions(self):
+        foo = compile_for_llvm("foo", """
+def foo(a, b):
+    return a + b, a - b, a * b, a / b
+""", optimization_level=None)
+        spin_until_hot(foo, [3, 2.0])
+        self.assertTrue(foo.__code__.co_use_jit)
+        llvm_ir = str(foo.__code__.co_llvm)
+        for api_func in ["PyNumber_Add", "PyNumber_Subtract",
+                         "PyNumber_Multiply", "PyNumber_Divide"]:
+            self.assertFalse(api_func in llvm_ir, api_func)
+        self.assertEqual(foo(3, 2.0), (5.0, 1.0, 6.0, 1.5))
+        self.assertRaises(RuntimeError, foo, 3.0, 2.0)
+        self.assertRaises(RuntimeError, foo, 3, 0.0)
+
+        bar = compile_for_llvm("bar", """
+def bar(a, b):
+    return a + b, a - b
+""", optimization_level=None)
+        spin_until_hot(bar, [3.0, 2])
+        self.assertTrue(bar.__code__.co_use_jit)
+        self.assertEqual(bar(3.5, 2), (5.5, 1.5))
+        self.assertRaises(RuntimeError, bar, 3, 2)
+
+    def test_inlining_small_long_arithmetic(self):
+        foo = compile_for_llvm("foo", """
+def foo(a, b):
+    return a + b, a - b, a * b
+""", optimization_level=None)
+        spin_until_hot(foo, [3L, 2L])
+        self.assertTrue(foo.__code__.co_use_jit)
+        result = foo(300L, -200L)
+        self.assertEqual(result, (100L, 500L, -60000L))
+        for value in result:
+            self.assertEqual(type(value), long)
+        self.assertEqual(foo(32767L, 32767L)[2], 32767L * 32767L)
+
+        # Longs that need more than one digit bail.
+        self.assertRaises(RuntimeError, foo, 2L ** 40, 1L)
+        sys.setbailerror(False)
+        self.assertEqual(foo(2L ** 40, 1L)[0], 2L ** 40 + 1)
+
+    def test_inlining_unary_ops(self):
+        neg = compile_for_llvm("neg", "def neg(a): return -a",
+                               optimization_level=None)
+        inv = compile_for_llvm("inv", "def inv(a): return ~a",
+                               optimization_level=None)
+        spin_until_hot(neg, [5])
+        spin_until_hot(inv, [5])
+        self.assertTrue(neg.__code__.co_use_jit)
+        self.assertTrue(inv.__code__.co_use_jit)
+        self.assertFalse("PyNumber_Negative" in str(neg.__code__.co_llvm))
+        self.assertFalse("PyNumber_Invert" in str(inv.__code__.co_llvm))
+        self.assertEqual(neg(5), -5)
+        self.assertEqual(neg(-1000), 1000)
+        self.assertEqual(inv(5), -6)
+        self.assertRaises(RuntimeError, neg, -sys.maxint - 1)
+        self.assertRaises(RuntimeError, neg, 5.0)
+
+        sys.setbailerror(False)
+        self.assertEqual(neg(-sys.maxint - 1), sys.maxint + 1)
+        self.assertEqual(neg(5.0), -5.0)
+
+        fneg = compile_for_llvm("fneg", "def fneg(a): return -a",
+                                optimization_level=None)
+        spin_until_hot(fneg, [2.5])
+        self.assertEqual(fneg(2.5), -2.5)
+        self.assertEqual(str(fneg(0.0)), "-0.0")
+
+    def test_inlining_string_subscript(self):
+        for s in ["abcdef", u"abcdef"]:
+            sys.setbailerror(True)
+            foo = compile_for_llvm("foo", "def foo(s, i): return s[i]",
+                                   optimization_level=None)
+            spin_until_hot(foo, [s, 1])
+            self.assertTrue(foo.__code__.co_use_jit)
+            self.assertFalse("PyObject_GetItem" in str(foo.__code__.co_llvm))
+            self.assertEqual(foo(s, 0), s[0])
+            self.assertEqual(type(foo(s, 0)), type(s))
+            self.assertEqual(foo(s, -1), s[-1])
+            # Single characters come from the shared cache.
+            self.assertTrue(foo(s, 2) is foo(s, 2))
+
+            self.assertRaises(RuntimeError, foo, s, 6)
+            self.assertRaises(RuntimeError, foo, s, -7)
+            self.assertRaises(RuntimeError, foo, list(s), 0)
+            self.assertRaises(RuntimeError, foo, s, 0L)
+
+            sys.setbailerror(False)
+            self.assertRaises(IndexError, foo, s, 6)
+            self.assertEqual(foo(s, 0L), s[0])
+
+    def test_inlining_string_slicing(self):
+        for s in ["abcdef", u"abcdef"]:
+            sys.setbailerror(True)
+            foo = compile_for_llvm("foo", """
+def foo(s, i, j):
+    return s[i:j], s[i:], s[:j], s[:]
+""", optimization_level=None)
+            spin_until_hot(foo, [s, 1, 3])
+            self.assertTrue(foo.__code__.co_use_jit)
+            self.assertFalse("_PyEval_ApplySlice" in str(foo.__code__.co_llvm))
+            for i, j in [(1, 3), (-2, 100), (4, 2), (-100, -5), (0, 6)]:
+                result = foo(s, i, j)
+                self.assertEqual(result, (s[i:j], s[i:], s[:j], s[:]))
+                for part in result:
+                    self.assertEqual(type(part), type(s))
+            self.assertTrue(foo(s, 0, 6)[3] is s)
+
+            self.assertRaises(RuntimeError, foo, s, None, 3)
+            self.assertRaises(RuntimeError, foo, list(s), 1, 3)
+
+            sys.setbailerror(False)
+            self.assertEqual(foo(s, None, 3)[0], s[:3])
+
+    def test_inlining_string_concatenation(self):
+        for a, b in [("abc", "def"), (u"abc", u"def")]:
+            sys.setbailerror(True)
+            foo = compile_for_llvm("foo", "def foo(a, b): return a + b",
+                                   optimization_level=None)
+            spin_until_hot(foo, [a, b])
+            self.assertTrue(foo.__code__.co_use_jit)
+            self.assertFalse("PyNumber_Add" in str(foo.__code__.co_llvm))
+            self.assertEqual(foo(a, b), a + b)
+            self.assertEqual(type(foo(a, b)), type(a))
+            self.assertEqual(foo(a, b[:0]), a)
+            self.assertEqual(foo(a[:0], b), b)
+
+            self.assertRaises(RuntimeError, foo, "abc", u"def")
+            self.assertRaises(RuntimeError, foo, a, 1)
+
+            sys.setbailerror(False)
+            self.assertEqual(foo("abc", u"def"), u"abcdef")
+            self.assertRaises(TypeError, foo, a, 1)
+
+    def test_inlining_string_contains(self):
+        for item, container in [("cd", "abcdef"), (u"cd", u"abcdef")]:
+            sys.setbailerror(True)
+            foo = compile_for_llvm("foo", """
+def foo(a, b):
+    return a in b, a not in b
+""", optimization_level=None)
+            spin_until_hot(foo, [item, container])
+            self.assertTrue(foo.__code__.co_use_jit)
+            llvm_ir = str(foo.__code__.co_llvm)
+            self.assertFalse("PySequence_Contains" in llvm_ir)
+            empty = item[:0]
+            for needle in [item, item[0], container, container + item,
+                           empty, item[::-1], container[-1]]:
+                self.assertEqual(foo(needle, container),
+                                 (needle in container,
+                                  needle not in container))
+            self.assertEqual(foo(item, empty), (False, True))
+
+            self.assertRaises(RuntimeError, foo, 1, container)
+            self.assertRaises(RuntimeError, foo, item, [item])
+
+            sys.setbailerror(False)
+            self.assertRaises(TypeError, foo, 1, container)
+            self.assertEqual(foo(item, [item]), (True, False))
+
     def test_inlining_string_len(self):
         self.len_inlining_test("abcdef", length=6, unexpected_arg=[])
 
@@ -3886,6 +4874,84 @@ def foo():
         self.assertRaises(AttributeError, set_attr, c, 0)
         self.assertEqual(c.foo, -1)
 
+    def test_load_attr_polymorphic(self):
+        # A site that has seen a few types caches each of them, and sends any
+        # other type down the generic path instead of bailing.
+        class C(object):
+            def __init__(self):
+                self.foo = 1
+        class D(object):
+            foo = 2
+        class E(object):
+            @property
+            def foo(self):
+                return 3
+        def get_foo(o):
+            return o.foo
+        spin_until_hot(get_foo, [C()], [D()], [E()])
+        self.assertTrue(get_foo.__code__.co_use_jit)
+        self.assertEqual(get_foo(C()), 1)
+        self.assertEqual(get_foo(D()), 2)
+        self.assertEqual(get_foo(E()), 3)
+
+        # setbailerror is on, so these would raise RuntimeError if we bailed.
+        get_foo.foo = 4
+        self.assertEqual(get_foo(get_foo), 4)
+        self.assertRaises(AttributeError, get_foo, object())
+
+        # Each cached type is watched.
+        D.foo = 5
+        self.assertFalse(get_foo.__code__.co_use_jit)
+        self.assertEqual(get_foo(D()), 5)
+
+    def test_load_attr_megamorphic(self):
+        # Sites that have seen too many types to cache don't bail either.
+        classes = [type("C%d" % i, (object,), {"foo": i}) for i in range(5)]
+        def get_foo(o):
+            return o.foo
+        spin_until_hot(get_foo, *[[cls()] for cls in classes])
+        self.assertTrue(get_foo.__code__.co_use_jit)
+        self.assertEqual([get_foo(cls()) for cls in classes], range(5))
+        get_foo.foo = 5
+        self.assertEqual(get_foo(get_foo), 5)
+
+    def test_load_attr_megamorphic_dominant_type(self):
+        # A site that sees many types, but mostly one, caches that one.
+        classes = [type("C%d" % i, (object,), {"foo": i}) for i in range(5)]
+        def get_foo(o):
+            return o.foo
+        training = [[classes[0]()]] * 4 + [[cls()] for cls in classes[1:]]
+        spin_until_hot(get_foo, *training)
+        self.assertTrue(get_foo.__code__.co_use_jit)
+        self.assertEqual([get_foo(cls()) for cls in classes], range(5))
+
+        # The rare types aren't watched, but the dominant one is.
+        classes[1].foo = -1
+        self.assertTrue(get_foo.__code__.co_use_jit)
+        self.assertEqual(get_foo(classes[1]()), -1)
+        classes[0].foo = -1
+        self.assertFalse(get_foo.__code__.co_use_jit)
+        self.assertEqual(get_foo(classes[0]()), -1)
+
+    def test_store_attr_polymorphic(self):
+        class C(object):
+            pass
+        class D(object):
+            __slots__ = ('foo',)
+        def set_foo(o, x):
+            o.foo = x
+        spin_until_hot(set_foo, [C(), 0], [D(), 0])
+        self.assertTrue(set_foo.__code__.co_use_jit)
+        c, d = C(), D()
+        set_foo(c, 1)
+        set_foo(d, 2)
+        self.assertEqual((c.foo, d.foo), (1, 2))
+
+        # Other types take the generic path without bailing.
+        set_foo(set_foo, 3)
+        self.assertEqual(set_foo.foo, 3)
+        self.assertRaises(AttributeError, set_foo, object(), 4)
+
     def test_store_attr_fast_mutate_vanilla_object_to_data_descriptor(self):
         # Make a non-data descriptor class and a data-descriptor class and see
         # if switching between them causes breakage.
@@ -4378,6 +5444,177 @@ class SetJitControlTests(LlvmTestCase):
         self.assertRaises(ValueError, _llvm.set_jit_control, "asdf")
 
 
+class BackgroundCompileTests(LlvmTestCase):
+
+    def setUp(self):
+        LlvmTestCase.setUp(self)
+        self._old_background = _llvm.get_background_compile()
+        _llvm.set_background_compile(True)
+
+    def tearDown(self):
+        _llvm.wait_for_background_compile()
+        _llvm.set_background_compile(self._old_background)
+        LlvmTestCase.tearDown(self)
+
+    def test_get_set(self):
+        self.assertTrue(_llvm.get_background_compile())
+        _llvm.set_background_compile(False)
+        self.assertFalse(_llvm.get_background_compile())
+
+    def test_hot_code_compiled_in_background(self):
+        def foo(x):
+            return x + 1
+        spin_until_hot(foo, [1])
+        _llvm.wait_for_background_compile()
+        self.assertFalse(foo.__code__.co_compile_pending)
+        self.assertTrue(foo.__code__.co_use_jit)
+        self.assertEqual(foo.__code__.co_optimization, JIT_OPT_LEVEL)
+        self.assertEqual(foo(5), 6)
+
+    def test_always_compiles_in_foreground(self):
+        def foo():
+            return 5
+        with set_jit_control("always"):
+            self.assertEqual(foo(), 5)
+        self.assertFalse(foo.__code__.co_compile_pending)
+        self.assertEqual(foo.__code__.co_optimization, JIT_OPT_LEVEL)
+
+
+class CodeCacheTests(LlvmTestCase):
+
+    module_name = "llvm_code_cache_test"
+    module_source = "def foo(x):\n    return x + 1\n"
+
+    def setUp(self):
+        LlvmTestCase.setUp(self)
+        self._old_code_cache = _llvm.get_code_cache()
+        self.dir = tempfile.mkdtemp()
+        sys.path.insert(0, self.dir)
+        with open(os.path.join(self.dir, self.module_name + ".py"), "w") as f:
+            f.write(self.module_source)
+
+    def tearDown(self):
+        sys.modules.pop(self.module_name, None)
+        sys.path.remove(self.dir)
+        shutil.rmtree(self.dir)
+        _llvm.set_code_cache(self._old_code_cache)
+        LlvmTestCase.tearDown(self)
+
+    def import_fresh(self):
+        sys.modules.pop(self.module_name, None)
+        return __import__(self.module_name)
+
+    def test_get_set(self):
+        _llvm.set_code_cache(True)
+        self.assertTrue(_llvm.get_code_cache())
+        _llvm.set_code_cache(False)
+        self.assertFalse(_llvm.get_code_cache())
+
+    def test_disabled(self):
+        _llvm.set_code_cache(False)
+        mod = self.import_fresh()
+        spin_until_hot(mod.foo, [1])
+        _llvm.flush_code_cache()
+        self.assertFalse(os.path.exists(
+            os.path.join(self.dir, self.module_name + ".pyj")))
+        mod = self.import_fresh()
+        self.assertEqual(mod.foo.__code__.co_hotness, 0)
+
+    def test_hot_code_gets_head_start(self):
+        _llvm.set_code_cache(True)
+        mod = self.import_fresh()
+        self.assertEqual(mod.foo.__code__.co_hotness, 0)
+        spin_until_hot(mod.foo, [1])
+        self.assertTrue(mod.foo.__code__.co_use_jit)
+        _llvm.flush_code_cache()
+        self.assertTrue(os.path.exists(
+            os.path.join(self.dir, self.module_name + ".pyj")))
+
+        head_start = _llvm.get_hotness_threshold() - 1000
+        mod = self.import_fresh()
+        self.assertEqual(mod.foo.__code__.co_hotness, head_start)
+        self.assertFalse(mod.foo.__code__.co_use_jit)
+
+        # A new process reads the head start back from the .pyj file.
+        env = dict(os.environ, PYTHONJITCACHE="1")
+        proc = subprocess.Popen(
+            [sys.executable, "-c",
+             "import sys; sys.path.insert(0, %r); import %s; "
+             "print %s.foo.__code__.co_hotness" %
+             (self.dir, self.module_name, self.module_name)],
+            stdout=subprocess.PIPE, env=env)
+        out = proc.communicate()[0]
+        self.assertEqual(proc.returncode, 0)
+        self.assertEqual(int(out), head_start)
+
+
+class CompileBudgetTests(LlvmTestCase):
+
+    def setUp(self):
+        LlvmTestCase.setUp(self)
+        self._old_budget = _llvm.get_compile_budget()
+
+    def tearDown(self):
+        _llvm.set_compile_budget(self._old_budget)
+        LlvmTestCase.tearDown(self)
+
+    def test_get_set(self):
+        _llvm.set_compile_budget(0.25)
+        self.assertEqual(_llvm.get_compile_budget(), 0.25)
+        _llvm.set_compile_budget(0)
+        self.assertEqual(_llvm.get_compile_budget(), 0)
+        self.assertRaises(ValueError, _llvm.set_compile_budget, -1)
+        self.assertRaises(TypeError, _llvm.set_compile_budget, "fast")
+
+    def test_exhausted_budget_defers_compilation(self):
+        def foo(x):
+            return x + 1
+        def bar(x):
+            return x + 2
+        # A microsecond a second: foo's quick-tier compile gets the full
+        # bucket, and everything after it has to wait until long after this
+        # test is over.
+        _llvm.set_compile_budget(1e-6)
+        deferrals = _llvm.get_compile_deferrals()
+        spin_until_hot(foo, [1])
+        self.assertEqual(foo.__code__.co_optimization, QUICK_JIT_OPT_LEVEL)
+        spin_until_hot(bar, [1])
+        self.assertEqual(bar.__code__.co_optimization, -1)
+        self.assertTrue(_llvm.get_compile_deferrals() > deferrals)
+        self.assertEqual(bar(1), 3)
+
+        _llvm.set_compile_budget(0)
+        with set_jit_control("whenhot"):
+            self.assertEqual(bar(1), 3)
+        self.assertEqual(bar.__code__.co_optimization, JIT_OPT_LEVEL)
+
+
+class PerfMapTests(LlvmTestCase):
+
+    def test_compiled_functions_named_in_perf_map(self):
+        env = dict(os.environ, PYTHONJITPERFMAP="1")
+        proc = subprocess.Popen(
+            [sys.executable, "-Xjit=always", "-c",
+             "import os\n"
+             "def perf_map_test_func(): return 5\n"
+             "perf_map_test_func()\n"
+             "print os.getpid()"],
+            stdout=subprocess.PIPE, env=env)
+        out = proc.communicate()[0]
+        self.assertEqual(proc.returncode, 0)
+        path = "/tmp/perf-%d.map" % int(out)
+        try:
+            with open(path) as f:
+                entries = [line.rstrip("\n").split(" ", 2) for line in f]
+        finally:
+            os.unlink(path)
+        for start, size, name in entries:
+            self.assertTrue(int(start, 16) > 0)
+            self.assertTrue(int(size, 16) > 0)
+        names = [name for start, size, name in entries]
+        self.assertTrue("py::perf_map_test_func:<string>:2" in names, names)
+
+
 def modify_code_object(code_obj, **changes):
     order = ["argcount", "nlocals", "stacksize", "flags", "code",
              "consts", "names", "varnames", "filename", "name",
@@ -4497,7 +5734,9 @@ def test_main():
                  OperatorTests, LiteralsTests, BailoutTests, InliningTests,
                  LlvmRebindBuiltinsTests, OptimizationTests,
                  SetJitControlTests, TypeBasedAnalysisTests,
-                 CrashRegressionTests, LoadMethodTests]
+                 CrashRegressionTests, LoadMethodTests,
+                 BackgroundCompileTests, CodeCacheTests,
+                 CompileBudgetTests, PerfMapTests]
     if sys.flags.optimize >= 1:
         print >>sys.stderr, "test_llvm -- skipping some tests due to -O flag."
         sys.stderr.flush()
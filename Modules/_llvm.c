@@ -8,6 +8,9 @@ LLVM-py.
 
 #include "Python.h"
 #include "_llvmfunctionobject.h"
+#include "JIT/CodeCache_fwd.h"
+#include "JIT/CompileBudget_fwd.h"
+#include "JIT/CompileQueue_fwd.h"
 #include "JIT/global_llvm_data_fwd.h"
 #include "JIT/llvm_compile.h"
 #include "JIT/RuntimeFeedback_fwd.h"
@@ -43,6 +46,7 @@ llvm_compile(PyObject *self, PyObject *args)
     PyObject *obj;
     PyCodeObject *code;
     long opt_level;
+    struct PyGlobalLlvmData *global_llvm_data;
 
     if (!PyArg_ParseTuple(args, "O!l:compile",
                           &PyCode_Type, &obj, &opt_level))
@@ -54,19 +58,25 @@ llvm_compile(PyObject *self, PyObject *args)
     }
 
     code = (PyCodeObject *)obj;
+    global_llvm_data = PyGlobalLlvmData_GET();
+    PyGlobalLlvmData_Lock(global_llvm_data);
     if (code->co_llvm_function)
         _LlvmFunction_Dealloc(code->co_llvm_function);
     code->co_llvm_function = _PyCode_ToLlvmIr(code);
-    if (code->co_llvm_function == NULL)
+    if (code->co_llvm_function == NULL) {
+        PyGlobalLlvmData_Unlock(global_llvm_data);
         return NULL;
+    }
     if (code->co_optimization < opt_level &&
-        PyGlobalLlvmData_Optimize(PyGlobalLlvmData_GET(),
+        PyGlobalLlvmData_Optimize(global_llvm_data,
                                   code->co_llvm_function, opt_level) < 0) {
         PyErr_Format(PyExc_ValueError,
                      "Failed to optimize to level %ld", opt_level);
         _LlvmFunction_Dealloc(code->co_llvm_function);
+        PyGlobalLlvmData_Unlock(global_llvm_data);
         return NULL;
     }
+    PyGlobalLlvmData_Unlock(global_llvm_data);
 
     return _PyLlvmFunction_FromCodeObject((PyObject *)code);
 }
@@ -161,6 +171,58 @@ llvm_get_hotness_threshold(PyObject *self)
     return PyInt_FromLong(PY_HOTNESS_THRESHOLD);
 }
 
+PyDoc_STRVAR(llvm_get_quick_hotness_threshold_doc,
+"get_quick_hotness_threshold() -> long\n\
+\n\
+Return the threshold for co_hotness before the code is compiled with the\n\
+quick optimization pipeline.");
+
+static PyObject *
+llvm_get_quick_hotness_threshold(PyObject *self)
+{
+    return PyInt_FromLong(PY_QUICK_HOTNESS_THRESHOLD);
+}
+
+PyDoc_STRVAR(llvm_get_max_fatal_bail_count_doc,
+"get_max_fatal_bail_count() -> int\n\
+\n\
+Return how many times a code object's machine code may be invalidated\n\
+before it is left in the interpreter for good.");
+
+static PyObject *
+llvm_get_max_fatal_bail_count(PyObject *self)
+{
+    return PyInt_FromLong(PY_MAX_FATALBAILCOUNT);
+}
+
+PyDoc_STRVAR(llvm_get_recompile_hotness_doc,
+"get_recompile_hotness(code) -> long or None\n\
+\n\
+Return the co_hotness a code object (or function) has to pass before it is\n\
+compiled again under the 'whenhot' JIT control mode.  This doubles every\n\
+time its machine code is invalidated.  Return None if it has been\n\
+invalidated too often to be compiled again.");
+
+static PyObject *
+llvm_get_recompile_hotness(PyObject *self, PyObject *obj)
+{
+    PyCodeObject *code;
+    if (PyFunction_Check(obj))
+        obj = PyFunction_GET_CODE(obj);
+    if (!PyCode_Check(obj)) {
+        PyErr_Format(PyExc_TypeError,
+                     "expected code or function, not %.100s object",
+                     Py_TYPE(obj)->tp_name);
+        return NULL;
+    }
+    code = (PyCodeObject *)obj;
+
+    if (code->co_fatalbailcount >= PY_MAX_FATALBAILCOUNT)
+        Py_RETURN_NONE;
+    return PyInt_FromLong(
+        (long)PY_QUICK_HOTNESS_THRESHOLD << code->co_fatalbailcount);
+}
+
 PyDoc_STRVAR(llvm_collect_unused_globals_doc,
 "collect_unused_globals()\n\
 \n\
@@ -174,6 +236,143 @@ llvm_collect_unused_globals(PyObject *self)
     Py_RETURN_NONE;
 }
 
+PyDoc_STRVAR(llvm_set_background_compile_doc,
+"set_background_compile(bool)\n\
+\n\
+Turn background compilation on or off.  When it's on, code objects that\n\
+become hot under the 'whenhot' JIT control mode are compiled on a separate\n\
+thread, and keep running in the interpreter until their machine code is\n\
+ready.");
+
+static PyObject *
+llvm_set_background_compile(PyObject *self, PyObject *on_obj)
+{
+    int on = PyObject_IsTrue(on_obj);
+    if (on == -1)  /* Error. */
+        return NULL;
+
+    if (PyJitCompileQueue_SetEnabled(PyGlobalLlvmData_GET(), on) < 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(llvm_get_background_compile_doc,
+"get_background_compile() -> bool\n\
+\n\
+Return whether hot code objects are compiled on a background thread.");
+
+static PyObject *
+llvm_get_background_compile(PyObject *self)
+{
+    return PyBool_FromLong(
+        PyJitCompileQueue_IsEnabled(PyGlobalLlvmData_GET()));
+}
+
+PyDoc_STRVAR(llvm_wait_for_background_compile_doc,
+"wait_for_background_compile()\n\
+\n\
+Block until the background compiler thread has finished compiling every\n\
+code object queued so far.");
+
+static PyObject *
+llvm_wait_for_background_compile(PyObject *self)
+{
+    PyJitCompileQueue_WaitUntilIdle(PyGlobalLlvmData_GET());
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(llvm_set_code_cache_doc,
+"set_code_cache(bool)\n\
+\n\
+Turn the code cache on or off.  When it's on, modules imported from now on\n\
+get a head start for the code that was compiled in previous runs, and the\n\
+code compiled in this run is remembered in a .pyj file next to each\n\
+module's .pyc.  The cache only shortens the warm-up; the code is still\n\
+compiled in every process.  Also controlled by the PYTHONJITCACHE\n\
+environment variable.");
+
+static PyObject *
+llvm_set_code_cache(PyObject *self, PyObject *on_obj)
+{
+    int on = PyObject_IsTrue(on_obj);
+    if (on == -1)  /* Error. */
+        return NULL;
+
+    PyJitCodeCache_SetEnabled(PyGlobalLlvmData_GET(), on);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(llvm_get_code_cache_doc,
+"get_code_cache() -> bool\n\
+\n\
+Return whether the code cache is on.");
+
+static PyObject *
+llvm_get_code_cache(PyObject *self)
+{
+    return PyBool_FromLong(PyJitCodeCache_IsEnabled(PyGlobalLlvmData_GET()));
+}
+
+PyDoc_STRVAR(llvm_flush_code_cache_doc,
+"flush_code_cache()\n\
+\n\
+Write out the code cache files now rather than at exit.");
+
+static PyObject *
+llvm_flush_code_cache(PyObject *self)
+{
+    PyJitCodeCache_Flush(PyGlobalLlvmData_GET());
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(llvm_set_compile_budget_doc,
+"set_compile_budget(rate)\n\
+\n\
+Limit the time spent compiling to rate seconds per second, e.g. 0.1 for at\n\
+most a tenth of the program's time.  Code objects that become hot while the\n\
+budget is used up keep running in the interpreter until it refills.  A rate\n\
+of 0 means compilation is unlimited, which is the default.");
+
+static PyObject *
+llvm_set_compile_budget(PyObject *self, PyObject *rate_obj)
+{
+    double rate = PyFloat_AsDouble(rate_obj);
+    if (rate == -1.0 && PyErr_Occurred())
+        return NULL;
+    if (rate < 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "compile budget must not be negative");
+        return NULL;
+    }
+    PyJitCompileBudget_SetRate(PyGlobalLlvmData_GET(), rate);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(llvm_get_compile_budget_doc,
+"get_compile_budget() -> float\n\
+\n\
+Return the seconds of compilation allowed per second, or 0 if unlimited.");
+
+static PyObject *
+llvm_get_compile_budget(PyObject *self)
+{
+    return PyFloat_FromDouble(
+        PyJitCompileBudget_GetRate(PyGlobalLlvmData_GET()));
+}
+
+PyDoc_STRVAR(llvm_get_compile_deferrals_doc,
+"get_compile_deferrals() -> int\n\
+\n\
+Return how many times compiling a hot code object has been put off because\n\
+the compile budget was used up.");
+
+static PyObject *
+llvm_get_compile_deferrals(PyObject *self)
+{
+    return PyLong_FromUnsignedLong(
+        PyJitCompileBudget_GetDeferrals(PyGlobalLlvmData_GET()));
+}
+
 static struct PyMethodDef llvm_methods[] = {
     {"set_debug", (PyCFunction)llvm_setdebug, METH_O, setdebug_doc},
     {"compile", llvm_compile, METH_VARARGS, llvm_compile_doc},
@@ -185,8 +384,34 @@ static struct PyMethodDef llvm_methods[] = {
      llvm_set_jit_control_doc},
     {"get_hotness_threshold", (PyCFunction)llvm_get_hotness_threshold,
      METH_NOARGS, llvm_get_hotness_threshold_doc},
+    {"get_quick_hotness_threshold",
+     (PyCFunction)llvm_get_quick_hotness_threshold, METH_NOARGS,
+     llvm_get_quick_hotness_threshold_doc},
+    {"get_max_fatal_bail_count", (PyCFunction)llvm_get_max_fatal_bail_count,
+     METH_NOARGS, llvm_get_max_fatal_bail_count_doc},
+    {"get_recompile_hotness", (PyCFunction)llvm_get_recompile_hotness,
+     METH_O, llvm_get_recompile_hotness_doc},
     {"collect_unused_globals", (PyCFunction)llvm_collect_unused_globals,
      METH_NOARGS, llvm_collect_unused_globals_doc},
+    {"set_background_compile", (PyCFunction)llvm_set_background_compile,
+     METH_O, llvm_set_background_compile_doc},
+    {"get_background_compile", (PyCFunction)llvm_get_background_compile,
+     METH_NOARGS, llvm_get_background_compile_doc},
+    {"wait_for_background_compile",
+     (PyCFunction)llvm_wait_for_background_compile, METH_NOARGS,
+     llvm_wait_for_background_compile_doc},
+    {"set_code_cache", (PyCFunction)llvm_set_code_cache, METH_O,
+     llvm_set_code_cache_doc},
+    {"get_code_cache", (PyCFunction)llvm_get_code_cache, METH_NOARGS,
+     llvm_get_code_cache_doc},
+    {"set_compile_budget", (PyCFunction)llvm_set_compile_budget, METH_O,
+     llvm_set_compile_budget_doc},
+    {"get_compile_budget", (PyCFunction)llvm_get_compile_budget, METH_NOARGS,
+     llvm_get_compile_budget_doc},
+    {"get_compile_deferrals", (PyCFunction)llvm_get_compile_deferrals,
+     METH_NOARGS, llvm_get_compile_deferrals_doc},
+    {"flush_code_cache", (PyCFunction)llvm_flush_code_cache, METH_NOARGS,
+     llvm_flush_code_cache_doc},
     { NULL, NULL }
 };
 
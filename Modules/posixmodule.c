@@ -29,6 +29,7 @@
 
 #include "Python.h"
 #include "structseq.h"
+#include "JIT/global_llvm_data_fwd.h"
 
 #if defined(__VMS)
 #    include <unixio.h>
@@ -3620,6 +3621,18 @@ posix_spawnvpe(PyObject *self, PyObject *args)
 #endif /* HAVE_SPAWNV */
 
 
+#ifdef WITH_LLVM
+/* Hold the LLVM lock across fork() so the child doesn't inherit LLVM state
+   that the background compiler thread was halfway through changing.  This
+   nests inside the import lock, since imports can trigger compilation. */
+#define PY_LLVM_LOCK_FOR_FORK() PyGlobalLlvmData_Lock(PyGlobalLlvmData_GET())
+#define PY_LLVM_UNLOCK_FOR_FORK() \
+	PyGlobalLlvmData_Unlock(PyGlobalLlvmData_GET())
+#else
+#define PY_LLVM_LOCK_FOR_FORK()
+#define PY_LLVM_UNLOCK_FOR_FORK()
+#endif
+
 #ifdef HAVE_FORK1
 PyDoc_STRVAR(posix_fork1__doc__,
 "fork1() -> pid\n\n\
@@ -3633,7 +3646,9 @@ posix_fork1(PyObject *self, PyObject *noargs)
 	pid_t pid;
 	int result;
 	_PyImport_AcquireLock();
+	PY_LLVM_LOCK_FOR_FORK();
 	pid = fork1();
+	PY_LLVM_UNLOCK_FOR_FORK();
 	result = _PyImport_ReleaseLock();
 	if (pid == -1)
 		return posix_error();
@@ -3662,7 +3677,9 @@ posix_fork(PyObject *self, PyObject *noargs)
 	pid_t pid;
 	int result;
 	_PyImport_AcquireLock();
+	PY_LLVM_LOCK_FOR_FORK();
 	pid = fork();
+	PY_LLVM_UNLOCK_FOR_FORK();
 	result = _PyImport_ReleaseLock();
 	if (pid == -1)
 		return posix_error();
@@ -3780,7 +3797,9 @@ posix_forkpty(PyObject *self, PyObject *noargs)
 	pid_t pid;
 
 	_PyImport_AcquireLock();
+	PY_LLVM_LOCK_FOR_FORK();
 	pid = forkpty(&master_fd, NULL, NULL, NULL);
+	PY_LLVM_UNLOCK_FOR_FORK();
 	result = _PyImport_ReleaseLock();
 	if (pid == -1)
 		return posix_error();
@@ -35,21 +35,10 @@ struct _LlvmFunction {
     // shutdown, where the Module is destroyed without destroying all
     // code objects first.
     Function *lf_function;
-};
-
-#ifdef Py_WITH_INSTRUMENTATION
-// Collect statistics about the number of lines of LLVM IR we're writing,
-// and the amount of native code that translates to. Even if we're not changing
-// the amount of generated native code, reducing the number of LLVM IR lines
-// helps compilation time.
-class NativeSizeStats : public DataVectorStats<size_t> {
-public:
-    NativeSizeStats() : DataVectorStats<size_t>("Native code size in bytes") {}
-};
-
-class LlvmIrSizeStats : public DataVectorStats<size_t> {
-public:
-    LlvmIrSizeStats() : DataVectorStats<size_t>("LLVM IR size in lines") {}
+    // Functions this one replaced when the code object was recompiled.
+    // Frames may still be running their machine code, so we keep them
+    // around for as long as the code object is.
+    std::vector<Function *> lf_retired;
 };
 
 // Count the number of non-blank lines of LLVM IR for the given function.
@@ -68,6 +57,21 @@ count_ir_lines(llvm::Function *const function)
     return result;
 }
 
+#ifdef Py_WITH_INSTRUMENTATION
+// Collect statistics about the number of lines of LLVM IR we're writing,
+// and the amount of native code that translates to. Even if we're not changing
+// the amount of generated native code, reducing the number of LLVM IR lines
+// helps compilation time.
+class NativeSizeStats : public DataVectorStats<size_t> {
+public:
+    NativeSizeStats() : DataVectorStats<size_t>("Native code size in bytes") {}
+};
+
+class LlvmIrSizeStats : public DataVectorStats<size_t> {
+public:
+    LlvmIrSizeStats() : DataVectorStats<size_t>("LLVM IR size in lines") {}
+};
+
 static llvm::ManagedStatic<NativeSizeStats> native_size_stats;
 static llvm::ManagedStatic<LlvmIrSizeStats> llvm_ir_size_stats;
 #endif  // Py_WITH_INSTRUMENTATION
@@ -81,21 +85,43 @@ _LlvmFunction_New(void *llvm_function)
     return wrapper;
 }
 
-void
-_LlvmFunction_Dealloc(_LlvmFunction *functionobj)
+static void
+release_function(llvm::Function *function)
 {
-    llvm::Function *function = functionobj->lf_function;
-    // Clear the AssertingVH to avoid crashing when we delete the function.
-    functionobj->lf_function = NULL;
     // Allow global optimizations to destroy the function.
     function->setLinkage(llvm::GlobalValue::InternalLinkage);
     if (function->use_empty()) {
         // Delete the function if it's already unused.
         function->eraseFromParent();
     }
+}
+
+void
+_LlvmFunction_Dealloc(_LlvmFunction *functionobj)
+{
+    PyGlobalLlvmData *global_llvm_data = PyGlobalLlvmData::Get();
+    global_llvm_data->LockLlvm();
+    llvm::Function *function = functionobj->lf_function;
+    // Clear the AssertingVH to avoid crashing when we delete the function.
+    functionobj->lf_function = NULL;
+    release_function(function);
+    for (size_t i = 0; i < functionobj->lf_retired.size(); ++i) {
+        release_function(functionobj->lf_retired[i]);
+    }
+    global_llvm_data->UnlockLlvm();
     delete functionobj;
 }
 
+void
+_LlvmFunction_Retire(_LlvmFunction *replacement, _LlvmFunction *old)
+{
+    replacement->lf_retired.insert(replacement->lf_retired.end(),
+                                   old->lf_retired.begin(),
+                                   old->lf_retired.end());
+    replacement->lf_retired.push_back(old->lf_function);
+    delete old;
+}
+
 // Deletes most of the contents of function but keeps all references
 // to global variables so they don't get destroyed by globaldce.
 static void
@@ -142,12 +168,12 @@ clear_body(llvm::Function *function)
 }
 
 PyEvalFrameFunction
-_LlvmFunction_Jit(_LlvmFunction *function_obj)
+_LlvmFunction_Jit(PyGlobalLlvmData *global_llvm_data,
+                  _LlvmFunction *function_obj)
 {
     llvm::Function *function = (llvm::Function *)function_obj->lf_function;
-    PyGlobalLlvmData *global_llvm_data =
-        PyThreadState_GET()->interp->global_llvm_data;
     llvm::ExecutionEngine *engine = global_llvm_data->getExecutionEngine();
+    global_llvm_data->LockLlvm();
 
     PyEvalFrameFunction native_func;
 #ifdef Py_WITH_INSTRUMENTATION
@@ -168,6 +194,7 @@ _LlvmFunction_Jit(_LlvmFunction *function_obj)
     // need to re-compile the bytecode to IR and reoptimize it again, if we
     // need it again.
     clear_body(function);
+    global_llvm_data->UnlockLlvm();
     return native_func;
 }
 
@@ -176,7 +203,14 @@ _LlvmFunction_Optimize(PyGlobalLlvmData *global_data,
                        _LlvmFunction *llvm_function,
                        int level)
 {
-    return global_data->Optimize(*llvm_function->lf_function, level);
+    Function *function = llvm_function->lf_function;
+    // The full pipeline's passes take superlinear time in the size of the
+    // function, so huge functions get the quick tier's instead.
+    if (level > Py_QUICK_JIT_OPT_LEVEL &&
+        count_ir_lines(function) > Py_MAX_IR_SIZE_FOR_FULL_OPT) {
+        level = Py_QUICK_JIT_OPT_LEVEL;
+    }
+    return global_data->Optimize(*function, level);
 }
 
 // Python-level wrapper.
@@ -219,6 +253,8 @@ llvmfunction_dealloc(PyLlvmFunctionObject *functionobj)
     Py_DECREF(functionobj->code_object);
 }
 
+// The caller must hold the LLVM lock, so that the background compiler
+// thread can't see the temporary values we put in the code object.
 static _LlvmFunction *
 recompile(PyLlvmFunctionObject *functionobj)
 {
@@ -257,13 +293,17 @@ llvmfunction_str(PyLlvmFunctionObject *function_obj)
     std::string result;
     llvm::raw_string_ostream wrapper(result);
 
+    PyGlobalLlvmData *global_llvm_data = PyGlobalLlvmData::Get();
+    global_llvm_data->LockLlvm();
     _LlvmFunction *new_function = recompile(function_obj);
     if (new_function == NULL) {
+        global_llvm_data->UnlockLlvm();
         return NULL;
     }
     llvm::Function *func = (llvm::Function *)new_function->lf_function;
     func->print(wrapper);
     _LlvmFunction_Dealloc(new_function);
+    global_llvm_data->UnlockLlvm();
 
     wrapper.flush();
     return PyString_FromStringAndSize(result.data(), result.size());
@@ -272,13 +312,17 @@ llvmfunction_str(PyLlvmFunctionObject *function_obj)
 static PyObject *
 func_view_cfg(PyLlvmFunctionObject *function_obj)
 {
+    PyGlobalLlvmData *global_llvm_data = PyGlobalLlvmData::Get();
+    global_llvm_data->LockLlvm();
     _LlvmFunction *new_function = recompile(function_obj);
     if (new_function == NULL) {
+        global_llvm_data->UnlockLlvm();
         return NULL;
     }
     llvm::Function *func = (llvm::Function *)new_function->lf_function;
     func->viewCFG();
     _LlvmFunction_Dealloc(new_function);
+    global_llvm_data->UnlockLlvm();
     Py_RETURN_NONE;
 }
 
@@ -293,7 +337,10 @@ func_get_module(PyLlvmFunctionObject *op)
 
     std::string result;
     llvm::raw_string_ostream wrapper(result);
+    PyGlobalLlvmData *global_llvm_data = PyGlobalLlvmData::Get();
+    global_llvm_data->LockLlvm();
     module->print(wrapper, NULL /* No extra annotations in the output */);
+    global_llvm_data->UnlockLlvm();
     wrapper.flush();
 
     return PyString_FromStringAndSize(result.data(),
@@ -118,6 +118,10 @@ PyCode_New(int argcount, int nlocals, int stacksize, int flags,
 		co->co_hotness = 0;
 		co->co_fatalbailcount = 0;
 		co->co_watching = NULL;
+		co->co_watched_keys = NULL;
+		co->co_compile_pending = 0;
+		co->co_needs_recompile = 0;
+		co->co_elide_frame = 0;
 #endif
 	}
 	return co;
@@ -145,6 +149,8 @@ static PyMemberDef code_memberlist[] = {
 	{"co_hotness", T_INT,		OFF(co_hotness),	READONLY},
 	{"co_fatalbailcount", T_INT,	OFF(co_fatalbailcount),	READONLY},
 	{"co_use_jit", T_BOOL,		OFF(co_use_jit)},
+	{"co_compile_pending", T_BOOL,	OFF(co_compile_pending), READONLY},
+	{"co_elide_frame", T_BOOL,	OFF(co_elide_frame),	READONLY},
 #endif
 	{NULL}	/* Sentinel */
 };
@@ -200,6 +206,64 @@ new_watch_list(void)
 }
 
 
+static void
+clear_watched_keys(PyCodeObject *code, ReasonWatched reason)
+{
+	if (code->co_watched_keys != NULL)
+		Py_CLEAR(code->co_watched_keys[reason]);
+}
+
+
+/* Registers code with the dict it watches for reason: as depending on the
+   whole dict, or, if we've narrowed that dependency, on each of the keys in
+   co_watched_keys[reason]. */
+static int
+add_watch(PyCodeObject *code, ReasonWatched reason)
+{
+	PyObject *dict = code->co_watching[reason];
+	PyObject *keys = NULL;
+	PyObject *key, *value;
+	Py_ssize_t pos = 0;
+
+	if (code->co_watched_keys != NULL)
+		keys = code->co_watched_keys[reason];
+	if (keys == NULL)
+		return _PyDict_AddWatcher(dict, code);
+	while (PyDict_Next(keys, &pos, &key, &value)) {
+		if (_PyDict_AddKeyWatcher(dict, code, key) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+
+/* Undoes add_watch(code, reason). */
+static void
+drop_watch(PyCodeObject *code, ReasonWatched reason)
+{
+	PyObject *dict = code->co_watching[reason];
+	PyObject *keys = NULL;
+	PyObject *key, *value;
+	Py_ssize_t pos = 0;
+	int i;
+
+	if (code->co_watched_keys != NULL)
+		keys = code->co_watched_keys[reason];
+	if (keys == NULL)
+		_PyDict_DropWatcher(dict, code);
+	while (keys != NULL && PyDict_Next(keys, &pos, &key, &value))
+		_PyDict_DropKeyWatcher(dict, code, key);
+	/* The same dict may be watched for another reason (e.g., a module
+	   whose globals are the builtins), whose registration may have just
+	   been dropped along with this one's.  Nothing new needs to be
+	   allocated to put it back. */
+	for (i = 0; i < NUM_WATCHING_REASONS; ++i) {
+		if (i != reason && code->co_watching[i] == dict)
+			(void)add_watch(code, (ReasonWatched)i);
+	}
+}
+
+
 int
 _PyCode_WatchDict(PyCodeObject *code, ReasonWatched reason, PyObject *dict)
 {
@@ -210,16 +274,18 @@ _PyCode_WatchDict(PyCodeObject *code, ReasonWatched reason, PyObject *dict)
 	}
 
 	if (code->co_watching[reason] != NULL) {
-		_PyDict_DropWatcher(code->co_watching[reason], code);
+		drop_watch(code, reason);
 	}
+	/* Keys we narrowed our dependency to describe the old dict, not this
+	   one. */
+	if (code->co_watching[reason] != dict)
+		clear_watched_keys(code, reason);
 	/* Note that we do not hold a reference to these dicts. If one of these
 	   dicts is deleted, it will notify all dependent code objects.
 	   Likewise, if this code object is deleted, it will remove itself from
 	   the dictionaries' watcher arrays. */
 	code->co_watching[reason] = dict;
-	_PyDict_AddWatcher(dict, code);
-
-	return 0;
+	return add_watch(code, reason);
 }
 
 int
@@ -227,11 +293,46 @@ _PyCode_IgnoreDict(PyCodeObject *code, ReasonWatched reason)
 {
 	if (code->co_watching == NULL || code->co_watching[reason] == NULL)
 		return 0;
-	_PyDict_DropWatcher(code->co_watching[reason], code);
+	drop_watch(code, reason);
 	code->co_watching[reason] = NULL;
+	clear_watched_keys(code, reason);
 	return 0;
 }
 
+int
+_PyCode_SetWatchedKeys(PyCodeObject *code, ReasonWatched reason,
+		       PyObject *keys)
+{
+	PyObject *key, *value;
+	Py_ssize_t pos = 0;
+
+	assert(keys == NULL || PyDict_Check(keys));
+	if (code->co_watching == NULL || code->co_watching[reason] == NULL) {
+		/* Nothing to narrow. */
+		Py_XDECREF(keys);
+		return 0;
+	}
+	/* The dict indexes its watchers by the contents of exact strs, which
+	   is all names ever are.  Anything else keeps the whole dict. */
+	while (keys != NULL && PyDict_Next(keys, &pos, &key, &value)) {
+		if (!PyString_CheckExact(key))
+			Py_CLEAR(keys);
+	}
+	if (code->co_watched_keys == NULL) {
+		if (keys == NULL)
+			return 0;
+		code->co_watched_keys = new_watch_list();
+		if (code->co_watched_keys == NULL) {
+			Py_DECREF(keys);
+			return -1;
+		}
+	}
+	drop_watch(code, reason);
+	clear_watched_keys(code, reason);
+	code->co_watched_keys[reason] = keys;
+	return add_watch(code, reason);
+}
+
 Py_ssize_t
 _PyCode_WatchingSize(PyCodeObject *code)
 {
@@ -254,9 +355,10 @@ _PyCode_IgnoreWatchedDicts(PyCodeObject *code)
 
 	for (i = 0; i < NUM_WATCHING_REASONS; ++i) {
 		if (code->co_watching[i] != NULL) {
-			_PyDict_DropWatcher(code->co_watching[i], code);
+			drop_watch(code, (ReasonWatched)i);
 		}
 		code->co_watching[i] = NULL;
+		clear_watched_keys(code, (ReasonWatched)i);
 	}
 }
 
@@ -265,9 +367,19 @@ _PyCode_InvalidateMachineCode(PyCodeObject *code)
 {
 	/* This will cause the LLVM-generated code to bail back to the
 	   interpreter. The LLVM code won't be re-entered until it is
-	   recompiled. */
+	   recompiled.  Frames that are already running it keep it alive
+	   through co_llvm_function. */
 	code->co_use_jit = 0;
+	code->co_native_function = NULL;
+	code->co_needs_recompile = 1;
 	code->co_fatalbailcount++;
+	/* Start warming up again.  The feedback stays: frames further up the
+	   stack may still be running the old machine code, or building IR from
+	   this feedback, and the machine code doesn't record any, so a quick
+	   tier compiled after clearing it would leave the tier-up with nothing
+	   to go on.  The recompile sees what the code has done both before and
+	   after the failure, which at worst makes a site polymorphic. */
+	code->co_hotness = 0;
 	/* This is a no-op if not configured with --with-instrumentation. */
 	_PyEval_RecordFatalBail(code);
 	/* The machine code is invalid, no need to keep watching these dicts. */
@@ -289,7 +401,7 @@ _PyCode_ToOptimizedLlvmIr(PyCodeObject *code, int new_opt_level)
 	/* Large functions take a very long time to translate to LLVM
 	   IR, optimize, and JIT, so we just keep them in the
 	   interpreter. */
-	if (PyString_GET_SIZE(code->co_code) > 5000) {
+	if (_PyCode_EstimateIrSize(code) > PY_MAX_ESTIMATED_IR_SIZE) {
 		return 1;
 	}
 	// The exec statement wants to mess with the frame object in
@@ -298,24 +410,60 @@ _PyCode_ToOptimizedLlvmIr(PyCodeObject *code, int new_opt_level)
 	// exec.
 	if (code->co_flags & CO_USES_EXEC)
 		return 1;
+	global_llvm_data = PyThreadState_GET()->interp->global_llvm_data;
+	/* The background compiler thread may be using the LLVM module
+	   without holding the GIL. */
+	PyGlobalLlvmData_Lock(global_llvm_data);
 	if (code->co_llvm_function == NULL) {
 		code->co_llvm_function = _PyCode_ToLlvmIr(code);
-		if (code->co_llvm_function == NULL)
+		if (code->co_llvm_function == NULL) {
+			PyGlobalLlvmData_Unlock(global_llvm_data);
 			return -1;
+		}
+		code->co_needs_recompile = 0;
 	}
-	global_llvm_data = PyThreadState_GET()->interp->global_llvm_data;
 	if (code->co_optimization < new_opt_level &&
 	    PyGlobalLlvmData_Optimize(global_llvm_data,
 				      code->co_llvm_function,
 				      new_opt_level) < 0) {
+		PyGlobalLlvmData_Unlock(global_llvm_data);
 		PyErr_Format(PyExc_SystemError,
 			     "Failed to optimize to level %d",
 			     new_opt_level);
 		return -1;
 	}
+	PyGlobalLlvmData_Unlock(global_llvm_data);
 	code->co_optimization = new_opt_level;
 	return 0;
 }
+
+int
+_PyCode_RecompileLlvmIr(PyCodeObject *code, int new_opt_level)
+{
+	struct PyGlobalLlvmData *global_llvm_data =
+		PyThreadState_GET()->interp->global_llvm_data;
+	_LlvmFunction *old_function = code->co_llvm_function;
+	int old_opt_level = code->co_optimization;
+	char old_needs_recompile = code->co_needs_recompile;
+	int r;
+
+	PyGlobalLlvmData_Lock(global_llvm_data);
+	code->co_llvm_function = NULL;
+	code->co_optimization = -1;
+	r = _PyCode_ToOptimizedLlvmIr(code, new_opt_level);
+	if (r != 0) {
+		if (code->co_llvm_function != NULL)
+			_LlvmFunction_Dealloc(code->co_llvm_function);
+		code->co_llvm_function = old_function;
+		code->co_optimization = old_opt_level;
+		code->co_needs_recompile = old_needs_recompile;
+	}
+	else if (old_function != NULL) {
+		_LlvmFunction_Retire(code->co_llvm_function, old_function);
+	}
+	PyGlobalLlvmData_Unlock(global_llvm_data);
+	return r;
+}
 #else
 static PyGetSetDef code_getsetlist[] = {
 	{NULL} /* Sentinel */
@@ -475,6 +623,10 @@ code_dealloc(PyCodeObject *co)
 		PyMem_Free(co->co_watching);
 		co->co_watching = NULL;
 	}
+	if (co->co_watched_keys) {
+		PyMem_Free(co->co_watched_keys);
+		co->co_watched_keys = NULL;
+	}
 	PyFeedbackMap_Del(co->co_runtime_feedback);
 #endif
 	PyObject_DEL(co);
@@ -10,6 +10,7 @@
 #include "Python.h"
 
 #include "Util/PySmallPtrSet.h"
+#include "Util/PySmallPtrSetMap.h"
 
 
 /* Set a key error with the specified argument, wrapping it in a
@@ -149,7 +150,7 @@ _PyDict_Dummy(void)
 
 /* forward declarations */
 static PyDictEntry *lookdict_string(PyDictObject *mp, PyObject *key, long hash);
-static void notify_watchers(PyDictObject *self);
+static void notify_watchers(PyDictObject *self, PyObject *key);
 static void del_watchers_array(PyDictObject *self);
 
 #ifdef SHOW_CONVERSION_COUNTS
@@ -267,6 +268,7 @@ PyDict_New(void)
 	mp->ma_lookup = lookdict_string;
 #ifdef WITH_LLVM
 	mp->ma_watchers = NULL;
+	mp->ma_key_watchers = NULL;
 #endif
 #ifdef SHOW_CONVERSION_COUNTS
 	++created;
@@ -711,7 +713,7 @@ PyDict_SetItem(register PyObject *op, PyObject *key, PyObject *value)
 	if (status < 0)
 		return -1;
 	else if (status == 0)
-		notify_watchers(mp);
+		notify_watchers(mp, key);
 	/* If we added a key, we can safely resize.  Otherwise just return!
 	 * If fill >= 2/3 size, adjust size.  Normally, this doubles or
 	 * quaduples the size, but it's also possible for the dict to shrink
@@ -766,7 +768,7 @@ PyDict_DelItem(PyObject *op, PyObject *key)
 	mp->ma_used--;
 	Py_DECREF(old_value);
 	Py_DECREF(old_key);
-	notify_watchers(mp);
+	notify_watchers(mp, key);
 	return 0;
 }
 
@@ -791,7 +793,7 @@ PyDict_Clear(PyObject *op)
 #endif
 
 	/* Clear the list of watching code objects. */
-	notify_watchers(mp);
+	notify_watchers(mp, NULL);
 	del_watchers_array(mp);
 
 	table = mp->ma_table;
@@ -921,7 +923,7 @@ dict_dealloc(register PyDictObject *mp)
 	Py_ssize_t fill = mp->ma_fill;
 
 	/* De-optimize any optimized code objects. */
-	notify_watchers(mp);
+	notify_watchers(mp, NULL);
 	del_watchers_array(mp);
 
  	PyObject_GC_UnTrack(mp);
@@ -1497,15 +1499,18 @@ PyDict_Merge(PyObject *a, PyObject *b, int override)
 			if (entry->me_value != NULL &&
 			    (override ||
 			     PyDict_GetItem(a, entry->me_key) == NULL)) {
+				int status;
 				Py_INCREF(entry->me_key);
 				Py_INCREF(entry->me_value);
-				if (insertdict(mp, entry->me_key,
-					       (long)entry->me_hash,
-					       entry->me_value) < 0)
+				status = insertdict(mp, entry->me_key,
+						    (long)entry->me_hash,
+						    entry->me_value);
+				if (status < 0)
 					return -1;
+				if (status == 0)
+					notify_watchers(mp, entry->me_key);
 			}
 		}
-		notify_watchers(mp);
 	}
 	else {
 		/* Do it the generic, slower way */
@@ -1946,7 +1951,7 @@ dict_pop(PyDictObject *mp, PyObject *key, PyObject *deflt)
 	ep->me_value = NULL;
 	mp->ma_used--;
 	Py_DECREF(old_key);
-	notify_watchers(mp);
+	notify_watchers(mp, key);
 	return old_value;
 }
 
@@ -2005,7 +2010,7 @@ dict_popitem(PyDictObject *mp)
 	mp->ma_used--;
 	assert(mp->ma_table[0].me_value == NULL);
 	mp->ma_table[0].me_hash = i + 1;  /* next place to start */
-	notify_watchers(mp);
+	notify_watchers(mp, PyTuple_GET_ITEM(res, 0));
 	return res;
 }
 
@@ -2058,18 +2063,93 @@ _PyDict_DropWatcher(PyObject *self, PyCodeObject *code)
 	PySmallPtrSet_Erase(mp->ma_watchers, (PyObject *)code);
 }
 
+int
+_PyDict_AddKeyWatcher(PyObject *self, PyCodeObject *code, PyObject *key)
+{
+	PyDictObject *mp = (PyDictObject *)self;
+	assert(code != NULL);
+	assert(PyString_CheckExact(key));
+
+	/* notify_watchers() only looks at ma_key_watchers if ma_watchers is
+	   set. */
+	if (mp->ma_watchers == NULL) {
+		mp->ma_watchers = PySmallPtrSet_New();
+		if (mp->ma_watchers == NULL) {
+			PyErr_NoMemory();
+			return -1;
+		}
+	}
+	if (mp->ma_key_watchers == NULL) {
+		mp->ma_key_watchers = PySmallPtrSetMap_New();
+		if (mp->ma_key_watchers == NULL) {
+			PyErr_NoMemory();
+			return -1;
+		}
+	}
+
+	PySmallPtrSetMap_Insert(mp->ma_key_watchers, PyString_AS_STRING(key),
+				PyString_GET_SIZE(key), (PyObject *)code);
+	return 0;
+}
+
+void
+_PyDict_DropKeyWatcher(PyObject *self, PyCodeObject *code, PyObject *key)
+{
+	PyDictObject *mp = (PyDictObject *)self;
+	assert(code != NULL);
+	assert(PyString_CheckExact(key));
+
+	if (mp->ma_key_watchers == NULL)
+		return;
+	PySmallPtrSetMap_Erase(mp->ma_key_watchers, PyString_AS_STRING(key),
+			       PyString_GET_SIZE(key), (PyObject *)code);
+}
+
+static void
+collect_watcher_callback(PyObject *obj, void *set)
+{
+	PySmallPtrSet_Insert((PySmallPtrSet *)set, obj);
+}
+
+/* Returns the set of code objects watching any part of mp, or NULL if out of
+   memory.  The caller owns the set. */
+static PySmallPtrSet *
+all_watchers(PyDictObject *mp)
+{
+	PySmallPtrSet *all = PySmallPtrSet_New();
+	if (all == NULL)
+		return NULL;
+	if (mp->ma_watchers != NULL)
+		PySmallPtrSet_ForEach(mp->ma_watchers, collect_watcher_callback,
+				      all);
+	if (mp->ma_key_watchers != NULL)
+		PySmallPtrSetMap_ForEach(mp->ma_key_watchers,
+					 collect_watcher_callback, all);
+	return all;
+}
+
 Py_ssize_t
 _PyDict_NumWatchers(PyDictObject *mp)
 {
-	if (mp->ma_watchers == NULL)
-		return 0;
-	return PySmallPtrSet_Size(mp->ma_watchers);
+	Py_ssize_t n;
+	PySmallPtrSet *all = all_watchers(mp);
+	if (all == NULL)
+		return -1;
+	n = PySmallPtrSet_Size(all);
+	PySmallPtrSet_Del(all);
+	return n;
 }
 
 int
 _PyDict_IsWatchedBy(PyDictObject *mp, PyCodeObject *code)
 {
-	return PySmallPtrSet_Count(mp->ma_watchers, (PyObject *)code);
+	int watched;
+	PySmallPtrSet *all = all_watchers(mp);
+	if (all == NULL)
+		return -1;
+	watched = PySmallPtrSet_Count(all, (PyObject *)code);
+	PySmallPtrSet_Del(all);
+	return watched;
 }
 #endif  /* WITH_LLVM */
 
@@ -2084,7 +2164,7 @@ notify_watcher_callback(PyObject *obj, void *unused)
 // We split the real work of notify_watchers() out into a separate function so
 // that gcc will inline the self->ma_watchers == NULL test.
 static void
-notify_watchers_helper(PyDictObject *self)
+notify_watchers_helper(PyDictObject *self, PyObject *key)
 {
 	/* No-op if not configured with --with-instrumentation. */
 	_PyEval_RecordWatcherCount(PySmallPtrSet_Size(self->ma_watchers));
@@ -2096,17 +2176,37 @@ notify_watchers_helper(PyDictObject *self)
 	   in quick succession. */
 	PySmallPtrSet_ForEach(self->ma_watchers, notify_watcher_callback, NULL);
 	assert(PySmallPtrSet_Size(self->ma_watchers) == 0);
+	if (self->ma_key_watchers == NULL)
+		return;
+	/* Only the code watching key needs to hear about it.  Any other key
+	   (a str subclass, or a unicode equal to some str) may compare equal
+	   to a watched key, and we can't run its __eq__ in the middle of a
+	   dict mutation to find out, so treat it like a change to every
+	   key. */
+	if (key != NULL && PyString_CheckExact(key)) {
+		PySmallPtrSetMap_ForEachIn(self->ma_key_watchers,
+					   PyString_AS_STRING(key),
+					   PyString_GET_SIZE(key),
+					   notify_watcher_callback, NULL);
+	}
+	else {
+		PySmallPtrSetMap_ForEach(self->ma_key_watchers,
+					 notify_watcher_callback, NULL);
+		assert(PySmallPtrSetMap_Size(self->ma_key_watchers) == 0);
+	}
 }
 #endif  /* WITH_LLVM */
 
+/* Tell the code objects watching this dict that the value for key changed.
+   key is NULL if every key may have changed. */
 static void
-notify_watchers(PyDictObject *self)
+notify_watchers(PyDictObject *self, PyObject *key)
 {
 #ifdef WITH_LLVM
 	if (self->ma_watchers == NULL)
 		return;
 
-	notify_watchers_helper(self);
+	notify_watchers_helper(self, key);
 #endif  /* WITH_LLVM */
 }
 
@@ -2120,6 +2220,12 @@ del_watchers_array(PyDictObject *self)
 		PySmallPtrSet_Del(self->ma_watchers);
 		self->ma_watchers = NULL;
 	}
+	if (self->ma_key_watchers != NULL) {
+		assert(PySmallPtrSetMap_Size(self->ma_key_watchers) == 0 &&
+	       	       "call notify_watchers() before del_watchers_array()");
+		PySmallPtrSetMap_Del(self->ma_key_watchers);
+		self->ma_key_watchers = NULL;
+	}
 #endif  /* WITH_LLVM */
 }
 
@@ -723,12 +723,109 @@ PyFrame_New(PyThreadState *tstate, PyCodeObject *code, PyObject *globals,
 	f->f_use_jit = 0;
 	f->f_bailed_from_llvm = _PYFRAME_NO_BAIL;
 	f->f_guard_type = _PYGUARD_DEFAULT;
+	f->f_virtual = 0;
 #endif
 
 	_PyObject_GC_TRACK(f);
 	return f;
 }
 
+#ifdef WITH_LLVM
+PyFrameObject *
+_PyFrame_InitVirtual(PyVirtualFrame *vf, PyThreadState *tstate,
+		     PyCodeObject *code, PyObject *globals)
+{
+	PyFrameObject *f = &vf->vf_frame;
+	PyFrameObject *back = tstate->frame;
+	int nlocals = code->co_nlocals;
+	int i;
+
+	assert(code->co_flags & CO_NOFREE);
+	if (back == NULL || back->f_globals != globals ||
+	    nlocals + code->co_stacksize > PY_VIRTUAL_FRAME_SLOTS)
+		return NULL;
+
+	/* The frame is never in the gc lists or, under Py_TRACE_REFS, in the
+	   list of live objects, so only the basic header is filled in.  The
+	   caller keeps back, globals and builtins alive for the duration. */
+	memset(f, 0, offsetof(PyFrameObject, f_blockstack));
+	Py_REFCNT(f) = 1;
+	Py_TYPE(f) = &PyFrame_Type;
+	Py_SIZE(f) = nlocals + code->co_stacksize;
+	f->f_back = back;
+	/* Unlike globals, the function's code can be replaced while the
+	   frame runs. */
+	Py_INCREF(code);
+	f->f_code = code;
+	f->f_builtins = back->f_builtins;
+	f->f_globals = globals;
+	f->f_valuestack = f->f_localsplus + nlocals;
+	f->f_stacktop = f->f_valuestack;
+	for (i = 0; i < nlocals; i++)
+		f->f_localsplus[i] = NULL;
+	f->f_tstate = tstate;
+	f->f_lasti = -1;
+	f->f_lineno = code->co_firstlineno;
+	f->f_virtual = 1;
+	return f;
+}
+
+PyFrameObject *
+_PyFrame_Materialize(PyFrameObject *f)
+{
+	PyFrameObject *copy;
+	PyObject **src, **dst;
+
+	assert(f->f_virtual);
+	/* A virtual frame's f_back is always tstate->frame, so PyFrame_New()
+	   picks the same parent and builtins. */
+	assert(f->f_back == f->f_tstate->frame);
+	copy = PyFrame_New(f->f_tstate, f->f_code, f->f_globals, NULL);
+	if (copy == NULL)
+		return NULL;
+
+	for (src = f->f_localsplus, dst = copy->f_localsplus;
+	     src < f->f_valuestack; src++, dst++) {
+		Py_XINCREF(*src);
+		*dst = *src;
+	}
+	/* Machine code only saves the value stack when it bails. */
+	if (f->f_stacktop != NULL) {
+		for (src = f->f_valuestack, dst = copy->f_valuestack;
+		     src < f->f_stacktop; src++, dst++) {
+			Py_XINCREF(*src);
+			*dst = *src;
+		}
+		copy->f_stacktop = dst;
+	}
+	copy->f_lasti = f->f_lasti;
+	copy->f_lineno = f->f_lineno;
+	copy->f_iblock = f->f_iblock;
+	memcpy(copy->f_blockstack, f->f_blockstack,
+	       f->f_iblock * sizeof(PyTryBlock));
+	copy->f_use_jit = f->f_use_jit;
+	copy->f_bailed_from_llvm = f->f_bailed_from_llvm;
+	copy->f_guard_type = f->f_guard_type;
+	return copy;
+}
+
+void
+_PyFrame_ClearVirtual(PyFrameObject *f)
+{
+	PyObject **p;
+
+	assert(f->f_virtual);
+	assert(Py_REFCNT(f) == 1 && "a virtual frame escaped");
+	for (p = f->f_localsplus; p < f->f_valuestack; p++)
+		Py_CLEAR(*p);
+	if (f->f_stacktop != NULL) {
+		for (p = f->f_valuestack; p < f->f_stacktop; p++)
+			Py_XDECREF(*p);
+	}
+	Py_DECREF(f->f_code);
+}
+#endif  /* WITH_LLVM */
+
 /* Block management. Keep these in sync with the definitions in
    JIT/llvm_inline_functions.c. */
 
@@ -86,7 +86,10 @@ gen_send_ex(PyGenObject *gen, PyObject *arg, int exc)
 
 	gen->gi_running = 1;
 	f->f_throwflag = exc;
-	result = PyEval_EvalFrame(f);
+#ifdef WITH_LLVM
+	if (!_PyEval_ResumeGenerator(f, &result))
+#endif
+		result = PyEval_EvalFrame(f);
 	f->f_throwflag = 0;
 	gen->gi_running = 0;
 
@@ -203,13 +203,7 @@ PyTypeObject PyRange_Type = {
 
 /*********************** Xrange Iterator **************************/
 
-typedef struct {
-	PyObject_HEAD
-	long	index;
-	long	start;
-	long	step;
-	long	len;
-} rangeiterobject;
+typedef _PyRangeIterObject rangeiterobject;
 
 static PyObject *
 rangeiter_next(rangeiterobject *r)
@@ -232,7 +226,7 @@ static PyMethodDef rangeiter_methods[] = {
  	{NULL,		NULL}		/* sentinel */
 };
 
-static PyTypeObject Pyrangeiter_Type = {
+PyTypeObject PyRangeIter_Type = {
 	PyObject_HEAD_INIT(&PyType_Type)
 	0,                                      /* ob_size */
 	"rangeiterator",                        /* tp_name */
@@ -275,7 +269,7 @@ range_iter(PyObject *seq)
 		PyErr_BadInternalCall();
 		return NULL;
 	}
-	it = PyObject_New(rangeiterobject, &Pyrangeiter_Type);
+	it = PyObject_New(rangeiterobject, &PyRangeIter_Type);
 	if (it == NULL)
 		return NULL;
 	it->index = 0;
@@ -295,7 +289,7 @@ range_reverse(PyObject *seq)
 		PyErr_BadInternalCall();
 		return NULL;
 	}
-	it = PyObject_New(rangeiterobject, &Pyrangeiter_Type);
+	it = PyObject_New(rangeiterobject, &PyRangeIter_Type);
 	if (it == NULL)
 		return NULL;
 
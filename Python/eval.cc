@@ -29,6 +29,9 @@
 #include "llvm/Function.h"
 #include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/raw_ostream.h"
+#include "JIT/CodeCache.h"
+#include "JIT/CompileBudget.h"
+#include "JIT/CompileQueue.h"
 #include "JIT/global_llvm_data.h"
 #include "JIT/RuntimeFeedback.h"
 #include "Util/Stats.h"
@@ -100,6 +103,26 @@ private:
 
 static llvm::ManagedStatic<FeedbackMapCounter> feedback_map_counter;
 
+// Count how many times frames moved from the interpreter into machine code in
+// the middle of a loop.
+class OsrEntryCounter {
+public:
+	OsrEntryCounter() : counter_(0) {}
+	~OsrEntryCounter() {
+		errs() << "\nOn-stack replacements into machine code:\n";
+		errs() << "N: " << this->counter_ << "\n";
+	}
+
+	void IncCounter() {
+		this->counter_++;
+	}
+
+private:
+	unsigned counter_;
+};
+
+static llvm::ManagedStatic<OsrEntryCounter> osr_entries;
+
 
 class HotnessTracker {
 	// llvm::DenseSet or llvm::SmallPtrSet may be better, but as of this
@@ -292,6 +315,7 @@ public:
 			GUARD_CASE(_PYGUARD_CFUNC)
 			GUARD_CASE(_PYGUARD_BRANCH)
 			GUARD_CASE(_PYGUARD_STORE_SUBSCR)
+			GUARD_CASE(_PYGUARD_SLICE)
 			default:
 				wrapper << ((int)frame->f_guard_type);
 		}
@@ -345,6 +369,15 @@ static PyObject * load_args(PyObject ***, int);
 #ifdef WITH_LLVM
 static inline void mark_called(PyCodeObject *co);
 static inline int maybe_compile(PyCodeObject *co, PyFrameObject *f);
+static int maybe_enter_osr(PyThreadState *tstate, PyCodeObject *co,
+			   PyFrameObject *f, PyObject **stack_pointer,
+			   int loop_header, PyObject **retval);
+
+/* A warm loop without machine code to enter only asks maybe_compile() to
+   start compiling it once every this many backedges.  Asking on every
+   backedge would make a loop whose compile was refused by the budget pay
+   for maybe_compile() on each iteration. */
+#define PY_OSR_RECHECK_INTERVAL 1024
 
 /* Record data for use in generating optimized machine code. */
 static void record_type(PyCodeObject *, int, int, int, PyObject *);
@@ -532,6 +565,11 @@ PyEval_ReInitThreads(void)
 	PyThread_acquire_lock(interpreter_lock, 1);
 	_PyEval_main_thread = PyThread_get_thread_ident();
 
+#ifdef WITH_LLVM
+	/* The background compiler thread didn't survive the fork. */
+	PyGlobalLlvmData::Get()->AfterFork();
+#endif
+
 	/* Update the threading module with the new state.
 	 */
 	tstate = PyThreadState_GET();
@@ -1097,6 +1135,19 @@ PyEval_EvalFrame(PyFrameObject *f)
 		return NULL;
 
 #ifdef WITH_LLVM
+	if (f->f_virtual) {
+		/* Machine code running in a virtual frame bailed.  The
+		   interpreter carries on in a heap copy of the frame, and
+		   _PyEval_CallPyFunction() clears the original. */
+		PyFrameObject *heap_frame = _PyFrame_Materialize(f);
+		if (heap_frame == NULL)
+			return NULL;
+		retval = PyEval_EvalFrame(heap_frame);
+		/* A bailed frame leaves tstate->frame pointing at itself. */
+		tstate->frame = heap_frame->f_back;
+		Py_DECREF(heap_frame);
+		return retval;
+	}
 	bail_reason = (_PyFrameBailReason)f->f_bailed_from_llvm;
 #else
 	bail_reason = _PYFRAME_NO_BAIL;
@@ -1113,13 +1164,10 @@ PyEval_EvalFrame(PyFrameObject *f)
 
 	if (f->f_use_jit) {
 		assert(bail_reason == _PYFRAME_NO_BAIL);
-		assert(co->co_native_function != NULL &&
-		       "maybe_compile was supposed to ensure"
-		       " that co_native_function exists");
-		if (!co->co_use_jit) {
+		if (!co->co_use_jit || co->co_native_function == NULL) {
 			// A frame cannot use_jit if the underlying code object
-			// can't use_jit. This comes up when a generator is
-			// invalidated while active.
+			// can't use_jit, or has no machine code to run. This
+			// comes up when a generator is invalidated while active.
 			f->f_use_jit = 0;
 		}
 		else {
@@ -1153,7 +1201,7 @@ PyEval_EvalFrame(PyFrameObject *f)
 #if Py_WITH_INSTRUMENTATION
 		feedback_map_counter->IncCounter();
 #endif
-		co->co_runtime_feedback = PyFeedbackMap_New();
+		co->co_runtime_feedback = PyFeedbackMap_New(co);
 	}
 #endif  /* WITH_LLVM */
 
@@ -2687,6 +2735,32 @@ PyEval_EvalFrame(PyFrameObject *f)
 		TARGET(JUMP_ABSOLUTE)
 			UPDATE_HOTNESS_JABS();
 			JUMPTO(oparg);
+#ifdef WITH_LLVM
+			/* A long-running loop may make its code hot without
+			   the code ever being called again; move the frame
+			   into machine code at the loop header.  This runs
+			   on every backedge, so only bother maybe_compile()
+			   when it has machine code to enter, or now and then
+			   to start a compile when none is pending. */
+			if (oparg <= f->f_lasti &&
+			    _PyCode_HOTNESS(co) > PY_QUICK_HOTNESS_THRESHOLD &&
+			    Py_JitControl == PY_JIT_WHENHOT &&
+			    f->f_bailed_from_llvm == _PYFRAME_NO_BAIL &&
+			    (co->co_native_function != NULL ?
+			     co->co_fatalbailcount < PY_MAX_FATALBAILCOUNT :
+			     !co->co_compile_pending &&
+			     co->co_hotness % PY_OSR_RECHECK_INTERVAL == 0)) {
+				err = maybe_enter_osr(tstate, co, f,
+						      stack_pointer, oparg,
+						      &retval);
+				if (err < 0) {
+					why = UNWIND_EXCEPTION;
+					break;
+				}
+				if (err > 0)
+					goto exit_eval_frame;
+			}
+#endif
 #if FAST_LOOPS
 			/* Enabling this path speeds-up all while and for-loops by bypassing
                            the per-loop checks for signals.  By default, this should be turned-off
@@ -2860,6 +2934,10 @@ PyEval_EvalFrame(PyFrameObject *f)
 				 * _PyEval_CallFunction(). */
 				PyObject **func = stack_pointer - num_args - 1;
 				RECORD_FUNC(*func);
+				if (PyFunction_Check(*func)) {
+					RECORD_OBJECT(PY_FDO_CALLEE_CODE,
+					    PyFunction_GET_CODE(*func));
+				}
 				/* For C functions, record the types passed, 
 				 * in order to do potential inlining. */
 				if (PyCFunction_Check(*func) &&
@@ -2914,6 +2992,10 @@ PyEval_EvalFrame(PyFrameObject *f)
 			 * implement). */
 			if (num_kwargs == 0) {
 				RECORD_FUNC(method);
+				if (PyFunction_Check(method)) {
+					RECORD_OBJECT(PY_FDO_CALLEE_CODE,
+					    PyFunction_GET_CODE(method));
+				}
 			}
 #endif
 			x = _PyEval_CallFunction(stack_pointer,
@@ -3958,6 +4040,20 @@ _PyEval_CallTrace(Py_tracefunc func, PyObject *obj, PyFrameObject *frame,
 	int result;
 	if (tstate->tracing)
 		return 0;
+#ifdef WITH_LLVM
+	if (frame->f_virtual) {
+		/* Tracers may keep the frame they're given, so give them
+		   one that lives on the heap.  Machine code for leaf
+		   functions only calls tracers on the way out, so changes
+		   they make to the frame don't need to be copied back. */
+		PyFrameObject *heap_frame = _PyFrame_Materialize(frame);
+		if (heap_frame == NULL)
+			return -1;
+		result = _PyEval_CallTrace(func, obj, heap_frame, what, arg);
+		Py_DECREF(heap_frame);
+		return result;
+	}
+#endif
 	tstate->tracing++;
 	tstate->use_tracing = 0;
 	result = func(obj, frame, what, arg);
@@ -4328,20 +4424,70 @@ mark_called(PyCodeObject *co)
 	co->co_hotness += 10;
 }
 
+// Remember that co was compiled, so that the next process can compile it
+// sooner.  Only hotness-driven compilation says anything about which code is
+// worth compiling.
+static void
+record_in_code_cache(PyCodeObject *co)
+{
+	if (Py_JitControl != PY_JIT_WHENHOT)
+		return;
+	PyJitCodeCache &cache = PyGlobalLlvmData::Get()->code_cache();
+	if (cache.enabled())
+		cache.Record(co, co->co_optimization);
+}
+
+// Hand co off to the background compiler thread, if it's enabled, to be
+// compiled (or recompiled, if recompile is true) at target_optimization.
+// Returns 1 if co is (or already was) queued; 0 if the caller should compile
+// co itself; or -1 on error.
+static int
+queue_background_compile(PyCodeObject *co, PyFrameObject *f,
+			 int target_optimization, bool recompile)
+{
+	PyJitCompileQueue &queue = PyGlobalLlvmData::Get()->compile_queue();
+	if (!queue.enabled())
+		return 0;
+	if (co->co_compile_pending)
+		return 1;
+
+	if (recompile || (co->co_llvm_function == NULL &&
+			  co->co_optimization < target_optimization)) {
+		// The IR is specialized on these, so watch them before the
+		// compiler thread generates it.
+		if (_PyCode_WatchDict(co, WATCHING_GLOBALS, f->f_globals))
+			return -1;
+		if (_PyCode_WatchDict(co, WATCHING_BUILTINS, f->f_builtins))
+			return -1;
+	}
+	return queue.Enqueue(co, target_optimization) ? 1 : 0;
+}
+
 // Decide whether to compile a code object's bytecode to native code based on
 // the current Py_JitControl setting and the code's hotness.  We do the
 // compilation if any of the following conditions are true:
 //
 // - We are running under PY_JIT_WHENHOT and co's hotness has passed the
-//   hotness threshold.
+//   quick-tier hotness threshold.
 // - The code object was marked as needing to be run through LLVM
 //   (co_use_jit is true).
 // - We are running under PY_JIT_ALWAYS.
 //
+// Under PY_JIT_WHENHOT, code is compiled in tiers: warm code (past
+// PY_QUICK_HOTNESS_THRESHOLD) gets the cheap Py_QUICK_JIT_OPT_LEVEL pipeline,
+// and hot code (past PY_HOTNESS_THRESHOLD) gets the full pipeline, which may
+// mean recompiling code that is already running as quick-tier machine code.
+// If background compilation is enabled (see JIT/CompileQueue.h), the
+// compilation happens on another thread and f keeps running whatever it
+// would have run before until the new co_native_function is published.
+//
 // Returns 0 on success or -1 on failure.
 //
-// If this code object has had too many fatal guard failures (see
-// PY_MAX_FATALBAILCOUNT), it is forced to use the eval loop forever.
+// Code whose machine code failed a fatal guard goes through the same steps
+// again, from its updated feedback, once it is hot again; _PyCode_HOTNESS()
+// makes it wait twice as long after each failure.  If this code object has had too
+// many fatal guard failures (see PY_MAX_FATALBAILCOUNT), it is forced to use
+// the eval loop forever.
 //
 // This function is performance-critical. If you're changing this function,
 // you should keep a close eye on the benchmarks, particularly call_simple.
@@ -4350,6 +4496,10 @@ mark_called(PyCodeObject *co)
 static inline int
 maybe_compile(PyCodeObject *co, PyFrameObject *f)
 {
+	// f may be a generator frame that ran machine code last time.  Unless
+	// we get to the end and decide otherwise, it runs in the interpreter.
+	f->f_use_jit = 0;
+
 	if (f->f_bailed_from_llvm != _PYFRAME_NO_BAIL) {
 		// Don't consider compiling code objects that we've already
 		// bailed from.  This avoids re-entering code that we just
@@ -4371,20 +4521,34 @@ maybe_compile(PyCodeObject *co, PyFrameObject *f)
 		return 0;
 	}
 
+	const long hotness = _PyCode_HOTNESS(co);
 	bool is_hot = false;
-	if (co->co_hotness > PY_HOTNESS_THRESHOLD) {
+	if (hotness > PY_HOTNESS_THRESHOLD) {
 		is_hot = true;
 #ifdef Py_WITH_INSTRUMENTATION
 		hot_code->AddHotCode(co);
 #endif
 	}
+	int target_optimization =
+		std::max(Py_DEFAULT_JIT_OPT_LEVEL, Py_OptimizeFlag);
+	// True if co is already running as machine code from a cheaper tier
+	// and should be recompiled at target_optimization.
+	bool tier_up = false;
 	switch (Py_JitControl) {
 	default:
 		PyErr_BadInternalCall();
 		return -1;
 	case PY_JIT_WHENHOT:
-		if (is_hot)
-			co->co_use_jit = 1;
+		if (!is_hot) {
+			if (hotness <= PY_QUICK_HOTNESS_THRESHOLD)
+				break;
+			target_optimization =
+				std::max(Py_QUICK_JIT_OPT_LEVEL,
+					 Py_OptimizeFlag);
+		}
+		co->co_use_jit = 1;
+		tier_up = co->co_native_function != NULL &&
+			co->co_optimization < target_optimization;
 		break;
 	case PY_JIT_ALWAYS:
 		co->co_use_jit = 1;
@@ -4392,14 +4556,72 @@ maybe_compile(PyCodeObject *co, PyFrameObject *f)
 	case PY_JIT_NEVER:
 		break;
 	}
+	// Invalidated IR was generated under assumptions that no longer hold,
+	// so it has to be regenerated, just like when tiering up.
+	const bool recompile = tier_up ||
+		(co->co_needs_recompile && co->co_llvm_function != NULL);
+
+	if (co->co_use_jit && (co->co_native_function == NULL || recompile) &&
+	    Py_JitControl == PY_JIT_WHENHOT) {
+		if (!co->co_compile_pending &&
+		    !PyGlobalLlvmData::Get()->compile_budget().CanCompile(co)) {
+			// We've compiled enough for now.  co stays hot, so a
+			// later call will try again once the budget has
+			// refilled.
+			f->f_use_jit = co->co_native_function != NULL;
+			return 0;
+		}
+		int r = queue_background_compile(co, f, target_optimization,
+						  recompile);
+		if (r < 0)
+			return -1;
+		if (r == 1) {
+			// Keep running the interpreter, or the previous tier's
+			// machine code, until the new machine code is ready.
+			f->f_use_jit = co->co_native_function != NULL;
+			return 0;
+		}
+	}
 
 	if (co->co_use_jit) {
-		if (co->co_llvm_function == NULL) {
+		const bool compiling = co->co_native_function == NULL || recompile;
+		const int64_t compile_start =
+			compiling ? PyJitCompileBudget::Now() : 0;
+		if (recompile) {
+			// Regenerate the IR rather than reoptimizing the quick
+			// tier's (or the invalidated code's), which may have
+			// been inlined or specialized differently.
+			PY_LOG_TSC_EVENT(EVAL_COMPILE_START);
+			int r;
+#if Py_WITH_INSTRUMENTATION
+			Timer timer(*ir_compilation_times);
+#endif
+			PY_LOG_TSC_EVENT(LLVM_COMPILE_START);
+			if (_PyCode_WatchDict(co,
+			                      WATCHING_GLOBALS,
+			                      f->f_globals))
+				return -1;
+			if (_PyCode_WatchDict(co,
+			                      WATCHING_BUILTINS,
+			                      f->f_builtins))
+				return -1;
+			r = _PyCode_RecompileLlvmIr(co, target_optimization);
+			PY_LOG_TSC_EVENT(LLVM_COMPILE_END);
+			if (r < 0)  // Error
+				return -1;
+			if (r == 0)
+				co->co_native_function = NULL;
+			else if (co->co_needs_recompile) {
+				// Codegen refused, and there's no valid
+				// machine code to fall back on.
+				co->co_use_jit = 0;
+				return 0;
+			}
+			// If codegen was refused, keep the old machine code.
+		}
+		else if (co->co_llvm_function == NULL) {
 			// Translate the bytecode to IR and optimize it if we
 			// haven't already done that.
-			int target_optimization =
-				std::max(Py_DEFAULT_JIT_OPT_LEVEL,
-					 Py_OptimizeFlag);
 			if (co->co_optimization < target_optimization) {
 				PY_LOG_TSC_EVENT(EVAL_COMPILE_START);
 				int r;
@@ -4433,18 +4655,55 @@ maybe_compile(PyCodeObject *co, PyFrameObject *f)
 #endif
 			PY_LOG_TSC_EVENT(JIT_START);
 			co->co_native_function =
-				_LlvmFunction_Jit(co->co_llvm_function);
+				_LlvmFunction_Jit(PyGlobalLlvmData::Get(),
+						  co->co_llvm_function);
 			PY_LOG_TSC_EVENT(JIT_END);
 			if (co->co_native_function == NULL) {
 				return -1;
 			}
+			record_in_code_cache(co);
 		}
 		PY_LOG_TSC_EVENT(EVAL_COMPILE_END);
+		if (compiling)
+			PyGlobalLlvmData::Get()->compile_budget().Charge(
+				PyJitCompileBudget::Now() - compile_start,
+				_PyCode_EstimateIrSize(co));
 	}
 
 	f->f_use_jit = co->co_use_jit;
 	return 0;
 }
+
+// On-stack replacement: called from the JUMP_ABSOLUTE at the bottom of a
+// loop, just before the interpreter jumps back to loop_header.  If co has
+// (or can now get) machine code, hand f over to it in the middle of the loop
+// and let it run the frame to completion (or to the next yield).  Returns 1
+// if the machine code ran, with its result in *retval; 0 if the interpreter
+// should keep going; or -1 on error.
+static int
+maybe_enter_osr(PyThreadState *tstate, PyCodeObject *co, PyFrameObject *f,
+		PyObject **stack_pointer, int loop_header, PyObject **retval)
+{
+	// The machine code would fire the call trace event again, and a frame
+	// that already bailed shouldn't go straight back.
+	if (tstate->use_tracing || f->f_bailed_from_llvm != _PYFRAME_NO_BAIL)
+		return 0;
+	if (maybe_compile(co, f) < 0)
+		return -1;
+	if (!f->f_use_jit)
+		return 0;
+
+	// This is the state LlvmFunctionBuilder::AddOsrEntry() expects: the
+	// block stack is already in the frame, and the locals always are.
+	assert(co->co_native_function != NULL);
+	f->f_stacktop = stack_pointer;
+	f->f_lasti = loop_header;
+#ifdef Py_WITH_INSTRUMENTATION
+	osr_entries->IncCounter();
+#endif
+	*retval = co->co_native_function(f);
+	return 1;
+}
 #endif  /* WITH_LLVM */
 
 #define C_TRACE(x, call) \
@@ -4590,6 +4849,176 @@ _PyEval_CallFunction(PyObject **stack_pointer, int na, int nk)
 	return x;
 }
 
+#ifdef WITH_LLVM
+/* Returns true if f can run co's machine code right away, skipping
+   PyEval_EvalFrame()'s prologue and maybe_compile(): nothing is tracing, f
+   hasn't bailed, co's machine code is valid and not due for a tier-up, and it
+   was compiled for f's globals and builtins.  Anything else has to take the
+   regular path, which knows how to deal with it. */
+static inline bool
+can_enter_machine_code(PyThreadState *tstate, PyCodeObject *co,
+		       PyFrameObject *f)
+{
+	PyObject **watching;
+
+	if (tstate->use_tracing || f->f_bailed_from_llvm != _PYFRAME_NO_BAIL)
+		return false;
+	if (!co->co_use_jit || co->co_native_function == NULL ||
+	    co->co_needs_recompile ||
+	    co->co_fatalbailcount >= PY_MAX_FATALBAILCOUNT)
+		return false;
+	if (Py_JitControl == PY_JIT_WHENHOT &&
+	    co->co_optimization < std::max(Py_DEFAULT_JIT_OPT_LEVEL,
+					   Py_OptimizeFlag) &&
+	    _PyCode_HOTNESS(co) > PY_HOTNESS_THRESHOLD)
+		// Let maybe_compile() move it up from the quick tier.
+		return false;
+	watching = co->co_watching;
+	if (watching != NULL && watching[WATCHING_GLOBALS] != NULL &&
+	    (watching[WATCHING_GLOBALS] != f->f_globals ||
+	     watching[WATCHING_BUILTINS] != f->f_builtins))
+		// The machine code assumes other globals; see maybe_compile().
+		return false;
+	return true;
+}
+
+/* Called from machine code at callsites whose feedback says they call Python
+   functions.  If func's machine code can run as-is, this sets up the frame
+   the way fast_function() does and calls the machine code directly, skipping
+   PyEval_EvalFrame()'s prologue and maybe_compile().  Anything that
+   maybe_compile() or the prologue would have to deal with -- a tracer or
+   profiler, a pending tier-up, invalidated machine code, machine code
+   compiled for other globals -- takes the regular path instead; see
+   can_enter_machine_code().
+
+   Leaf functions (see can_elide_frame() in JIT/llvm_compile.cc) run in a
+   virtual frame on the C stack rather than a PyFrameObject from the heap;
+   see Include/frameobject.h.
+
+   Like _PyEval_CallFunction(), this consumes a reference to each of the
+   arguments and the called function, and the caller must adjust the stack
+   pointer down by na + 1. */
+PyObject *
+_PyEval_CallPyFunction(PyObject **stack_pointer, int na)
+{
+	PyObject **pfunc = stack_pointer - na - 1;
+	PyObject *func = *pfunc;
+	PyThreadState *tstate = PyThreadState_GET();
+	PyCodeObject *co;
+	PyVirtualFrame vf;
+	PyFrameObject *f = NULL;
+	PyObject *retval;
+	int flags_required, flags_forbidden, flags_mask;
+	int i;
+
+	if (!PyFunction_Check(func) || tstate->use_tracing)
+		return _PyEval_CallFunction(stack_pointer, na, 0);
+	co = (PyCodeObject *)PyFunction_GET_CODE(func);
+	flags_required = (CO_OPTIMIZED | CO_NEWLOCALS | CO_NOFREE);
+	flags_forbidden = (CO_VARKEYWORDS | CO_VARARGS | CO_GENERATOR);
+	flags_mask = flags_required | flags_forbidden;
+	// can_enter_machine_code() makes the real decision once we have a
+	// frame; checking co_native_function here as well keeps us from
+	// building one for code that has never been compiled.
+	if (co->co_argcount != na ||
+	    (co->co_flags & flags_mask) != flags_required ||
+	    co->co_native_function == NULL)
+		return _PyEval_CallFunction(stack_pointer, na, 0);
+
+	if (co->co_elide_frame)
+		f = _PyFrame_InitVirtual(&vf, tstate, co,
+					 PyFunction_GET_GLOBALS(func));
+	if (f == NULL) {
+		f = PyFrame_New(tstate, co, PyFunction_GET_GLOBALS(func), NULL);
+		if (f == NULL) {
+			retval = NULL;
+			goto clear_stack;
+		}
+	}
+	if (!can_enter_machine_code(tstate, co, f)) {
+		if (f->f_virtual)
+			_PyFrame_ClearVirtual(f);
+		else
+			Py_DECREF(f);
+		return _PyEval_CallFunction(stack_pointer, na, 0);
+	}
+	PCALL(PCALL_FUNCTION);
+	PCALL(PCALL_FAST_FUNCTION);
+	PCALL(PCALL_FASTER_FUNCTION);
+	mark_called(co);
+
+	/* Hand our references to the arguments over to the frame. */
+	for (i = 0; i < na; i++) {
+		f->f_localsplus[i] = pfunc[i + 1];
+	}
+	stack_pointer = pfunc + 1;
+	f->f_use_jit = 1;
+
+	if (Py_EnterRecursiveCall("")) {
+		retval = NULL;
+	}
+	else {
+		/* If the machine code bails, the PyEval_EvalFrame() that takes
+		   over leaves tstate->frame and the recursion depth for us to
+		   clean up, as it would for its caller.  Virtual frames stay
+		   out of tstate->frame altogether. */
+		if (!f->f_virtual)
+			tstate->frame = f;
+		retval = co->co_native_function(f);
+		Py_LeaveRecursiveCall();
+		tstate->frame = f->f_back;
+	}
+	++tstate->recursion_depth;
+	if (f->f_virtual)
+		_PyFrame_ClearVirtual(f);
+	else
+		Py_DECREF(f);
+	--tstate->recursion_depth;
+
+clear_stack:
+	while (stack_pointer > pfunc) {
+		PyObject *w = EXT_POP(stack_pointer);
+		Py_DECREF(w);
+	}
+	return retval;
+}
+
+/* Called from gen_send_ex() to resume a suspended generator frame.  If the
+   frame is already running as machine code and that machine code can take
+   it as-is, this calls straight back into it, skipping PyEval_EvalFrame()'s
+   prologue and maybe_compile() the same way _PyEval_CallPyFunction() does.
+   The live part of the value stack was left in f->f_valuestack by
+   YIELD_VALUE, and that is all the machine code reloads on the way in.
+
+   Returns 1 and stores the result in *retval if it ran the frame, or 0 if
+   the caller has to go through PyEval_EvalFrame() instead. */
+int
+_PyEval_ResumeGenerator(PyFrameObject *f, PyObject **retval)
+{
+	PyThreadState *tstate = PyThreadState_GET();
+	PyCodeObject *co = f->f_code;
+
+	if (f->f_lasti == -1 || !f->f_use_jit ||
+	    !can_enter_machine_code(tstate, co, f))
+		return 0;
+	// Each resume counts like a call, so that hot generators still tier up
+	// from the quick tier.
+	mark_called(co);
+
+	if (Py_EnterRecursiveCall("")) {
+		*retval = NULL;
+		return 1;
+	}
+	/* As in _PyEval_CallPyFunction(), a bail leaves tstate->frame and the
+	   recursion depth to us. */
+	tstate->frame = f;
+	*retval = co->co_native_function(f);
+	Py_LeaveRecursiveCall();
+	tstate->frame = f->f_back;
+	return 1;
+}
+#endif  /* WITH_LLVM */
+
 /* Consumes a reference to each of the arguments and the called function, but
    the caller must adjust the stack pointer down by (na + 2*nk + 1) + 1 for a
    *args call + 1 for a **kwargs call.  We put the stack change in the caller
@@ -4963,10 +5392,13 @@ void inc_feedback_counter(PyCodeObject *co, int expected_opcode,
 		actual_opcode == EXTENDED_ARG) &&
 	       "Mismatch between feedback and opcode array.");
 #endif  /* NDEBUG */
-	PyRuntimeFeedback &feedback =
-		co->co_runtime_feedback->GetOrCreateFeedbackEntry(
-			opcode_index, arg_index);
-	feedback.IncCounter(counter_id);
+	PyRuntimeFeedback *feedback =
+		co->co_runtime_feedback->GetFeedbackEntry(opcode_index,
+							  arg_index);
+	assert(feedback != NULL &&
+	       "num_feedback_slots() doesn't know about this opcode.");
+	if (feedback != NULL)
+		feedback->IncCounter(counter_id);
 }
 
 // Records func into the feedback array.
@@ -4980,10 +5412,13 @@ void record_func(PyCodeObject *co, int expected_opcode,
 		actual_opcode == EXTENDED_ARG) &&
 	       "Mismatch between feedback and opcode array.");
 #endif  /* NDEBUG */
-	PyRuntimeFeedback &feedback =
-		co->co_runtime_feedback->GetOrCreateFeedbackEntry(
-			opcode_index, arg_index);
-	feedback.AddFuncSeen(func);
+	PyRuntimeFeedback *feedback =
+		co->co_runtime_feedback->GetFeedbackEntry(opcode_index,
+							  arg_index);
+	assert(feedback != NULL &&
+	       "num_feedback_slots() doesn't know about this opcode.");
+	if (feedback != NULL)
+		feedback->AddFuncSeen(func);
 }
 
 // Records obj into the feedback array. Only use this on long-lived objects,
@@ -4998,10 +5433,13 @@ void record_object(PyCodeObject *co, int expected_opcode,
 		actual_opcode == EXTENDED_ARG) &&
 	       "Mismatch between feedback and opcode array.");
 #endif  /* NDEBUG */
-	PyRuntimeFeedback &feedback =
-		co->co_runtime_feedback->GetOrCreateFeedbackEntry(
-			opcode_index, arg_index);
-	feedback.AddObjectSeen(obj);
+	PyRuntimeFeedback *feedback =
+		co->co_runtime_feedback->GetFeedbackEntry(opcode_index,
+							  arg_index);
+	assert(feedback != NULL &&
+	       "num_feedback_slots() doesn't know about this opcode.");
+	if (feedback != NULL)
+		feedback->AddObjectSeen(obj);
 }
 
 // Records the type of obj into the feedback array.
@@ -14,6 +14,8 @@
 #include "eval.h"
 #include "osdefs.h"
 #include "importdl.h"
+#include "JIT/CodeCache_fwd.h"
+#include "JIT/global_llvm_data_fwd.h"
 
 #ifdef HAVE_FCNTL_H
 #include <fcntl.h>
@@ -810,6 +812,9 @@ load_compiled_module(char *name, char *cpathname, FILE *fp)
 	if (Py_VerboseFlag)
 		PySys_WriteStderr("import %s # precompiled from %s\n",
 			name, cpathname);
+#ifdef WITH_LLVM
+	PyJitCodeCache_Apply(PyGlobalLlvmData_GET(), co);
+#endif
 	m = PyImport_ExecCodeModuleEx(name, (PyObject *)co, cpathname);
 	Py_DECREF(co);
 
@@ -1022,6 +1027,9 @@ load_source_module(char *name, char *pathname, FILE *fp)
 				write_compiled_module(co, cpathname, &st);
 		}
 	}
+#ifdef WITH_LLVM
+	PyJitCodeCache_Apply(PyGlobalLlvmData_GET(), co);
+#endif
 	m = PyImport_ExecCodeModuleEx(name, (PyObject *)co, pathname);
 	Py_DECREF(co);
 
@@ -17,6 +17,8 @@
 #include "ast.h"
 #include "eval.h"
 #include "marshal.h"
+#include "JIT/CodeCache_fwd.h"
+#include "JIT/CompileQueue_fwd.h"
 #include "JIT/global_llvm_data_fwd.h"
 
 #ifdef HAVE_SIGNAL_H
@@ -231,6 +233,11 @@ Py_InitializeEx(int install_sigs)
 		Py_FatalError("Py_Initialize: can't make first thread");
 	(void) PyThreadState_Swap(tstate);
 
+#ifdef WITH_LLVM
+	if ((p = Py_GETENV("PYTHONJITCACHE")) && *p != '\0')
+		PyJitCodeCache_SetEnabled(interp->global_llvm_data, 1);
+#endif
+
 	_Py_ReadyTypes();
 
 	if (!_PyFrame_Init())
@@ -497,6 +504,13 @@ Py_Finalize(void)
 	tstate = PyThreadState_GET();
 	interp = tstate->interp;
 
+#ifdef WITH_LLVM
+	/* Stop the background compiler thread before we start tearing down
+	   the objects it may be compiling. */
+	PyJitCompileQueue_Stop(interp->global_llvm_data);
+	PyJitCodeCache_Flush(interp->global_llvm_data);
+#endif
+
 	/* Disable signal handling */
 	PyOS_FiniInterrupts();
 
@@ -727,6 +741,11 @@ Py_EndInterpreter(PyThreadState *tstate)
 
 	if (tstate != PyThreadState_GET())
 		Py_FatalError("Py_EndInterpreter: thread is not current");
+#ifdef WITH_LLVM
+	/* The background compiler thread has a thread state of its own. */
+	PyJitCompileQueue_Stop(interp->global_llvm_data);
+	PyJitCodeCache_Flush(interp->global_llvm_data);
+#endif
 	if (tstate->frame != NULL)
 		Py_FatalError("Py_EndInterpreter: thread still has a frame");
 	if (tstate != interp->tstate_head || tstate->next != NULL)
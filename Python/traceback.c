@@ -106,8 +106,25 @@ int
 PyTraceBack_Here(PyFrameObject *frame)
 {
 	PyThreadState *tstate = PyThreadState_GET();
-	PyTracebackObject *oldtb = (PyTracebackObject *) tstate->curexc_traceback;
-	PyTracebackObject *tb = newtracebackobject(oldtb, frame);
+	PyTracebackObject *oldtb;
+	PyTracebackObject *tb;
+#ifdef WITH_LLVM
+	/* A virtual frame goes away when its C call returns, but the
+	   traceback may outlive it. */
+	if (frame->f_virtual) {
+		PyFrameObject *heap_frame = _PyFrame_Materialize(frame);
+		if (heap_frame == NULL)
+			return -1;
+		oldtb = (PyTracebackObject *) tstate->curexc_traceback;
+		tb = newtracebackobject(oldtb, heap_frame);
+		Py_DECREF(heap_frame);
+	}
+	else
+#endif
+	{
+		oldtb = (PyTracebackObject *) tstate->curexc_traceback;
+		tb = newtracebackobject(oldtb, frame);
+	}
 	if (tb == NULL)
 		return -1;
 	tstate->curexc_traceback = (PyObject *)tb;
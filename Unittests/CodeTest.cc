@@ -25,6 +25,8 @@ protected:
         assert(code != NULL);
         // We only initialize the fields related to dict watchers.
         code->co_watching = NULL;
+        code->co_watched_keys = NULL;
+        code->co_runtime_feedback = NULL;
         code->co_use_jit = 0;
         code->co_fatalbailcount = 0;
         code->ob_type = &PyCode_Type;
@@ -133,9 +135,12 @@ TEST_F(CodeWatchingTest, InvalidateMachineCode)
     EXPECT_EQ(1, _PyDict_NumWatchers((PyDictObject *)this->globals_));
     EXPECT_EQ(1, _PyDict_NumWatchers((PyDictObject *)this->builtins_));
 
+    code->co_hotness = PY_HOTNESS_THRESHOLD + 1;
     _PyCode_InvalidateMachineCode(code);
     EXPECT_EQ(1, code->co_fatalbailcount);
     EXPECT_EQ(0, code->co_use_jit);
+    EXPECT_EQ(1, code->co_needs_recompile);
+    EXPECT_EQ(0, code->co_hotness);
     EXPECT_EQ(0, _PyCode_WatchingSize(code));
     EXPECT_EQ(0, _PyDict_NumWatchers((PyDictObject *)this->globals_));
     EXPECT_EQ(0, _PyDict_NumWatchers((PyDictObject *)this->builtins_));
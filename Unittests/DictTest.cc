@@ -25,6 +25,8 @@ protected:
         assert(code != NULL);
         // We only initialize the fields related to dict watchers.
         code->co_watching = NULL;
+        code->co_watched_keys = NULL;
+        code->co_runtime_feedback = NULL;
         code->co_use_jit = 0;
         code->co_fatalbailcount = 0;
         code->ob_type = &PyCode_Type;
@@ -116,3 +118,103 @@ TEST_F(DictWatcherTest, NotifyWatcher)
 
     PyMem_DEL(code1);
 }
+
+TEST_F(DictWatcherTest, NotifyWatcherOfWatchedKeysOnly)
+{
+    PyCodeObject *code1 = this->FakeCodeObject();
+    code1->co_use_jit = 1;
+
+    EXPECT_EQ(0, _PyCode_WatchDict(code1, WATCHING_GLOBALS, this->globals_));
+    EXPECT_EQ(0, _PyCode_WatchDict(code1, WATCHING_BUILTINS, this->builtins_));
+    PyObject *keys = PyDict_New();
+    PyDict_SetItemString(keys, "hello", Py_None);
+    EXPECT_EQ(0, _PyCode_SetWatchedKeys(code1, WATCHING_GLOBALS, keys));
+
+    // Other keys in the globals don't matter...
+    PyDict_SetItemString(this->globals_, "goodbye", Py_None);
+    PyDict_DelItemString(this->globals_, "goodbye");
+    EXPECT_EQ(1, code1->co_use_jit);
+    EXPECT_EQ(2, _PyCode_WatchingSize(code1));
+
+    // ... but every key in the builtins does.
+    PyDict_SetItemString(this->builtins_, "goodbye", Py_None);
+    EXPECT_EQ(0, code1->co_use_jit);
+    EXPECT_EQ(0, _PyCode_WatchingSize(code1));
+
+    code1->co_use_jit = 1;
+    EXPECT_EQ(0, _PyCode_WatchDict(code1, WATCHING_GLOBALS, this->globals_));
+    keys = PyDict_New();
+    PyDict_SetItemString(keys, "hello", Py_None);
+    EXPECT_EQ(0, _PyCode_SetWatchedKeys(code1, WATCHING_GLOBALS, keys));
+
+    PyDict_SetItemString(this->globals_, "hello", Py_None);
+    EXPECT_EQ(0, code1->co_use_jit);
+    EXPECT_EQ(0, _PyDict_NumWatchers((PyDictObject *)this->globals_));
+
+    PyMem_Free(code1->co_watched_keys);
+    PyMem_DEL(code1);
+}
+
+TEST_F(DictWatcherTest, NotifyOnlyWatchersOfChangedKey)
+{
+    PyCodeObject *code1 = this->FakeCodeObject();
+    PyCodeObject *code2 = this->FakeCodeObject();
+    code1->co_use_jit = 1;
+    code2->co_use_jit = 1;
+    PyDictObject *globals_dict = (PyDictObject *)this->globals_;
+
+    EXPECT_EQ(0, _PyCode_WatchDict(code1, WATCHING_GLOBALS, this->globals_));
+    EXPECT_EQ(0, _PyCode_WatchDict(code2, WATCHING_GLOBALS, this->globals_));
+    PyObject *keys = PyDict_New();
+    PyDict_SetItemString(keys, "hello", Py_None);
+    EXPECT_EQ(0, _PyCode_SetWatchedKeys(code1, WATCHING_GLOBALS, keys));
+    keys = PyDict_New();
+    PyDict_SetItemString(keys, "goodbye", Py_None);
+    EXPECT_EQ(0, _PyCode_SetWatchedKeys(code2, WATCHING_GLOBALS, keys));
+    EXPECT_EQ(2, _PyDict_NumWatchers(globals_dict));
+    EXPECT_TRUE(_PyDict_IsWatchedBy(globals_dict, code1));
+
+    // An equal but distinct string finds the watchers of its contents.
+    PyObject *goodbye = PyString_FromString("goodbye");
+    PyDict_SetItem(this->globals_, goodbye, Py_None);
+    Py_DECREF(goodbye);
+    EXPECT_EQ(1, code1->co_use_jit);
+    EXPECT_EQ(0, code2->co_use_jit);
+    EXPECT_EQ(1, _PyDict_NumWatchers(globals_dict));
+    EXPECT_FALSE(_PyDict_IsWatchedBy(globals_dict, code2));
+
+    // We can't tell which str a non-str key may be equal to, so it
+    // notifies every watcher.
+    PyObject *five = PyInt_FromLong(5);
+    PyDict_SetItem(this->globals_, five, Py_None);
+    Py_DECREF(five);
+    EXPECT_EQ(0, code1->co_use_jit);
+    EXPECT_EQ(0, _PyDict_NumWatchers(globals_dict));
+
+    PyMem_Free(code1->co_watched_keys);
+    PyMem_Free(code2->co_watched_keys);
+    PyMem_DEL(code1);
+    PyMem_DEL(code2);
+}
+
+TEST_F(DictWatcherTest, SameDictWatchedForTwoReasons)
+{
+    PyCodeObject *code1 = this->FakeCodeObject();
+    code1->co_use_jit = 1;
+
+    // A module whose globals are the builtins.
+    EXPECT_EQ(0, _PyCode_WatchDict(code1, WATCHING_GLOBALS, this->globals_));
+    EXPECT_EQ(0, _PyCode_WatchDict(code1, WATCHING_BUILTINS, this->globals_));
+    PyObject *keys = PyDict_New();
+    PyDict_SetItemString(keys, "hello", Py_None);
+    EXPECT_EQ(0, _PyCode_SetWatchedKeys(code1, WATCHING_GLOBALS, keys));
+
+    // Narrowing the globals mustn't drop the builtins' dependency on the
+    // whole dict.
+    PyDict_SetItemString(this->globals_, "goodbye", Py_None);
+    EXPECT_EQ(0, code1->co_use_jit);
+    EXPECT_EQ(0, _PyDict_NumWatchers((PyDictObject *)this->globals_));
+
+    PyMem_Free(code1->co_watched_keys);
+    PyMem_DEL(code1);
+}
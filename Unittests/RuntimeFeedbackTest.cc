@@ -332,6 +332,120 @@ TEST_F(PyLimitedFeedbackTest, Assignment)
     EXPECT_EQ(str_start_refcnt, Py_REFCNT(this->a_string_));
 }
 
+TEST_F(PyLimitedFeedbackTest, DominantObjects)
+{
+    long int_start_refcnt = Py_REFCNT(this->an_int_);
+    long dict_start_refcnt = Py_REFCNT(this->a_dict_);
+
+    this->feedback_.AddObjectSeen(this->an_int_);
+    this->feedback_.AddObjectSeen(this->a_list_);
+    this->feedback_.AddObjectSeen(this->a_tuple_);
+    this->feedback_.AddObjectSeen(this->a_dict_);
+    EXPECT_TRUE(this->feedback_.ObjectsOverflowed());
+    EXPECT_EQ(int_start_refcnt + 1, Py_REFCNT(this->an_int_));
+    EXPECT_EQ(dict_start_refcnt + 1, Py_REFCNT(this->a_dict_));
+
+    // Too few samples to say anything yet.
+    SmallVector<PyObject*, 3> dominant;
+    this->feedback_.GetDominantObjectsInto(dominant, 2);
+    EXPECT_TRUE(dominant.empty());
+
+    for (int i = 0; i < PY_FDO_MIN_HISTOGRAM_SAMPLES; ++i) {
+        this->feedback_.AddObjectSeen(this->a_dict_);
+        this->feedback_.AddObjectSeen(this->a_dict_);
+        this->feedback_.AddObjectSeen(this->an_int_);
+    }
+    // The list and tuple are too rare to count.
+    this->feedback_.GetDominantObjectsInto(dominant, 3);
+    ASSERT_EQ(2U, dominant.size());
+    EXPECT_EQ(this->a_dict_, dominant[0]);
+    EXPECT_EQ(this->an_int_, dominant[1]);
+    this->feedback_.GetDominantObjectsInto(dominant, 1);
+    ASSERT_EQ(1U, dominant.size());
+    EXPECT_EQ(this->a_dict_, dominant[0]);
+
+    // GetSeenObjectsInto() still reports the first three objects.
+    SmallVector<PyObject*, 3> seen;
+    this->feedback_.GetSeenObjectsInto(seen);
+    ASSERT_EQ(3U, seen.size());
+    EXPECT_EQ(this->an_int_, seen[0]);
+    EXPECT_EQ(this->a_list_, seen[1]);
+    EXPECT_EQ(this->a_tuple_, seen[2]);
+
+    this->feedback_.Clear();
+    EXPECT_FALSE(this->feedback_.ObjectsOverflowed());
+    EXPECT_EQ(int_start_refcnt, Py_REFCNT(this->an_int_));
+    EXPECT_EQ(dict_start_refcnt, Py_REFCNT(this->a_dict_));
+}
+
+TEST_F(PyLimitedFeedbackTest, NoDominantObject)
+{
+    PyObject *objects[] = { this->an_int_, this->a_list_, this->a_tuple_,
+                            this->a_dict_, this->a_string_ };
+    for (int i = 0; i < PY_FDO_MIN_HISTOGRAM_SAMPLES; ++i) {
+        for (unsigned j = 0; j < 5; ++j)
+            this->feedback_.AddObjectSeen(objects[j]);
+    }
+    // Each object is only 20% of the samples.
+    SmallVector<PyObject*, 3> dominant;
+    this->feedback_.GetDominantObjectsInto(dominant, 2);
+    EXPECT_TRUE(dominant.empty());
+}
+
+TEST_F(PyLimitedFeedbackTest, DominantFuncs)
+{
+    PyObject *join_meth = PyObject_GetAttrString(this->a_string_, "join");
+    PyObject *split_meth = PyObject_GetAttrString(this->a_string_, "split");
+
+    this->feedback_.AddFuncSeen(join_meth);
+    for (int i = 0; i < PY_FDO_MIN_HISTOGRAM_SAMPLES; ++i) {
+        this->feedback_.AddFuncSeen(split_meth);
+    }
+    EXPECT_TRUE(this->feedback_.FuncsOverflowed());
+
+    SmallVector<PyTypeMethodPair, 3> seen;
+    this->feedback_.GetSeenFuncsInto(seen);
+    ASSERT_EQ(1U, seen.size());
+    EXPECT_EQ((void *)PyCFunction_GET_FUNCTION(join_meth),
+              (void *)seen[0].second->ml_meth);
+
+    this->feedback_.GetDominantFuncsInto(seen, 2);
+    ASSERT_EQ(1U, seen.size());
+    EXPECT_EQ((void *)PyCFunction_GET_FUNCTION(split_meth),
+              (void *)seen[0].second->ml_meth);
+
+    Py_DECREF(join_meth);
+    Py_DECREF(split_meth);
+}
+
+TEST_F(PyLimitedFeedbackTest, CopyableHistogram)
+{
+    long int_start_refcnt = Py_REFCNT(this->an_int_);
+
+    this->feedback_.AddObjectSeen(this->a_list_);
+    this->feedback_.AddObjectSeen(this->a_tuple_);
+    this->feedback_.AddObjectSeen(this->a_dict_);
+    for (int i = 0; i < PY_FDO_MIN_HISTOGRAM_SAMPLES; ++i) {
+        this->feedback_.AddObjectSeen(this->an_int_);
+    }
+    PyLimitedFeedback second = this->feedback_;
+    EXPECT_TRUE(second.ObjectsOverflowed());
+    EXPECT_EQ(int_start_refcnt + 2, Py_REFCNT(this->an_int_));
+
+    SmallVector<PyObject*, 3> dominant;
+    second.GetDominantObjectsInto(dominant, 1);
+    ASSERT_EQ(1U, dominant.size());
+    EXPECT_EQ(this->an_int_, dominant[0]);
+
+    // Demonstrate that the copies are independent.
+    second.Clear();
+    second.GetDominantObjectsInto(dominant, 1);
+    EXPECT_TRUE(dominant.empty());
+    this->feedback_.GetDominantObjectsInto(dominant, 1);
+    ASSERT_EQ(1U, dominant.size());
+    EXPECT_EQ(int_start_refcnt + 1, Py_REFCNT(this->an_int_));
+}
+
 class PyFullFeedbackTest : public PyRuntimeFeedbackTest {
 protected:
     PyFullFeedback feedback_;
@@ -530,3 +644,66 @@ TEST_F(PyFullFeedbackTest, SameMethodSameTypeDifferentObjects)
     Py_DECREF(join_meth1);
     Py_DECREF(join_meth2);
 }
+
+class PyFeedbackMapTest : public PyRuntimeFeedbackTest {
+protected:
+    // Compiles an expression and lays out a feedback map for it.
+    PyFeedbackMap *NewMap(const char *expr)
+    {
+        PyObject *code = Py_CompileString(expr, "<test>", Py_eval_input);
+        assert(code != NULL && PyCode_Check(code));
+        PyFeedbackMap *map = PyFeedbackMap_New((PyCodeObject *)code);
+        Py_DECREF(code);
+        return map;
+    }
+};
+
+TEST_F(PyFeedbackMapTest, BinaryOperator)
+{
+    // 0 LOAD_NAME a; 3 LOAD_NAME b; 6 BINARY_ADD; 7 RETURN_VALUE
+    PyFeedbackMap *map = this->NewMap("a + b");
+    EXPECT_TRUE(NULL == map->GetFeedbackEntry(0, 0));
+    EXPECT_TRUE(NULL == map->GetFeedbackEntry(3, 0));
+    PyRuntimeFeedback *lhs = map->GetFeedbackEntry(6, 0);
+    PyRuntimeFeedback *rhs = map->GetFeedbackEntry(6, 1);
+    ASSERT_TRUE(lhs != NULL);
+    ASSERT_TRUE(rhs != NULL);
+    EXPECT_NE(lhs, rhs);
+    EXPECT_TRUE(NULL == map->GetFeedbackEntry(6, 2));
+    EXPECT_TRUE(NULL == map->GetFeedbackEntry(7, 0));
+
+    lhs->AddObjectSeen(this->an_int_);
+    SmallVector<PyObject*, 3> seen;
+    map->GetFeedbackEntry(6, 0)->GetSeenObjectsInto(seen);
+    ASSERT_EQ(1U, seen.size());
+    EXPECT_EQ(this->an_int_, seen[0]);
+    map->GetFeedbackEntry(6, 1)->GetSeenObjectsInto(seen);
+    EXPECT_TRUE(seen.empty());
+
+    PyFeedbackMap_Clear(map);
+    map->GetFeedbackEntry(6, 0)->GetSeenObjectsInto(seen);
+    EXPECT_TRUE(seen.empty());
+    PyFeedbackMap_Del(map);
+}
+
+TEST_F(PyFeedbackMapTest, CallFunction)
+{
+    // 0 LOAD_NAME f; 3 LOAD_NAME x; 6 CALL_FUNCTION 1; 9 RETURN_VALUE
+    PyFeedbackMap *map = this->NewMap("f(x)");
+    PyRuntimeFeedback *func = map->GetFeedbackEntry(6, 0);
+    PyRuntimeFeedback *arg = map->GetFeedbackEntry(6, 1);
+    PyRuntimeFeedback *callee = map->GetFeedbackEntry(6, PY_FDO_CALLEE_CODE);
+    ASSERT_TRUE(func != NULL);
+    ASSERT_TRUE(arg != NULL);
+    ASSERT_TRUE(callee != NULL);
+    EXPECT_NE(func, callee);
+    EXPECT_NE(arg, callee);
+    EXPECT_TRUE(NULL == map->GetFeedbackEntry(9, 0));
+    PyFeedbackMap_Del(map);
+
+    // Calls with keyword arguments don't record any feedback.
+    map = this->NewMap("f(x=1)");
+    EXPECT_TRUE(NULL == map->GetFeedbackEntry(9, 0));
+    EXPECT_TRUE(NULL == map->GetFeedbackEntry(9, PY_FDO_CALLEE_CODE));
+    PyFeedbackMap_Del(map);
+}
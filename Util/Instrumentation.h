@@ -22,13 +22,14 @@ template<const char* full_name, const char* short_name>
 class OpStats {
 public:
     OpStats()
-        : total(0), optimized(0), unpredictable(0), omitted(0) {
+        : total(0), optimized(0), dominant(0), unpredictable(0), omitted(0) {
     }
 
     ~OpStats() {
         errs() << "\n" << full_name << " inlining:\n";
         errs() << "Total " << short_name << ": " << this->total << "\n";
         errs() << "Optimized " << short_name << ": " << this->optimized << "\n";
+        errs() << "Optimized for dominant types: " << this->dominant << "\n";
         errs() << "Unpredictable types: " << this->unpredictable << "\n";
         errs() << short_name << " without inline version: " <<
             this->omitted << "\n";
@@ -38,6 +39,9 @@ public:
     unsigned total;
     // Number of opcodes inlined.
     unsigned optimized;
+    // Number of the inlined opcodes specialized on the dominant type of a
+    // megamorphic operand, with a generic fallback.
+    unsigned dominant;
     // Number of opcodes with unpredictable types.
     unsigned unpredictable;
     // Number of opcodes without inline-able functions.
@@ -0,0 +1,96 @@
+#include "Util/PySmallPtrSetMap.h"
+
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+
+typedef llvm::SmallPtrSet<PyObject *, 4> PySmallPtrSetMap_Set;
+typedef llvm::StringMap<PySmallPtrSetMap_Set> PySmallPtrSetMap_Impl;
+
+typedef struct PySmallPtrSetMap {
+    PySmallPtrSetMap_Impl llvm_map;
+} PySmallPtrSetMap;
+
+
+// C'tors, d'tors
+PySmallPtrSetMap *
+PySmallPtrSetMap_New()
+{
+    PySmallPtrSetMap *map = PyMem_New(PySmallPtrSetMap, 1);
+    if (map == NULL)
+        return NULL;
+    new(map)PySmallPtrSetMap();
+
+    return map;
+}
+
+void
+PySmallPtrSetMap_Del(PySmallPtrSetMap *map)
+{
+    map->~PySmallPtrSetMap();
+    PyMem_Free(map);
+}
+
+int
+PySmallPtrSetMap_Insert(PySmallPtrSetMap *map, const char *key,
+                        Py_ssize_t key_len, PyObject *obj)
+{
+    return map->llvm_map[llvm::StringRef(key, key_len)].insert(obj);
+}
+
+int
+PySmallPtrSetMap_Erase(PySmallPtrSetMap *map, const char *key,
+                       Py_ssize_t key_len, PyObject *obj)
+{
+    PySmallPtrSetMap_Impl::iterator it =
+        map->llvm_map.find(llvm::StringRef(key, key_len));
+    if (it == map->llvm_map.end() || !it->second.erase(obj))
+        return 0;
+    if (it->second.empty())
+        map->llvm_map.erase(it);
+    return 1;
+}
+
+unsigned
+PySmallPtrSetMap_Size(PySmallPtrSetMap *map)
+{
+    return map->llvm_map.size();
+}
+
+void
+PySmallPtrSetMap_ForEachIn(PySmallPtrSetMap *map, const char *key,
+                           Py_ssize_t key_len, PySmallPtrSetCallback callback,
+                           void *callback_arg)
+{
+    PySmallPtrSetMap_Impl::iterator it =
+        map->llvm_map.find(llvm::StringRef(key, key_len));
+    if (it == map->llvm_map.end())
+        return;
+    // Copy the set in case the callback modifies the map.
+    llvm::SmallVector<PyObject *, 4> contents(it->second.begin(),
+                                              it->second.end());
+    for (llvm::SmallVector<PyObject *, 4>::iterator i = contents.begin(),
+            end = contents.end(); i != end; ++i) {
+        callback(*i, callback_arg);
+    }
+}
+
+void
+PySmallPtrSetMap_ForEach(PySmallPtrSetMap *map, PySmallPtrSetCallback callback,
+                         void *callback_arg)
+{
+    // Collect the distinct pointers first, in case the callback modifies the
+    // map.
+    llvm::SmallPtrSet<PyObject *, 8> all;
+    for (PySmallPtrSetMap_Impl::iterator it = map->llvm_map.begin(),
+            end = map->llvm_map.end(); it != end; ++it) {
+        all.insert(it->second.begin(), it->second.end());
+    }
+    llvm::SmallVector<PyObject *, 8> contents(all.begin(), all.end());
+    for (llvm::SmallVector<PyObject *, 8>::iterator i = contents.begin(),
+            end = contents.end(); i != end; ++i) {
+        callback(*i, callback_arg);
+    }
+}
@@ -0,0 +1,56 @@
+//===----------------------------------------------------------------------===//
+//
+// This file defines C wrappers for an llvm::StringMap of
+// llvm::SmallPtrSet<PyObject *>, a set of pointers for each string key
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef UTIL_PYSMALLPTRSETMAP_H
+#define UTIL_PYSMALLPTRSETMAP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "Python.h"
+#include "Util/PySmallPtrSet.h"
+
+
+typedef struct PySmallPtrSetMap PySmallPtrSetMap;
+
+
+// C'tors, d'tors
+PySmallPtrSetMap *PySmallPtrSetMap_New(void);
+void PySmallPtrSetMap_Del(PySmallPtrSetMap *);
+
+/// Insert - Add the pointer to the set for the key_len bytes at key.  This
+/// returns 1 if the pointer was new to that set, 0 if it was already in it.
+int PySmallPtrSetMap_Insert(PySmallPtrSetMap *, const char *key,
+                            Py_ssize_t key_len, PyObject *);
+
+/// Erase - If the set for key contains the specified pointer, remove it and
+/// return 1, otherwise return 0.  Sets are dropped once they're empty.
+int PySmallPtrSetMap_Erase(PySmallPtrSetMap *, const char *key,
+                           Py_ssize_t key_len, PyObject *);
+
+/// Get the number of keys with a non-empty set.
+unsigned PySmallPtrSetMap_Size(PySmallPtrSetMap *);
+
+// Call the callback once for each pointer in the set for key.  Like
+// PySmallPtrSet_ForEach(), this iterates over a copy, so the callback may
+// modify the map.
+void PySmallPtrSetMap_ForEachIn(PySmallPtrSetMap *, const char *key,
+                                Py_ssize_t key_len, PySmallPtrSetCallback,
+                                void *);
+
+// Call the callback once for each distinct pointer in any of the sets.  This
+// also iterates over a copy.
+void PySmallPtrSetMap_ForEach(PySmallPtrSetMap *, PySmallPtrSetCallback,
+                              void *);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // UTIL_PYSMALLPTRSETMAP_H